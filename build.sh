@@ -3,7 +3,7 @@ OUTDIR="./build"
 
 STARTTIME=$(date +%s)
 COMPILEPARAM="-ggdb -O0 -Wall -Werror -D ENGINEBUILD_SLOW"
-GAMELIBS="-lopenal -lfreetype -lalut -lGL -lGLEW -lOpenCL"
+GAMELIBS="-lopenal -lfreetype -lalut -lGL -lGLEW -lOpenCL -lpthread"
 EXELIBS="-lGL -lGLEW -lX11 -ldl -lm -lpthread"
 
 #clang lib/parson.c -c -fpic $COMPILEPARAM
@@ -23,9 +23,20 @@ clang $COMPILEPARAM -c -fpic -std=gnu99 \
  memory.c \
  input.c \
  core.c \
+ chunk_map.c \
+ chunk_scheduler.c \
+ terrain_generator.c \
+ worker_pool.c \
+ chunk_cache.c \
+ mesh_arena.c \
  modelParser.c \
  opengl.c \
  voxel_terrain.c \
+ noise_simd.c \
+ voxel_simplify.c \
+ tunnel_grid.c \
+ voxel_edit.c \
+ opencl.c \
  renderer.c
 
 CURTIME=$(date +%s)
@@ -35,7 +46,7 @@ STARTTIME=$(date +%s)
 mv *.o $OUTDIR
 cwd=$(pwd)
 cd $OUTDIR
-clang $COMPILEPARAM -shared -std=gnu99 -o libgame.so camera.o ttmath.o mesh.o transform.o material.o terrain.o texture.o audio.o debug.o memory.o input.o core.o modelParser.o opengl.o voxel_terrain.o renderer.o \
+clang $COMPILEPARAM -shared -std=gnu99 -o libgame.so camera.o ttmath.o mesh.o transform.o material.o terrain.o texture.o audio.o debug.o memory.o input.o core.o chunk_map.o chunk_scheduler.o terrain_generator.o worker_pool.o chunk_cache.o mesh_arena.o modelParser.o opengl.o voxel_terrain.o noise_simd.o voxel_simplify.o tunnel_grid.o voxel_edit.o opencl.o renderer.o \
 $GAMELIBS
 
 cd $cwd
@@ -47,6 +58,10 @@ STARTTIME=$(date +%s)
 
 clang $COMPILEPARAM platform_linux.c input.c memory.c ttmath.c -std=gnu99 -o game.out $EXELIBS
 
+# headless benchmark, uses the game library like game.out but links it
+clang $COMPILEPARAM terrain_bench.c -std=gnu99 -I/usr/include/freetype2 -o terrain_bench.out \
+-L$OUTDIR -lgame -Wl,-rpath,'$ORIGIN' $EXELIBS -lOpenCL
+
 mv -v *.out $OUTDIR
 
 CURTIME=$(date +%s)
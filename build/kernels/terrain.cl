@@ -0,0 +1,720 @@
+// OpenCL version of terrain_compute2.glsl, see opencl.c.
+//
+// The operations are the ones of voxel_terrain.c in the same order, with
+// contraction off so nothing turns into a fused multiply-add. Devices with
+// correctly rounded division and square roots (the build asks for them where
+// it can) give the CPU's meshes bit for bit, others differ by a rounding.
+//
+// The GL shader does a block per workgroup and shares its samples through
+// shared memory between barriers. Here every stage is its own kernel over
+// all sample columns of all blocks, the samples and column masks stay in
+// global memory in between. Nothing depends on the workgroup size, so any
+// device runs it, CPU runtimes like PoCL included.
+//
+// terrainSample   density of every sample of the chunk
+// terrainCount    edge or cell masks and triangle counts of every column
+// terrainScan     one work item, column and block prefix sums and the totals
+// terrainEmit     vertices and triangles of every column at their offsets
+//
+// Vertex and triangle order is the one of voxelGenerateChunk().
+
+#ifdef __OPENCL_C_VERSION__
+#pragma OPENCL FP_CONTRACT OFF
+#endif
+
+#define BLOCK_CUBES 16 // VOXEL_BLOCK_CUBES
+#define BLOCK_SAMPLES 17
+// surface nets sample one more layer, VOXEL_NETS_SAMPLES
+#define BLOCK_THREADS 18
+#define BLOCK_COLUMNS (BLOCK_THREADS*BLOCK_THREADS)
+#define BLOCK_VALUES (BLOCK_COLUMNS*BLOCK_THREADS)
+#define POSITION_RANGE 68.0f // VOXEL_POSITION_RANGE
+#define HEIGHT_PLANE 33.11f // VOXEL_HEIGHT_PLANE
+#define TUNNEL_RADIUS 5.0f // VOXEL_TUNNEL_RADIUS
+#define BRICK_SIZE 8 // VOXEL_BRICK_SIZE
+#define CHUNK_BRICKS 9 // VOXEL_CHUNK_BRICKS
+#define MESHER_MARCHING_CUBES 0
+#define MESHER_SURFACE_NETS 1
+
+// ChunkGenData, the chunk's tunnels follow it
+typedef struct GenData
+{
+    uint tunnelCount;
+    float firstOctaveMax;
+    float secondOctaveMax;
+    uint columnWarp;
+    float dxgoalFirstOctaveMax;
+    float dxgoalSecondOctaveMax;
+    float dzgoalFirstOctaveMax;
+    float dzgoalSecondOctaveMax;
+    float chunkOrigin[4];
+} GenData;
+
+// Line3D
+typedef struct Line
+{
+    float start[4];
+    float end[4];
+} Line;
+
+// VoxelEditChunk, its bricks follow it
+typedef struct EditData
+{
+    int firstBrick[3];
+    uint brickCount;
+    int table[CHUNK_BRICKS*CHUNK_BRICKS*CHUNK_BRICKS];
+} EditData;
+
+// OpenclTerrainParams
+typedef struct Params
+{
+    float worldOffset[3];
+    float voxelScale;
+    uint groups;
+    int mesher;
+    uint maxVertices;
+    uint maxTriangles;
+} Params;
+
+// edge -> (x, y, z, axis) of the edge vertex relative to the cube
+__constant int edgeVertexOffset[12][4] =
+{
+    {0, 0, 0, 0}, // 0
+    {1, 0, 0, 1},
+    {0, 1, 0, 0},
+    {0, 0, 0, 1},
+    {0, 0, 1, 0}, // 4
+    {1, 0, 1, 1},
+    {0, 1, 1, 0},
+    {0, 0, 1, 1},
+    {0, 0, 0, 2}, // 8
+    {1, 0, 0, 2},
+    {1, 1, 0, 2},
+    {0, 1, 0, 2} // 11
+};
+
+float minF(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+float maxF(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+float absF(float x)
+{
+    return x < 0.0f ? -x : x;
+}
+
+float mod289(float x)
+{
+    return x - floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+float permute(float x)
+{
+    return mod289(((x*34.0f)+1.0f)*x);
+}
+
+// voxelSnoise()
+float snoise(float vx, float vy, float vz)
+{
+    const float Cx = 1.0f/6.0f;
+    const float Cy = 1.0f/3.0f;
+
+    // First corner
+    float s = (vx + vy + vz)*Cy;
+    float ix = floor(vx + s);
+    float iy = floor(vy + s);
+    float iz = floor(vz + s);
+    float t = (ix + iy + iz)*Cx;
+    float x0[3] = {vx - ix + t, vy - iy + t, vz - iz + t};
+
+    // Other corners
+    float g[3] = {x0[0] >= x0[1] ? 1.0f : 0.0f, x0[1] >= x0[2] ? 1.0f : 0.0f, x0[2] >= x0[0] ? 1.0f : 0.0f};
+    float l[3] = {1.0f - g[0], 1.0f - g[1], 1.0f - g[2]};
+    float i1[3] = {minF(g[0], l[2]), minF(g[1], l[0]), minF(g[2], l[1])};
+    float i2[3] = {maxF(g[0], l[2]), maxF(g[1], l[0]), maxF(g[2], l[1])};
+
+    float x[4][3];
+    for(int c = 0; c < 3; c++)
+    {
+        x[0][c] = x0[c];
+        x[1][c] = x0[c] - i1[c] + Cx;
+        x[2][c] = x0[c] - i2[c] + Cy;
+        x[3][c] = x0[c] - 0.5f;
+    }
+
+    // Permutations
+    ix = mod289(ix);
+    iy = mod289(iy);
+    iz = mod289(iz);
+    float offX[4] = {0.0f, i1[0], i2[0], 1.0f};
+    float offY[4] = {0.0f, i1[1], i2[1], 1.0f};
+    float offZ[4] = {0.0f, i1[2], i2[2], 1.0f};
+
+    // Gradients: 7x7 points over a square, mapped onto an octahedron.
+    const float n_ = 0.142857142857f; // 1.0/7.0
+    const float nsx = n_*2.0f;
+    const float nsy = n_*0.5f - 1.0f;
+    const float nsz = n_;
+
+    float result = 0.0f;
+    for(int c = 0; c < 4; c++)
+    {
+        float p = permute(permute(permute(iz + offZ[c]) + iy + offY[c]) + ix + offX[c]);
+
+        float j = p - 49.0f * floor(p * nsz * nsz); // mod(p,7*7)
+        float x_ = floor(j * nsz);
+        float y_ = floor(j - 7.0f * x_); // mod(j,N)
+
+        float gx = x_*nsx + nsy;
+        float gy = y_*nsx + nsy;
+        float h = 1.0f - absF(gx) - absF(gy);
+
+        float sh = h <= 0.0f ? -1.0f : 0.0f;
+        gx += (floor(gx)*2.0f + 1.0f)*sh;
+        gy += (floor(gy)*2.0f + 1.0f)*sh;
+        float gz = h;
+
+        // Normalise gradients
+        float norm = 1.79284291400159f - 0.85373472095314f * (gx*gx + gy*gy + gz*gz);
+
+        // Mix final noise value
+        float m = maxF(0.6f - (x[c][0]*x[c][0] + x[c][1]*x[c][1] + x[c][2]*x[c][2]), 0.0f);
+        m = m * m;
+        result += m*m*norm*(gx*x[c][0] + gy*x[c][1] + gz*x[c][2]);
+    }
+    return 42.0f * result;
+}
+
+float getOffset(float v1, float v2)
+{
+    float delta = v1 - v2;
+    if(delta == 0.0f)
+        return 0.5f;
+    return v1/delta;
+}
+
+int floorDivInt(int a, int b)
+{
+    return a >= 0 ? a/b : -((-a+b-1)/b);
+}
+
+// voxelEditDelta()
+float editDelta(__global const EditData *edits, float px, float py, float pz)
+{
+    __global const float *deltas = (__global const float*)(edits + 1);
+    int vx = (int)floor(px+0.5f);
+    int vy = (int)floor(py+0.5f);
+    int vz = (int)floor(pz+0.5f);
+    int bx = floorDivInt(vx, BRICK_SIZE);
+    int by = floorDivInt(vy, BRICK_SIZE);
+    int bz = floorDivInt(vz, BRICK_SIZE);
+    int tx = bx - edits->firstBrick[0];
+    int ty = by - edits->firstBrick[1];
+    int tz = bz - edits->firstBrick[2];
+    if(tx < 0 || ty < 0 || tz < 0 || tx >= CHUNK_BRICKS || ty >= CHUNK_BRICKS || tz >= CHUNK_BRICKS)
+        return 0.0f;
+    int brick = edits->table[(tz*CHUNK_BRICKS + ty)*CHUNK_BRICKS + tx];
+    if(brick < 0)
+        return 0.0f;
+    int lx = vx - bx*BRICK_SIZE;
+    int ly = vy - by*BRICK_SIZE;
+    int lz = vz - bz*BRICK_SIZE;
+    return deltas[brick*BRICK_SIZE*BRICK_SIZE*BRICK_SIZE + (lz*BRICK_SIZE + ly)*BRICK_SIZE + lx];
+}
+
+// voxelTerrainHeight(), only px and pz matter with columnWarp
+float columnHeight(__global const GenData *gen, float px, float py, float pz)
+{
+    // voxelWarpCoord(), voxelSampleCoord(), the octaves at voxelOctaveScale
+    float wy = gen->columnWarp ? HEIGHT_PLANE : py;
+    float warp = snoise(px*0.08f, wy*0.08f, pz*0.08f)+1.0f;
+    float sx = 0.2f*warp*10.0f + px;
+    float sy = HEIGHT_PLANE;
+    float sz = 0.48f*warp*10.0f + pz;
+    float octave0 = snoise(sx*0.005f, sy*0.005f, sz*0.005f);
+    float octave1 = snoise(sx*0.08f, sy*0.08f, sz*0.08f);
+    float octave2 = snoise(sx*0.002f, sy*0.002f, sz*0.002f);
+
+    float progressX = (px - gen->chunkOrigin[0])/64.0f;
+    float progressZ = (pz - gen->chunkOrigin[2])/64.0f;
+    float fom = gen->dxgoalFirstOctaveMax*progressX + gen->dzgoalFirstOctaveMax*progressZ;
+    float som = gen->dxgoalSecondOctaveMax*progressX + gen->dzgoalSecondOctaveMax*progressZ;
+
+    float h2noise = octave0+1.0f;
+    float h2 = h2noise*(gen->secondOctaveMax+som);
+    float h0 = h2noise*0.5f*(octave1+1.0f);
+    float h1 = h2noise*0.5f*(octave2+1.0f)*(gen->firstOctaveMax+fom);
+
+    return h0+h1+h2;
+}
+
+// voxelTerrainDensity() and the edits
+float fieldDensity(__global const GenData *gen, __global const EditData *edits, float px, float py, float pz,
+                   float height)
+{
+    __global const Line *tunnels = (__global const Line*)(gen + 1);
+    float ret = height - py;
+
+    for(uint i = 0; i < gen->tunnelCount; i++)
+    {
+        __global const Line *tunnel = &tunnels[i];
+        float abx = tunnel->end[0] - tunnel->start[0];
+        float aby = tunnel->end[1] - tunnel->start[1];
+        float abz = tunnel->end[2] - tunnel->start[2];
+        float apx = px - tunnel->start[0];
+        float apy = py - tunnel->start[1];
+        float apz = pz - tunnel->start[2];
+        float t = (apx*abx+apy*aby+apz*abz) / (abx*abx+aby*aby+abz*abz);
+        t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+        float dx = px - (abx*t + tunnel->start[0]);
+        float dy = py - (aby*t + tunnel->start[1]);
+        float dz = pz - (abz*t + tunnel->start[2]);
+        float sphere = sqrt(dx*dx+dy*dy+dz*dz);
+        if(sphere < TUNNEL_RADIUS)
+        {
+            ret = (-TUNNEL_RADIUS+sphere)*10.0f;
+            break;
+        }
+    }
+
+    if(edits->brickCount > 0)
+        ret += editDelta(edits, px, py, pz);
+    return ret;
+}
+
+// voxelDensity()
+float density(__global const GenData *gen, __global const EditData *edits, float px, float py, float pz)
+{
+    return fieldDensity(gen, edits, px, py, pz, columnHeight(gen, px, py, pz));
+}
+
+// blocks go z fastest, then x, then y, like the seeds of the GL path
+void blockSeed(Params params, uint block, float seed[3])
+{
+    uint groups = params.groups;
+    float blockSize = params.voxelScale*BLOCK_CUBES;
+    seed[0] = (block/groups%groups)*blockSize;
+    seed[1] = (block/(groups*groups))*blockSize;
+    seed[2] = (block%groups)*blockSize;
+}
+
+float sampleValue(__global const float *values, uint block, int x, int y, int z)
+{
+    return values[block*BLOCK_VALUES + (y*BLOCK_THREADS + x)*BLOCK_THREADS + z];
+}
+
+int isInside(__global const float *values, uint block, int x, int y, int z)
+{
+    return sampleValue(values, block, x, y, z) <= 0.0f;
+}
+
+// voxelEdgeVertex()
+void edgePosition(__global const float *values, uint block, float seed[3], float voxelScale,
+                  int x, int y, int z, int axis, float position[3])
+{
+    float fOffset = getOffset(sampleValue(values, block, x, y, z),
+                              sampleValue(values, block, x + (axis == 0), y + (axis == 1), z + (axis == 2)));
+    position[0] = seed[0] + (x + (axis == 0)*fOffset)*voxelScale;
+    position[1] = seed[1] + (y + (axis == 1)*fOffset)*voxelScale;
+    position[2] = seed[2] + (z + (axis == 2)*fOffset)*voxelScale;
+}
+
+int cubeCase(__global const float *values, uint block, int i, int j, int k)
+{
+    return isInside(values, block, i, j, k)
+            | isInside(values, block, i+1, j, k) << 1
+            | isInside(values, block, i+1, j+1, k) << 2
+            | isInside(values, block, i, j+1, k) << 3
+            | isInside(values, block, i, j, k+1) << 4
+            | isInside(values, block, i+1, j, k+1) << 5
+            | isInside(values, block, i+1, j+1, k+1) << 6
+            | isInside(values, block, i, j+1, k+1) << 7;
+}
+
+int netsEdgeCrosses(__global const float *values, uint block, int x, int y, int z, int axis)
+{
+    int p[3] = {x, y, z};
+    for(int i = 0; i < 3; i++)
+    {
+        if(i == axis ? p[i] >= BLOCK_CUBES : (p[i] < 1 || p[i] > BLOCK_CUBES))
+            return 0;
+    }
+    return isInside(values, block, x, y, z) != isInside(values, block, x + (axis == 0), y + (axis == 1), z + (axis == 2));
+}
+
+// start of the e-th of the 4 edges along axis around the cell
+void netsCellEdge(int x, int y, int z, int axis, int e, int p[3])
+{
+    p[0] = x;
+    p[1] = y;
+    p[2] = z;
+    p[(axis+1)%3] += e & 1;
+    p[(axis+2)%3] += e >> 1;
+}
+
+// bit z*3+axis of a marching cubes column, bit z of a surface nets one
+ulong columnMask(__global const float *values, uint block, int x, int y, int mesher)
+{
+    ulong mask = 0;
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
+    {
+        if(mesher == MESHER_SURFACE_NETS)
+        {
+            int used = 0;
+            for(int axis = 0; axis < 3 && !used; axis++)
+            {
+                for(int e = 0; e < 4 && !used; e++)
+                {
+                    int p[3];
+                    netsCellEdge(x, y, z, axis, e, p);
+                    used = netsEdgeCrosses(values, block, p[0], p[1], p[2], axis);
+                }
+            }
+            if(used)
+                mask |= (ulong)1 << z;
+            continue;
+        }
+        int inside = isInside(values, block, x, y, z);
+        if(x < BLOCK_CUBES && inside != isInside(values, block, x+1, y, z))
+            mask |= (ulong)1 << (z*3);
+        if(y < BLOCK_CUBES && inside != isInside(values, block, x, y+1, z))
+            mask |= (ulong)1 << (z*3+1);
+        if(z < BLOCK_CUBES && inside != isInside(values, block, x, y, z+1))
+            mask |= (ulong)1 << (z*3+2);
+    }
+    return mask;
+}
+
+// vertexNormal() of the shader, voxelNormal()
+void vertexNormal(__global const GenData *gen, __global const EditData *edits, Params params,
+                  float position[3], float normal[3])
+{
+    float px = position[0] + params.worldOffset[0];
+    float py = position[1] + params.worldOffset[1];
+    float pz = position[2] + params.worldOffset[2];
+    float h = 0.5f*params.voxelScale;
+    normal[0] = density(gen, edits, px - h, py, pz) - density(gen, edits, px + h, py, pz);
+    normal[1] = density(gen, edits, px, py - h, pz) - density(gen, edits, px, py + h, pz);
+    normal[2] = density(gen, edits, px, py, pz - h) - density(gen, edits, px, py, pz + h);
+}
+
+// voxelSampleNormal()
+void sampleNormal(__global const float *values, uint block, int x, int y, int z, float normal[3])
+{
+    normal[0] = 0.5f*(sampleValue(values, block, x-1, y, z) - sampleValue(values, block, x+1, y, z));
+    normal[1] = 0.5f*(sampleValue(values, block, x, y-1, z) - sampleValue(values, block, x, y+1, z));
+    normal[2] = 0.5f*(sampleValue(values, block, x, y, z-1) - sampleValue(values, block, x, y, z+1));
+}
+
+// voxelEdgeNormal(), vertexNormal() on and next to the block's faces
+void edgeNormal(__global const GenData *gen, __global const EditData *edits, Params params,
+                __global const float *values, uint block, float position[3], int x, int y, int z, int axis,
+                float normal[3])
+{
+    int p[3] = {x, y, z};
+    for(int i = 0; i < 3; i++)
+    {
+        if(p[i] < 1 || p[i] > BLOCK_CUBES - 1 - (i == axis))
+        {
+            vertexNormal(gen, edits, params, position, normal);
+            return;
+        }
+    }
+    int nx = x + (axis == 0);
+    int ny = y + (axis == 1);
+    int nz = z + (axis == 2);
+    float t = getOffset(sampleValue(values, block, x, y, z), sampleValue(values, block, nx, ny, nz));
+    float a[3], b[3];
+    sampleNormal(values, block, x, y, z, a);
+    sampleNormal(values, block, nx, ny, nz, b);
+    for(int c = 0; c < 3; c++)
+        normal[c] = a[c] + (b[c] - a[c])*t;
+}
+
+// voxelCellNormal()
+void cellNormal(__global const GenData *gen, __global const EditData *edits, Params params,
+                __global const float *values, uint block, float seed[3], float position[3], int x, int y, int z,
+                float normal[3])
+{
+    if(x < 1 || y < 1 || z < 1 || x > BLOCK_CUBES - 1 || y > BLOCK_CUBES - 1 || z > BLOCK_CUBES - 1)
+    {
+        vertexNormal(gen, edits, params, position, normal);
+        return;
+    }
+    float fx = (position[0] - seed[0])/params.voxelScale - x;
+    float fy = (position[1] - seed[1])/params.voxelScale - y;
+    float fz = (position[2] - seed[2])/params.voxelScale - z;
+    float wx[2] = {1.0f - fx, fx}, wy[2] = {1.0f - fy, fy}, wz[2] = {1.0f - fz, fz};
+    normal[0] = normal[1] = normal[2] = 0.0f;
+    for(int c = 0; c < 8; c++)
+    {
+        int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+        float w = wx[dx]*wy[dy]*wz[dz];
+        float g[3];
+        sampleNormal(values, block, x + dx, y + dy, z + dz, g);
+        for(int i = 0; i < 3; i++)
+            normal[i] += g[i]*w;
+    }
+}
+
+short packSnorm(float v)
+{
+    return (short)round(maxF(-1.0f, minF(v, 1.0f))*32767.0f);
+}
+
+// voxelPackVertex(), a VertexOut is 6 ushorts
+void packVertex(__global ushort *vertices, uint vertex, float position[3], float normal[3])
+{
+    for(int i = 0; i < 3; i++)
+        vertices[6*vertex+i] = (ushort)round(maxF(0.0f, minF(position[i]/POSITION_RANGE, 1.0f))*65535.0f);
+    vertices[6*vertex+3] = 0;
+
+    float sum = fabs(normal[0]) + fabs(normal[1]) + fabs(normal[2]);
+    float nx = sum > 0.0f ? normal[0]/sum : 0.0f;
+    float ny = sum > 0.0f ? normal[1]/sum : 1.0f;
+    float nz = sum > 0.0f ? normal[2]/sum : 0.0f;
+    float ex = nx, ey = ny;
+    if(nz < 0.0f)
+    {
+        ex = (1.0f - fabs(ny))*(nx >= 0.0f ? 1.0f : -1.0f);
+        ey = (1.0f - fabs(nx))*(ny >= 0.0f ? 1.0f : -1.0f);
+    }
+    vertices[6*vertex+4] = (ushort)packSnorm(ex);
+    vertices[6*vertex+5] = (ushort)packSnorm(ey);
+}
+
+// a work item per sample column of every block
+__kernel void terrainSample(__global const GenData *gen, __global const EditData *edits, Params params,
+                            __global float *values)
+{
+    uint id = get_global_id(0);
+    uint block = id/BLOCK_COLUMNS;
+    int x = id%BLOCK_COLUMNS%BLOCK_THREADS;
+    int y = id%BLOCK_COLUMNS/BLOCK_THREADS;
+    int samples = params.mesher == MESHER_SURFACE_NETS ? BLOCK_THREADS : BLOCK_SAMPLES;
+    if(block >= params.groups*params.groups*params.groups || x >= samples || y >= samples)
+        return;
+    float seed[3];
+    blockSeed(params, block, seed);
+    if(gen->columnWarp)
+    {
+        // the height is the same along y, so the item takes column (x, z = y)
+        // of the height map and fills the samples along y instead
+        int z = y;
+        float px = seed[0] + x*params.voxelScale + params.worldOffset[0];
+        float pz = seed[2] + z*params.voxelScale + params.worldOffset[2];
+        float height = columnHeight(gen, px, HEIGHT_PLANE, pz);
+        for(y = 0; y < samples; y++)
+        {
+            float py = seed[1] + y*params.voxelScale + params.worldOffset[1];
+            uint column = block*BLOCK_COLUMNS + y*BLOCK_THREADS + x;
+            values[column*BLOCK_THREADS + z] = fieldDensity(gen, edits, px, py, pz, height);
+        }
+        return;
+    }
+    for(int z = 0; z < samples; z++)
+    {
+        float px = seed[0] + x*params.voxelScale + params.worldOffset[0];
+        float py = seed[1] + y*params.voxelScale + params.worldOffset[1];
+        float pz = seed[2] + z*params.voxelScale + params.worldOffset[2];
+        values[id*BLOCK_THREADS + z] = density(gen, edits, px, py, pz);
+    }
+}
+
+// columnCounts gets the vertices and triangles of every column
+__kernel void terrainCount(Params params, __constant int *triangleTable, __global const float *values,
+                           __global ulong *columnMasks, __global uint *columnCounts)
+{
+    uint id = get_global_id(0);
+    uint block = id/BLOCK_COLUMNS;
+    int x = id%BLOCK_COLUMNS%BLOCK_THREADS;
+    int y = id%BLOCK_COLUMNS/BLOCK_THREADS;
+    if(block >= params.groups*params.groups*params.groups)
+        return;
+
+    // the threads of the extra layer have nothing
+    ulong mask = 0;
+    uint triangles = 0;
+    if(x < BLOCK_SAMPLES && y < BLOCK_SAMPLES)
+    {
+        mask = columnMask(values, block, x, y, params.mesher);
+        if(params.mesher == MESHER_SURFACE_NETS)
+        {
+            for(int z = 0; z < BLOCK_SAMPLES; z++)
+            {
+                for(int axis = 0; axis < 3; axis++)
+                    triangles += 2*netsEdgeCrosses(values, block, x, y, z, axis);
+            }
+        }
+        else if(x < BLOCK_CUBES && y < BLOCK_CUBES)
+        {
+            for(int k = 0; k < BLOCK_CUBES; k++)
+            {
+                __constant int *edges = &triangleTable[16*cubeCase(values, block, x, y, k)];
+                for(int t = 0; t < 5 && edges[3*t] > -1; t++)
+                    triangles++;
+            }
+        }
+    }
+    columnMasks[id] = mask;
+    columnCounts[2*id] = popcount(mask);
+    columnCounts[2*id+1] = triangles;
+}
+
+// One work item. Turns columnCounts into the offsets of the columns in their
+// block, blockStarts gets those of the blocks in the chunk and totals the
+// vertex and triangle count and whether they fit.
+__kernel void terrainScan(Params params, __global uint *columnCounts, __global uint *blockStarts,
+                          __global uint *totals)
+{
+    uint blocks = params.groups*params.groups*params.groups;
+    uint vertices = 0, triangles = 0;
+    for(uint block = 0; block < blocks; block++)
+    {
+        blockStarts[2*block] = vertices;
+        blockStarts[2*block+1] = triangles;
+        uint blockVertices = 0, blockTriangles = 0;
+        for(uint column = 0; column < BLOCK_COLUMNS; column++)
+        {
+            __global uint *counts = &columnCounts[2*(block*BLOCK_COLUMNS + column)];
+            uint columnVertices = counts[0], columnTriangles = counts[1];
+            counts[0] = blockVertices;
+            counts[1] = blockTriangles;
+            blockVertices += columnVertices;
+            blockTriangles += columnTriangles;
+        }
+        vertices += blockVertices;
+        triangles += blockTriangles;
+    }
+    totals[0] = vertices;
+    totals[1] = triangles;
+    totals[2] = vertices > params.maxVertices || triangles > params.maxTriangles;
+}
+
+// block relative index of the vertex of mask bit
+uint maskVertex(__global const ulong *columnMasks, __global const uint *columnStarts, uint block, int x, int y, int bit)
+{
+    uint column = block*BLOCK_COLUMNS + y*BLOCK_THREADS + x;
+    ulong below = columnMasks[column] & (((ulong)1 << bit) - 1);
+    return columnStarts[2*column] + popcount(below);
+}
+
+// writes nothing if the mesh doesn't fit
+__kernel void terrainEmit(__global const GenData *gen, __global const EditData *edits, Params params,
+                          __constant int *triangleTable, __global const float *values,
+                          __global const ulong *columnMasks, __global const uint *columnStarts,
+                          __global const uint *blockStarts, __global const uint *totals,
+                          __global ushort *vertices, __global int *triangles)
+{
+    uint id = get_global_id(0);
+    uint block = id/BLOCK_COLUMNS;
+    int x = id%BLOCK_COLUMNS%BLOCK_THREADS;
+    int y = id%BLOCK_COLUMNS/BLOCK_THREADS;
+    if(block >= params.groups*params.groups*params.groups || totals[2] || x >= BLOCK_SAMPLES || y >= BLOCK_SAMPLES)
+        return;
+
+    float seed[3];
+    blockSeed(params, block, seed);
+    uint baseVertex = blockStarts[2*block];
+    uint vertex = baseVertex + columnStarts[2*id];
+    uint triangle = blockStarts[2*block+1] + columnStarts[2*id+1];
+    ulong mask = columnMasks[id];
+    float position[3], normal[3];
+
+    if(params.mesher == MESHER_SURFACE_NETS)
+    {
+        for(int z = 0; z < BLOCK_SAMPLES; z++)
+        {
+            if(((mask >> z) & 1) == 0)
+                continue;
+            // voxelNetsCellVertex()
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            float crossings = 0.0f;
+            for(int axis = 0; axis < 3; axis++)
+            {
+                for(int e = 0; e < 4; e++)
+                {
+                    int p[3];
+                    netsCellEdge(x, y, z, axis, e, p);
+                    if(isInside(values, block, p[0], p[1], p[2])
+                            == isInside(values, block, p[0] + (axis == 0), p[1] + (axis == 1), p[2] + (axis == 2)))
+                        continue;
+                    float edge[3];
+                    edgePosition(values, block, seed, params.voxelScale, p[0], p[1], p[2], axis, edge);
+                    for(int c = 0; c < 3; c++)
+                        sum[c] += edge[c];
+                    crossings += 1.0f;
+                }
+            }
+            float scale = 1.0f/crossings;
+            for(int c = 0; c < 3; c++)
+                position[c] = sum[c]*scale;
+            cellNormal(gen, edits, params, values, block, seed, position, x, y, z, normal);
+            packVertex(vertices, vertex++, position, normal);
+        }
+
+        // the four cells around the edge, wound to face the air
+        for(int z = 0; z < BLOCK_SAMPLES; z++)
+        {
+            for(int axis = 0; axis < 3; axis++)
+            {
+                if(!netsEdgeCrosses(values, block, x, y, z, axis))
+                    continue;
+                int u = (axis+1)%3, v = (axis+2)%3;
+                int quad[4];
+                for(int c = 0; c < 4; c++)
+                {
+                    int p[3] = {x, y, z};
+                    p[u] -= (c == 0 || c == 3);
+                    p[v] -= (c == 0 || c == 1);
+                    quad[c] = (int)(baseVertex + maskVertex(columnMasks, columnStarts, block, p[0], p[1], p[2]));
+                }
+                int flip = isInside(values, block, x, y, z);
+                triangles[3*triangle] = quad[0];
+                triangles[3*triangle+1] = quad[flip ? 2 : 1];
+                triangles[3*triangle+2] = quad[flip ? 1 : 2];
+                triangles[3*triangle+3] = quad[0];
+                triangles[3*triangle+4] = quad[flip ? 3 : 2];
+                triangles[3*triangle+5] = quad[flip ? 2 : 3];
+                triangle += 2;
+            }
+        }
+        return;
+    }
+
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(((mask >> (z*3 + axis)) & 1) == 0)
+                continue;
+            edgePosition(values, block, seed, params.voxelScale, x, y, z, axis, position);
+            edgeNormal(gen, edits, params, values, block, position, x, y, z, axis, normal);
+            packVertex(vertices, vertex++, position, normal);
+        }
+    }
+
+    if(x >= BLOCK_CUBES || y >= BLOCK_CUBES)
+        return;
+
+    // indices are relative to the chunk's first vertex
+    for(int k = 0; k < BLOCK_CUBES; k++)
+    {
+        __constant int *edges = &triangleTable[16*cubeCase(values, block, x, y, k)];
+        for(int t = 0; t < 5 && edges[3*t] > -1; t++)
+        {
+            for(int corner = 0; corner < 3; corner++)
+            {
+                __constant int *o = edgeVertexOffset[edges[3*t+corner]];
+                triangles[3*triangle+corner] = (int)(baseVertex
+                        + maskVertex(columnMasks, columnStarts, block, x+o[0], y+o[1], (k+o[2])*3 + o[3]));
+            }
+            triangle++;
+        }
+    }
+}
@@ -3,15 +3,27 @@
 uniform mat4 viewMat;
 uniform mat4 perspectiveMatrix;
 
+// VertexOut of voxel_terrain.h, the position comes in as 0..1 of the chunk
+// (the model matrix scales it up) and the normal octahedral encoded
+const float POSITION_RANGE = 68.0; // VOXEL_POSITION_RANGE
 layout(location = 0) in vec4 position;
-layout(location = 1) in vec4 theNormal;
+layout(location = 1) in vec2 theNormal;
 
 layout(location = 1) smooth out vec3 theNormalOut;
 layout(location = 2) smooth out vec3 thePosOut;
 
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx))*vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main()
 {
-	theNormalOut = normalize((theNormal/theNormal.w).xyz);
-   thePosOut = position.xyz;
+	theNormalOut = octahedralDecode(theNormal);
+   // the fragment shader colours and lights in units of the chunk
+   thePosOut = position.xyz*POSITION_RANGE;
    gl_Position = perspectiveMatrix*viewMat*position;
 }
@@ -1,10 +1,5 @@
 #version 440
 
-struct VertexOut {
-    vec4 position;
-    vec4 normal;
-};
-
 struct TriangleOut
 {
     int index[3];
@@ -20,7 +15,7 @@ struct GenData
     uint tunnelCount;
     float firstOctaveMax;
     float secondOctaveMax;
-    float padding;
+    uint columnWarp;
     float dxgoalFirstOctaveMax;
     float dxgoalSecondOctaveMax;
     float dzgoalFirstOctaveMax;
@@ -28,23 +23,15 @@ struct GenData
     vec4 chunkOrigin;
 };
 
-struct GlobalVert
-{
-	vec3 coord;
-	int index;
-};
-
-struct EdgeVertices{
-	GlobalVert left[17][17][17][3];
-};
-
 // Shader storage buffer objects
 layout(std430, binding = 0) readonly buffer InputVertexBuffer {
     vec4 data[];
 } inputVertexBuffer;
 
+// VertexOut of voxel_terrain.h, 3 uints a vertex: position x and y, z and
+// padding, the octahedral normal. See packVertex().
 layout(std430, binding = 1) writeonly buffer OutputVertexBuffer {
-    VertexOut data[];
+    uint data[];
 } outputVertexBuffer;
 
 layout(std430, binding = 5) writeonly buffer OutputElementBuffer {
@@ -54,25 +41,78 @@ layout(std430, binding = 5) writeonly buffer OutputElementBuffer {
 layout(std430, binding = 2) readonly buffer TunnelData
 {
     GenData genData;
-    Line tunnels[];
+    Line tunnels[]; // only the ones reaching this chunk
 } tunnelData;
 
-layout(std430, binding = 4) buffer EdgeVertexData
+// brush edits, density added to the field, bricks of 8^3 voxels with x
+// changing fastest. table maps the 9^3 bricks the chunk samples to the ones
+// uploaded, it's only there if brickCount > 0
+layout(std430, binding = 6) readonly buffer EditData
+{
+    ivec3 firstBrick;
+    uint brickCount;
+    int table[729];
+    float deltas[];
+} editData;
+
+// samples of every block with a surface, the count pass stores them and the
+// emit pass reads them
+layout(std430, binding = 4) buffer DensityData
 {
-    EdgeVertices data[];
-} edgeVertexData;
+    float values[];
+} densityData;
 
-layout (binding = 3, offset = 0) uniform atomic_uint triangleCount;
-layout (binding = 3, offset = 4) uniform atomic_uint indexCount;
+// samples of the chunk on the grid of the finest LOD kept between generations,
+// x changes fastest. The ones at multiples of cachedStride are valid already,
+// the count pass evaluates and stores the rest of its own.
+layout(std430, binding = 7) buffer DensityCache
+{
+    float values[];
+} densityCache;
+
+// vertices and triangles of every block, written by the count pass
+layout(std430, binding = 3) buffer BlockData
+{
+    uvec2 counts[];
+} blockData;
 
 // Uniforms
 uniform isampler2D mcubesLookup;
 uniform isampler1D mcubesLookup2;
 uniform vec3 worldOffset;
 uniform float voxelScale;
+// STAGE_COUNT or STAGE_EMIT, the emit pass writes its block's range of the
+// exact sized mesh that starts at firstVertex/firstTriangle
+uniform int stage;
+uniform uint firstVertex;
+uniform uint firstTriangle;
+// grid units between cached samples (0 if there are none) and between ours
+uniform int cachedStride;
+uniform int gridStride;
+// MESHER_MARCHING_CUBES or MESHER_SURFACE_NETS, VoxelMesher
+uniform int mesher;
+
+#define STAGE_COUNT 0
+#define STAGE_EMIT 1
+#define MESHER_MARCHING_CUBES 0
+#define MESHER_SURFACE_NETS 1
+#define BLOCK_SAMPLES 17
+// surface nets sample one more layer, VOXEL_NETS_SAMPLES
+#define BLOCK_THREADS 18
+#define BLOCK_COLUMNS (BLOCK_THREADS*BLOCK_THREADS)
+#define DENSITY_GRID 65 // CHUNK_SIZE+1
+#define POSITION_RANGE 68.0 // VOXEL_POSITION_RANGE
 
 // Shared values between all the threads in the group
-shared float cubeValues[18][18][18]; // the actual used size is 17, but using 18 saves 3 overflow checks
+shared float cubeValues[BLOCK_THREADS][BLOCK_THREADS][BLOCK_THREADS]; // marching cubes only use 17
+// edges crossing the surface in every sample column, see edgeMask(), or the
+// cells with a vertex in every cell column, see cellMask()
+shared uvec2 columnMask[BLOCK_THREADS][BLOCK_THREADS];
+// vertices and triangles of every column, prefix summed by scanColumns()
+shared uvec2 columnCount[BLOCK_COLUMNS];
+shared uvec2 columnStart[BLOCK_COLUMNS];
+// terrain height of every x, z sample column with columnWarp
+shared float columnHeights[BLOCK_THREADS][BLOCK_THREADS];
 
 const ivec4 edgeVertexOffset[12] =
 {
@@ -210,7 +250,22 @@ vec3 getClosestPointOnLine(vec3 a, vec3 b, vec3 from)
     return a+atob;
 }
 
-float voxel(vec3 worldPos)
+float editDelta(vec3 worldPos)
+{
+    ivec3 voxel = ivec3(floor(worldPos+0.5));
+    ivec3 brick = ivec3(floor(vec3(voxel)/8.0));
+    ivec3 slot = brick - editData.firstBrick;
+    if(any(lessThan(slot, ivec3(0))) || any(greaterThanEqual(slot, ivec3(9))))
+        return 0.0;
+    int index = editData.table[(slot.z*9 + slot.y)*9 + slot.x];
+    if(index < 0)
+        return 0.0;
+    ivec3 local = voxel - brick*8;
+    return editData.deltas[index*512 + (local.z*8 + local.y)*8 + local.x];
+}
+
+// terrain height under worldPos, with columnWarp it's the same for the whole column
+float columnHeight(vec3 worldPos)
 {
     vec3 curVec = worldPos-tunnelData.genData.chunkOrigin.xyz;
     float progressX = curVec.x/64.0; 	// TODO: 64=chunk size
@@ -221,7 +276,10 @@ float voxel(vec3 worldPos)
 
     float lacunarity = 2.0;
 
-    float warp = (snoise(0.08*worldPos)+1);
+    vec3 warpCoord = worldPos;
+    if(tunnelData.genData.columnWarp != 0u)
+        warpCoord.y = 33.11;
+    float warp = (snoise(0.08*warpCoord)+1);
     vec3 sampleCoord = vec3(0.2,0.9,0.48)*warp*10 + worldPos;
     //vec3 sampleCoord = worldPos;
     sampleCoord.y = 33.11;
@@ -232,7 +290,13 @@ float voxel(vec3 worldPos)
     float h0 = h2noise*0.5*((snoise(0.005*pow(lacunarity,4.0)*sampleCoord)+1)*(1.0));
     float h1 = h2noise*0.5*((snoise(0.0005*pow(lacunarity,2.0)*sampleCoord)+1)*(tunnelData.genData.firstOctaveMax+fom));
 
-    float minHeight = (h0+h1+h2) - worldPos.y ;
+    return h0+h1+h2;
+}
+
+// density at worldPos with the terrain height there known
+float fieldDensity(vec3 worldPos, float height)
+{
+    float minHeight = height - worldPos.y ;
 
     for(int i = 0; i < tunnelData.genData.tunnelCount; i++)
     {
@@ -241,131 +305,448 @@ float voxel(vec3 worldPos)
         vec3 cp = getClosestPointOnLine(p0,p1,worldPos);
         float sphere = length(worldPos-cp);
         if(sphere < 5.0)
-            return (-5.0+sphere)*10.0;
+        {
+            minHeight = (-5.0+sphere)*10.0;
+            break;
+        }
     }
 
+    if(editData.brickCount > 0)
+        minHeight += editDelta(worldPos);
     return minHeight;
 }
 
-void vMarchCube1(int i, int j, int k, uint index)
-{	
-    int iterate, iFlagIndex;
-    vec4 afCubeValuev[2];
+float voxel(vec3 worldPos)
+{
+    return fieldDensity(worldPos, columnHeight(worldPos));
+}
 
-    afCubeValuev[0].x = cubeValues[i][j][k];
-    afCubeValuev[0].y = cubeValues[i+1][j][k];
-    afCubeValuev[0].z = cubeValues[i+1][j+1][k];
-    afCubeValuev[0].w = cubeValues[i][j+1][k];
-    afCubeValuev[1].x = cubeValues[i][j][k+1];
-    afCubeValuev[1].y = cubeValues[i+1][j][k+1];
-    afCubeValuev[1].z = cubeValues[i+1][j+1][k+1];
-    afCubeValuev[1].w = cubeValues[i][j+1][k+1];
 
-	 // I heard GPU likes vectors...
-    iFlagIndex = int(dot(ivec4(1, 2, 4, 8)*ivec4(step(afCubeValuev[0],vec4(0.0))),ivec4(1)) + 
-		dot(ivec4(16, 32, 64, 128)*ivec4(step(afCubeValuev[1],vec4(0.0))),ivec4(1)) + vec4(0.1));
+uvec2 setBit(uvec2 mask, int bit)
+{
+    if(bit < 32)
+        mask.x |= 1u << bit;
+    else
+        mask.y |= 1u << (bit-32);
+    return mask;
+}
+
+// set bits below bit, the index of that edge's vertex in its column
+uint maskRank(uvec2 mask, int bit)
+{
+    if(bit < 32)
+        return uint(bitCount(mask.x & ((1u << bit) - 1u)));
+    return uint(bitCount(mask.x) + bitCount(mask.y & ((1u << (bit-32)) - 1u)));
+}
 
-	 int edgeConnection[3];
- 
-    for(iterate = 0; iterate < 5; iterate++)
+// bit z*3+axis is set if the edge from sample (x, y, z) along axis crosses
+// the surface, edges leaving the block don't exist. Every crossing edge is
+// used by the cubes around it, so it's exactly one vertex.
+uvec2 edgeMask(int x, int y)
+{
+    uvec2 mask = uvec2(0);
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
     {
-    	  edgeConnection[0] = texelFetch2D(mcubesLookup, ivec2(3*iterate, iFlagIndex), 0).a;
-		  edgeConnection[1] = texelFetch2D(mcubesLookup, ivec2(3*iterate+1, iFlagIndex), 0).a;
-		  edgeConnection[2] = texelFetch2D(mcubesLookup, ivec2(3*iterate+2, iFlagIndex), 0).a;
+        bool inside = cubeValues[x][y][z] <= 0.0;
+        if(x < 16 && inside != (cubeValues[x+1][y][z] <= 0.0))
+            mask = setBit(mask, z*3);
+        if(y < 16 && inside != (cubeValues[x][y+1][z] <= 0.0))
+            mask = setBit(mask, z*3+1);
+        if(z < 16 && inside != (cubeValues[x][y][z+1] <= 0.0))
+            mask = setBit(mask, z*3+2);
+    }
+    return mask;
+}
+
+int cubeCase(ivec3 cube)
+{
+    int i = cube.x, j = cube.y, k = cube.z;
+    return int(cubeValues[i][j][k] <= 0.0)
+        | int(cubeValues[i+1][j][k] <= 0.0) << 1
+        | int(cubeValues[i+1][j+1][k] <= 0.0) << 2
+        | int(cubeValues[i][j+1][k] <= 0.0) << 3
+        | int(cubeValues[i][j][k+1] <= 0.0) << 4
+        | int(cubeValues[i+1][j][k+1] <= 0.0) << 5
+        | int(cubeValues[i+1][j+1][k+1] <= 0.0) << 6
+        | int(cubeValues[i][j+1][k+1] <= 0.0) << 7;
+}
+
+// n-th edge of the case's triangle list, -1 ends it
+int triangleEdge(int flags, int n)
+{
+    return texelFetch(mcubesLookup, ivec2(n, flags), 0).a;
+}
 
-        if(edgeConnection[0] > -1)
+vec3 edgePosition(ivec3 p, int axis)
+{
+    ivec3 n = p + ivec3(equal(ivec3(axis), ivec3(0, 1, 2)));
+    float fOffset = getOffset(cubeValues[p.x][p.y][p.z], cubeValues[n.x][n.y][n.z]);
+    vec3 position = inputVertexBuffer.data[gl_WorkGroupID.x].xyz + vec3(p)*voxelScale;
+    position[axis] += fOffset*voxelScale;
+    return position;
+}
+
+// block relative index of the edge's vertex
+uint edgeVertex(ivec3 p, int axis)
+{
+    return columnStart[p.y*BLOCK_THREADS + p.x].x + maskRank(columnMask[p.x][p.y], p.z*3 + axis);
+}
+
+// Surface nets, same as voxelNetsEmitBlock(). A block owns the edges that
+// start in one of its cells along the edge and lie on its far faces or inside
+// it across the edge. The cells around those reach one past the far faces.
+bool netsEdgeOwned(ivec3 p, int axis)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        if(i == axis ? p[i] >= 16 : (p[i] < 1 || p[i] > 16))
+            return false;
+    }
+    return true;
+}
+
+bool netsSignChange(ivec3 p, int axis)
+{
+    ivec3 n = p + ivec3(equal(ivec3(axis), ivec3(0, 1, 2)));
+    return (cubeValues[p.x][p.y][p.z] <= 0.0) != (cubeValues[n.x][n.y][n.z] <= 0.0);
+}
+
+bool netsEdgeCrosses(ivec3 p, int axis)
+{
+    return netsEdgeOwned(p, axis) && netsSignChange(p, axis);
+}
+
+// start of the e-th of the 4 edges along axis around the cell
+ivec3 netsCellEdge(ivec3 cell, int axis, int e)
+{
+    ivec3 d = ivec3(0);
+    d[(axis+1)%3] = e & 1;
+    d[(axis+2)%3] = e >> 1;
+    return cell + d;
+}
+
+// bit z is set if a quad uses cell (x, y, z), only those get a vertex
+uint cellMask(int x, int y)
+{
+    uint mask = 0u;
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
+    {
+        bool used = false;
+        for(int axis = 0; axis < 3 && !used; axis++)
         {
-            uint indexIndex = atomicCounterIncrement(indexCount);
+            for(int e = 0; e < 4 && !used; e++)
+                used = netsEdgeCrosses(netsCellEdge(ivec3(x, y, z), axis, e), axis);
+        }
+        if(used)
+            mask |= 1u << z;
+    }
+    return mask;
+}
 
-            // calculate vertex positions and normal of the triangle
-            vec3 verts[3];
-            for(int curVert = 0; curVert < 3; curVert++)
-            {
-                ivec4 indexOffset = edgeVertexOffset[edgeConnection[curVert]];
-                verts[curVert] = edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].coord;
-            }
-            vec3 normal = normalize(cross(verts[1].xyz -verts[0].xyz, verts[2].xyz - verts[0].xyz));
+// quads around the owned edges crossing the surface in sample column (x, y)
+uint netsQuadCount(int x, int y)
+{
+    uint quads = 0u;
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
+    {
+        for(int axis = 0; axis < 3; axis++)
+            quads += uint(netsEdgeCrosses(ivec3(x, y, z), axis));
+    }
+    return quads;
+}
 
-            // add missing vertices and indices
-            for(int curVert = 0; curVert < 3; curVert++)
-            {
-                ivec4 indexOffset = edgeVertexOffset[edgeConnection[curVert]];
-                int res = -2;
-                do
-                {
-                    res = atomicCompSwap(edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].index, -1, -2);
-                    if(res == -1) // new vertex
-                    {
-                        // create new vertex
-                        uint vertexIndex = atomicCounterIncrement(triangleCount);
-                        // write new vertex index so others can read it
-                        atomicExchange(edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].index, int(vertexIndex));                      
-                        outputVertexBuffer.data[vertexIndex].position = vec4(verts[curVert], 1.0);
-                        outputVertexBuffer.data[vertexIndex].normal = vec4(normal,1.0);
-                        // add new index
-                        outputElementBuffer.data[indexIndex].index[curVert] = int(vertexIndex);
-                    }
-                    else if(res != -2)	// some other thread already created this vertex, just use the stored value
-                    {
-                        // add new index
-                        outputElementBuffer.data[indexIndex].index[curVert] = res;
-                        // TODO: atomic?
-                        outputVertexBuffer.data[res].normal += vec4(normal,1.0);
-                    }
-                } while (res == -2);		
-            }
+// mean of the points where the cell's edges cross the surface
+vec3 cellPosition(ivec3 cell)
+{
+    vec3 sum = vec3(0.0);
+    float crossings = 0.0;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        for(int e = 0; e < 4; e++)
+        {
+            ivec3 p = netsCellEdge(cell, axis, e);
+            if(!netsSignChange(p, axis))
+                continue;
+            sum += edgePosition(p, axis);
+            crossings += 1.0;
         }
     }
+    return sum*(1.0/crossings);
+}
+
+// block relative index of the cell's vertex
+uint cellVertex(ivec3 cell)
+{
+    uint mask = columnMask[cell.x][cell.y].x;
+    return columnStart[cell.y*BLOCK_THREADS + cell.x].x + uint(bitCount(mask & ((1u << cell.z) - 1u)));
+}
+
+// Points away from the solid side, the density falls off towards the air.
+// Central differences of the field around the vertex itself, so it only
+// depends on the world position. Neighbouring blocks and chunks agree on a
+// shared vertex and every thread writes its vertices once.
+vec3 vertexNormal(vec3 position)
+{
+    vec3 worldPos = position + worldOffset;
+    float h = 0.5*voxelScale;
+    vec3 gradient = vec3(voxel(worldPos + vec3(h, 0.0, 0.0)) - voxel(worldPos - vec3(h, 0.0, 0.0)),
+                         voxel(worldPos + vec3(0.0, h, 0.0)) - voxel(worldPos - vec3(0.0, h, 0.0)),
+                         voxel(worldPos + vec3(0.0, 0.0, h)) - voxel(worldPos - vec3(0.0, 0.0, h)));
+    return -gradient;
+}
+
+// gradient of the samples at p towards the air over one voxel, its
+// neighbours must be in the block
+vec3 sampleNormal(ivec3 p)
+{
+    return 0.5*vec3(cubeValues[p.x-1][p.y][p.z] - cubeValues[p.x+1][p.y][p.z],
+                    cubeValues[p.x][p.y-1][p.z] - cubeValues[p.x][p.y+1][p.z],
+                    cubeValues[p.x][p.y][p.z-1] - cubeValues[p.x][p.y][p.z+1]);
+}
+
+// Same as voxelEdgeNormal(), the gradients of the edge's samples interpolated
+// like its position. Vertices on or next to the block's faces are the shared
+// ones and take vertexNormal().
+vec3 edgeNormal(vec3 position, ivec3 p, int axis)
+{
+    ivec3 along = ivec3(equal(ivec3(axis), ivec3(0, 1, 2)));
+    if(any(lessThan(p, ivec3(1))) || any(greaterThan(p, ivec3(15) - along)))
+        return vertexNormal(position);
+    ivec3 n = p + along;
+    float t = getOffset(cubeValues[p.x][p.y][p.z], cubeValues[n.x][n.y][n.z]);
+    return mix(sampleNormal(p), sampleNormal(n), t);
+}
+
+// voxelCellNormal(), the gradients of the cell's corners at its vertex
+vec3 cellNormal(vec3 position, ivec3 cell)
+{
+    if(any(lessThan(cell, ivec3(1))) || any(greaterThan(cell, ivec3(15))))
+        return vertexNormal(position);
+    vec3 f = (position - inputVertexBuffer.data[gl_WorkGroupID.x].xyz)/voxelScale - vec3(cell);
+    vec3 normal = vec3(0.0);
+    for(int c = 0; c < 8; c++)
+    {
+        ivec3 d = ivec3(c & 1, (c >> 1) & 1, c >> 2);
+        vec3 w = mix(1.0 - f, f, vec3(d));
+        normal += sampleNormal(cell + d)*(w.x*w.y*w.z);
+    }
+    return normal;
+}
+
+// positions relative to the chunk in 16 bit, the normal folded onto an
+// octahedron, same as voxelPackVertex()
+void packVertex(uint vertex, vec3 position, vec3 normal)
+{
+    float sum = abs(normal.x) + abs(normal.y) + abs(normal.z);
+    vec3 n = sum > 0.0 ? normal/sum : vec3(0.0, 1.0, 0.0);
+    vec2 e = n.xy;
+    if(n.z < 0.0)
+        e = (1.0 - abs(n.yx))*vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    vec3 p = position/POSITION_RANGE;
+    outputVertexBuffer.data[3*vertex] = packUnorm2x16(p.xy);
+    outputVertexBuffer.data[3*vertex+1] = packUnorm2x16(vec2(p.z, 0.0));
+    outputVertexBuffer.data[3*vertex+2] = packSnorm2x16(e);
 }
 
-// cant use 17 17 17 because "local work size runs out of limitaion"
-layout(local_size_x = 17, local_size_y = 17, local_size_z = 1) in;
+// Two dispatches per chunk, one workgroup per block, a thread per sample column.
+// STAGE_COUNT samples the block and writes how many vertices and triangles it
+// has. The CPU sizes the mesh from those, then STAGE_EMIT writes the block's
+// part of it at the offset the blocks before it add up to. Inside a block the
+// columns get their ranges from a prefix sum, so nothing is contended and the
+// output has no gaps. Vertices are shared through the column edge masks in
+// shared memory, the only scratch in global memory are the samples of blocks
+// the surface goes through.
+// Surface nets work the same way with cell columns instead of sample columns
+// and a quad per owned edge, they need a thread for the extra sample layer.
+// cant use 18 18 18 because "local work size runs out of limitaion"
+layout(local_size_x = BLOCK_THREADS, local_size_y = BLOCK_THREADS, local_size_z = 1) in;
 void main() {
-    ivec2 location = ivec2(gl_WorkGroupID.xy);
     ivec2 itemID = ivec2(gl_LocalInvocationID.xy);
-    ivec2 tileNumber = ivec2(gl_NumWorkGroups.xy);
-    uint index = location.x;
-
-	 // take all the samples we will need
-    for(int i = 0; i < 17; i++) {
-        int zv = i;
-        vec3 worldPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,itemID.y*voxelScale,i*voxelScale);
-        cubeValues[itemID.x][itemID.y][zv] = voxel(worldPosition+worldOffset);
+    uint index = gl_WorkGroupID.x;
+    uint column = gl_LocalInvocationIndex;
+    uint densityBase = (index*BLOCK_COLUMNS + itemID.x*BLOCK_THREADS + itemID.y)*BLOCK_THREADS;
+    // samples along each side of the block and whether this thread has a column of them
+    int samples = mesher == MESHER_SURFACE_NETS ? BLOCK_THREADS : BLOCK_SAMPLES;
+    bool sampling = itemID.x < samples && itemID.y < samples;
+
+    if(stage == STAGE_COUNT)
+    {
+        // take all the samples we will need, from the cache where they are,
+        // the extra layer of surface nets is outside of it
+        ivec3 blockGrid = ivec3(round(inputVertexBuffer.data[index].xyz/voxelScale));
+        // with columnWarp the height is the same along y, thread (x, y)
+        // finds it for column (x, z = y) and the samples only subtract
+        bool heightField = tunnelData.genData.columnWarp != 0u;
+        if(heightField)
+        {
+            if(sampling)
+            {
+                vec3 columnPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,0.0,itemID.y*voxelScale);
+                columnHeights[itemID.x][itemID.y] = columnHeight(columnPosition+worldOffset);
+            }
+            barrier();
+        }
+        for(int i = 0; i < samples && sampling; i++) {
+            ivec3 g = (blockGrid + ivec3(itemID, i))*gridStride;
+            int cacheIndex = (g.z*DENSITY_GRID + g.y)*DENSITY_GRID + g.x;
+            bool inGrid = all(lessThan(g, ivec3(DENSITY_GRID)));
+            if(inGrid && cachedStride > 0 && all(equal(g % cachedStride, ivec3(0))))
+            {
+                cubeValues[itemID.x][itemID.y][i] = densityCache.values[cacheIndex];
+                continue;
+            }
+            vec3 worldPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,itemID.y*voxelScale,i*voxelScale);
+            float value = heightField ? fieldDensity(worldPosition+worldOffset, columnHeights[itemID.x][i])
+                                      : voxel(worldPosition+worldOffset);
+            cubeValues[itemID.x][itemID.y][i] = value;
+            if(inGrid)
+                densityCache.values[cacheIndex] = value;
+        }
     }
+    else
+    {
+        // the same for every thread of the group, blocks without a surface
+        // have nothing to emit and their samples were never stored
+        if(blockData.counts[index].x == 0u)
+            return;
+        for(int i = 0; i < samples && sampling; i++)
+            cubeValues[itemID.x][itemID.y][i] = densityData.values[densityBase + i];
+    }
+    barrier();
 
-	 int dummy = 3; // i don't understand the dynamically uniform expression thing, so I use these
-    dummy;
+    // vertices and triangles of the column, the threads of the extra layer have none
+    uvec2 mask = uvec2(0);
+    uint triangles = 0;
+    if(itemID.x < BLOCK_SAMPLES && itemID.y < BLOCK_SAMPLES)
+    {
+        if(mesher == MESHER_SURFACE_NETS)
+        {
+            mask.x = cellMask(itemID.x, itemID.y);
+            triangles = 2u*netsQuadCount(itemID.x, itemID.y);
+        }
+        else
+        {
+            mask = edgeMask(itemID.x, itemID.y);
+            if(itemID.x < 16 && itemID.y < 16)
+            {
+                for(int k = 0; k < 16; k++)
+                {
+                    int flags = cubeCase(ivec3(itemID, k));
+                    for(int t = 0; t < 5 && triangleEdge(flags, 3*t) > -1; t++)
+                        triangles++;
+                }
+            }
+        }
+    }
+    columnMask[itemID.x][itemID.y] = mask;
+    columnCount[column] = uvec2(bitCount(mask.x) + bitCount(mask.y), triangles);
     barrier();
 
-	 // calculate all possible vertex positions
-    for(int i = 0; i < 17; i++) {
-        int zv = i;
+    if(column == 0)
+    {
+        uvec2 sum = uvec2(0);
+        for(int c = 0; c < BLOCK_COLUMNS; c++)
+        {
+            columnStart[c] = sum;
+            sum += columnCount[c];
+        }
+    }
+    barrier();
 
-        vec3 worldPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,itemID.y*voxelScale,zv*voxelScale)/* + worldOffset*/;
+    if(stage == STAGE_COUNT)
+    {
+        uvec2 total = columnStart[BLOCK_COLUMNS-1] + columnCount[BLOCK_COLUMNS-1];
+        if(column == BLOCK_COLUMNS-1)
+            blockData.counts[index] = total;
+        // only blocks the surface goes through are read back by the emit pass
+        if(total.x > 0u)
+        {
+            for(int i = 0; i < samples && sampling; i++)
+                densityData.values[densityBase + i] = cubeValues[itemID.x][itemID.y][i];
+        }
+        return;
+    }
 
-        float fOffset = getOffset(cubeValues[itemID.x][itemID.y][zv], cubeValues[itemID.x+1][itemID.y][zv]);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][0].coord = worldPosition + fOffset*vec3(voxelScale,0.0,0.0);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][0].index = -1;
+    uvec2 base = uvec2(0);
+    for(uint b = 0; b < index; b++)
+        base += blockData.counts[b];
 
-        fOffset = getOffset(cubeValues[itemID.x][itemID.y][zv], cubeValues[itemID.x][itemID.y+1][zv]);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][1].coord = worldPosition + fOffset*vec3(0.0,voxelScale,0.0);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][1].index = -1;
+    uint vertex = firstVertex + base.x + columnStart[column].x;
+    if(mesher == MESHER_SURFACE_NETS)
+    {
+        if(itemID.x >= BLOCK_SAMPLES || itemID.y >= BLOCK_SAMPLES)
+            return;
+        for(int z = 0; z < BLOCK_SAMPLES; z++)
+        {
+            if((mask.x & (1u << z)) == 0u)
+                continue;
+            vec3 position = cellPosition(ivec3(itemID, z));
+            packVertex(vertex, position, cellNormal(position, ivec3(itemID, z)));
+            vertex++;
+        }
 
-        fOffset = getOffset(cubeValues[itemID.x][itemID.y][zv], cubeValues[itemID.x][itemID.y][zv+1]);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][2].coord = worldPosition + fOffset*vec3(0.0,0.0,voxelScale);
-        edgeVertexData.data[index].left[itemID.x][itemID.y][zv][2].index = -1;
+        // the four cells around the edge, wound to face the air like the
+        // marching cubes triangles
+        uint triangle = firstTriangle + base.y + columnStart[column].y;
+        for(int z = 0; z < BLOCK_SAMPLES; z++)
+        {
+            for(int axis = 0; axis < 3; axis++)
+            {
+                ivec3 p = ivec3(itemID, z);
+                if(!netsEdgeCrosses(p, axis))
+                    continue;
+                ivec3 u = ivec3(equal(ivec3((axis+1)%3), ivec3(0, 1, 2)));
+                ivec3 v = ivec3(equal(ivec3((axis+2)%3), ivec3(0, 1, 2)));
+                int quad[4];
+                quad[0] = int(base.x + cellVertex(p - u - v));
+                quad[1] = int(base.x + cellVertex(p - v));
+                quad[2] = int(base.x + cellVertex(p));
+                quad[3] = int(base.x + cellVertex(p - u));
+                bool flip = cubeValues[p.x][p.y][p.z] <= 0.0;
+                outputElementBuffer.data[triangle].index[0] = quad[0];
+                outputElementBuffer.data[triangle].index[1] = quad[flip ? 2 : 1];
+                outputElementBuffer.data[triangle].index[2] = quad[flip ? 1 : 2];
+                outputElementBuffer.data[triangle+1].index[0] = quad[0];
+                outputElementBuffer.data[triangle+1].index[1] = quad[flip ? 3 : 2];
+                outputElementBuffer.data[triangle+1].index[2] = quad[flip ? 2 : 3];
+                triangle += 2u;
+            }
+        }
+        return;
     }
 
-	dummy = 4;
-    dummy;
-    barrier();
-
-    if(itemID.x == 16 || itemID.y == 16)
-	    return;
+    for(int z = 0; z < BLOCK_SAMPLES; z++)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            int bit = z*3 + axis;
+            if(((bit < 32 ? mask.x >> bit : mask.y >> (bit-32)) & 1u) == 0u)
+                continue;
+            vec3 position = edgePosition(ivec3(itemID, z), axis);
+            packVertex(vertex, position, edgeNormal(position, ivec3(itemID, z), axis));
+            vertex++;
+        }
+    }
 
-	 for(int i = 0; i < 16; i++)
-	 {
-    	 vMarchCube1(itemID.x, itemID.y, i, index);
-	 }
+    if(itemID.x >= 16 || itemID.y >= 16)
+        return;
 
+    // indices are relative to the chunk's first vertex
+    uint triangle = firstTriangle + base.y + columnStart[column].y;
+    for(int k = 0; k < 16; k++)
+    {
+        ivec3 cube = ivec3(itemID, k);
+        int flags = cubeCase(cube);
+        for(int t = 0; t < 5; t++)
+        {
+            if(triangleEdge(flags, 3*t) < 0)
+                break;
+            for(int curVert = 0; curVert < 3; curVert++)
+            {
+                ivec4 o = edgeVertexOffset[triangleEdge(flags, 3*t+curVert)];
+                outputElementBuffer.data[triangle].index[curVert] = int(base.x + edgeVertex(cube + o.xyz, o.w));
+            }
+            triangle++;
+        }
+    }
 }
@@ -0,0 +1,436 @@
+#include "core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk cache of generated chunk meshes.
+//
+// Chunks are grouped into regions of CHUNK_CACHE_REGION_SIZE^3 chunks, each
+// region is one file per generator parameter hash. A region file starts with
+// a fixed header holding an entry per chunk and LOD, mesh data is appended
+// behind it. Files are read through a shared mapping, so a hit hands out
+// pointers straight into the page cache. Entries are only written after the
+// data they point to, a reader never sees a half written mesh.
+//
+// A chunk stored again (an edit, a new mesher) goes where its old mesh was if
+// it fits, the entry is cleared while the data is overwritten. Otherwise the
+// old data is dead, once a region is mostly dead data it's rewritten with
+// only the live meshes into a new file that replaces the old one.
+//
+// Changing the generator parameters changes the hash, the old files are
+// simply not used anymore. Tunnels, brush edits and how a LOD is meshed are
+// not part of it, every entry instead records a hash of the tunnels and edit
+// bricks its chunk sees, the mesher of its LOD and the simplification error
+// if its LOD is simplified. An edit only misses on the chunks it actually
+// changes, a new mesher or error only on the LOD it's used for.
+
+#define CHUNK_CACHE_MAGIC 0x31434354 // "TCC1"
+#define CHUNK_CACHE_VERSION 5
+// dead data a region needs before it's compacted, besides being half of it
+#define CHUNK_CACHE_COMPACT_MIN_BYTES Megabytes(4)
+
+typedef struct ChunkCacheEntry
+{
+    u64 offset; // 0 if not cached
+    u32 vertexCount;
+    u32 triangleCount;
+    u64 meshHash; // see chunkCacheHashMesh()
+} ChunkCacheEntry;
+
+typedef struct ChunkCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 genHash;
+    ChunkCacheEntry entries[CHUNK_CACHE_REGION_CHUNKS][CHUNK_CACHE_LODS];
+} ChunkCacheHeader;
+
+// FNV-1a
+static u64 chunkCacheHashBytes(u64 hash, const void *data, u64 size)
+{
+    const u8 *bytes = (const u8*)data;
+    for(u64 i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// tunnelCount changes from chunk to chunk, only the parameters take part
+u64 chunkCacheHashGenData(ChunkGenData *gen)
+{
+    u64 hash = 0xcbf29ce484222325ULL;
+    u64 start = offsetof(ChunkGenData, firstOctaveMax);
+    return chunkCacheHashBytes(hash, (u8*)gen + start, sizeof(ChunkGenData) - start);
+}
+
+// tunnels and edit bricks of the chunk, without bricks it's the hash of the tunnels
+u64 chunkCacheHashEdits(VoxelField *field)
+{
+    u64 hash = 0xcbf29ce484222325ULL;
+    hash = chunkCacheHashBytes(hash, field->tunnels, field->gen->tunnelCount*sizeof(Line3D));
+    if(field->edits->brickCount > 0)
+    {
+        hash = chunkCacheHashBytes(hash, field->edits, sizeof(VoxelEditChunk));
+        hash = chunkCacheHashBytes(hash, field->bricks, field->edits->brickCount*sizeof(VoxelBrick));
+    }
+    return hash;
+}
+
+// key of an entry, the chunk's edit hash and what its LOD is meshed with.
+// simplifyError is the one applied to this chunk, 0 if it isn't simplified
+u64 chunkCacheHashMesh(u64 editHash, VoxelMesher mesher, r32 simplifyError)
+{
+    u64 hash = chunkCacheHashBytes(editHash, &mesher, sizeof(VoxelMesher));
+    if(simplifyError > 0.0f)
+        hash = chunkCacheHashBytes(hash, &simplifyError, sizeof(r32));
+    return hash;
+}
+
+static i32 floorDiv(i32 a, i32 b)
+{
+    return a >= 0 ? a/b : -((-a+b-1)/b);
+}
+
+static IVec3 chunkCacheRegionId(IVec3 chunkId)
+{
+    IVec3 ret;
+    ret.x = floorDiv(chunkId.x, CHUNK_CACHE_REGION_SIZE);
+    ret.y = floorDiv(chunkId.y, CHUNK_CACHE_REGION_SIZE);
+    ret.z = floorDiv(chunkId.z, CHUNK_CACHE_REGION_SIZE);
+    return ret;
+}
+
+static void chunkCacheRegionPath(ChunkCache *cache, IVec3 regionId, u64 genHash, char *fileName, u32 size)
+{
+    snprintf(fileName, size, "%s/%016llx.%d.%d.%d.region", cache->directory,
+             (unsigned long long)genHash, regionId.x, regionId.y, regionId.z);
+}
+
+static u64 chunkCacheEntrySize(ChunkCacheEntry *entry)
+{
+    return entry->vertexCount*sizeof(VertexOut) + entry->triangleCount*sizeof(TriangleOut);
+}
+
+static u32 chunkCacheRegionSlot(IVec3 chunkId)
+{
+    u32 x = (u32)(chunkId.x - floorDiv(chunkId.x, CHUNK_CACHE_REGION_SIZE)*CHUNK_CACHE_REGION_SIZE);
+    u32 y = (u32)(chunkId.y - floorDiv(chunkId.y, CHUNK_CACHE_REGION_SIZE)*CHUNK_CACHE_REGION_SIZE);
+    u32 z = (u32)(chunkId.z - floorDiv(chunkId.z, CHUNK_CACHE_REGION_SIZE)*CHUNK_CACHE_REGION_SIZE);
+    return (y*CHUNK_CACHE_REGION_SIZE + z)*CHUNK_CACHE_REGION_SIZE + x;
+}
+
+void chunkCacheInit(ChunkCache *cache, const char *directory)
+{
+    memset(cache, 0, sizeof(ChunkCache));
+    snprintf(cache->directory, sizeof(cache->directory), "%s", directory);
+    if(mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+        printf("Creating chunk cache directory %s failed, cache disabled\n", directory);
+        return;
+    }
+    cache->enabled = true;
+}
+
+static void chunkCacheCloseRegion(ChunkCacheRegion *region)
+{
+    if(region->map != 0)
+        munmap(region->map, region->mapSize);
+    if(region->fd >= 0)
+        close(region->fd);
+    region->map = 0;
+    region->mapSize = 0;
+    region->fd = -1;
+    region->used = false;
+}
+
+void chunkCachePrintStats(ChunkCache *cache)
+{
+    printf("chunk cache: %u hits, %u misses, %u writes (%.1fMB, %u in place), %u compactions (%.1fMB reclaimed), %u write errors\n",
+           cache->hits, cache->misses, cache->writes, cache->bytesWritten/(r64)Megabytes(1), cache->reusedWrites,
+           cache->compactions, cache->bytesReclaimed/(r64)Megabytes(1), cache->writeErrors);
+}
+
+void chunkCacheShutdown(ChunkCache *cache)
+{
+    for(u32 i = 0; i < CHUNK_CACHE_OPEN_REGIONS; i++)
+    {
+        if(cache->regions[i].used)
+            chunkCacheCloseRegion(&cache->regions[i]);
+    }
+    cache->enabled = false;
+}
+
+// map the whole file, called again when the file grew past the mapping
+static b32 chunkCacheMapRegion(ChunkCacheRegion *region)
+{
+    if(region->map != 0 && region->mapSize >= region->fileSize)
+        return true;
+    if(region->map != 0)
+        munmap(region->map, region->mapSize);
+    region->map = mmap(0, region->fileSize, PROT_READ, MAP_SHARED, region->fd, 0);
+    if(region->map == MAP_FAILED)
+    {
+        region->map = 0;
+        region->mapSize = 0;
+        return false;
+    }
+    region->mapSize = region->fileSize;
+    return true;
+}
+
+static ChunkCacheRegion* chunkCacheOpenRegion(ChunkCache *cache, IVec3 regionId, u64 genHash, b32 create)
+{
+    ChunkCacheRegion *lru = &cache->regions[0];
+    for(u32 i = 0; i < CHUNK_CACHE_OPEN_REGIONS; i++)
+    {
+        ChunkCacheRegion *region = &cache->regions[i];
+        if(region->used && region->genHash == genHash && region->regionId.x == regionId.x
+                && region->regionId.y == regionId.y && region->regionId.z == regionId.z)
+        {
+            region->lastUse = ++cache->useCounter;
+            return region;
+        }
+        if(!region->used || (lru->used && region->lastUse < lru->lastUse))
+            lru = region;
+    }
+
+    char fileName[CHUNK_CACHE_PATH_LENGTH];
+    chunkCacheRegionPath(cache, regionId, genHash, fileName, sizeof(fileName));
+    i32 fd = open(fileName, create ? O_RDWR|O_CREAT : O_RDWR, 0644);
+    if(fd < 0)
+        return 0;
+
+    struct stat st;
+    fstat(fd, &st);
+    u64 fileSize = (u64)st.st_size;
+    if(fileSize < sizeof(ChunkCacheHeader))
+    {
+        // new (or truncated) file, start with an empty header
+        ChunkCacheHeader *header = (ChunkCacheHeader*)calloc(1, sizeof(ChunkCacheHeader));
+        header->magic = CHUNK_CACHE_MAGIC;
+        header->version = CHUNK_CACHE_VERSION;
+        header->genHash = genHash;
+        b32 written = pwrite(fd, header, sizeof(ChunkCacheHeader), 0) == (ssize_t)sizeof(ChunkCacheHeader);
+        free(header);
+        if(!written || ftruncate(fd, sizeof(ChunkCacheHeader)) != 0)
+        {
+            close(fd);
+            return 0;
+        }
+        fileSize = sizeof(ChunkCacheHeader);
+    }
+
+    if(lru->used)
+        chunkCacheCloseRegion(lru);
+    lru->used = true;
+    lru->regionId = regionId;
+    lru->genHash = genHash;
+    lru->fd = fd;
+    lru->fileSize = fileSize;
+    lru->map = 0;
+    lru->mapSize = 0;
+    lru->lastUse = ++cache->useCounter;
+
+    ChunkCacheHeader *header = chunkCacheMapRegion(lru) ? (ChunkCacheHeader*)lru->map : 0;
+    if(!header || header->magic != CHUNK_CACHE_MAGIC || header->version != CHUNK_CACHE_VERSION || header->genHash != genHash)
+    {
+        printf("Chunk cache file %s is invalid, ignoring it\n", fileName);
+        chunkCacheCloseRegion(lru);
+        return 0;
+    }
+
+    // whatever no entry points to was left behind by stores of the same chunk
+    u64 liveBytes = 0;
+    for(u32 i = 0; i < CHUNK_CACHE_REGION_CHUNKS; i++)
+    {
+        for(u32 lod = 0; lod < CHUNK_CACHE_LODS; lod++)
+        {
+            if(header->entries[i][lod].offset != 0)
+                liveBytes += chunkCacheEntrySize(&header->entries[i][lod]);
+        }
+    }
+    u64 dataBytes = fileSize - sizeof(ChunkCacheHeader);
+    lru->deadBytes = dataBytes > liveBytes ? dataBytes - liveBytes : 0;
+    return lru;
+}
+
+// Writes the live meshes of the region into a new file behind a new header
+// and renames it over the old one. False if that failed, the old file is
+// still in use then.
+static b32 chunkCacheCompactRegion(ChunkCache *cache, ChunkCacheRegion *region)
+{
+    if(!chunkCacheMapRegion(region))
+        return false;
+    char fileName[CHUNK_CACHE_PATH_LENGTH];
+    char tempName[CHUNK_CACHE_PATH_LENGTH+8];
+    chunkCacheRegionPath(cache, region->regionId, region->genHash, fileName, sizeof(fileName));
+    snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+    i32 fd = open(tempName, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+
+    ChunkCacheHeader *header = (ChunkCacheHeader*)malloc(sizeof(ChunkCacheHeader));
+    memcpy(header, region->map, sizeof(ChunkCacheHeader));
+    u64 offset = sizeof(ChunkCacheHeader);
+    b32 written = true;
+    for(u32 i = 0; i < CHUNK_CACHE_REGION_CHUNKS && written; i++)
+    {
+        for(u32 lod = 0; lod < CHUNK_CACHE_LODS; lod++)
+        {
+            ChunkCacheEntry *entry = &header->entries[i][lod];
+            u64 size = chunkCacheEntrySize(entry);
+            if(entry->offset == 0)
+                continue;
+            if(entry->offset + size > region->fileSize)
+            {
+                memset(entry, 0, sizeof(ChunkCacheEntry));
+                continue;
+            }
+            if(pwrite(fd, (u8*)region->map + entry->offset, size, offset) != (ssize_t)size)
+            {
+                written = false;
+                break;
+            }
+            entry->offset = offset;
+            offset += size;
+        }
+    }
+    written = written && pwrite(fd, header, sizeof(ChunkCacheHeader), 0) == (ssize_t)sizeof(ChunkCacheHeader)
+            && rename(tempName, fileName) == 0;
+    free(header);
+    if(!written)
+    {
+        close(fd);
+        unlink(tempName);
+        return false;
+    }
+
+    cache->compactions++;
+    cache->bytesReclaimed += region->fileSize - offset;
+    munmap(region->map, region->mapSize);
+    close(region->fd);
+    region->fd = fd;
+    region->fileSize = offset;
+    region->map = 0;
+    region->mapSize = 0;
+    region->deadBytes = 0;
+    return chunkCacheMapRegion(region);
+}
+
+// on a hit the pointers stay valid until the next chunkCache* call
+b32 chunkCacheLookup(ChunkCache *cache, IVec3 chunkId, u32 lodLevel, u64 genHash, u64 meshHash,
+                     ChunkCacheResult *result)
+{
+    if(!cache->enabled)
+        return false;
+    assert(lodLevel < CHUNK_CACHE_LODS);
+
+    ChunkCacheRegion *region = chunkCacheOpenRegion(cache, chunkCacheRegionId(chunkId), genHash, false);
+    if(region)
+    {
+        ChunkCacheHeader *header = (ChunkCacheHeader*)region->map;
+        ChunkCacheEntry entry = header->entries[chunkCacheRegionSlot(chunkId)][lodLevel];
+        u64 size = entry.vertexCount*sizeof(VertexOut) + entry.triangleCount*sizeof(TriangleOut);
+        if(entry.offset != 0 && entry.meshHash == meshHash
+                && entry.offset + size <= region->fileSize && chunkCacheMapRegion(region))
+        {
+            result->vertices = (VertexOut*)((u8*)region->map + entry.offset);
+            result->triangles = (TriangleOut*)((u8*)region->map + entry.offset + entry.vertexCount*sizeof(VertexOut));
+            result->vertexCount = entry.vertexCount;
+            result->triangleCount = entry.triangleCount;
+            cache->hits++;
+            return true;
+        }
+    }
+    cache->misses++;
+    return false;
+}
+
+b32 chunkCacheStore(ChunkCache *cache, IVec3 chunkId, u32 lodLevel, u64 genHash, u64 meshHash,
+                    VertexOut *vertices, u32 vertexCount, TriangleOut *triangles, u32 triangleCount)
+{
+    if(!cache->enabled)
+        return false;
+    assert(lodLevel < CHUNK_CACHE_LODS);
+
+    ChunkCacheRegion *region = chunkCacheOpenRegion(cache, chunkCacheRegionId(chunkId), genHash, true);
+    // the header is read through the mapping, a failed remap dropped it
+    if(!region || (!region->map && !chunkCacheMapRegion(region)))
+    {
+        cache->writeErrors++;
+        return false;
+    }
+
+    ChunkCacheEntry entry;
+    entry.vertexCount = vertexCount;
+    entry.triangleCount = triangleCount;
+    entry.meshHash = meshHash;
+    u64 vertexSize = vertexCount*sizeof(VertexOut);
+    u64 triangleSize = triangleCount*sizeof(TriangleOut);
+    u64 entryOffset = offsetof(ChunkCacheHeader, entries) + (chunkCacheRegionSlot(chunkId)*CHUNK_CACHE_LODS + lodLevel)*sizeof(ChunkCacheEntry);
+
+    // the old mesh of the chunk is dropped first, its space is reused if the
+    // new one fits, otherwise it's dead until the region is compacted
+    ChunkCacheEntry old = ((ChunkCacheHeader*)region->map)->entries[chunkCacheRegionSlot(chunkId)][lodLevel];
+    u64 oldSize = chunkCacheEntrySize(&old);
+    if(old.offset != 0)
+    {
+        ChunkCacheEntry cleared;
+        memset(&cleared, 0, sizeof(cleared));
+        if(pwrite(region->fd, &cleared, sizeof(cleared), entryOffset) != (ssize_t)sizeof(cleared))
+        {
+            cache->writeErrors++;
+            return false;
+        }
+    }
+    if(old.offset != 0 && vertexSize + triangleSize <= oldSize && old.offset + oldSize <= region->fileSize)
+    {
+        entry.offset = old.offset;
+        region->deadBytes += oldSize - (vertexSize + triangleSize);
+        cache->reusedWrites++;
+    }
+    else
+    {
+        if(old.offset != 0)
+            region->deadBytes += oldSize;
+        if(region->deadBytes >= CHUNK_CACHE_COMPACT_MIN_BYTES && region->deadBytes*2 >= region->fileSize
+                && !chunkCacheCompactRegion(cache, region))
+        {
+            // still the old file, appending to it works as before
+            cache->writeErrors++;
+        }
+        if(!region->map)
+        {
+            // compacted but the new file couldn't be mapped
+            chunkCacheCloseRegion(region);
+            return false;
+        }
+        entry.offset = region->fileSize;
+    }
+
+    // data first, then the entry pointing to it
+    if(pwrite(region->fd, vertices, vertexSize, entry.offset) != (ssize_t)vertexSize
+            || pwrite(region->fd, triangles, triangleSize, entry.offset+vertexSize) != (ssize_t)triangleSize)
+    {
+        cache->writeErrors++;
+        return false;
+    }
+    if(entry.offset + vertexSize + triangleSize > region->fileSize)
+        region->fileSize = entry.offset + vertexSize + triangleSize;
+
+    if(pwrite(region->fd, &entry, sizeof(entry), entryOffset) != (ssize_t)sizeof(entry))
+    {
+        cache->writeErrors++;
+        return false;
+    }
+    cache->writes++;
+    cache->bytesWritten += vertexSize + triangleSize;
+    return true;
+}
@@ -0,0 +1,119 @@
+#include "core.h"
+
+// Open addressing with linear probing. Removal shifts the following entries
+// back instead of leaving tombstones, so lookups never degrade over time.
+
+static inline u32 chunkMapHash(IVec3 chunkId)
+{
+    u32 h = (u32)chunkId.x*73856093u ^ (u32)chunkId.y*19349663u ^ (u32)chunkId.z*83492791u;
+    // murmur3 finalizer, the raw xor has poor low bits for neighbouring chunks
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline b32 chunkIdEquals(IVec3 a, IVec3 b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+void chunkMapClear(ChunkMap *map)
+{
+    memset(map->entries, 0, sizeof(map->entries));
+    map->count = 0;
+}
+
+u32 chunkMapFind(ChunkMap *map, IVec3 chunkId)
+{
+    u32 slot = chunkMapHash(chunkId) & (CHUNK_MAP_CAPACITY-1);
+    while(map->entries[slot].used)
+    {
+        if(chunkIdEquals(map->entries[slot].chunkId, chunkId))
+            return map->entries[slot].chunkIndex;
+        slot = (slot+1) & (CHUNK_MAP_CAPACITY-1);
+    }
+    return CHUNK_MAP_INVALID;
+}
+
+b32 chunkMapInsert(ChunkMap *map, IVec3 chunkId, u32 chunkIndex)
+{
+    u32 slot = chunkMapHash(chunkId) & (CHUNK_MAP_CAPACITY-1);
+    while(map->entries[slot].used)
+    {
+        if(chunkIdEquals(map->entries[slot].chunkId, chunkId))
+        {
+            map->entries[slot].chunkIndex = chunkIndex;
+            return true;
+        }
+        slot = (slot+1) & (CHUNK_MAP_CAPACITY-1);
+    }
+    // keep at least one free slot or lookups of missing keys never terminate
+    if(map->count+1 >= CHUNK_MAP_CAPACITY)
+    {
+        assert(false);
+        return false;
+    }
+    map->entries[slot].chunkId = chunkId;
+    map->entries[slot].chunkIndex = chunkIndex;
+    map->entries[slot].used = true;
+    map->count++;
+    return true;
+}
+
+b32 chunkMapRemove(ChunkMap *map, IVec3 chunkId)
+{
+    u32 mask = CHUNK_MAP_CAPACITY-1;
+    u32 slot = chunkMapHash(chunkId) & mask;
+    while(map->entries[slot].used)
+    {
+        if(chunkIdEquals(map->entries[slot].chunkId, chunkId))
+            break;
+        slot = (slot+1) & mask;
+    }
+    if(!map->entries[slot].used)
+        return false;
+
+    // backward shift: pull every following entry of the cluster that is not
+    // already at its home position into the hole
+    u32 hole = slot;
+    u32 next = (hole+1) & mask;
+    while(map->entries[next].used)
+    {
+        u32 home = chunkMapHash(map->entries[next].chunkId) & mask;
+        // distance from home to next vs. home to hole (both wrapped)
+        if(((next-home) & mask) >= ((next-hole) & mask))
+        {
+            map->entries[hole] = map->entries[next];
+            hole = next;
+        }
+        next = (next+1) & mask;
+    }
+    map->entries[hole].used = false;
+    map->count--;
+    return true;
+}
+
+// forgets empty chunks outside of [keepMin, keepMax], returns how many
+u32 chunkMapRemoveEmpty(ChunkMap *map, IVec3 keepMin, IVec3 keepMax)
+{
+    u32 removed = 0;
+    for(u32 slot = 0; slot < CHUNK_MAP_CAPACITY; )
+    {
+        ChunkMapEntry *entry = &map->entries[slot];
+        IVec3 id = entry->chunkId;
+        if(entry->used && entry->chunkIndex == CHUNK_MAP_EMPTY
+                && (id.x < keepMin.x || id.y < keepMin.y || id.z < keepMin.z
+                    || id.x > keepMax.x || id.y > keepMax.y || id.z > keepMax.z))
+        {
+            // removal can shift another entry into this slot, look at it again
+            chunkMapRemove(map, id);
+            removed++;
+            continue;
+        }
+        slot++;
+    }
+    return removed;
+}
@@ -0,0 +1,1020 @@
+#include "core.h"
+
+#include <math.h>
+#include <time.h>
+
+// Chunk streaming scheduler.
+//
+// Unloaded chunks around the camera sit in a max-heap ranked by
+// calculatePriority(). Loaded chunks of each LOD sit in two heaps, one
+// giving the lowest priority chunk (eviction/demotion candidate) and one the
+// highest (promotion candidate). Heap keys are only recomputed when the
+// camera crosses a chunk boundary, in between jobs push and pop single
+// entries. Entries are invalidated lazily: every loaded chunk has a version
+// that is bumped when it changes LOD or coordinate, stale entries are
+// dropped when they reach the top of a heap or when the keys are recomputed.
+// Keys are recomputed in place, the heaps are only built from scratch at the
+// start, when a queue overflowed or when the search box has to grow.
+//
+// Jobs only submit generations (see terrain_generator.c), so the number of
+// jobs per frame is limited by free generation slots as well as the budget.
+//
+// Candidates are searched in a box of horizontal rings and CHUNK_VERTICAL_RING
+// layers above and below the camera. A chunk whose generation finds no surface
+// is unloaded and stays in the chunk map as empty, so slots only go to chunks
+// with something to draw. Candidates that terrainGenClassify() proves empty
+// go straight into the map that way, without taking a slot or a generation.
+// Empty entries are forgotten once they leave the box. When the camera
+// crosses a chunk boundary the box moves along, only the cells it uncovers
+// are classified and only the ones it leaves behind are forgotten.
+//
+// LOD swaps and replacements need the more important chunk to beat the other
+// one by CHUNK_LOD_HYSTERESIS, plus a margin for the measured cost of
+// regenerating both, and both chunks need to have kept their LOD for
+// CHUNK_MIN_RESIDENCY_FRAMES. A camera hovering at a boundary doesn't make
+// the same pair swap back and forth every frame.
+//
+// Priorities come from a ChunkStreamView: the camera's velocity is tracked
+// and chunks along the path it's predicted to take are ranked as if they were
+// close, chunks in view get CHUNK_FRUSTUM_MULTIPLIER on top. Keys are
+// recomputed in place when the prediction moves to another chunk or the
+// camera turns, nothing is rescanned or classified again for it.
+//
+// Residency is limited by GPU memory, not chunk counts. The mesh sizes the
+// generations actually produced are summed every frame, a chunk is only
+// added if the projected use stays within the budget and the least important
+// chunks are evicted when it's exceeded. The average mesh size per LOD scales
+// all rings down together so the budget is spread over every LOD instead of
+// the high detail ones taking it all, MAX_LOD_*_LOADED_CHUNKS are upper bounds.
+//
+// Edits (new tunnels) don't touch the other heaps. The loaded chunks they
+// reach go into dirtyQueue once, however many edits hit them before they are
+// regenerated, and are regenerated before any other job runs.
+
+// a loaded chunk is in dirtyQueue at most once with its current version, once
+// the stale entries are dropped there is always room for every loaded chunk
+#if CHUNK_QUEUE_CAPACITY < MAX_LOADED_CHUNKS
+#error "dirtyQueue can't hold every loaded chunk"
+#endif
+
+static r32 schedulerElapsedMs(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start->tv_sec)*1000.0f+(now.tv_nsec-start->tv_nsec)/1000000.0f;
+}
+
+static void chunkQueueSiftUp(ChunkQueue *queue, u32 index)
+{
+    ChunkQueueEntry entry = queue->entries[index];
+    while(index > 0)
+    {
+        u32 parent = (index-1)/2;
+        if(queue->entries[parent].key >= entry.key)
+            break;
+        queue->entries[index] = queue->entries[parent];
+        index = parent;
+    }
+    queue->entries[index] = entry;
+}
+
+static void chunkQueueSiftDown(ChunkQueue *queue, u32 index)
+{
+    ChunkQueueEntry entry = queue->entries[index];
+    for(;;)
+    {
+        u32 child = index*2+1;
+        if(child >= queue->count)
+            break;
+        if(child+1 < queue->count && queue->entries[child+1].key > queue->entries[child].key)
+            child++;
+        if(entry.key >= queue->entries[child].key)
+            break;
+        queue->entries[index] = queue->entries[child];
+        index = child;
+    }
+    queue->entries[index] = entry;
+}
+
+b32 chunkQueuePush(ChunkQueue *queue, ChunkQueueEntry entry)
+{
+    if(queue->count >= CHUNK_QUEUE_CAPACITY)
+        return false;
+    queue->entries[queue->count] = entry;
+    chunkQueueSiftUp(queue, queue->count);
+    queue->count++;
+    return true;
+}
+
+ChunkQueueEntry chunkQueuePop(ChunkQueue *queue)
+{
+    assert(queue->count > 0);
+    ChunkQueueEntry ret = queue->entries[0];
+    queue->count--;
+    if(queue->count > 0)
+    {
+        queue->entries[0] = queue->entries[queue->count];
+        chunkQueueSiftDown(queue, 0);
+    }
+    return ret;
+}
+
+// restore heap order after entries were written directly
+static void chunkQueueHeapify(ChunkQueue *queue)
+{
+    if(queue->count < 2)
+        return;
+    for(i32 i = (i32)queue->count/2-1; i >= 0; i--)
+        chunkQueueSiftDown(queue, (u32)i);
+}
+
+static Vec3 schedulerChunkCenter(IVec3 chunkId)
+{
+    Vec3 toMiddle = vec3(CHUNK_SIZE/2,CHUNK_SIZE/2,CHUNK_SIZE/2);
+    Vec3 chunkOrigin = getChunkOrigin(chunkId);
+    vec3Add(&chunkOrigin, &chunkOrigin, &toMiddle);
+    return chunkOrigin;
+}
+
+r32 chunkPriority(IVec3 chunkId, ChunkStreamView *view)
+{
+    Vec3 center = schedulerChunkCenter(chunkId);
+    return calculatePriority(&center, view);
+}
+
+// cone around the look direction that contains the whole frustum
+static void schedulerViewFromCamera(ChunkStreamView *view, Camera *cam)
+{
+    view->position = cam->position;
+    view->forward = cameraCalculateForwardDirection(cam);
+    r32 halfFov = cam->FOV*0.5f*PI/180.0f;
+    view->halfAngle = atanf(tanf(halfFov)*sqrtf(1.0f + cam->aspectRatio*cam->aspectRatio));
+}
+
+// velocity is taken from the camera movement, the predicted position is where
+// the camera ends up if it keeps going for CHUNK_PREFETCH_SECONDS
+static void schedulerUpdateView(ChunkScheduler *sched, Camera *cam, r32 dt)
+{
+    ChunkStreamView *view = &sched->view;
+    Vec3 moved;
+    vec3Sub(&moved, &cam->position, &view->position);
+    sched->cameraMoved = moved.x != 0.0f || moved.y != 0.0f || moved.z != 0.0f;
+    if(sched->frame == 0 || dt <= 0.0f || vec3Mag(&moved) > CHUNK_PREFETCH_MAX_DISTANCE)
+    {
+        view->velocity = vec3(0.0f, 0.0f, 0.0f);
+    }
+    else
+    {
+        Vec3 velocity;
+        vec3Scale(&velocity, &moved, 0.1f/dt);
+        vec3Scale(&view->velocity, &view->velocity, 0.9f);
+        vec3Add(&view->velocity, &view->velocity, &velocity);
+    }
+    schedulerViewFromCamera(view, cam);
+
+    Vec3 ahead;
+    vec3Scale(&ahead, &view->velocity, CHUNK_PREFETCH_SECONDS);
+    r32 aheadLength = vec3Mag(&ahead);
+    if(aheadLength > CHUNK_PREFETCH_MAX_DISTANCE)
+        vec3Scale(&ahead, &ahead, CHUNK_PREFETCH_MAX_DISTANCE/aheadLength);
+    vec3Add(&view->predicted, &view->position, &ahead);
+}
+
+// the heap keys depend on the view, they need recomputing once the prediction
+// ends up in another chunk or the camera turned away
+static b32 schedulerViewChanged(ChunkScheduler *sched)
+{
+    ChunkStreamView *view = &sched->view;
+    ChunkStreamView *old = &sched->rebuildView;
+    IVec3 predictedChunk = getChunkId(view->predicted);
+    IVec3 oldPredictedChunk = getChunkId(old->predicted);
+    return predictedChunk.x != oldPredictedChunk.x || predictedChunk.y != oldPredictedChunk.y
+            || predictedChunk.z != oldPredictedChunk.z
+            || vec3Dot(&view->forward, &old->forward) < CHUNK_VIEW_REKEY_COS;
+}
+
+// chunk changed LOD or coordinate, entries pushed before are stale now
+static void schedulerTouch(ChunkScheduler *sched, u32 chunkIndex)
+{
+    sched->chunkVersion[chunkIndex]++;
+    sched->residentSince[chunkIndex] = sched->frame;
+    // any regeneration picks up the edits made so far
+    sched->chunkDirty[chunkIndex] = false;
+}
+
+static b32 schedulerIsSettled(ChunkScheduler *sched, u32 chunkIndex)
+{
+    return sched->frame - sched->residentSince[chunkIndex] >= CHUNK_MIN_RESIDENCY_FRAMES;
+}
+
+// priority ratio a swap needs, regenerating expensive LODs needs a bigger gain
+static r32 schedulerRequiredGain(Permanent_Storage *state, r32 costMs)
+{
+    return CHUNK_LOD_HYSTERESIS + CHUNK_LOD_COST_WEIGHT*costMs/state->game.scheduler.frameBudgetMs;
+}
+
+static void schedulerCountAvoided(ChunkScheduler *sched, u32 kind, IVec3 a, IVec3 b, u32 regens)
+{
+    IVec3 *last = sched->rejected[kind];
+    if(last[0].x == a.x && last[0].y == a.y && last[0].z == a.z
+            && last[1].x == b.x && last[1].y == b.y && last[1].z == b.z)
+        return;
+    last[0] = a;
+    last[1] = b;
+    sched->avoidedRegens += regens;
+}
+
+static void schedulerPushLoaded(ChunkScheduler *sched, TerrainChunk *chunk, u32 chunkIndex, r32 priority)
+{
+    ChunkQueueEntry entry;
+    entry.chunkIndex = chunkIndex;
+    entry.version = sched->chunkVersion[chunkIndex];
+    entry.chunkId = chunk->chunkCoordinate;
+
+    entry.key = -priority;
+    if(!chunkQueuePush(&sched->lowQueue[chunk->LODLevel], entry))
+        sched->needsRebuild = true;
+    entry.key = priority;
+    if(!chunkQueuePush(&sched->highQueue[chunk->LODLevel], entry))
+        sched->needsRebuild = true;
+}
+
+static void schedulerPushCandidate(ChunkScheduler *sched, IVec3 chunkId, r32 priority)
+{
+    ChunkQueueEntry entry;
+    entry.key = priority;
+    entry.chunkIndex = CHUNK_MAP_INVALID;
+    entry.version = 0;
+    entry.chunkId = chunkId;
+    // full queue just means the candidate is far away, it will be picked
+    // up again on the next rebuild
+    chunkQueuePush(&sched->loadQueue, entry);
+}
+
+// loaded chunks end up filling a disc around the camera, the candidate
+// square needs to cover its radius (and minRing) plus one extra ring of
+// candidates to replace the farthest chunks with
+static i32 schedulerSearchRing(ChunkScheduler *sched, i32 minRing)
+{
+    i32 ring = 1;
+    u32 limit = sched->lodLimit[1] + sched->lodLimit[2] + sched->lodLimit[3];
+    while(PI*ring*ring < limit)
+        ring++;
+    ring = max(ring, minRing);
+    ring++;
+    i32 layers = 2*CHUNK_VERTICAL_RING+1;
+    while((2*ring+1)*(2*ring+1)*layers > CHUNK_QUEUE_CAPACITY)
+        ring--;
+    return ring;
+}
+
+static void schedulerSearchBox(ChunkScheduler *sched, IVec3 *boxMin, IVec3 *boxMax)
+{
+    *boxMin = sched->cameraChunk;
+    boxMin->x -= sched->searchRing;
+    boxMin->y -= CHUNK_VERTICAL_RING;
+    boxMin->z -= sched->searchRing;
+    *boxMax = sched->cameraChunk;
+    boxMax->x += sched->searchRing;
+    boxMax->y += CHUNK_VERTICAL_RING;
+    boxMax->z += sched->searchRing;
+}
+
+static b32 schedulerInBox(IVec3 chunkId, IVec3 boxMin, IVec3 boxMax)
+{
+    return chunkId.x >= boxMin.x && chunkId.y >= boxMin.y && chunkId.z >= boxMin.z
+            && chunkId.x <= boxMax.x && chunkId.y <= boxMax.y && chunkId.z <= boxMax.z;
+}
+
+// calls visit for the cells of [boxMin, boxMax] outside of [skipMin, skipMax],
+// columns inside the skipped box jump over its layers
+static void schedulerVisitBoxDifference(Permanent_Storage *state, IVec3 boxMin, IVec3 boxMax, IVec3 skipMin, IVec3 skipMax,
+                                        void (*visit)(Permanent_Storage *state, IVec3 chunkId))
+{
+    for(i32 x = boxMin.x; x <= boxMax.x; x++)
+    {
+        for(i32 z = boxMin.z; z <= boxMax.z; z++)
+        {
+            b32 skipColumn = x >= skipMin.x && x <= skipMax.x && z >= skipMin.z && z <= skipMax.z;
+            for(i32 y = boxMin.y; y <= boxMax.y; y++)
+            {
+                if(skipColumn && y >= skipMin.y && y <= skipMax.y)
+                {
+                    y = skipMax.y;
+                    continue;
+                }
+                IVec3 chunkId;
+                chunkId.x = x;
+                chunkId.y = y;
+                chunkId.z = z;
+                visit(state, chunkId);
+            }
+        }
+    }
+}
+
+// a cell the search box uncovered, the classifier decides if it's a candidate
+static void schedulerAddCell(Permanent_Storage *state, IVec3 chunkId)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    if(chunkMapFind(&state->game.chunkMap, chunkId) != CHUNK_MAP_INVALID)
+        return;
+    if(terrainGenClassify(&state->terrainGenState, chunkId) != VoxelChunkClass_Surface)
+    {
+        chunkMapInsert(&state->game.chunkMap, chunkId, CHUNK_MAP_EMPTY);
+        return;
+    }
+    schedulerPushCandidate(sched, chunkId, chunkPriority(chunkId, &sched->view));
+}
+
+// a cell the search box left behind, empty chunks are forgotten
+static void schedulerForgetCell(Permanent_Storage *state, IVec3 chunkId)
+{
+    if(chunkMapFind(&state->game.chunkMap, chunkId) == CHUNK_MAP_EMPTY)
+        chunkMapRemove(&state->game.chunkMap, chunkId);
+}
+
+// drops the entries of a loaded chunk queue whose chunk changed since
+static void schedulerCompactLoaded(ChunkScheduler *sched, ChunkQueue *queue)
+{
+    u32 kept = 0;
+    for(u32 i = 0; i < queue->count; i++)
+    {
+        if(queue->entries[i].version == sched->chunkVersion[queue->entries[i].chunkIndex])
+            queue->entries[kept++] = queue->entries[i];
+    }
+    queue->count = kept;
+    chunkQueueHeapify(queue);
+}
+
+// recomputes the keys of a loaded chunk queue with the current view, stale
+// entries are dropped on the way
+static void schedulerRekeyLoaded(ChunkScheduler *sched, ChunkQueue *queue, r32 sign)
+{
+    u32 kept = 0;
+    for(u32 i = 0; i < queue->count; i++)
+    {
+        ChunkQueueEntry entry = queue->entries[i];
+        if(entry.version != sched->chunkVersion[entry.chunkIndex])
+            continue;
+        entry.key = sign*chunkPriority(entry.chunkId, &sched->view);
+        queue->entries[kept++] = entry;
+    }
+    queue->count = kept;
+    chunkQueueHeapify(queue);
+}
+
+// Recomputes every heap key with the current view, without looking for new
+// candidates. Candidates that were loaded, found empty or left the search
+// box are dropped.
+static void schedulerRekey(Permanent_Storage *state)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    IVec3 boxMin, boxMax;
+    schedulerSearchBox(sched, &boxMin, &boxMax);
+    ChunkQueue *queue = &sched->loadQueue;
+    u32 kept = 0;
+    for(u32 i = 0; i < queue->count; i++)
+    {
+        ChunkQueueEntry entry = queue->entries[i];
+        if(!schedulerInBox(entry.chunkId, boxMin, boxMax)
+                || chunkMapFind(&state->game.chunkMap, entry.chunkId) != CHUNK_MAP_INVALID)
+            continue;
+        entry.key = chunkPriority(entry.chunkId, &sched->view);
+        queue->entries[kept++] = entry;
+    }
+    queue->count = kept;
+    chunkQueueHeapify(queue);
+
+    for(u32 lod = 0; lod < 4; lod++)
+    {
+        schedulerRekeyLoaded(sched, &sched->lowQueue[lod], -1.0f);
+        schedulerRekeyLoaded(sched, &sched->highQueue[lod], 1.0f);
+    }
+    schedulerRekeyLoaded(sched, &sched->dirtyQueue, 1.0f);
+
+    sched->rebuildView = sched->view;
+    sched->rekeys++;
+}
+
+// The camera moved to another chunk, the search box follows it. Cells it
+// uncovers become candidates or empty entries, empty entries it leaves
+// behind are forgotten and the keys of everything else are recomputed.
+static void schedulerShift(Permanent_Storage *state, IVec3 currentChunk)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    IVec3 oldMin, oldMax, newMin, newMax;
+    schedulerSearchBox(sched, &oldMin, &oldMax);
+    sched->cameraChunk = currentChunk;
+    schedulerSearchBox(sched, &newMin, &newMax);
+
+    schedulerVisitBoxDifference(state, oldMin, oldMax, newMin, newMax, schedulerForgetCell);
+    schedulerRekey(state);
+    schedulerVisitBoxDifference(state, newMin, newMax, oldMin, oldMax, schedulerAddCell);
+    sched->shifts++;
+}
+
+static void schedulerRebuild(Permanent_Storage *state, Camera *cam)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    IVec3 currentChunk = getChunkId(cam->position);
+
+    i32 ring = schedulerSearchRing(sched, getHighestChunkRing(state, cam));
+    sched->searchRing = ring;
+
+    IVec3 keepMin = currentChunk;
+    keepMin.x -= ring;
+    keepMin.y -= CHUNK_VERTICAL_RING;
+    keepMin.z -= ring;
+    IVec3 keepMax = currentChunk;
+    keepMax.x += ring;
+    keepMax.y += CHUNK_VERTICAL_RING;
+    keepMax.z += ring;
+    chunkMapRemoveEmpty(&state->game.chunkMap, keepMin, keepMax);
+
+    // only chunks the map knows nothing about, loaded and empty ones are skipped
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    sched->loadQueue.count = 0;
+    for(i32 i = -ring; i <= ring; i++)
+    {
+        for(i32 j = -ring; j <= ring; j++)
+        {
+            for(i32 k = -CHUNK_VERTICAL_RING; k <= CHUNK_VERTICAL_RING; k++)
+            {
+                IVec3 searchChunk = currentChunk;
+                searchChunk.x += i;
+                searchChunk.y += k;
+                searchChunk.z += j;
+                if(chunkMapFind(&state->game.chunkMap, searchChunk) != CHUNK_MAP_INVALID)
+                    continue;
+                if(terrainGenClassify(tgstate, searchChunk) != VoxelChunkClass_Surface)
+                {
+                    chunkMapInsert(&state->game.chunkMap, searchChunk, CHUNK_MAP_EMPTY);
+                    continue;
+                }
+                ChunkQueueEntry *entry = &sched->loadQueue.entries[sched->loadQueue.count++];
+                entry->key = chunkPriority(searchChunk, &sched->view);
+                entry->chunkIndex = CHUNK_MAP_INVALID;
+                entry->version = 0;
+                entry->chunkId = searchChunk;
+            }
+        }
+    }
+    chunkQueueHeapify(&sched->loadQueue);
+
+    for(u32 lod = 0; lod < 4; lod++)
+    {
+        sched->lowQueue[lod].count = 0;
+        sched->highQueue[lod].count = 0;
+    }
+    TerrainChunk *chunks = state->game.loadedChunks;
+    for(u32 i = 0; i < state->game.totalLoadedChunkCount; i++)
+    {
+        if(!chunks[i].isAllocate)
+            continue;
+        u32 lod = chunks[i].LODLevel;
+        r32 priority = chunkPriority(chunks[i].chunkCoordinate, &sched->view);
+
+        ChunkQueueEntry entry;
+        entry.chunkIndex = i;
+        entry.version = sched->chunkVersion[i];
+        entry.chunkId = chunks[i].chunkCoordinate;
+        entry.key = -priority;
+        sched->lowQueue[lod].entries[sched->lowQueue[lod].count++] = entry;
+        entry.key = priority;
+        sched->highQueue[lod].entries[sched->highQueue[lod].count++] = entry;
+    }
+    for(u32 lod = 0; lod < 4; lod++)
+    {
+        chunkQueueHeapify(&sched->lowQueue[lod]);
+        chunkQueueHeapify(&sched->highQueue[lod]);
+    }
+
+    sched->cameraChunk = currentChunk;
+    sched->rebuildView = sched->view;
+    sched->needsRebuild = false;
+    sched->rebuilds++;
+}
+
+// drop entries whose chunk changed since they were pushed, returns 0 if empty
+static ChunkQueueEntry* schedulerPeekLoaded(ChunkScheduler *sched, ChunkQueue *queue)
+{
+    while(queue->count > 0)
+    {
+        ChunkQueueEntry *top = &queue->entries[0];
+        if(top->version == sched->chunkVersion[top->chunkIndex])
+            return top;
+        chunkQueuePop(queue);
+    }
+    return 0;
+}
+
+static ChunkQueueEntry* schedulerPeekCandidate(Permanent_Storage *state)
+{
+    ChunkQueue *queue = &state->game.scheduler.loadQueue;
+    while(queue->count > 0)
+    {
+        ChunkQueueEntry *top = &queue->entries[0];
+        if(chunkMapFind(&state->game.chunkMap, top->chunkId) == CHUNK_MAP_INVALID)
+            return top;
+        chunkQueuePop(queue);
+    }
+    return 0;
+}
+
+static u32 schedulerLodCapacity(u32 lod)
+{
+    switch(lod)
+    {
+        case 3: return MAX_LOD_3_LOADED_CHUNKS;
+        case 2: return MAX_LOD_2_LOADED_CHUNKS;
+        case 1: return MAX_LOD_1_LOADED_CHUNKS;
+        default: return 0;
+    }
+}
+
+static u64 schedulerMeshBytes(TerrainChunk *chunk)
+{
+    if(!chunk->meshAlloc.valid)
+        return 0;
+    return chunk->meshAlloc.vertexCount*sizeof(VertexOut) + chunk->meshAlloc.triangleCount*sizeof(TriangleOut);
+}
+
+// Sums the meshes of the loaded chunks and works out how large the rings can
+// be. Shrinking happens right away, growing back is rate limited so a ring
+// doesn't pulse while the averages settle.
+static void schedulerMeasureMemory(Permanent_Storage *state, r32 dt)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    u64 bytes[4] = {0};
+    u32 meshed[4] = {0};
+    u32 pending[4] = {0};
+    TerrainChunk *chunks = state->game.loadedChunks;
+    for(u32 i = 0; i < state->game.totalLoadedChunkCount; i++)
+    {
+        if(!chunks[i].isAllocate)
+            continue;
+        u32 lod = chunks[i].LODLevel;
+        if(chunks[i].meshAlloc.valid)
+        {
+            bytes[lod] += schedulerMeshBytes(&chunks[i]);
+            meshed[lod]++;
+        }
+        else if(!chunks[i].isEmpty)
+        {
+            pending[lod]++;
+        }
+    }
+
+    sched->residentBytes = 0;
+    sched->projectedBytes = 0;
+    u64 fullBytes = 0;
+    for(u32 lod = 1; lod <= 3; lod++)
+    {
+        if(meshed[lod] > 0)
+            sched->chunkBytes[lod] = bytes[lod]/meshed[lod];
+        sched->residentBytes += bytes[lod];
+        sched->projectedBytes += bytes[lod] + pending[lod]*sched->chunkBytes[lod];
+        fullBytes += schedulerLodCapacity(lod)*sched->chunkBytes[lod];
+    }
+
+    r32 target = 1.0f;
+    if(fullBytes > 0)
+        target = minf(1.0f, (r32)((r64)sched->vramBudget*CHUNK_BUDGET_FILL/fullBytes));
+    if(target < sched->budgetScale)
+        sched->budgetScale = target;
+    else
+        sched->budgetScale = minf(target, sched->budgetScale + CHUNK_BUDGET_GROW_RATE*dt);
+    for(u32 lod = 1; lod <= 3; lod++)
+        sched->lodLimit[lod] = max(1, (u32)(schedulerLodCapacity(lod)*sched->budgetScale));
+}
+
+// a new chunk of the LOD fits the ring and the budget
+static b32 schedulerHasRoom(Permanent_Storage *state, u32 lod)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    return state->game.loadedChunkCount[lod] < sched->lodLimit[lod]
+            && sched->projectedBytes + sched->chunkBytes[lod] <= (u64)(sched->vramBudget*CHUNK_BUDGET_FILL);
+}
+
+// unloads the least important chunk of the LOD, it goes back to the candidates
+static b32 schedulerEvict(Permanent_Storage *state, u32 lod)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    if(!schedulerPeekLoaded(sched, &sched->lowQueue[lod]))
+        return false;
+    ChunkQueueEntry lowest = chunkQueuePop(&sched->lowQueue[lod]);
+    TerrainChunk *chunk = &state->game.loadedChunks[lowest.chunkIndex];
+    u64 bytes = schedulerMeshBytes(chunk);
+    sched->residentBytes -= bytes;
+    sched->projectedBytes -= chunk->meshAlloc.valid ? bytes : min(sched->chunkBytes[lod], sched->projectedBytes);
+    unloadChunk(state, chunk);
+    schedulerTouch(sched, lowest.chunkIndex);
+    schedulerPushCandidate(sched, lowest.chunkId, chunkPriority(lowest.chunkId, &sched->view));
+    sched->budgetEvictions++;
+    return true;
+}
+
+// does a single load, replace or LOD swap, returns false if there was nothing to do
+static b32 schedulerRunJob(Permanent_Storage *state)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+
+    // regenerate chunks an edit touched, before anything else so the edit shows up
+    if(schedulerPeekLoaded(sched, &sched->dirtyQueue))
+    {
+        ChunkQueueEntry dirty = chunkQueuePop(&sched->dirtyQueue);
+        TerrainChunk *chunk = &state->game.loadedChunks[dirty.chunkIndex];
+        reloadChunk(state, chunk->origin, chunk, chunk->LODLevel);
+        schedulerTouch(sched, dirty.chunkIndex);
+        schedulerPushLoaded(sched, chunk, dirty.chunkIndex, chunkPriority(chunk->chunkCoordinate, &sched->view));
+        return true;
+    }
+
+    // over budget or a ring shrank, the farthest rings give up chunks first.
+    // Fill stops short of the budget so it doesn't bring them right back
+    for(u32 lod = 1; lod <= 3; lod++)
+    {
+        if(state->game.loadedChunkCount[lod] > sched->lodLimit[lod] && schedulerEvict(state, lod))
+            return true;
+    }
+    if(sched->residentBytes > sched->vramBudget)
+    {
+        for(u32 lod = 1; lod <= 3; lod++)
+        {
+            if(schedulerEvict(state, lod))
+                return true;
+        }
+    }
+
+    // fill free slots, highest detail first so the closest chunks get it
+    for(u32 lod = 3; lod >= 1; lod--)
+    {
+        if(!schedulerHasRoom(state, lod))
+            continue;
+        if(!schedulerPeekCandidate(state))
+            return false;
+        ChunkQueueEntry candidate = chunkQueuePop(&sched->loadQueue);
+        TerrainChunk *chunk = loadChunk(state, candidate.chunkId, lod);
+        u32 chunkIndex = (u32)(chunk - state->game.loadedChunks);
+        schedulerTouch(sched, chunkIndex);
+        schedulerPushLoaded(sched, chunk, chunkIndex, chunkPriority(candidate.chunkId, &sched->view));
+        sched->projectedBytes += sched->chunkBytes[lod];
+        return true;
+    }
+
+    // move the least important LOD 1 chunk to the most important unloaded spot
+    ChunkQueueEntry *candidateTop = schedulerPeekCandidate(state);
+    ChunkQueueEntry *lowestTop = schedulerPeekLoaded(sched, &sched->lowQueue[1]);
+    if(candidateTop && lowestTop)
+    {
+        r32 candidatePriority = chunkPriority(candidateTop->chunkId, &sched->view);
+        r32 lowestPriority = chunkPriority(lowestTop->chunkId, &sched->view);
+        r32 required = schedulerRequiredGain(state, state->terrainGenState.lodCostMs[1]);
+        if(lowestPriority < candidatePriority && candidatePriority < lowestPriority*required)
+            schedulerCountAvoided(sched, 0, lowestTop->chunkId, candidateTop->chunkId, 1);
+        if(candidatePriority >= lowestPriority*required && schedulerIsSettled(sched, lowestTop->chunkIndex))
+        {
+            ChunkQueueEntry candidate = chunkQueuePop(&sched->loadQueue);
+            ChunkQueueEntry lowest = chunkQueuePop(&sched->lowQueue[1]);
+            TerrainChunk *chunk = &state->game.loadedChunks[lowest.chunkIndex];
+            reloadChunk(state, getChunkOrigin(candidate.chunkId), chunk, 1);
+            schedulerTouch(sched, lowest.chunkIndex);
+            sched->swaps++;
+            schedulerPushLoaded(sched, chunk, lowest.chunkIndex, candidatePriority);
+            schedulerPushCandidate(sched, lowest.chunkId, lowestPriority);
+            return true;
+        }
+    }
+
+    // swap LODs where a lower detail chunk is more important than a higher detail one
+    for(u32 lod = 1; lod < 3; lod++)
+    {
+        ChunkQueueEntry *highTop = schedulerPeekLoaded(sched, &sched->highQueue[lod]);
+        ChunkQueueEntry *lowTop = schedulerPeekLoaded(sched, &sched->lowQueue[lod+1]);
+        if(!highTop || !lowTop)
+            continue;
+        r32 highPriority = chunkPriority(highTop->chunkId, &sched->view);
+        r32 lowPriority = chunkPriority(lowTop->chunkId, &sched->view);
+        r32 *costMs = state->terrainGenState.lodCostMs;
+        r32 required = schedulerRequiredGain(state, costMs[lod]+costMs[lod+1]);
+        if(highPriority > lowPriority && highPriority < lowPriority*required)
+            schedulerCountAvoided(sched, lod, highTop->chunkId, lowTop->chunkId, 2);
+        if(highPriority >= lowPriority*required && schedulerIsSettled(sched, highTop->chunkIndex)
+                && schedulerIsSettled(sched, lowTop->chunkIndex))
+        {
+            ChunkQueueEntry high = chunkQueuePop(&sched->highQueue[lod]);
+            ChunkQueueEntry low = chunkQueuePop(&sched->lowQueue[lod+1]);
+            TerrainChunk *promoted = &state->game.loadedChunks[high.chunkIndex];
+            TerrainChunk *demoted = &state->game.loadedChunks[low.chunkIndex];
+            reloadChunk(state, promoted->origin, promoted, lod+1);
+            reloadChunk(state, demoted->origin, demoted, lod);
+            schedulerTouch(sched, high.chunkIndex);
+            schedulerTouch(sched, low.chunkIndex);
+            sched->swaps++;
+            schedulerPushLoaded(sched, promoted, high.chunkIndex, highPriority);
+            schedulerPushLoaded(sched, demoted, low.chunkIndex, lowPriority);
+            return true;
+        }
+    }
+    return false;
+}
+
+// number of candidates that should be resident but are not, found by only
+// descending into heap nodes above the threshold
+static u32 schedulerCountAbove(ChunkQueue *queue, u32 index, r32 threshold)
+{
+    if(index >= queue->count || queue->entries[index].key <= threshold)
+        return 0;
+    return 1 + schedulerCountAbove(queue, index*2+1, threshold)
+            + schedulerCountAbove(queue, index*2+2, threshold);
+}
+
+void chunkSchedulerInit(ChunkScheduler *sched, r32 frameBudgetMs)
+{
+    memset(sched, 0, sizeof(ChunkScheduler));
+    sched->frameBudgetMs = frameBudgetMs;
+    sched->needsRebuild = true;
+    sched->vramBudget = CHUNK_VRAM_BUDGET;
+    sched->budgetScale = 1.0f;
+    for(u32 lod = 1; lod <= 3; lod++)
+        sched->lodLimit[lod] = schedulerLodCapacity(lod);
+}
+
+void chunkSchedulerUpdate(Permanent_Storage *state, Camera *cam, r32 dt)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // chunks whose generation found no surface give their slot back, the
+    // candidate heap doesn't need a rebuild, the freed slot just gets filled
+    for(u32 i = 0; i < state->game.emptyChunkCount; i++)
+    {
+        u32 chunkIndex = state->game.emptyChunks[i];
+        TerrainChunk *chunk = &state->game.loadedChunks[chunkIndex];
+        // reloaded meanwhile
+        if(!chunk->isAllocate || !chunk->isEmpty)
+            continue;
+        unloadEmptyChunk(state, chunk);
+        schedulerTouch(sched, chunkIndex);
+        sched->emptyUnloads++;
+    }
+    state->game.emptyChunkCount = 0;
+
+    schedulerMeasureMemory(state, dt);
+    schedulerUpdateView(sched, cam, dt);
+    IVec3 currentChunk = getChunkId(cam->position);
+    b32 crossed = currentChunk.x != sched->cameraChunk.x || currentChunk.y != sched->cameraChunk.y
+            || currentChunk.z != sched->cameraChunk.z;
+    // the box only grows with a rebuild, a larger ring than needed just
+    // means more candidates. Empty entries of chunks that went empty outside
+    // the box are never left behind by it, a rebuild clears them out once the
+    // map holds more than a full box and the loaded chunks
+    if(sched->needsRebuild || (crossed && schedulerSearchRing(sched, 0) > sched->searchRing)
+            || state->game.chunkMap.count > CHUNK_MAP_CAPACITY*3/4)
+    {
+        schedulerRebuild(state, cam);
+    }
+    else if(crossed)
+    {
+        schedulerShift(state, currentChunk);
+    }
+    else if(schedulerViewChanged(sched))
+    {
+        // only the keys depend on the view, the box and classification stay
+        schedulerRekey(state);
+    }
+
+    // a job can submit up to two generations (LOD swap), the budget is only
+    // checked after a job so streaming can't stall on a slow frame
+    u32 jobs = 0;
+    b32 idle = false;
+    while(terrainGenFreeSlots(&state->terrainGenState) >= 2)
+    {
+        if(!schedulerRunJob(state))
+        {
+            idle = true;
+            break;
+        }
+        jobs++;
+        if(schedulerElapsedMs(&start) >= sched->frameBudgetMs)
+            break;
+    }
+
+    u32 freeSlots = 0;
+    for(u32 lod = 1; lod <= 3; lod++)
+    {
+        if(schedulerHasRoom(state, lod))
+            freeSlots += sched->lodLimit[lod] - state->game.loadedChunkCount[lod];
+    }
+    if(freeSlots > 0)
+    {
+        sched->backlog = min(freeSlots, sched->loadQueue.count);
+    }
+    else
+    {
+        ChunkQueueEntry *lowestTop = schedulerPeekLoaded(sched, &sched->lowQueue[1]);
+        r32 threshold = lowestTop ? chunkPriority(lowestTop->chunkId, &sched->view)
+                *schedulerRequiredGain(state, state->terrainGenState.lodCostMs[1]) : R32MAX;
+        sched->backlog = schedulerCountAbove(&sched->loadQueue, 0, threshold);
+    }
+
+    // keys go stale while the camera moves inside a chunk, once it stopped
+    // and there is nothing left to do they are recomputed, once per stop
+    if(sched->cameraMoved)
+    {
+        sched->rekeyedAtRest = false;
+    }
+    else if(idle && jobs == 0 && !sched->rekeyedAtRest)
+    {
+        schedulerRekey(state);
+        sched->rekeyedAtRest = true;
+    }
+
+    sched->jobsLastFrame = jobs;
+    sched->totalJobs += jobs;
+    sched->frame++;
+    sched->lastFrameMs = schedulerElapsedMs(&start);
+}
+
+static void schedulerInvalidateChunk(Permanent_Storage *state, IVec3 chunkId)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    u32 chunkIndex = chunkMapFind(&state->game.chunkMap, chunkId);
+    // not generated yet, it will be with the edit
+    if(chunkIndex == CHUNK_MAP_INVALID)
+        return;
+
+    r32 priority = chunkPriority(chunkId, &sched->view);
+    if(chunkIndex == CHUNK_MAP_EMPTY)
+    {
+        // a solid chunk gets a surface, an air chunk stays empty
+        if(terrainGenClassify(&state->terrainGenState, chunkId) == VoxelChunkClass_Surface)
+        {
+            chunkMapRemove(&state->game.chunkMap, chunkId);
+            schedulerPushCandidate(sched, chunkId, priority);
+            sched->editUncovered++;
+        }
+        return;
+    }
+    if(sched->chunkDirty[chunkIndex])
+        return;
+
+    ChunkQueueEntry entry;
+    entry.key = priority;
+    entry.chunkIndex = chunkIndex;
+    entry.version = sched->chunkVersion[chunkIndex];
+    entry.chunkId = chunkId;
+    // Stale entries of chunks that were regenerated meanwhile only leave the
+    // queue at its top, so it can fill up with them. Dropping them all makes
+    // room, if it still doesn't fit the chunk stays clean and the next edit
+    // tries again.
+    if(!chunkQueuePush(&sched->dirtyQueue, entry))
+    {
+        schedulerCompactLoaded(sched, &sched->dirtyQueue);
+        if(!chunkQueuePush(&sched->dirtyQueue, entry))
+        {
+            sched->editDrops++;
+            return;
+        }
+    }
+    sched->chunkDirty[chunkIndex] = true;
+    sched->editRegens++;
+}
+
+// Queues regeneration of the loaded chunks a new tunnel carves into and brings
+// back empty chunks it opens up. The tunnel is walked a chunk length at a
+// time and only the chunks around each piece are looked at, so an edit costs
+// work along the tunnel, not over everything that is loaded.
+void chunkSchedulerInvalidateTunnel(Permanent_Storage *state, Line3D *tunnel)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    Vec3 start = vec3FromVec4(tunnel->start);
+    Vec3 end = vec3FromVec4(tunnel->end);
+    Vec3 delta;
+    vec3Sub(&delta, &end, &start);
+    u32 pieces = (u32)(vec3Mag(&delta)/CHUNK_SIZE) + 1;
+    sched->edits++;
+
+    for(u32 piece = 0; piece < pieces; piece++)
+    {
+        Vec3 a, b;
+        vec3Scale(&a, &delta, (r32)piece/pieces);
+        vec3Add(&a, &a, &start);
+        vec3Scale(&b, &delta, (r32)(piece+1)/pieces);
+        vec3Add(&b, &b, &start);
+        // chunks sample the density past their cube, see VOXEL_CHUNK_REACH
+        r32 reach = VOXEL_TUNNEL_RADIUS + VOXEL_CHUNK_REACH;
+        IVec3 minChunk = getChunkId(vec3(minf(a.x, b.x) - reach, minf(a.y, b.y) - reach, minf(a.z, b.z) - reach));
+        IVec3 maxChunk = getChunkId(vec3(maxf(a.x, b.x) + reach, maxf(a.y, b.y) + reach, maxf(a.z, b.z) + reach));
+        // chunks shared with the previous piece are already dirty or no longer empty
+        for(i32 x = minChunk.x; x <= maxChunk.x; x++)
+        {
+            for(i32 y = minChunk.y; y <= maxChunk.y; y++)
+            {
+                for(i32 z = minChunk.z; z <= maxChunk.z; z++)
+                {
+                    IVec3 chunkId;
+                    chunkId.x = x;
+                    chunkId.y = y;
+                    chunkId.z = z;
+                    Vec3 origin = getChunkOrigin(chunkId);
+                    origin = vec3(origin.x - VOXEL_CHUNK_REACH, origin.y - VOXEL_CHUNK_REACH, origin.z - VOXEL_CHUNK_REACH);
+                    if(voxelTunnelTouchesBox(tunnel, origin, CHUNK_SIZE + 2.0f*VOXEL_CHUNK_REACH))
+                        schedulerInvalidateChunk(state, chunkId);
+                }
+            }
+        }
+    }
+}
+
+// Same for a brush edit of the voxels in [min, max]. Chunks sample their far
+// faces too, so a voxel on a chunk border is in both chunks.
+void chunkSchedulerInvalidateBox(Permanent_Storage *state, Vec3 min, Vec3 max)
+{
+    ChunkScheduler *sched = &state->game.scheduler;
+    sched->edits++;
+    IVec3 minChunk = getChunkId(vec3(min.x - 1.0f, min.y - 1.0f, min.z - 1.0f));
+    IVec3 maxChunk = getChunkId(max);
+    for(i32 x = minChunk.x; x <= maxChunk.x; x++)
+    {
+        for(i32 y = minChunk.y; y <= maxChunk.y; y++)
+        {
+            for(i32 z = minChunk.z; z <= maxChunk.z; z++)
+            {
+                IVec3 chunkId;
+                chunkId.x = x;
+                chunkId.y = y;
+                chunkId.z = z;
+                schedulerInvalidateChunk(state, chunkId);
+            }
+        }
+    }
+}
+
+// chunks in view and closer than viewDistance that have something to draw
+// but no mesh yet, unknown chunks count unless the classifier proves them empty
+u32 chunkSchedulerMissingOnScreen(Permanent_Storage *state, Camera *cam, r32 viewDistance, u32 *onScreen)
+{
+    ChunkStreamView view;
+    schedulerViewFromCamera(&view, cam);
+    IVec3 currentChunk = getChunkId(cam->position);
+    i32 ring = (i32)(viewDistance/CHUNK_SIZE) + 1;
+
+    u32 missing = 0;
+    *onScreen = 0;
+    for(i32 i = -ring; i <= ring; i++)
+    {
+        for(i32 j = -ring; j <= ring; j++)
+        {
+            for(i32 k = -CHUNK_VERTICAL_RING; k <= CHUNK_VERTICAL_RING; k++)
+            {
+                IVec3 chunkId = currentChunk;
+                chunkId.x += i;
+                chunkId.y += k;
+                chunkId.z += j;
+                Vec3 center = schedulerChunkCenter(chunkId);
+                Vec3 camToChunk;
+                vec3Sub(&camToChunk, &center, &cam->position);
+                if(vec3Mag(&camToChunk) > viewDistance || !chunkStreamViewContains(&view, &center))
+                    continue;
+
+                u32 chunkIndex = chunkMapFind(&state->game.chunkMap, chunkId);
+                if(chunkIndex == CHUNK_MAP_EMPTY)
+                    continue;
+                if(chunkIndex == CHUNK_MAP_INVALID)
+                {
+                    if(terrainGenClassify(&state->terrainGenState, chunkId) != VoxelChunkClass_Surface)
+                        continue;
+                    missing++;
+                }
+                else if(!state->game.loadedChunks[chunkIndex].entity.amesh.loadedToGPU)
+                {
+                    missing++;
+                }
+                (*onScreen)++;
+            }
+        }
+    }
+    return missing;
+}
+
+void chunkSchedulerPrintStats(ChunkScheduler *sched)
+{
+    printf("chunk scheduler: %u jobs in %.2fms (budget %.2fms), backlog %u, queue depth %u (lod1 %u lod2 %u lod3 %u), rebuilds %u, shifts %u, rekeys %u, empty unloads %u, swaps %u, avoided regenerations %u\n",
+           sched->jobsLastFrame, sched->lastFrameMs, sched->frameBudgetMs, sched->backlog,
+           sched->loadQueue.count, sched->lowQueue[1].count, sched->lowQueue[2].count, sched->lowQueue[3].count,
+           sched->rebuilds, sched->shifts, sched->rekeys, sched->emptyUnloads, sched->swaps, sched->avoidedRegens);
+    printf("chunk memory: %.1f/%.1fMB (%.1f%%), %.1fMB with generating chunks, rings at %.0f%% (lod1 %u/%u lod2 %u/%u lod3 %u/%u), "
+           "average chunk %.1f/%.1f/%.1fKB, %u budget evictions\n",
+           sched->residentBytes/(r64)Megabytes(1), sched->vramBudget/(r64)Megabytes(1),
+           sched->vramBudget ? 100.0*sched->residentBytes/sched->vramBudget : 0.0, sched->projectedBytes/(r64)Megabytes(1),
+           sched->budgetScale*100.0f, sched->lodLimit[1], MAX_LOD_1_LOADED_CHUNKS, sched->lodLimit[2], MAX_LOD_2_LOADED_CHUNKS,
+           sched->lodLimit[3], MAX_LOD_3_LOADED_CHUNKS, sched->chunkBytes[1]/1024.0, sched->chunkBytes[2]/1024.0,
+           sched->chunkBytes[3]/1024.0, sched->budgetEvictions);
+    if(sched->edits > 0)
+        printf("chunk edits: %u edits, %u chunk regenerations, %u empty chunks uncovered, %u waiting, %u dropped\n",
+               sched->edits, sched->editRegens, sched->editUncovered, sched->dirtyQueue.count, sched->editDrops);
+}
@@ -1,296 +1,15 @@
 #include "core.h"
 
 #include <stdio.h>
-//#include <math.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
-#include "opencl.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 //#include "stb_image.h"
 
 Mesh *domeMesh, *mesh, *terrainMesh, *vterrainMesh[100];
 
-int a2iTriangleConnectionTable2[256][16] =
-{
-    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 8, 3, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 2, 10, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 8, 3, 2, 10, 8, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-    {3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 11, 2, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 11, 2, 1, 9, 11, 9, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-    {3, 10, 1, 11, 10, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 10, 1, 0, 8, 10, 8, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-    {3, 9, 0, 3, 11, 9, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 3, 0, 7, 3, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 1, 9, 4, 7, 1, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 4, 7, 3, 0, 4, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1},
-    {9, 2, 10, 9, 0, 2, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-    {2, 10, 9, 2, 9, 7, 2, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-    {8, 4, 7, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 4, 7, 11, 2, 4, 2, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 1, 8, 4, 7, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-    {4, 7, 11, 9, 4, 11, 9, 11, 2, 9, 2, 1, -1, -1, -1, -1},
-    {3, 10, 1, 3, 11, 10, 7, 8, 4, -1, -1, -1, -1, -1, -1, -1},
-    {1, 11, 10, 1, 4, 11, 1, 0, 4, 7, 11, 4, -1, -1, -1, -1},
-    {4, 7, 8, 9, 0, 11, 9, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-    {4, 7, 11, 4, 11, 9, 9, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 5, 4, 1, 5, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 5, 4, 8, 3, 5, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 1, 2, 10, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-    {5, 2, 10, 5, 4, 2, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-    {2, 10, 5, 3, 2, 5, 3, 5, 4, 3, 4, 8, -1, -1, -1, -1},
-    {9, 5, 4, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 11, 2, 0, 8, 11, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-    {0, 5, 4, 0, 1, 5, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-    {2, 1, 5, 2, 5, 8, 2, 8, 11, 4, 8, 5, -1, -1, -1, -1},
-    {10, 3, 11, 10, 1, 3, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 5, 0, 8, 1, 8, 10, 1, 8, 11, 10, -1, -1, -1, -1},
-    {5, 4, 0, 5, 0, 11, 5, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-    {5, 4, 8, 5, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-    {9, 7, 8, 5, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 3, 0, 9, 5, 3, 5, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 7, 8, 0, 1, 7, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-    {1, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 7, 8, 9, 5, 7, 10, 1, 2, -1, -1, -1, -1, -1, -1, -1},
-    {10, 1, 2, 9, 5, 0, 5, 3, 0, 5, 7, 3, -1, -1, -1, -1},
-    {8, 0, 2, 8, 2, 5, 8, 5, 7, 10, 5, 2, -1, -1, -1, -1},
-    {2, 10, 5, 2, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-    {7, 9, 5, 7, 8, 9, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 7, 9, 7, 2, 9, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-    {2, 3, 11, 0, 1, 8, 1, 7, 8, 1, 5, 7, -1, -1, -1, -1},
-    {11, 2, 1, 11, 1, 7, 7, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 8, 8, 5, 7, 10, 1, 3, 10, 3, 11, -1, -1, -1, -1},
-    {5, 7, 0, 5, 0, 9, 7, 11, 0, 1, 0, 10, 11, 10, 0, -1},
-    {11, 10, 0, 11, 0, 3, 10, 5, 0, 8, 0, 7, 5, 7, 0, -1},
-    {11, 10, 5, 7, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 1, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 8, 3, 1, 9, 8, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 5, 2, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 5, 1, 2, 6, 3, 0, 8, -1, -1, -1, -1, -1, -1, -1},
-    {9, 6, 5, 9, 0, 6, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 9, 8, 5, 8, 2, 5, 2, 6, 3, 2, 8, -1, -1, -1, -1},
-    {2, 3, 11, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 0, 8, 11, 2, 0, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 1, 9, 2, 9, 11, 2, 9, 8, 11, -1, -1, -1, -1},
-    {6, 3, 11, 6, 5, 3, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 11, 0, 11, 5, 0, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-    {3, 11, 6, 0, 3, 6, 0, 6, 5, 0, 5, 9, -1, -1, -1, -1},
-    {6, 5, 9, 6, 9, 11, 11, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 3, 0, 4, 7, 3, 6, 5, 10, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 5, 10, 6, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-    {10, 6, 5, 1, 9, 7, 1, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-    {6, 1, 2, 6, 5, 1, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 5, 5, 2, 6, 3, 0, 4, 3, 4, 7, -1, -1, -1, -1},
-    {8, 4, 7, 9, 0, 5, 0, 6, 5, 0, 2, 6, -1, -1, -1, -1},
-    {7, 3, 9, 7, 9, 4, 3, 2, 9, 5, 9, 6, 2, 6, 9, -1},
-    {3, 11, 2, 7, 8, 4, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-    {5, 10, 6, 4, 7, 2, 4, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-    {0, 1, 9, 4, 7, 8, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1},
-    {9, 2, 1, 9, 11, 2, 9, 4, 11, 7, 11, 4, 5, 10, 6, -1},
-    {8, 4, 7, 3, 11, 5, 3, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-    {5, 1, 11, 5, 11, 6, 1, 0, 11, 7, 11, 4, 0, 4, 11, -1},
-    {0, 5, 9, 0, 6, 5, 0, 3, 6, 11, 6, 3, 8, 4, 7, -1},
-    {6, 5, 9, 6, 9, 11, 4, 7, 9, 7, 11, 9, -1, -1, -1, -1},
-    {10, 4, 9, 6, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 10, 6, 4, 9, 10, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1},
-    {10, 0, 1, 10, 6, 0, 6, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-    {8, 3, 1, 8, 1, 6, 8, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-    {1, 4, 9, 1, 2, 4, 2, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 1, 2, 9, 2, 4, 9, 2, 6, 4, -1, -1, -1, -1},
-    {0, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 3, 2, 8, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-    {10, 4, 9, 10, 6, 4, 11, 2, 3, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 2, 2, 8, 11, 4, 9, 10, 4, 10, 6, -1, -1, -1, -1},
-    {3, 11, 2, 0, 1, 6, 0, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-    {6, 4, 1, 6, 1, 10, 4, 8, 1, 2, 1, 11, 8, 11, 1, -1},
-    {9, 6, 4, 9, 3, 6, 9, 1, 3, 11, 6, 3, -1, -1, -1, -1},
-    {8, 11, 1, 8, 1, 0, 11, 6, 1, 9, 1, 4, 6, 4, 1, -1},
-    {3, 11, 6, 3, 6, 0, 0, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-    {6, 4, 8, 11, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 10, 6, 7, 8, 10, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-    {0, 7, 3, 0, 10, 7, 0, 9, 10, 6, 7, 10, -1, -1, -1, -1},
-    {10, 6, 7, 1, 10, 7, 1, 7, 8, 1, 8, 0, -1, -1, -1, -1},
-    {10, 6, 7, 10, 7, 1, 1, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 6, 1, 6, 8, 1, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-    {2, 6, 9, 2, 9, 1, 6, 7, 9, 0, 9, 3, 7, 3, 9, -1},
-    {7, 8, 0, 7, 0, 6, 6, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-    {7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 11, 10, 6, 8, 10, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-    {2, 0, 7, 2, 7, 11, 0, 9, 7, 6, 7, 10, 9, 10, 7, -1},
-    {1, 8, 0, 1, 7, 8, 1, 10, 7, 6, 7, 10, 2, 3, 11, -1},
-    {11, 2, 1, 11, 1, 7, 10, 6, 1, 6, 7, 1, -1, -1, -1, -1},
-    {8, 9, 6, 8, 6, 7, 9, 1, 6, 11, 6, 3, 1, 3, 6, -1},
-    {0, 9, 1, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 8, 0, 7, 0, 6, 3, 11, 0, 11, 6, 0, -1, -1, -1, -1},
-    {7, 11, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 8, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 9, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 1, 9, 8, 3, 1, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-    {10, 1, 2, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 3, 0, 8, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-    {2, 9, 0, 2, 10, 9, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-    {6, 11, 7, 2, 10, 3, 10, 8, 3, 10, 9, 8, -1, -1, -1, -1},
-    {7, 2, 3, 6, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {7, 0, 8, 7, 6, 0, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-    {2, 7, 6, 2, 3, 7, 0, 1, 9, -1, -1, -1, -1, -1, -1, -1},
-    {1, 6, 2, 1, 8, 6, 1, 9, 8, 8, 7, 6, -1, -1, -1, -1},
-    {10, 7, 6, 10, 1, 7, 1, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-    {10, 7, 6, 1, 7, 10, 1, 8, 7, 1, 0, 8, -1, -1, -1, -1},
-    {0, 3, 7, 0, 7, 10, 0, 10, 9, 6, 10, 7, -1, -1, -1, -1},
-    {7, 6, 10, 7, 10, 8, 8, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-    {6, 8, 4, 11, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 6, 11, 3, 0, 6, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-    {8, 6, 11, 8, 4, 6, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 4, 6, 9, 6, 3, 9, 3, 1, 11, 3, 6, -1, -1, -1, -1},
-    {6, 8, 4, 6, 11, 8, 2, 10, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 3, 0, 11, 0, 6, 11, 0, 4, 6, -1, -1, -1, -1},
-    {4, 11, 8, 4, 6, 11, 0, 2, 9, 2, 10, 9, -1, -1, -1, -1},
-    {10, 9, 3, 10, 3, 2, 9, 4, 3, 11, 3, 6, 4, 6, 3, -1},
-    {8, 2, 3, 8, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-    {0, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 9, 0, 2, 3, 4, 2, 4, 6, 4, 3, 8, -1, -1, -1, -1},
-    {1, 9, 4, 1, 4, 2, 2, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-    {8, 1, 3, 8, 6, 1, 8, 4, 6, 6, 10, 1, -1, -1, -1, -1},
-    {10, 1, 0, 10, 0, 6, 6, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-    {4, 6, 3, 4, 3, 8, 6, 10, 3, 0, 3, 9, 10, 9, 3, -1},
-    {10, 9, 4, 6, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 5, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 4, 9, 5, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-    {5, 0, 1, 5, 4, 0, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-    {11, 7, 6, 8, 3, 4, 3, 5, 4, 3, 1, 5, -1, -1, -1, -1},
-    {9, 5, 4, 10, 1, 2, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-    {6, 11, 7, 1, 2, 10, 0, 8, 3, 4, 9, 5, -1, -1, -1, -1},
-    {7, 6, 11, 5, 4, 10, 4, 2, 10, 4, 0, 2, -1, -1, -1, -1},
-    {3, 4, 8, 3, 5, 4, 3, 2, 5, 10, 5, 2, 11, 7, 6, -1},
-    {7, 2, 3, 7, 6, 2, 5, 4, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 5, 4, 0, 8, 6, 0, 6, 2, 6, 8, 7, -1, -1, -1, -1},
-    {3, 6, 2, 3, 7, 6, 1, 5, 0, 5, 4, 0, -1, -1, -1, -1},
-    {6, 2, 8, 6, 8, 7, 2, 1, 8, 4, 8, 5, 1, 5, 8, -1},
-    {9, 5, 4, 10, 1, 6, 1, 7, 6, 1, 3, 7, -1, -1, -1, -1},
-    {1, 6, 10, 1, 7, 6, 1, 0, 7, 8, 7, 0, 9, 5, 4, -1},
-    {4, 0, 10, 4, 10, 5, 0, 3, 10, 6, 10, 7, 3, 7, 10, -1},
-    {7, 6, 10, 7, 10, 8, 5, 4, 10, 4, 8, 10, -1, -1, -1, -1},
-    {6, 9, 5, 6, 11, 9, 11, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-    {3, 6, 11, 0, 6, 3, 0, 5, 6, 0, 9, 5, -1, -1, -1, -1},
-    {0, 11, 8, 0, 5, 11, 0, 1, 5, 5, 6, 11, -1, -1, -1, -1},
-    {6, 11, 3, 6, 3, 5, 5, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 10, 9, 5, 11, 9, 11, 8, 11, 5, 6, -1, -1, -1, -1},
-    {0, 11, 3, 0, 6, 11, 0, 9, 6, 5, 6, 9, 1, 2, 10, -1},
-    {11, 8, 5, 11, 5, 6, 8, 0, 5, 10, 5, 2, 0, 2, 5, -1},
-    {6, 11, 3, 6, 3, 5, 2, 10, 3, 10, 5, 3, -1, -1, -1, -1},
-    {5, 8, 9, 5, 2, 8, 5, 6, 2, 3, 8, 2, -1, -1, -1, -1},
-    {9, 5, 6, 9, 6, 0, 0, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-    {1, 5, 8, 1, 8, 0, 5, 6, 8, 3, 8, 2, 6, 2, 8, -1},
-    {1, 5, 6, 2, 1, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 3, 6, 1, 6, 10, 3, 8, 6, 5, 6, 9, 8, 9, 6, -1},
-    {10, 1, 0, 10, 0, 6, 9, 5, 0, 5, 6, 0, -1, -1, -1, -1},
-    {0, 3, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {10, 5, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 5, 10, 7, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {11, 5, 10, 11, 7, 5, 8, 3, 0, -1, -1, -1, -1, -1, -1, -1},
-    {5, 11, 7, 5, 10, 11, 1, 9, 0, -1, -1, -1, -1, -1, -1, -1},
-    {10, 7, 5, 10, 11, 7, 9, 8, 1, 8, 3, 1, -1, -1, -1, -1},
-    {11, 1, 2, 11, 7, 1, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 1, 2, 7, 1, 7, 5, 7, 2, 11, -1, -1, -1, -1},
-    {9, 7, 5, 9, 2, 7, 9, 0, 2, 2, 11, 7, -1, -1, -1, -1},
-    {7, 5, 2, 7, 2, 11, 5, 9, 2, 3, 2, 8, 9, 8, 2, -1},
-    {2, 5, 10, 2, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-    {8, 2, 0, 8, 5, 2, 8, 7, 5, 10, 2, 5, -1, -1, -1, -1},
-    {9, 0, 1, 5, 10, 3, 5, 3, 7, 3, 10, 2, -1, -1, -1, -1},
-    {9, 8, 2, 9, 2, 1, 8, 7, 2, 10, 2, 5, 7, 5, 2, -1},
-    {1, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 7, 0, 7, 1, 1, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-    {9, 0, 3, 9, 3, 5, 5, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-    {9, 8, 7, 5, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {5, 8, 4, 5, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-    {5, 0, 4, 5, 11, 0, 5, 10, 11, 11, 3, 0, -1, -1, -1, -1},
-    {0, 1, 9, 8, 4, 10, 8, 10, 11, 10, 4, 5, -1, -1, -1, -1},
-    {10, 11, 4, 10, 4, 5, 11, 3, 4, 9, 4, 1, 3, 1, 4, -1},
-    {2, 5, 1, 2, 8, 5, 2, 11, 8, 4, 5, 8, -1, -1, -1, -1},
-    {0, 4, 11, 0, 11, 3, 4, 5, 11, 2, 11, 1, 5, 1, 11, -1},
-    {0, 2, 5, 0, 5, 9, 2, 11, 5, 4, 5, 8, 11, 8, 5, -1},
-    {9, 4, 5, 2, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 5, 10, 3, 5, 2, 3, 4, 5, 3, 8, 4, -1, -1, -1, -1},
-    {5, 10, 2, 5, 2, 4, 4, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-    {3, 10, 2, 3, 5, 10, 3, 8, 5, 4, 5, 8, 0, 1, 9, -1},
-    {5, 10, 2, 5, 2, 4, 1, 9, 2, 9, 4, 2, -1, -1, -1, -1},
-    {8, 4, 5, 8, 5, 3, 3, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 4, 5, 1, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {8, 4, 5, 8, 5, 3, 9, 0, 5, 0, 3, 5, -1, -1, -1, -1},
-    {9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 11, 7, 4, 9, 11, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-    {0, 8, 3, 4, 9, 7, 9, 11, 7, 9, 10, 11, -1, -1, -1, -1},
-    {1, 10, 11, 1, 11, 4, 1, 4, 0, 7, 4, 11, -1, -1, -1, -1},
-    {3, 1, 4, 3, 4, 8, 1, 10, 4, 7, 4, 11, 10, 11, 4, -1},
-    {4, 11, 7, 9, 11, 4, 9, 2, 11, 9, 1, 2, -1, -1, -1, -1},
-    {9, 7, 4, 9, 11, 7, 9, 1, 11, 2, 11, 1, 0, 8, 3, -1},
-    {11, 7, 4, 11, 4, 2, 2, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-    {11, 7, 4, 11, 4, 2, 8, 3, 4, 3, 2, 4, -1, -1, -1, -1},
-    {2, 9, 10, 2, 7, 9, 2, 3, 7, 7, 4, 9, -1, -1, -1, -1},
-    {9, 10, 7, 9, 7, 4, 10, 2, 7, 8, 7, 0, 2, 0, 7, -1},
-    {3, 7, 10, 3, 10, 2, 7, 4, 10, 1, 10, 0, 4, 0, 10, -1},
-    {1, 10, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 1, 4, 1, 7, 7, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-    {4, 9, 1, 4, 1, 7, 0, 8, 1, 8, 7, 1, -1, -1, -1, -1},
-    {4, 0, 3, 7, 4, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {4, 8, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {9, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 9, 3, 9, 11, 11, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-    {0, 1, 10, 0, 10, 8, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-    {3, 1, 10, 11, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 2, 11, 1, 11, 9, 9, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-    {3, 0, 9, 3, 9, 11, 1, 2, 9, 2, 11, 9, -1, -1, -1, -1},
-    {0, 2, 11, 8, 0, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 8, 2, 8, 10, 10, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-    {9, 10, 2, 0, 9, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {2, 3, 8, 2, 8, 10, 0, 1, 8, 1, 10, 8, -1, -1, -1, -1},
-    {1, 10, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {1, 3, 8, 9, 1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
-};
-
-GLint aiCubeEdgeFlags2[256]=
-{
-    0x000, 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c, 0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
-    0x190, 0x099, 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c, 0x99c, 0x895, 0xb9f, 0xa96, 0xd9a, 0xc93, 0xf99, 0xe90,
-    0x230, 0x339, 0x033, 0x13a, 0x636, 0x73f, 0x435, 0x53c, 0xa3c, 0xb35, 0x83f, 0x936, 0xe3a, 0xf33, 0xc39, 0xd30,
-    0x3a0, 0x2a9, 0x1a3, 0x0aa, 0x7a6, 0x6af, 0x5a5, 0x4ac, 0xbac, 0xaa5, 0x9af, 0x8a6, 0xfaa, 0xea3, 0xda9, 0xca0,
-    0x460, 0x569, 0x663, 0x76a, 0x066, 0x16f, 0x265, 0x36c, 0xc6c, 0xd65, 0xe6f, 0xf66, 0x86a, 0x963, 0xa69, 0xb60,
-    0x5f0, 0x4f9, 0x7f3, 0x6fa, 0x1f6, 0x0ff, 0x3f5, 0x2fc, 0xdfc, 0xcf5, 0xfff, 0xef6, 0x9fa, 0x8f3, 0xbf9, 0xaf0,
-    0x650, 0x759, 0x453, 0x55a, 0x256, 0x35f, 0x055, 0x15c, 0xe5c, 0xf55, 0xc5f, 0xd56, 0xa5a, 0xb53, 0x859, 0x950,
-    0x7c0, 0x6c9, 0x5c3, 0x4ca, 0x3c6, 0x2cf, 0x1c5, 0x0cc, 0xfcc, 0xec5, 0xdcf, 0xcc6, 0xbca, 0xac3, 0x9c9, 0x8c0,
-    0x8c0, 0x9c9, 0xac3, 0xbca, 0xcc6, 0xdcf, 0xec5, 0xfcc, 0x0cc, 0x1c5, 0x2cf, 0x3c6, 0x4ca, 0x5c3, 0x6c9, 0x7c0,
-    0x950, 0x859, 0xb53, 0xa5a, 0xd56, 0xc5f, 0xf55, 0xe5c, 0x15c, 0x055, 0x35f, 0x256, 0x55a, 0x453, 0x759, 0x650,
-    0xaf0, 0xbf9, 0x8f3, 0x9fa, 0xef6, 0xfff, 0xcf5, 0xdfc, 0x2fc, 0x3f5, 0x0ff, 0x1f6, 0x6fa, 0x7f3, 0x4f9, 0x5f0,
-    0xb60, 0xa69, 0x963, 0x86a, 0xf66, 0xe6f, 0xd65, 0xc6c, 0x36c, 0x265, 0x16f, 0x066, 0x76a, 0x663, 0x569, 0x460,
-    0xca0, 0xda9, 0xea3, 0xfaa, 0x8a6, 0x9af, 0xaa5, 0xbac, 0x4ac, 0x5a5, 0x6af, 0x7a6, 0x0aa, 0x1a3, 0x2a9, 0x3a0,
-    0xd30, 0xc39, 0xf33, 0xe3a, 0x936, 0x83f, 0xb35, 0xa3c, 0x53c, 0x435, 0x73f, 0x636, 0x13a, 0x033, 0x339, 0x230,
-    0xe90, 0xf99, 0xc93, 0xd9a, 0xa96, 0xb9f, 0x895, 0x99c, 0x69c, 0x795, 0x49f, 0x596, 0x29a, 0x393, 0x099, 0x190,
-    0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c, 0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x000
-};
-
 #define SHADOWMAP_RES   2048
 
 void addEntity(Permanent_Storage *state, Entity *ent)
@@ -307,15 +26,15 @@ static void addSurfaceShader(Permanent_Storage *state, Shader *shader)
 
 void initMCubesBuffer2(Permanent_Storage *state)
 {
-    state->mcubesTexture = opengl_Int16Texture2D(16,256,a2iTriangleConnectionTable2);
-    state->mcubesTexture2 = opengl_Int16Texture1D(256, aiCubeEdgeFlags2);
+    state->mcubesTexture = opengl_Int16Texture2D(16,256,a2iTriangleConnectionTable);
+    state->mcubesTexture2 = opengl_Int16Texture1D(256, aiCubeEdgeFlags);
 }
 
 Vec3 getChunkOrigin(IVec3 chunkId)
 {
     Vec3 ret;
     ret.x = chunkId.x/* * voxelSize*/ * CHUNK_SIZE;
-    ret.y = 0.0f;
+    ret.y = chunkId.y/* * voxelSize*/ * CHUNK_SIZE;
     ret.z = chunkId.z/* * voxelSize*/ * CHUNK_SIZE;
     return ret;
 }
@@ -324,7 +43,7 @@ IVec3 getChunkId(Vec3 position)
 {
     IVec3 ret;
     ret.x = (i32)floorf(((r32)position.x / (/*voxelSize**/CHUNK_SIZE)));
-    ret.y = 0;
+    ret.y = (i32)floorf(((r32)position.y / (/*voxelSize**/CHUNK_SIZE)));
     ret.z = (i32)floorf(((r32)position.z / (/*voxelSize**/CHUNK_SIZE)));
     return ret;
 }
@@ -355,17 +74,10 @@ IVec3 getChunkId(Vec3 position)
 
 b32 isChunkLoaded(Permanent_Storage *state, IVec3 chunkId)
 {
-    TerrainChunk* chunks = state->game.loadedChunks;
-    for(u32 i = 0; i < state->game.totalLoadedChunkCount; i++)
-    {
-        if(chunks[i].chunkCoordinate.x == chunkId.x &&
-                chunks[i].chunkCoordinate.y == chunkId.y &&
-                chunks[i].chunkCoordinate.z == chunkId.z)
-        {
-            return chunks[i].isAllocate;
-        }
-    }
-    return 0;
+    u32 index = chunkMapFind(&state->game.chunkMap, chunkId);
+    if(index == CHUNK_MAP_INVALID || index == CHUNK_MAP_EMPTY)
+        return 0;
+    return state->game.loadedChunks[index].isAllocate;
 }
 
 u32 getHighestChunkRing(Permanent_Storage *state, Camera* cam)
@@ -377,6 +89,8 @@ u32 getHighestChunkRing(Permanent_Storage *state, Camera* cam)
     TerrainChunk* chunks = state->game.loadedChunks;
     for(u32 i = 0; i < state->game.totalLoadedChunkCount; i++)
     {
+        if(!chunks[i].isAllocate)
+            continue;
         i32 ringx = abs(chunks[i].chunkCoordinate.x - currentChunk.x);
         i32 ringz = abs(chunks[i].chunkCoordinate.z - currentChunk.z);
         i32 maxValue = max(ringx,ringz);
@@ -384,197 +98,51 @@ u32 getHighestChunkRing(Permanent_Storage *state, Camera* cam)
             maxRing = maxValue;
     }
 
-    assert(maxRing >= 1);
-    return maxRing;
+    // 0 while only the camera's own column is loaded
+    return max(maxRing, 0);
 }
 
-r32 calculatePriority(Vec3 *pos, Camera *cam)
+// angle between the view cone and the bounding sphere of the chunk centered
+// at center, 0 if they touch
+static r32 chunkStreamViewAngle(ChunkStreamView *view, Vec3 *center)
 {
-    float distanceWeight = 250.0f;
+    r32 radius = CHUNK_SIZE*0.8660254f;
     Vec3 camToChunk;
-    vec3Sub(&camToChunk, pos, &cam->position);
-    r32 priorityValue = distanceWeight / vec3Mag2(&camToChunk);
-    /*if(cameraIsPointInFrustum(cam, prioritiOrigin))
-        priorityValue *= frustumMultiplier;*/
-    return priorityValue;
+    vec3Sub(&camToChunk, center, &view->position);
+    r32 distance = vec3Mag(&camToChunk);
+    if(distance <= radius)
+        return 0.0f;
+    r32 cosAngle = vec3Dot(&camToChunk, &view->forward)/distance;
+    r32 angle = acosf(maxf(-1.0f, minf(1.0f, cosAngle)));
+    return maxf(angle - view->halfAngle - asinf(radius/distance), 0.0f);
 }
 
-struct ChunkPriorityResult
-{
-    r32 highestPriority;
-    TerrainChunk* highestPriorityChunk;
-    r32 lowestPriority;
-    TerrainChunk* lowestPriorityChunk;
-} ChunkPriorityResult;
-
-void getLodPriorityExtremes(Permanent_Storage *state, Camera* cam, struct ChunkPriorityResult* result, u32 lod)
+b32 chunkStreamViewContains(ChunkStreamView *view, Vec3 *center)
 {
-    //r32 voxelScale = state->terrainGenState.voxelScale;
-    Vec3 toMiddle = vec3(CHUNK_SIZE/2,0.0f,CHUNK_SIZE/2);
-
-    r32 minPriority = R32MAX;
-    r32 maxPriority = R32MIN;
-    TerrainChunk* lowestChunk = 0;
-    TerrainChunk* highestChunk = 0;
-
-    TerrainChunk* chunks = state->game.loadedChunks;
-    for(u32 i = 0; i < state->game.totalLoadedChunkCount; i++)
-    {
-        if(chunks[i].isAllocate && chunks[i].LODLevel == lod)
-        {
-            Vec3 prioritiOrigin;
-            vec3Add(&prioritiOrigin, &chunks[i].origin, &toMiddle);
-
-            r32 priorityValue = calculatePriority(&prioritiOrigin,cam);
-            if(minPriority > priorityValue)
-            {
-                minPriority = priorityValue;
-                lowestChunk = &chunks[i];
-            }
-            if(maxPriority < priorityValue)
-            {
-                maxPriority = priorityValue;
-                highestChunk = &chunks[i];
-            }
-        }
-    }
-    result->lowestPriority = minPriority;
-    result->lowestPriorityChunk = lowestChunk;
-    result->highestPriority = maxPriority;
-    result->highestPriorityChunk = highestChunk;
+    return chunkStreamViewAngle(view, center) <= 0.0f;
 }
 
-void chunkCheck(Permanent_Storage *state, Camera *cam)
+// inverse squared distance to the path the camera is expected to take, a
+// chunk further along the path counts as a bit further away. Chunks in view
+// get CHUNK_FRUSTUM_MULTIPLIER, fading out over CHUNK_FRUSTUM_FADE radians
+// outside of it so priorities don't jump at the edge of the view.
+r32 calculatePriority(Vec3 *pos, ChunkStreamView *view)
 {
-    IVec3 currentChunk = getChunkId(cam->position);
-
-    if(state->game.loadedChunkCount[3] < MAX_LOD_3_LOADED_CHUNKS ||
-            state->game.loadedChunkCount[2] < MAX_LOD_2_LOADED_CHUNKS ||
-            state->game.loadedChunkCount[1] < MAX_LOD_1_LOADED_CHUNKS)
-    {
-        i32 searchRing = 1;
-        while(state->game.loadedChunkCount[3] < MAX_LOD_3_LOADED_CHUNKS ||
-              state->game.loadedChunkCount[2] < MAX_LOD_2_LOADED_CHUNKS ||
-              state->game.loadedChunkCount[1] < MAX_LOD_1_LOADED_CHUNKS)
-        {
-            for(int i = -searchRing; i <= searchRing; i++)
-            {
-                for(int j = -searchRing; j <= searchRing; j++)
-                {
-                    if(state->game.loadedChunkCount[3] < MAX_LOD_3_LOADED_CHUNKS)
-                    {
-                        IVec3 searchChunk = currentChunk;
-                        searchChunk.x += i;
-                        searchChunk.z += j;
-                        if(!isChunkLoaded(state, searchChunk))
-                        {
-                            TerrainChunk* ch = &state->game.loadedChunks[state->game.totalLoadedChunkCount++];
-                            state->game.loadedChunkCount[3]++;
-                            *ch = loadChunk(state, searchChunk, 3);
-                            addEntity(state, &ch->entity);
-                            printf("load a chunk3 %d %d %d\n",searchChunk.x,searchChunk.y,searchChunk.z);
-                            return;
-                        }
-                    }
-                    else if(state->game.loadedChunkCount[2] < MAX_LOD_2_LOADED_CHUNKS)
-                    {
-                        IVec3 searchChunk = currentChunk;
-                        searchChunk.x += i;
-                        searchChunk.z += j;
-                        if(!isChunkLoaded(state, searchChunk))
-                        {
-                            TerrainChunk* ch = &state->game.loadedChunks[state->game.totalLoadedChunkCount++];
-                            state->game.loadedChunkCount[2]++;
-                            *ch = loadChunk(state, searchChunk, 2);
-                            addEntity(state, &ch->entity);
-                            printf("load a chunk2 %d %d %d\n",searchChunk.x,searchChunk.y,searchChunk.z);
-                            return;
-                        }
-                    }
-                    else if(state->game.loadedChunkCount[1] < MAX_LOD_1_LOADED_CHUNKS)
-                    {
-                        IVec3 searchChunk = currentChunk;
-                        searchChunk.x += i;
-                        searchChunk.z += j;
-                        if(!isChunkLoaded(state, searchChunk))
-                        {
-                            TerrainChunk* ch = &state->game.loadedChunks[state->game.totalLoadedChunkCount++];
-                            state->game.loadedChunkCount[1]++;
-                            *ch = loadChunk(state, searchChunk, 1);
-                            addEntity(state, &ch->entity);
-                            printf("load a chunk1 %d %d %d\n",searchChunk.x,searchChunk.y,searchChunk.z);
-                            return;
-                        }
-                    }
-                    else
-                    {
-                        goto stop;
-                    }
-                }
-            }
-            stop:
-            searchRing++;
-        }
-    }
-    else
-    {
-        Vec3 toMiddle = vec3(CHUNK_SIZE/2,0.0f,CHUNK_SIZE/2);
-
-        r32 maxUnloadedPriority = R32MIN;
-        IVec3 highestUnloadedChunkId;
-
-        // find highest unloaded chunkId
-        i32 ring = getHighestChunkRing(state, cam);
-        for(i32 i = -ring; i <= ring; i++)
-        {
-            for(i32 j = -ring; j <= ring; j++)
-            {
-                IVec3 searchChunk = currentChunk;
-                searchChunk.x += i;
-                searchChunk.z += j;
-                if(!isChunkLoaded(state, searchChunk))
-                {
-                    Vec3 chunkOrigin = getChunkOrigin(searchChunk);
-                    vec3Add(&chunkOrigin, &chunkOrigin, &toMiddle);
-
-                    r32 priorityValue = calculatePriority(&chunkOrigin, cam);
-                    if(maxUnloadedPriority < priorityValue)
-                    {
-                        maxUnloadedPriority = priorityValue;
-                        highestUnloadedChunkId = searchChunk;
-                    }
-                }
-            }
-        }
-
-        struct ChunkPriorityResult result[4] = {};
-        for(int lod = 1; lod <= 3; lod++)
-        {
-            getLodPriorityExtremes(state, cam, &result[lod], lod);
-            //printf("lod %d max %f min %f \n",lod, result[lod].highestPriority, result[lod].lowestPriority);
-        }
-
-        if(result[1].lowestPriority < maxUnloadedPriority)
-        {
-            Vec3 newOrigin = getChunkOrigin(highestUnloadedChunkId);
-            reloadChunk(state, newOrigin, result[1].lowestPriorityChunk, 1);
-            result[1].lowestPriorityChunk->origin = newOrigin;
-            result[1].lowestPriorityChunk->chunkCoordinate = highestUnloadedChunkId;
-            printf("changed chunk to %d %d %d\n",highestUnloadedChunkId.x,highestUnloadedChunkId.y,highestUnloadedChunkId.z);
-            return;
-        }
-
-        for(int lod = 1; lod < 3; lod++)
-        {
-            if(result[lod].highestPriority > result[lod+1].lowestPriority)
-            {
-                reloadChunk(state, result[lod].highestPriorityChunk->origin, result[lod].highestPriorityChunk, lod+1);
-                reloadChunk(state, result[lod+1].lowestPriorityChunk->origin, result[lod+1].lowestPriorityChunk, lod);
-                printf("proted chunk from lod %d to %d\n",lod,lod+1);
-                return;
-            }
-        }
-    }
+    float distanceWeight = 250.0f;
+    Vec3 path, camToChunk;
+    vec3Sub(&path, &view->predicted, &view->position);
+    vec3Sub(&camToChunk, pos, &view->position);
+    r32 pathLength2 = vec3Mag2(&path);
+    r32 t = pathLength2 > 0.0f ? clamp01(vec3Dot(&camToChunk, &path)/pathLength2) : 0.0f;
+
+    Vec3 closest, offset;
+    vec3Scale(&closest, &path, t);
+    vec3Sub(&offset, &camToChunk, &closest);
+    r32 distance = vec3Mag(&offset) + 0.5f*t*sqrtf(pathLength2);
+    r32 priorityValue = distanceWeight / maxf(distance*distance, 1.0f);
+    r32 inView = 1.0f - clamp01(chunkStreamViewAngle(view, pos)/CHUNK_FRUSTUM_FADE);
+    priorityValue *= 1.0f + (CHUNK_FRUSTUM_MULTIPLIER-1.0f)*inView;
+    return priorityValue;
 }
 
 PlatformApi Platform;
@@ -582,8 +150,6 @@ void init(EngineMemory *mem, int width, int height)
 {
     Platform = mem->platformApi;
 
-    //inticl();
-
     memset(mem->gameState, 0, Megabytes(100));
 
     TransientStorage* tmem = (TransientStorage*)mem->transientState;
@@ -628,6 +194,10 @@ void init(EngineMemory *mem, int width, int height)
     state->game.loadedChunkCount[2] = 0;
     state->game.loadedChunkCount[3] = 0;
     state->game.totalLoadedChunkCount = 0;
+    state->game.freeChunkCount = 0;
+    state->game.emptyChunkCount = 0;
+    chunkMapClear(&state->game.chunkMap);
+    chunkSchedulerInit(&state->game.scheduler, CHUNK_SCHEDULER_FRAME_BUDGET_MS);
 
     domeMesh = loadMesh("sphere.tt");
     mesh = loadMesh("barra/barra.tt");
@@ -798,6 +368,10 @@ void init(EngineMemory *mem, int width, int height)
     // TODO: remove constant
     u32 maxGroups = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
     openglInitializeTerrainGeneration(&state->terrainGenState, maxGroups, CHUNK_WORKGROUP_SIZE, 4.0);
+    terrainGenInitCpu(&state->terrainGenState, 0);
+    terrainGenInitOpencl(&state->terrainGenState, "kernels/terrain.cl", "clcache");
+    chunkCacheInit(&state->game.chunkCache, "chunkcache");
+    terrainGenSetBackend(&state->terrainGenState, GLEW_ARB_compute_shader ? TerrainGenBackend_GPU : TerrainGenBackend_CPU);
 }
 
 int frames = 0;
@@ -827,6 +401,12 @@ void pushVisibleEntities(Permanent_Storage *state)
 
     for(int i = 0; i < state->numEntities; i++)
     {
+        // chunks that are still being generated
+        if(state->entities[i]->entityType == 1 && !state->entities[i]->amesh.loadedToGPU)
+        {
+            state->entities[i]->visible = false;
+            continue;
+        }
         r32 bR = state->entities[i]->entityType == 1 ? state->entities[i]->amesh.boundingRadius : state->entities[i]->mesh.boundingRadius;
         // TODO: check for all 6 planes?
         Vec3 pos;
@@ -1000,6 +580,8 @@ Entity* genTerrainChunk(Vec3 offset, Permanent_Storage* state, float scale)
     mesh.faces = primitives;
     mesh.vertices = primitives*3;
     mesh.vertexStride = 28;
+    mesh.baseVertex = 0;
+    mesh.firstIndex = 0;
     Entity *vt = &state->game.voxelTerrain[state->game.voxelTerrainCount++];
     vt->material.numTextures = 0;
     vt->material.shader = &state->game.straightShader;
@@ -1011,174 +593,167 @@ Entity* genTerrainChunk(Vec3 offset, Permanent_Storage* state, float scale)
     return vt;
 }
 
-#include <time.h>
-
+// queues a (re)generation of the chunk at origin, the chunk keeps its old mesh
+// until terrainGenPoll() picks up the result in a later frame
 void reloadChunk(Permanent_Storage* state, Vec3 origin, TerrainChunk* tchunk, u32 lodLevel)
 {
     tchunk->LODLevel = lodLevel;
+    tchunk->isEmpty = false;
     assert(lodLevel > 0);
 
-    glFinish();
-    struct timespec start;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    ArrayMesh* mesh = &tchunk->entity.amesh;
-
-#if 0
-    state->terrainGenState.tunnelData.secondOctaveMax = (r32)absf(origin.z)/(r32)CHUNK_SIZE;
-    state->terrainGenState.tunnelData.dxgoalFirstOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dzgoalFirstOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dxgoalSecondOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dzgoalSecondOctaveMax = (absf(origin.z+(r32)CHUNK_SIZE)/(r32)CHUNK_SIZE)-state->terrainGenState.tunnelData.secondOctaveMax;
-    state->terrainGenState.tunnelData.chunkOrigin = vec4FromVec3AndW(origin,1.0);
-#else
-    state->terrainGenState.tunnelData.secondOctaveMax = 30.0f;
-    state->terrainGenState.tunnelData.dxgoalFirstOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dzgoalFirstOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dxgoalSecondOctaveMax = 0.0f;
-    state->terrainGenState.tunnelData.dzgoalSecondOctaveMax = 0.0f;
-#endif
-
-    u32 groups = powInt(2,lodLevel-1);
-    r32 scale = (CHUNK_SIZE/CHUNK_WORKGROUP_SIZE)/groups;
-
-    openglPrepageTerrainGeneration(&state->terrainGenState, mesh->AttribBuffer, mesh->ElementBuffer, groups, scale);
-    glUseProgram(state->terrainComputeShader.program);
-    glUniform1i(state->terrainComputeShader.terrainGen.mcubesTexture1, 0);
-    glUniform1i(state->terrainComputeShader.terrainGen.mcubesTexture2, 2);
-    glUniform3fv(state->terrainComputeShader.terrainGen.worldOffset, 1, (GLfloat*)&origin);
-    glUniform1f(state->terrainComputeShader.terrainGen.voxelScale, scale);
-    if(state->terrainComputeShader.terrainGen.mcubesTexture1 == -1 /*|| state->terrainComputeShader.terrainGen.mcubesTexture2 == -1*/
-            || state->terrainComputeShader.terrainGen.worldOffset == -1 || state->terrainComputeShader.terrainGen.voxelScale == -1)
+    // chunk moved to a new coordinate, re-key it in the chunk map
+    IVec3 newChunkId = getChunkId(origin);
+    if(newChunkId.x != tchunk->chunkCoordinate.x || newChunkId.y != tchunk->chunkCoordinate.y
+            || newChunkId.z != tchunk->chunkCoordinate.z)
     {
-        assert(false);
+        u32 chunkIndex = (u32)(tchunk - state->game.loadedChunks);
+        chunkMapRemove(&state->game.chunkMap, tchunk->chunkCoordinate);
+        chunkMapInsert(&state->game.chunkMap, newChunkId, chunkIndex);
+        tchunk->chunkCoordinate = newChunkId;
+        tchunk->origin = origin;
     }
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, state->mcubesTexture);
-    glActiveTexture(GL_TEXTURE0+2);
-    glBindTexture(GL_TEXTURE_1D, state->mcubesTexture2);
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, state->terrainGenState.vertInbuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh->AttribBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, state->terrainGenState.tunnelBuffer);
-    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 3, state->terrainGenState.vertAtomicBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, state->terrainGenState.edgeVertexBuffer);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mesh->ElementBuffer);
 
-    glDispatchCompute(groups*groups*groups, 1, 1);
-
-    glFinish();
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    terrainGenSubmit(state, tchunk, lodLevel);
+}
 
-    /*void* evb = malloc(state->terrainGenState.edgeVertexBufferSize);
-    glBindBuffer(GL_ARRAY_BUFFER, state->terrainGenState.edgeVertexBuffer);
-    glGetBufferSubData(GL_ARRAY_BUFFER, 0, state->terrainGenState.edgeVertexBufferSize, evb);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    printf("%p \n",evb);
-    free(evb);*/
-
-    GLuint *userCounters;
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, state->terrainGenState.vertAtomicBuffer);
-    userCounters = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER,
-                                             0,
-                                             sizeof(GLuint)*2,
-                                             GL_MAP_READ_BIT
-                                            );
-    u32 triangleCount = userCounters[0];
-    u32 indexCount = userCounters[1];
-    printf("chunk vertices %d\n", triangleCount);
-    printf("chunk index triangles %d\n", indexCount);
-    glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
-    mesh->vertices = triangleCount;
-    mesh->faces = indexCount;
-    mesh->loadedToGPU = true;
-    mesh->data = NULL;
-    mesh->boundingRadius = sqrtf(3*CHUNK_SIZE*CHUNK_SIZE);
-    //mesh->boundingRadius = R32MAX;
-    mesh->vertexStride = 32;
-
-    /*void* evb = malloc(indexCount*4*3);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->ElementBuffer);
-    glGetBufferSubData(GL_ARRAY_BUFFER, 0, indexCount*4*3, evb);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    for(int i=0; i < indexCount*3; i+=3)
+TerrainChunk* loadChunk(Permanent_Storage* state, IVec3 chunkId, u32 lodLevel)
+{
+    // reuse a slot of an unloaded chunk, its entity is still registered
+    u32 chunkIndex;
+    b32 reused = state->game.freeChunkCount > 0;
+    if(reused)
     {
-        printf("%d %d %d \n",((int*)evb)[i],((int*)evb)[i+1],((int*)evb)[i+2]);
+        chunkIndex = state->game.freeChunkIndices[--state->game.freeChunkCount];
     }
-    free(evb);*/
-
-    /*int size = triangleCount*sizeof(Vec4);
-    void* vvb = malloc(size);
-    Vec4* vertd = (Vec4*)vvb;
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->AttribBuffer);
-    glGetBufferSubData(GL_ARRAY_BUFFER, 0, size, vvb);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    for(int i=0; i < triangleCount; i++)
+    else
     {
-        printf("%f %f %f %f \n",vertd[i].x,vertd[i].y,vertd[i].z,vertd[i].w);
+        assert(state->game.totalLoadedChunkCount < MAX_LOADED_CHUNKS);
+        chunkIndex = state->game.totalLoadedChunkCount++;
     }
-    free(vvb);*/
-
-    glBindVertexArray(mesh->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->AttribBuffer);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 32, 0);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 32, (GLvoid*)16);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ElementBuffer);
-    glBindVertexArray(0);
-    //glBindBuffer(GL_ARRAY_BUFFER, 0);
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    glFinish();
-    struct timespec last;
-    clock_gettime(CLOCK_MONOTONIC, &last);
-    float ms = (last.tv_sec-start.tv_sec)*1000.0f+(last.tv_nsec-start.tv_nsec)/1000000.0;
-    printf("Terrain gen time: %fms\n (LOD: %d)", ms, lodLevel);
-    //addEntity(state, chunk2 );*/
-    u32 difFromHighest = 4-lodLevel;
-    Vec3 offset = vec3(0.0f,-0.2f*difFromHighest,0.0f);
-    vec3Add(&origin, &offset, &origin);
-    setPosition(&tchunk->entity.transform, origin);
-}
+    state->game.loadedChunkCount[lodLevel]++;
 
-TerrainChunk loadChunk(Permanent_Storage* state, IVec3 chunkId, u32 lodLevel)
-{
-    TerrainChunk ret;
-    ret.chunkCoordinate = chunkId;
-    ret.isAllocate = 1;
-    ret.origin = getChunkOrigin(chunkId);
-    ret.LODLevel = lodLevel;
-
-    GLuint outBuffer;
-    glGenBuffers(1, &outBuffer);
-    GLuint outElBuffer;
-    glGenBuffers(1, &outElBuffer);
-    GLuint VAO;
-    glGenVertexArrays(1, &VAO);
+    TerrainChunk* ret = &state->game.loadedChunks[chunkIndex];
+    ret->chunkCoordinate = chunkId;
+    ret->isAllocate = 1;
+    ret->origin = getChunkOrigin(chunkId);
+    ret->LODLevel = lodLevel;
+    chunkMapInsert(&state->game.chunkMap, chunkId, chunkIndex);
 
-    ArrayMesh mesh;
-    mesh.AttribBuffer = outBuffer;
-    mesh.ElementBuffer = outElBuffer;
-    mesh.VAO = VAO;
+    ret->meshAlloc.valid = false;
 
-    Entity *vt = &ret.entity;
+    // buffers are assigned from the mesh arena once the mesh is generated
+    ArrayMesh mesh;
+    mesh.AttribBuffer = 0;
+    mesh.ElementBuffer = 0;
+    mesh.VAO = 0;
+    mesh.baseVertex = 0;
+    mesh.firstIndex = 0;
+    mesh.loadedToGPU = false;
+
+    Entity *vt = &ret->entity;
     vt->material.numTextures = 0;
     vt->material.shader = &state->game.straightShader;
     vt->amesh = mesh;
     vt->entityType = 1;
     transformInit(&vt->transform);
 
-    reloadChunk(state, ret.origin, &ret, lodLevel);
+    reloadChunk(state, ret->origin, ret, lodLevel);
+    if(!reused)
+        addEntity(state, vt);
 
     return ret;
 }
 
+// frees the mesh and the slot, the caller decides what the chunk map says
+static void releaseChunk(Permanent_Storage* state, TerrainChunk* tchunk)
+{
+    assert(tchunk->isAllocate);
+    u32 chunkIndex = (u32)(tchunk - state->game.loadedChunks);
+    meshArenaFree(&state->terrainGenState.meshArena, &tchunk->meshAlloc);
+    tchunk->entity.amesh.loadedToGPU = false;
+    tchunk->genTicket++; // drops anything still in flight
+    tchunk->isAllocate = 0;
+    tchunk->isEmpty = false;
+    state->game.loadedChunkCount[tchunk->LODLevel]--;
+    state->game.freeChunkIndices[state->game.freeChunkCount++] = chunkIndex;
+}
+
+// the chunk's generation found no surface, remember the coordinate as empty so
+// it isn't loaded again and give the slot back
+void unloadEmptyChunk(Permanent_Storage* state, TerrainChunk* tchunk)
+{
+    chunkMapInsert(&state->game.chunkMap, tchunk->chunkCoordinate, CHUNK_MAP_EMPTY);
+    releaseChunk(state, tchunk);
+}
+
+// give the slot back and forget the chunk, it can be loaded again later
+void unloadChunk(Permanent_Storage* state, TerrainChunk* tchunk)
+{
+    chunkMapRemove(&state->game.chunkMap, tchunk->chunkCoordinate);
+    releaseChunk(state, tchunk);
+}
+
+static void flyBenchReport(FlyBench *bench)
+{
+    printf("fly benchmark: %u frames, %.2f%% of on-screen chunks missing on average, worst frame %.2f%%, %u frames with missing chunks\n",
+           bench->frames, bench->frames > 0 ? 100.0*bench->missingSum/bench->frames : 0.0,
+           bench->worstMissing*100.0f, bench->framesWithMissing);
+}
+
+// flies the camera along a fixed path and reports the fraction of on-screen
+// chunks that had no mesh yet, every frame and at the end. Streaming gets
+// FLY_BENCH_WARMUP_SECONDS at the start of the path before frames count.
+static void flyBenchUpdate(Permanent_Storage *state, r32 dt)
+{
+    FlyBench *bench = &state->game.flyBench;
+    Camera *cam = &state->main_cam;
+    bench->time += dt;
+    if(bench->time >= FLY_BENCH_SECONDS)
+    {
+        flyBenchReport(bench);
+        bench->active = false;
+        return;
+    }
+
+    // forward along x with slow turns and height changes
+    r32 t = maxf(bench->time, 0.0f);
+    cam->position = vec3(FLY_BENCH_SPEED*t, 90.0f + 30.0f*sinf(0.3f*t), 400.0f*sinf(0.1f*t));
+    Vec3 direction = vec3(FLY_BENCH_SPEED, 9.0f*cosf(0.3f*t), 40.0f*cosf(0.1f*t));
+    direction = vec3Normalized(&direction);
+    Quaternion yaw = quaternionFromAxisAngle(vec3(0.f,1.f,0.f), atan2f(-direction.x, -direction.z));
+    Quaternion pitch = quaternionFromAxisAngle(vec3(1.f,0.f,0.f), asinf(direction.y));
+    quaternionMul(&cam->rotation, &yaw, &pitch);
+    cameraRecalculateMatrices(cam);
+
+    if(bench->time < 0.0f)
+        return;
+    u32 onScreen;
+    u32 missing = chunkSchedulerMissingOnScreen(state, cam, FLY_BENCH_VIEW_DISTANCE, &onScreen);
+    r32 fraction = onScreen > 0 ? (r32)missing/onScreen : 0.0f;
+    bench->frames++;
+    bench->missingSum += fraction;
+    bench->worstMissing = maxf(bench->worstMissing, fraction);
+    if(missing > 0)
+        bench->framesWithMissing++;
+    printf("fly benchmark frame %u: %u/%u on-screen chunks missing (%.1f%%)\n", bench->frames, missing, onScreen, fraction*100.0f);
+}
+
 r32 timeSinceStart;
 void display(EngineMemory *mem, Input *input, float dt)
 {
     Permanent_Storage *state = (Permanent_Storage*)mem->gameState;
 
-    chunkCheck(state, &state->main_cam);
+    terrainGenPoll(state);
+    chunkSchedulerUpdate(state, &state->main_cam, dt);
+    if(state->game.scheduler.jobsLastFrame > 0)
+        chunkSchedulerPrintStats(&state->game.scheduler);
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    if(tgstate->completedLastFrame > 0 || tgstate->cachedLastFrame > 0 || tgstate->discardedLastFrame > 0)
+    {
+        terrainGenPrintStats(tgstate);
+        chunkCachePrintStats(&state->game.chunkCache);
+        meshArenaPrintStats(&tgstate->meshArena);
+    }
     //findHighestPriorityChunk(state, &state->main_cam);
 
     timeSinceStart += dt;
@@ -1220,6 +795,9 @@ void display(EngineMemory *mem, Input *input, float dt)
 
     cameraRecalculateMatrices(&state->main_cam);
 
+    if(state->game.flyBench.active)
+        flyBenchUpdate(state, dt);
+
     /*Vec3 vector = vec3(0.0,0.316,0.9486);
     Vec3 res = vec3Normalized(&vector);
     printf("VEC %f, %f, %f\n",res.x,res.y,res.z);*/
@@ -1282,19 +860,91 @@ void display(EngineMemory *mem, Input *input, float dt)
         }
         else
         {
-            int newlineid = state->terrainGenState.tunnelData.tunnelCount++;
-            state->terrainGenState.tunnelData.tunnels[newlineid].start = vec4FromVec3AndW(startPos, 1.0f);
-            state->terrainGenState.tunnelData.tunnels[newlineid].end = vec4FromVec3AndW(bpos, 1.0f);
+            Line3D tunnel;
+            tunnel.start = vec4FromVec3AndW(startPos, 1.0f);
+            tunnel.end = vec4FromVec3AndW(bpos, 1.0f);
+            u32 newlineid = tunnelGridAdd(&state->terrainGenState.tunnels, tunnel);
             //genComputeTerrain(state, state->game.voxelTerrain[0].amesh.AttribBuffer, false);
+            chunkSchedulerInvalidateTunnel(state, &state->terrainGenState.tunnels.tunnels[newlineid]);
             startedLine = 0;
         }
     }
 
+    if(getKey(input, KEYCODE_Z) || getKey(input, KEYCODE_X) || getKey(input, KEYCODE_C))
+    {
+        VoxelBrush brush = VoxelBrush_Smooth;
+        r32 strength = minf(EDIT_SMOOTH_RATE*dt, 1.0f);
+        if(getKey(input, KEYCODE_Z))
+        {
+            brush = VoxelBrush_Dig;
+            strength = 1.0f;
+        }
+        else if(getKey(input, KEYCODE_X))
+        {
+            brush = VoxelBrush_Fill;
+            strength = 1.0f;
+        }
+        terrainGenEdit(state, brush, bpos, EDIT_BRUSH_RADIUS, strength);
+    }
+
     if(getKeyDown(input, KEYCODE_N))
     {
         state->tstorage->glState.night = !state->tstorage->glState.night;
     }
 
+    if(getKeyDown(input, KEYCODE_G))
+    {
+        // GPU, CPU, OpenCL and around, an unavailable one is skipped
+        TerrainGeneratorState *tgstate = &state->terrainGenState;
+        TerrainGenBackend backend = (tgstate->backend + 1) % 3;
+        if(backend == TerrainGenBackend_OpenCL && !tgstate->opencl.initialized)
+            backend = TerrainGenBackend_GPU;
+        terrainGenSetBackend(tgstate, backend);
+    }
+
+    if(getKeyDown(input, KEYCODE_V))
+    {
+        TerrainGeneratorState *tgstate = &state->terrainGenState;
+        tgstate->verifyCounts = !tgstate->verifyCounts;
+        printf("GPU chunk count check against the CPU: %s\n", tgstate->verifyCounts ? "on" : "off");
+    }
+
+    if(getKeyDown(input, KEYCODE_B))
+    {
+        FlyBench *bench = &state->game.flyBench;
+        if(bench->active)
+        {
+            flyBenchReport(bench);
+            bench->active = false;
+        }
+        else
+        {
+            memset(bench, 0, sizeof(FlyBench));
+            bench->active = true;
+            bench->time = -FLY_BENCH_WARMUP_SECONDS;
+        }
+    }
+
+    if(getKeyDown(input, KEYCODE_M))
+    {
+        voxelNoiseBenchmark();
+    }
+
+    if(getKeyDown(input, KEYCODE_J))
+    {
+        terrainGenCycleMeshers(&state->terrainGenState);
+    }
+
+    if(getKeyDown(input, KEYCODE_K))
+    {
+        terrainGenCycleSimplify(&state->terrainGenState);
+    }
+
+    if(getKeyDown(input, KEYCODE_H))
+    {
+        terrainGenToggleColumnWarp(&state->terrainGenState);
+    }
+
     {
         forwardRender(state, input, dt);
 
@@ -1396,5 +1046,8 @@ void reshape (EngineMemory *mem, int w, int h)
 
 void gameExit(EngineMemory *game_memory)
 {
+    Permanent_Storage *state = (Permanent_Storage*)game_memory->gameState;
+    terrainGenShutdown(&state->terrainGenState);
+    chunkCacheShutdown(&state->game.chunkCache);
     audioExit();
 }
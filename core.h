@@ -6,13 +6,75 @@
 
 #define CHUNK_SIZE 64
 #define CHUNK_WORKGROUP_SIZE 16
+// upper bounds, how many chunks are resident is decided by CHUNK_VRAM_BUDGET
 #define MAX_LOD_3_LOADED_CHUNKS 64
 #define MAX_LOD_2_LOADED_CHUNKS 128
 #define MAX_LOD_1_LOADED_CHUNKS 1024
 
+// CPU generation output limits of a LOD 3 chunk, lower LODs get a fraction,
+// the GPU counts first and writes exact sized meshes
 #define CHUNK_VERTEX_BUFFER_SIZE Megabytes(1)
 #define CHUNK_ELEMENT_BUFFER_SIZE Kilobytes(500)
 
+#define MAX_LOADED_CHUNKS (MAX_LOD_3_LOADED_CHUNKS+MAX_LOD_2_LOADED_CHUNKS+MAX_LOD_1_LOADED_CHUNKS)
+// chunk layers above and below the camera that are streamed
+#define CHUNK_VERTICAL_RING 2
+// GPU memory the chunk meshes may take up (vertices and elements), the LOD
+// rings are scaled down to fit
+#define CHUNK_VRAM_BUDGET Megabytes(256)
+// chunks are only added while the projected use stays below this part of the
+// budget, evictions start above all of it
+#define CHUNK_BUDGET_FILL 0.95f
+// part of their full size per second the rings grow back by once there is room
+#define CHUNK_BUDGET_GROW_RATE 0.1f
+// power of 2, holds the loaded chunks and the known empty ones around the
+// camera with plenty of room to keep probe sequences short
+#define CHUNK_MAP_CAPACITY 32768
+#define CHUNK_MAP_INVALID U32MAX
+// chunk was generated and has no surface (all air or all solid)
+#define CHUNK_MAP_EMPTY (U32MAX-1)
+// heap capacity, has to hold the candidates around the camera and every
+// loaded chunk of a LOD plus stale entries
+#define CHUNK_QUEUE_CAPACITY 16384
+// time chunk streaming may spend per frame (at least one job runs if a generation slot is free)
+#define CHUNK_SCHEDULER_FRAME_BUDGET_MS 4.0f
+// a chunk has to be this much more important than the one whose LOD or spot it takes
+#define CHUNK_LOD_HYSTERESIS 1.25f
+// added to the hysteresis per frame budget of measured regeneration cost
+#define CHUNK_LOD_COST_WEIGHT 0.5f
+// frames a chunk keeps its LOD and spot before it can be swapped again
+#define CHUNK_MIN_RESIDENCY_FRAMES 30
+// seconds of camera movement chunk streaming looks ahead
+#define CHUNK_PREFETCH_SECONDS 2.0f
+// the predicted path is never longer than this, moving further in a frame is a teleport
+#define CHUNK_PREFETCH_MAX_DISTANCE (4.0f*CHUNK_SIZE)
+// priority multiplier of chunks in view
+#define CHUNK_FRUSTUM_MULTIPLIER 4.0f
+// angle (radians) outside of the view over which the multiplier fades out
+#define CHUNK_FRUSTUM_FADE 0.5f
+// heap keys are recomputed when the look direction turned further than this (cosine)
+#define CHUNK_VIEW_REKEY_COS 0.95f
+
+// fly benchmark, see flyBenchUpdate()
+#define FLY_BENCH_WARMUP_SECONDS 5.0f
+#define FLY_BENCH_SECONDS 30.0f
+#define FLY_BENCH_SPEED 120.0f
+// on-screen chunks further away than this don't count as missing
+#define FLY_BENCH_VIEW_DISTANCE (8.0f*CHUNK_SIZE)
+
+// voxel brushes, Z digs, X fills and C smooths while held
+#define EDIT_BRUSH_RADIUS 6.0f
+// how far the smooth brush moves voxels per second, 1 is all the way
+#define EDIT_SMOOTH_RATE 4.0f
+
+// chunks along one side of a cache region file
+#define CHUNK_CACHE_REGION_SIZE 8
+#define CHUNK_CACHE_REGION_CHUNKS (CHUNK_CACHE_REGION_SIZE*CHUNK_CACHE_REGION_SIZE*CHUNK_CACHE_REGION_SIZE)
+#define CHUNK_CACHE_LODS 4
+// region files kept open (and mapped) at the same time
+#define CHUNK_CACHE_OPEN_REGIONS 32
+#define CHUNK_CACHE_PATH_LENGTH 256
+
 typedef struct TerrainChunk
 {
     Vec3 origin;
@@ -20,8 +82,148 @@ typedef struct TerrainChunk
     b32 isAllocate;
     Entity entity;
     u32 LODLevel;
+    u32 genTicket; // bumped on every submitted generation
+    b32 isEmpty; // last generation found no surface, see Game_State::emptyChunks
+    MeshArenaAllocation meshAlloc;
 } TerrainChunk;
 
+typedef struct ChunkMapEntry
+{
+    IVec3 chunkId;
+    u32 chunkIndex; // index into Game_State::loadedChunks or CHUNK_MAP_EMPTY
+    b32 used;
+} ChunkMapEntry;
+
+// chunk coordinate -> loaded chunk lookup
+typedef struct ChunkMap
+{
+    ChunkMapEntry entries[CHUNK_MAP_CAPACITY];
+    u32 count;
+} ChunkMap;
+
+typedef struct ChunkCacheRegion
+{
+    IVec3 regionId;
+    u64 genHash;
+    i32 fd;
+    u64 fileSize;
+    void *map;
+    u64 mapSize;
+    u32 lastUse;
+    b32 used;
+    u64 deadBytes; // data no entry points to anymore
+} ChunkCacheRegion;
+
+// on-disk chunk mesh cache, see chunk_cache.c
+typedef struct ChunkCache
+{
+    char directory[CHUNK_CACHE_PATH_LENGTH];
+    b32 enabled;
+    ChunkCacheRegion regions[CHUNK_CACHE_OPEN_REGIONS];
+    u32 useCounter;
+
+    // stats
+    u32 hits;
+    u32 misses;
+    u32 writes;
+    u32 writeErrors;
+    u64 bytesWritten;
+    u32 reusedWrites; // stored where the chunk's old mesh was
+    u32 compactions;
+    u64 bytesReclaimed;
+} ChunkCache;
+
+typedef struct ChunkCacheResult
+{
+    VertexOut *vertices;
+    TriangleOut *triangles;
+    u32 vertexCount;
+    u32 triangleCount;
+} ChunkCacheResult;
+
+typedef struct ChunkQueueEntry
+{
+    r32 key; // priority, negated in min-queues
+    u32 chunkIndex; // loaded chunk index, CHUNK_MAP_INVALID for load candidates
+    u32 version; // must match ChunkScheduler::chunkVersion or the entry is stale
+    IVec3 chunkId;
+} ChunkQueueEntry;
+
+// binary max-heap
+typedef struct ChunkQueue
+{
+    ChunkQueueEntry entries[CHUNK_QUEUE_CAPACITY];
+    u32 count;
+} ChunkQueue;
+
+// what chunk priorities are computed from
+typedef struct ChunkStreamView
+{
+    Vec3 position;
+    Vec3 velocity; // smoothed over a few frames
+    Vec3 predicted; // expected position CHUNK_PREFETCH_SECONDS from now
+    Vec3 forward;
+    r32 halfAngle; // half angle of a cone around forward that contains the frustum
+} ChunkStreamView;
+
+typedef struct ChunkScheduler
+{
+    IVec3 cameraChunk;
+    ChunkStreamView view;
+    ChunkStreamView rebuildView; // view the heap keys were computed with
+    b32 needsRebuild;
+    b32 cameraMoved; // since the last frame
+    b32 rekeyedAtRest; // keys recomputed since the camera stopped
+    i32 searchRing;
+    r32 frameBudgetMs;
+
+    ChunkQueue loadQueue; // unloaded chunks, highest priority first
+    ChunkQueue lowQueue[4]; // loaded chunks per LOD, lowest priority first
+    ChunkQueue highQueue[4]; // loaded chunks per LOD, highest priority first
+    ChunkQueue dirtyQueue; // loaded chunks an edit touched, highest priority first
+    b32 chunkDirty[MAX_LOADED_CHUNKS]; // already in dirtyQueue, cleared by any regeneration
+    u32 chunkVersion[MAX_LOADED_CHUNKS];
+    u32 residentSince[MAX_LOADED_CHUNKS]; // frame of the last LOD or coordinate change
+    u32 frame;
+    // last pair the hysteresis rejected per kind (replacement, LOD 1<->2, LOD 2<->3),
+    // so a pair that stays rejected is only counted once
+    IVec3 rejected[3][2];
+
+    u64 vramBudget; // bytes, CHUNK_VRAM_BUDGET unless changed
+    r32 budgetScale; // part of the MAX_LOD_*_LOADED_CHUNKS rings that fits the budget
+    u32 lodLimit[4]; // chunks allowed per LOD
+    u64 chunkBytes[4]; // average mesh of a chunk per LOD, measured
+    u64 residentBytes; // meshes of the loaded chunks
+    u64 projectedBytes; // and an estimate for the ones still generating
+
+    // stats
+    u32 jobsLastFrame;
+    u32 totalJobs;
+    u32 backlog; // chunks that should be loaded or swapped but aren't yet
+    u32 rebuilds;
+    u32 shifts; // search box moved along with the camera
+    u32 rekeys; // keys recomputed in place
+    u32 emptyUnloads; // chunks unloaded because they had no surface
+    u32 swaps; // LOD swaps and replacements done
+    u32 avoidedRegens; // generations the hysteresis, residency or cost check saved
+    u32 edits;
+    u32 editRegens; // regenerations queued by edits, repeated edits of a chunk count once
+    u32 editUncovered; // empty chunks an edit carved a surface into
+    u32 editDrops; // regenerations that didn't fit dirtyQueue, never expected
+    u32 budgetEvictions; // chunks unloaded to stay within the budget
+    r32 lastFrameMs;
+} ChunkScheduler;
+
+typedef struct FlyBench
+{
+    b32 active;
+    r32 time;
+    u32 frames;
+    u32 framesWithMissing;
+    r64 missingSum;
+    r32 worstMissing;
+} FlyBench;
+
 typedef struct Game_State
 {
     Vec4 sunDir;
@@ -44,9 +246,19 @@ typedef struct Game_State
     Entity voxelTerrain[100];
     Entity dome;
 
-    TerrainChunk loadedChunks[MAX_LOD_3_LOADED_CHUNKS+MAX_LOD_2_LOADED_CHUNKS+MAX_LOD_1_LOADED_CHUNKS];
+    TerrainChunk loadedChunks[MAX_LOADED_CHUNKS];
     u32 loadedChunkCount[4];
     u32 totalLoadedChunkCount;
+    // loadedChunks slots given back by unloadEmptyChunk()
+    u32 freeChunkIndices[MAX_LOADED_CHUNKS];
+    u32 freeChunkCount;
+    // chunks whose generation found no surface, unloaded by the scheduler
+    u32 emptyChunks[MAX_LOADED_CHUNKS];
+    u32 emptyChunkCount;
+    ChunkMap chunkMap;
+    ChunkScheduler scheduler;
+    ChunkCache chunkCache;
+    FlyBench flyBench;
 
     u32 voxelTerrainCount;
 
@@ -110,7 +322,61 @@ inline void addEntity(Permanent_Storage *state, Entity *ent);
 static inline void addSurfaceShader(Permanent_Storage *state, Shader *shader);
 
 void reloadChunk(Permanent_Storage* state, Vec3 origin, TerrainChunk* entity, u32 lodLevel);
-TerrainChunk loadChunk(Permanent_Storage* state, IVec3 chunkId, u32 lodLevel);
+TerrainChunk* loadChunk(Permanent_Storage* state, IVec3 chunkId, u32 lodLevel);
+void unloadEmptyChunk(Permanent_Storage* state, TerrainChunk* tchunk);
+void unloadChunk(Permanent_Storage* state, TerrainChunk* tchunk);
+
+void terrainGenInitParams(TerrainGeneratorState *tgstate);
+void terrainGenInitCpu(TerrainGeneratorState *tgstate, u32 threadCount);
+void terrainGenInitOpencl(TerrainGeneratorState *tgstate, const char *kernelFile, const char *cacheDirectory);
+void terrainGenShutdown(TerrainGeneratorState *tgstate);
+void terrainGenSetBackend(TerrainGeneratorState *tgstate, TerrainGenBackend backend);
+void terrainGenCycleMeshers(TerrainGeneratorState *tgstate);
+void terrainGenCycleSimplify(TerrainGeneratorState *tgstate);
+void terrainGenToggleColumnWarp(TerrainGeneratorState *tgstate);
+u32 terrainGenFreeSlots(TerrainGeneratorState *tgstate);
+VoxelChunkClass terrainGenClassify(TerrainGeneratorState *tgstate, IVec3 chunkId);
+void terrainGenSubmit(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel);
+u32 terrainGenEdit(Permanent_Storage *state, VoxelBrush brush, Vec3 center, r32 radius, r32 strength);
+void terrainGenPoll(Permanent_Storage *state);
+void terrainGenPrintStats(TerrainGeneratorState *tgstate);
+u32 terrainGenMaxVertices(u32 groups);
+u32 terrainGenMaxTriangles(u32 groups);
+
+u64 chunkCacheHashGenData(ChunkGenData *gen);
+u64 chunkCacheHashEdits(VoxelField *field);
+u64 chunkCacheHashMesh(u64 editHash, VoxelMesher mesher, r32 simplifyError);
+void chunkCacheInit(ChunkCache *cache, const char *directory);
+void chunkCacheShutdown(ChunkCache *cache);
+b32 chunkCacheLookup(ChunkCache *cache, IVec3 chunkId, u32 lodLevel, u64 genHash, u64 meshHash,
+                     ChunkCacheResult *result);
+b32 chunkCacheStore(ChunkCache *cache, IVec3 chunkId, u32 lodLevel, u64 genHash, u64 meshHash,
+                    VertexOut *vertices, u32 vertexCount, TriangleOut *triangles, u32 triangleCount);
+void chunkCachePrintStats(ChunkCache *cache);
+
+void chunkMapClear(ChunkMap *map);
+u32 chunkMapFind(ChunkMap *map, IVec3 chunkId);
+b32 chunkMapInsert(ChunkMap *map, IVec3 chunkId, u32 chunkIndex);
+b32 chunkMapRemove(ChunkMap *map, IVec3 chunkId);
+u32 chunkMapRemoveEmpty(ChunkMap *map, IVec3 keepMin, IVec3 keepMax);
+
+void initMCubesBuffer2(Permanent_Storage *state);
+Vec3 getChunkOrigin(IVec3 chunkId);
+IVec3 getChunkId(Vec3 position);
+b32 isChunkLoaded(Permanent_Storage *state, IVec3 chunkId);
+u32 getHighestChunkRing(Permanent_Storage *state, Camera* cam);
+r32 calculatePriority(Vec3 *pos, ChunkStreamView *view);
+b32 chunkStreamViewContains(ChunkStreamView *view, Vec3 *center);
+
+b32 chunkQueuePush(ChunkQueue *queue, ChunkQueueEntry entry);
+ChunkQueueEntry chunkQueuePop(ChunkQueue *queue);
+r32 chunkPriority(IVec3 chunkId, ChunkStreamView *view);
+void chunkSchedulerInit(ChunkScheduler *sched, r32 frameBudgetMs);
+void chunkSchedulerUpdate(Permanent_Storage *state, Camera *cam, r32 dt);
+u32 chunkSchedulerMissingOnScreen(Permanent_Storage *state, Camera *cam, r32 viewDistance, u32 *onScreen);
+void chunkSchedulerInvalidateTunnel(Permanent_Storage *state, Line3D *tunnel);
+void chunkSchedulerInvalidateBox(Permanent_Storage *state, Vec3 min, Vec3 max);
+void chunkSchedulerPrintStats(ChunkScheduler *sched);
 
 #ifdef __cplusplus
 extern "C" {
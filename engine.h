@@ -5,6 +5,9 @@
 
 #include "shared.h"
 #include "renderer.h"
+#include "voxel_terrain.h"
+#include "worker_pool.h"
+#include "opencl.h"
 
 
 #define KEYCODE_Q               1
@@ -50,7 +53,6 @@
 Mesh *generatePlane();
 
 #define NUM_BUFFERS 2
-#define MAX_TUNNELS 64
 
 typedef struct DebugState
 {
@@ -60,36 +62,256 @@ typedef struct DebugState
     GLuint lineVAO;
 } DebugState;
 
-typedef struct Line3D
+// vertex and element storage of all chunk meshes, see mesh_arena.c
+#define MESH_ARENA_MAX_PAGES 8
+#define MESH_ARENA_PAGE_VERTICES (Megabytes(24)/sizeof(VertexOut))
+#define MESH_ARENA_PAGE_TRIANGLES (Megabytes(32)/sizeof(TriangleOut))
+// free ranges per list, a page can't have more than allocations+1 of them
+#define MESH_ARENA_MAX_RANGES 2048
+
+typedef struct MeshArenaRange
 {
-    Vec4 start;
-    Vec4 end;
-} Line3D;
+    u32 offset;
+    u32 count;
+} MeshArenaRange;
 
-typedef struct ChunkGenData
+// free ranges sorted by offset, neighbours are merged on free
+typedef struct MeshArenaFreeList
 {
-    u32 tunnelCount;
-    r32 firstOctaveMax;
-    r32 secondOctaveMax;
-    r32 padding;
-    r32 dxgoalFirstOctaveMax;
-    r32 dxgoalSecondOctaveMax;
-    r32 dzgoalFirstOctaveMax;
-    r32 dzgoalSecondOctaveMax;
-    Vec4 chunkOrigin;
-    Line3D tunnels[MAX_TUNNELS];
-} ChunkGenData;
+    MeshArenaRange ranges[MESH_ARENA_MAX_RANGES];
+    u32 rangeCount;
+    u32 capacity;
+    u32 used;
+} MeshArenaFreeList;
 
-typedef struct TerrainGeneratorState
+typedef struct MeshArenaPage
+{
+    GLuint vertexBuffer;
+    GLuint elementBuffer;
+    GLuint VAO; // attributes and element buffer of this page, shared by its meshes
+    MeshArenaFreeList vertices;
+    MeshArenaFreeList triangles;
+} MeshArenaPage;
+
+typedef struct MeshArenaAllocation
+{
+    b32 valid;
+    u32 page;
+    u32 firstVertex;
+    u32 vertexCount;
+    u32 firstTriangle;
+    u32 triangleCount;
+} MeshArenaAllocation;
+
+typedef struct MeshArena
+{
+    MeshArenaPage pages[MESH_ARENA_MAX_PAGES];
+    u32 pageCount;
+
+    // stats
+    u32 allocations;
+    u32 failedAllocations;
+} MeshArena;
+
+// chunk generations that can be in flight on the GPU at the same time
+#define TERRAIN_GEN_SLOTS 4
+
+// pass of terrain_compute2.glsl a slot is waiting for, same values as its stage uniform
+typedef enum TerrainGenStage
+{
+    TerrainGenStage_Count, // block sizes are being counted
+    TerrainGenStage_Emit // mesh is being written to its arena range
+} TerrainGenStage;
+
+// scratch buffers of a single in flight generation, reused once its fence signals
+typedef struct TerrainGenSlot
 {
     GLuint vertInbuffer;
-    ChunkGenData tunnelData;
-    GLuint vertAtomicBuffer;
+    // vertex and triangle count of every block, read back to size the mesh
+    GLuint blockBuffer;
+    // samples of every block, the emit pass doesn't evaluate the density again
+    GLuint densityBuffer;
+    // ChunkGenData followed by the chunk's tunnels, grows when a chunk has more
     GLuint tunnelBuffer;
-    GLuint edgeVertexBuffer;
-    u32 edgeVertexBufferSize;
+    u32 tunnelBufferSize;
+    // VoxelEditChunk followed by the chunk's bricks, same
+    GLuint editBuffer;
+    u32 editBufferSize;
+    // copy of the emitted mesh for the chunk cache, vertices then triangles
+    GLuint readbackBuffer;
+    u32 readbackBufferSize;
+    GLsync fence; // of the pass in flight
+    GLuint timerQuery; // GPU time of the count pass, read once the fence signaled
+    GLuint emitTimerQuery;
+    b32 busy;
+    TerrainGenStage stage;
+    r32 countMs;
+
+    u32 chunkIndex;
+    u32 ticket; // must still match the chunk's genTicket when the result arrives
+    u32 lodLevel;
+    u32 groups;
+    r32 scale;
+    VoxelMesher mesher;
+    u32 submitFrame;
+    IVec3 chunkId;
+    u64 genHash; // chunk cache key
+    u64 meshHash;
+    // exact sized range the emit pass writes, the chunk draws its old one until then
+    MeshArenaAllocation alloc;
+    // voxelCountChunk() result when TerrainGeneratorState::verifyCounts was on
+    b32 verify;
+    u32 expectedVertices;
+    u32 expectedTriangles;
+} TerrainGenSlot;
+
+// chunks whose density samples are kept on the GPU for their next LOD change
+#define TERRAIN_DENSITY_CACHE_ENTRIES 64
+
+// samples of a chunk on the grid of the finest LOD, (CHUNK_SIZE+1)^3 floats
+// with x changing fastest. Only the ones at multiples of stride were taken.
+typedef struct TerrainDensityEntry
+{
+    GLuint buffer;
+    u32 stride; // 0 if nothing is cached
+    u32 lastUsedFrame;
+    IVec3 chunkId;
+    u64 genHash; // generator parameters, the field inputs besides editHash
+    u64 editHash;
+} TerrainDensityEntry;
+
+// chunks the CPU backend can have queued or running on workers
+#define TERRAIN_GEN_CPU_SLOTS 16
+
+typedef enum TerrainGenBackend
+{
+    TerrainGenBackend_GPU,
+    TerrainGenBackend_CPU,
+    TerrainGenBackend_OpenCL
+} TerrainGenBackend;
+
+// a chunk meshed by voxelGenerateChunk() on a worker, the main thread only uploads it
+typedef struct TerrainGenCpuSlot
+{
+    ChunkGenData genData; // copy, the main thread may add tunnels meanwhile
+    Line3D *tunnels; // genData.tunnelCount of them
+    u32 tunnelCapacity;
+    VoxelEditChunk edits;
+    VoxelBrick *bricks; // edits.brickCount of them
+    u32 brickCapacity;
+    Vec3 origin;
+    u32 groups;
+    r32 scale;
+    VoxelMesher mesher;
+    r32 simplifyError; // 0 if the mesh is uploaded as generated
+    VoxelScratch *scratch;
+    VoxelSimplifyScratch simplify;
+    VoxelMeshOutput out;
+    r32 genMs;
+    r32 simplifyMs; // part of genMs
+    u32 generatedTriangles; // before voxelSimplifyMesh()
+    volatile b32 done; // set by the worker when out is complete
+    b32 busy;
+
+    u32 chunkIndex;
+    u32 ticket;
+    u32 lodLevel;
+    u32 submitFrame;
+    IVec3 chunkId;
+    u64 genHash;
+    u64 meshHash;
+} TerrainGenCpuSlot;
+
+// chunks the OpenCL backend can have in flight, each has a queue and device memory
+#define TERRAIN_GEN_CL_SLOTS 4
+
+// a chunk meshed by the OpenCL kernels into out, the main thread uploads it
+typedef struct TerrainGenClSlot
+{
+    OpenclTerrainJob job;
+    VoxelMeshOutput out;
+    VoxelMesher mesher;
+    r32 genMs; // device time
+    b32 busy;
+
+    u32 chunkIndex;
+    u32 ticket;
+    u32 lodLevel;
+    u32 submitFrame;
+    IVec3 chunkId;
+    u64 genHash;
+    u64 meshHash;
+} TerrainGenClSlot;
+
+typedef struct TerrainGeneratorState
+{
+    ChunkGenData genData; // generator parameters, tunnelCount is set per chunk
+    TunnelGrid tunnels;
+    VoxelEditStore edits;
+    // tunnels and edits of the chunk being classified or submitted
+    Line3D *chunkTunnels;
+    u32 chunkTunnelCapacity;
+    VoxelEditChunk chunkEdits;
+    VoxelBrick *chunkBricks;
+    u32 chunkBrickCapacity;
     r32 voxelScale;
     b32 initialized;
+    TerrainGenBackend backend;
+    VoxelMesher lodMesher[4]; // see terrainGenCycleMeshers()
+    r32 simplifyError; // of LOD 1 meshes, 0 is off, see terrainGenCycleSimplify()
+
+    TerrainGenSlot slots[TERRAIN_GEN_SLOTS];
+    u32 slotsInFlight;
+    u32 frame;
+
+    MeshArena meshArena;
+
+    WorkerPool workers;
+    TerrainGenCpuSlot cpuSlots[TERRAIN_GEN_CPU_SLOTS];
+    u32 cpuSlotsInFlight;
+
+    OpenclState opencl;
+    TerrainGenClSlot clSlots[TERRAIN_GEN_CL_SLOTS];
+    u32 clSlotsInFlight;
+
+    // stats
+    u32 completedLastFrame;
+    u32 cachedLastFrame; // uploaded from the chunk cache without generating
+    u32 discardedLastFrame;
+    u32 totalCompleted;
+    u32 maxLatencyFrames;
+    u32 hostOverflows; // CPU or OpenCL meshes that didn't fit their output
+    r32 cpuGenMs; // worker time of the CPU chunks completed last frame
+    r32 clGenMs; // device time of the OpenCL chunks completed last frame
+    u32 classified[3]; // chunks per VoxelChunkClass
+    r32 lodCostMs[4]; // moving average of the generation time per LOD
+    u32 generationsSubmitted; // reached a backend
+    u64 tunnelsSubmitted; // tunnels those generations got
+    u32 maxChunkTunnels;
+    u32 editedSubmitted; // generations with edit bricks
+    u64 bricksSubmitted;
+    TerrainDensityEntry densityCache[TERRAIN_DENSITY_CACHE_ENTRIES];
+    u64 densitySamples; // taken by GPU count passes
+    u64 densitySamplesReused; // of those, read from the density cache
+    u32 chunksCounted; // GPU count passes read back
+    u64 blocksCounted;
+    u64 surfaceBlocks; // blocks with vertices, only they store samples for the emit pass
+    u64 blockSamples; // of all the blocks counted, surface nets take more
+    u64 surfaceBlockSamples;
+    // finished meshes per VoxelMesher and LOD
+    u32 meshedChunks[2][4];
+    u64 meshedVertices[2][4];
+    u64 meshedTriangles[2][4];
+    u32 simplifiedChunks;
+    u64 simplifiedBefore; // triangles
+    u64 simplifiedAfter;
+    r64 simplifyMs;
+
+    // checks the GPU's counts against voxelCountChunk(), slow
+    b32 verifyCounts;
+    VoxelScratch *verifyScratch;
+    u32 countsVerified;
+    u32 countMismatches;
 } TerrainGeneratorState;
 
 int initAudio();
@@ -112,6 +334,13 @@ Mesh *generateTerrainMesh();
 Mesh *terrainGen(r32 y);
 
 void openglInitializeTerrainGeneration(TerrainGeneratorState* tgstate, u32 maxGroups, u32 cubesPerSeed, r32 voxelScale);
-void openglPrepageTerrainGeneration(TerrainGeneratorState* tgstate, GLuint outBuffer, GLuint outElementBuffer, u32 groups, r32 scale);
+void openglPrepageTerrainGeneration(TerrainGeneratorState* tgstate, TerrainGenSlot* slot, u32 groups, r32 scale,
+                                    VoxelField *field);
+
+void meshArenaInit(MeshArena *arena);
+void meshArenaDestroy(MeshArena *arena);
+b32 meshArenaAlloc(MeshArena *arena, u32 vertexCount, u32 triangleCount, MeshArenaAllocation *alloc);
+void meshArenaFree(MeshArena *arena, MeshArenaAllocation *alloc);
+void meshArenaPrintStats(MeshArena *arena);
 
 #endif // ENGINE_H
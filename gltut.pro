@@ -12,7 +12,9 @@ HEADERS += stb_perlin.h \
     engine.h \
     shared.h \
     engine_platform.h \
-    opencl.h
+    opencl.h \
+    voxel_terrain.h \
+    worker_pool.h
 
 SOURCES += \
     platform_linux.c \
@@ -28,9 +30,20 @@ SOURCES += \
     modelParser.c \
     terrain.c \
     core.c \
+    chunk_map.c \
+    chunk_scheduler.c \
+    terrain_generator.c \
+    worker_pool.c \
+    chunk_cache.c \
+    mesh_arena.c \
     audio.c \
     opengl.c \
     voxel_terrain.c \
+    noise_simd.c \
+    voxel_simplify.c \
+    tunnel_grid.c \
+    voxel_edit.c \
+    opencl.c \
     renderer.c
 
 LIBS += -lGL
@@ -39,6 +52,8 @@ LIBS += -lX11
 LIBS += -lfreetype
 LIBS += -lopenal
 LIBS += -lalut
+LIBS += -lpthread
+LIBS += -lOpenCL
 
  INCLUDEPATH += /usr/include/freetype2 \
 
@@ -175,6 +175,12 @@ void initializeComputeProgram(Shader* shader, const char* computeFile, enum Shad
         shader->terrainGen.cameraPosition = glGetUniformLocation(shader->program, "camPos");
         shader->terrainGen.worldOffset = glGetUniformLocation(shader->program, "worldOffset");
         shader->terrainGen.voxelScale = glGetUniformLocation(shader->program, "voxelScale");
+        shader->terrainGen.stage = glGetUniformLocation(shader->program, "stage");
+        shader->terrainGen.firstVertex = glGetUniformLocation(shader->program, "firstVertex");
+        shader->terrainGen.firstTriangle = glGetUniformLocation(shader->program, "firstTriangle");
+        shader->terrainGen.cachedStride = glGetUniformLocation(shader->program, "cachedStride");
+        shader->terrainGen.gridStride = glGetUniformLocation(shader->program, "gridStride");
+        shader->terrainGen.mesher = glGetUniformLocation(shader->program, "mesher");
         break;
     default:
         INVALID_CODE_PATH
@@ -0,0 +1,234 @@
+#include "engine.h"
+
+// Sub-allocator for chunk meshes.
+//
+// Instead of a vertex and element buffer per chunk there are a few large pages,
+// every mesh gets an exact sized range of vertices and triangles in one of them
+// and is drawn with a base vertex and index offset. A page is only created when
+// no existing page has room, so buffers are never reallocated while streaming.
+//
+// Each page keeps a free list of ranges sorted by offset. Allocation takes the
+// smallest range that fits, freeing merges the range with its neighbours.
+
+static void meshArenaFreeListInit(MeshArenaFreeList *list, u32 capacity)
+{
+    list->ranges[0].offset = 0;
+    list->ranges[0].count = capacity;
+    list->rangeCount = 1;
+    list->capacity = capacity;
+    list->used = 0;
+}
+
+// best fit, -1 if nothing is big enough
+static i32 meshArenaFreeListFind(MeshArenaFreeList *list, u32 count)
+{
+    i32 best = -1;
+    for(u32 i = 0; i < list->rangeCount; i++)
+    {
+        u32 rangeCount = list->ranges[i].count;
+        if(rangeCount >= count && (best < 0 || rangeCount < list->ranges[best].count))
+        {
+            best = i;
+            if(rangeCount == count)
+                break;
+        }
+    }
+    return best;
+}
+
+static u32 meshArenaFreeListTake(MeshArenaFreeList *list, i32 index, u32 count)
+{
+    MeshArenaRange *range = &list->ranges[index];
+    u32 offset = range->offset;
+    if(range->count == count)
+    {
+        memmove(&list->ranges[index], &list->ranges[index+1], (list->rangeCount-index-1)*sizeof(MeshArenaRange));
+        list->rangeCount--;
+    }
+    else
+    {
+        range->offset += count;
+        range->count -= count;
+    }
+    list->used += count;
+    return offset;
+}
+
+static void meshArenaFreeListRelease(MeshArenaFreeList *list, u32 offset, u32 count)
+{
+    // first range behind the released one
+    u32 lo = 0, hi = list->rangeCount;
+    while(lo < hi)
+    {
+        u32 mid = (lo+hi)/2;
+        if(list->ranges[mid].offset < offset)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    u32 next = lo;
+    assert(next == list->rangeCount || list->ranges[next].offset >= offset+count);
+
+    b32 mergePrev = next > 0 && list->ranges[next-1].offset+list->ranges[next-1].count == offset;
+    b32 mergeNext = next < list->rangeCount && offset+count == list->ranges[next].offset;
+    if(mergePrev && mergeNext)
+    {
+        list->ranges[next-1].count += count + list->ranges[next].count;
+        memmove(&list->ranges[next], &list->ranges[next+1], (list->rangeCount-next-1)*sizeof(MeshArenaRange));
+        list->rangeCount--;
+    }
+    else if(mergePrev)
+    {
+        list->ranges[next-1].count += count;
+    }
+    else if(mergeNext)
+    {
+        list->ranges[next].offset = offset;
+        list->ranges[next].count += count;
+    }
+    else
+    {
+        // can't run out, every range is separated by at least one allocation
+        assert(list->rangeCount < MESH_ARENA_MAX_RANGES);
+        memmove(&list->ranges[next+1], &list->ranges[next], (list->rangeCount-next)*sizeof(MeshArenaRange));
+        list->ranges[next].offset = offset;
+        list->ranges[next].count = count;
+        list->rangeCount++;
+    }
+    list->used -= count;
+}
+
+static b32 meshArenaAddPage(MeshArena *arena)
+{
+    if(arena->pageCount >= MESH_ARENA_MAX_PAGES)
+        return false;
+    MeshArenaPage *page = &arena->pages[arena->pageCount];
+
+    glGenVertexArrays(1, &page->VAO);
+    glGenBuffers(1, &page->vertexBuffer);
+    glGenBuffers(1, &page->elementBuffer);
+
+    glBindVertexArray(page->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, page->vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, MESH_ARENA_PAGE_VERTICES*sizeof(VertexOut), 0, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    // quantized, see VertexOut
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(VertexOut), (GLvoid*)offsetof(VertexOut, position));
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(VertexOut), (GLvoid*)offsetof(VertexOut, normal));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page->elementBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, MESH_ARENA_PAGE_TRIANGLES*sizeof(TriangleOut), 0, GL_DYNAMIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    meshArenaFreeListInit(&page->vertices, MESH_ARENA_PAGE_VERTICES);
+    meshArenaFreeListInit(&page->triangles, MESH_ARENA_PAGE_TRIANGLES);
+    arena->pageCount++;
+    printf("Mesh arena page %u: %.0fMB vertices, %.0fMB elements\n", arena->pageCount,
+           MESH_ARENA_PAGE_VERTICES*sizeof(VertexOut)/(r64)Megabytes(1), MESH_ARENA_PAGE_TRIANGLES*sizeof(TriangleOut)/(r64)Megabytes(1));
+    return true;
+}
+
+void meshArenaInit(MeshArena *arena)
+{
+    arena->pageCount = 0;
+    arena->allocations = 0;
+    arena->failedAllocations = 0;
+    meshArenaAddPage(arena);
+}
+
+void meshArenaDestroy(MeshArena *arena)
+{
+    for(u32 i = 0; i < arena->pageCount; i++)
+    {
+        MeshArenaPage *page = &arena->pages[i];
+        glDeleteVertexArrays(1, &page->VAO);
+        glDeleteBuffers(1, &page->vertexBuffer);
+        glDeleteBuffers(1, &page->elementBuffer);
+    }
+    arena->pageCount = 0;
+}
+
+// both ranges come from the same page so the mesh can be drawn with its VAO
+b32 meshArenaAlloc(MeshArena *arena, u32 vertexCount, u32 triangleCount, MeshArenaAllocation *alloc)
+{
+    assert(vertexCount > 0 && triangleCount > 0);
+    // wouldn't fit an empty page either, adding pages for it only wastes memory
+    if(vertexCount > MESH_ARENA_PAGE_VERTICES || triangleCount > MESH_ARENA_PAGE_TRIANGLES)
+    {
+        alloc->valid = false;
+        arena->failedAllocations++;
+        return false;
+    }
+    for(u32 i = 0; ; i++)
+    {
+        if(i == arena->pageCount && !meshArenaAddPage(arena))
+            break;
+
+        MeshArenaPage *page = &arena->pages[i];
+        i32 vertexRange = meshArenaFreeListFind(&page->vertices, vertexCount);
+        i32 triangleRange = meshArenaFreeListFind(&page->triangles, triangleCount);
+        if(vertexRange < 0 || triangleRange < 0)
+            continue;
+
+        alloc->valid = true;
+        alloc->page = i;
+        alloc->firstVertex = meshArenaFreeListTake(&page->vertices, vertexRange, vertexCount);
+        alloc->vertexCount = vertexCount;
+        alloc->firstTriangle = meshArenaFreeListTake(&page->triangles, triangleRange, triangleCount);
+        alloc->triangleCount = triangleCount;
+        arena->allocations++;
+        return true;
+    }
+    alloc->valid = false;
+    arena->failedAllocations++;
+    return false;
+}
+
+void meshArenaFree(MeshArena *arena, MeshArenaAllocation *alloc)
+{
+    if(!alloc->valid)
+        return;
+    MeshArenaPage *page = &arena->pages[alloc->page];
+    meshArenaFreeListRelease(&page->vertices, alloc->firstVertex, alloc->vertexCount);
+    meshArenaFreeListRelease(&page->triangles, alloc->firstTriangle, alloc->triangleCount);
+    alloc->valid = false;
+    arena->allocations--;
+}
+
+// fragmentation is the part of the free space that isn't in the largest range
+// of its page
+static void meshArenaListStats(MeshArena *arena, b32 triangles, u64 *used, u64 *capacity, r32 *fragmentation)
+{
+    u64 freeTotal = 0;
+    u64 freeScattered = 0;
+    *used = 0;
+    *capacity = 0;
+    for(u32 i = 0; i < arena->pageCount; i++)
+    {
+        MeshArenaFreeList *list = triangles ? &arena->pages[i].triangles : &arena->pages[i].vertices;
+        *used += list->used;
+        *capacity += list->capacity;
+        u32 largest = 0;
+        for(u32 j = 0; j < list->rangeCount; j++)
+            largest = max(largest, list->ranges[j].count);
+        freeTotal += list->capacity - list->used;
+        freeScattered += list->capacity - list->used - largest;
+    }
+    *fragmentation = freeTotal > 0 ? freeScattered/(r32)freeTotal : 0.0f;
+}
+
+void meshArenaPrintStats(MeshArena *arena)
+{
+    u64 vertUsed, vertCapacity, triUsed, triCapacity;
+    r32 vertFrag, triFrag;
+    meshArenaListStats(arena, false, &vertUsed, &vertCapacity, &vertFrag);
+    meshArenaListStats(arena, true, &triUsed, &triCapacity, &triFrag);
+    printf("mesh arena: %u meshes in %u pages, vertices %.1f/%.1fMB (%.1f%%, %.1f%% fragmented), "
+           "elements %.1f/%.1fMB (%.1f%%, %.1f%% fragmented), %u failed\n",
+           arena->allocations, arena->pageCount,
+           vertUsed*sizeof(VertexOut)/(r64)Megabytes(1), vertCapacity*sizeof(VertexOut)/(r64)Megabytes(1),
+           vertCapacity ? 100.0*vertUsed/vertCapacity : 0.0, vertFrag*100.0f,
+           triUsed*sizeof(TriangleOut)/(r64)Megabytes(1), triCapacity*sizeof(TriangleOut)/(r64)Megabytes(1),
+           triCapacity ? 100.0*triUsed/triCapacity : 0.0, triFrag*100.0f, arena->failedAllocations);
+}
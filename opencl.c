@@ -0,0 +1,477 @@
+#include "opencl.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Terrain generation on any OpenCL device.
+//
+// Same results as voxelGenerateChunk() for both meshers, a chunk goes through
+// the four kernels of terrain.cl on the job's own queue and its totals are
+// read back behind them. Once those arrived the mesh is copied out at its
+// exact size. Only the main thread submits, the kernels are shared and get
+// their arguments right before they are queued.
+//
+// Building the program from source can take seconds on CPU runtimes, so the
+// binary is stored in the cache directory under a hash of the source, the
+// build options and the device and driver. A binary the driver refuses is
+// simply built again.
+
+// samples a block's columns have at most, and the columns, the kernels use the
+// surface nets layout for both meshers
+#define OPENCL_BLOCK_SAMPLES VOXEL_NETS_SAMPLES
+#define OPENCL_BLOCK_COLUMNS (OPENCL_BLOCK_SAMPLES*OPENCL_BLOCK_SAMPLES)
+#define OPENCL_BLOCK_VALUES (OPENCL_BLOCK_COLUMNS*OPENCL_BLOCK_SAMPLES)
+#define OPENCL_BUILD_OPTIONS "-cl-std=CL1.2"
+#define OPENCL_PATH_LENGTH 512
+
+static b32 openclCheck(cl_int err, const char *what)
+{
+    if(err == CL_SUCCESS)
+        return true;
+    printf("OpenCL: %s failed (%d)\n", what, err);
+    return false;
+}
+
+// FNV-1a
+static u64 openclHash(u64 hash, const void *data, u64 size)
+{
+    const u8 *bytes = (const u8*)data;
+    for(u64 i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static char* openclReadFile(const char *fileName, u64 *size)
+{
+    FILE *file = fopen(fileName, "rb");
+    if(!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *ret = length > 0 ? (char*)malloc(length + 1) : 0;
+    if(ret && fread(ret, 1, length, file) != (size_t)length)
+    {
+        free(ret);
+        ret = 0;
+    }
+    fclose(file);
+    if(!ret)
+        return 0;
+    ret[length] = 0;
+    *size = (u64)length;
+    return ret;
+}
+
+// first device of preferredType on any platform, or of any type if none has one
+static b32 openclPickDevice(OpenclState *cl, cl_device_type preferredType, cl_platform_id *platform)
+{
+    cl_uint platformCount = 0;
+    if(clGetPlatformIDs(0, 0, &platformCount) != CL_SUCCESS || platformCount == 0)
+    {
+        printf("OpenCL: no platforms\n");
+        return false;
+    }
+    cl_platform_id *platforms = (cl_platform_id*)malloc(platformCount*sizeof(cl_platform_id));
+    clGetPlatformIDs(platformCount, platforms, 0);
+
+    b32 found = false;
+    cl_device_type types[2] = {preferredType, CL_DEVICE_TYPE_ALL};
+    for(u32 t = 0; t < 2 && !found; t++)
+    {
+        for(u32 i = 0; i < platformCount && !found; i++)
+        {
+            cl_uint deviceCount = 0;
+            if(clGetDeviceIDs(platforms[i], types[t], 1, &cl->device, &deviceCount) == CL_SUCCESS && deviceCount > 0)
+            {
+                *platform = platforms[i];
+                found = true;
+            }
+        }
+    }
+    free(platforms);
+    if(!found)
+        printf("OpenCL: no devices\n");
+    return found;
+}
+
+static b32 openclBuild(OpenclState *cl, cl_program program, const char *options)
+{
+    cl_int err = clBuildProgram(program, 1, &cl->device, options, 0, 0);
+    if(err == CL_SUCCESS)
+        return true;
+    size_t logSize = 0;
+    clGetProgramBuildInfo(program, cl->device, CL_PROGRAM_BUILD_LOG, 0, 0, &logSize);
+    char *log = (char*)malloc(logSize + 1);
+    clGetProgramBuildInfo(program, cl->device, CL_PROGRAM_BUILD_LOG, logSize, log, 0);
+    log[logSize] = 0;
+    printf("OpenCL: building the terrain kernels failed (%d)\n%s\n", err, log);
+    free(log);
+    return false;
+}
+
+static void openclSaveBinary(OpenclState *cl, const char *cacheDirectory, const char *fileName)
+{
+    size_t size = 0;
+    if(clGetProgramInfo(cl->program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, 0) != CL_SUCCESS || size == 0)
+        return;
+    unsigned char *binary = (unsigned char*)malloc(size);
+    if(clGetProgramInfo(cl->program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, 0) == CL_SUCCESS
+            && (mkdir(cacheDirectory, 0755) == 0 || errno == EEXIST))
+    {
+        FILE *file = fopen(fileName, "wb");
+        if(file)
+        {
+            if(fwrite(binary, 1, size, file) != size)
+                printf("OpenCL: writing %s failed\n", fileName);
+            fclose(file);
+        }
+    }
+    free(binary);
+}
+
+// from the cache if it's there, otherwise from source and into the cache
+static b32 openclLoadProgram(OpenclState *cl, const char *kernelFile, const char *cacheDirectory)
+{
+    u64 sourceSize;
+    char *source = openclReadFile(kernelFile, &sourceSize);
+    if(!source)
+    {
+        printf("OpenCL: failed to open kernel file %s\n", kernelFile);
+        return false;
+    }
+
+    // the CPU's results need division and square roots without the error OpenCL allows by default
+    char options[256];
+    cl_device_fp_config fpConfig = 0;
+    clGetDeviceInfo(cl->device, CL_DEVICE_SINGLE_FP_CONFIG, sizeof(fpConfig), &fpConfig, 0);
+    snprintf(options, sizeof(options), "%s%s", OPENCL_BUILD_OPTIONS,
+             (fpConfig & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT) ? " -cl-fp32-correctly-rounded-divide-sqrt" : "");
+
+    char deviceInfo[512];
+    size_t infoSize = 0;
+    u64 hash = 0xcbf29ce484222325ULL;
+    hash = openclHash(hash, source, sourceSize);
+    hash = openclHash(hash, options, strlen(options));
+    cl_device_info keys[3] = {CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    for(u32 i = 0; i < 3; i++)
+    {
+        if(clGetDeviceInfo(cl->device, keys[i], sizeof(deviceInfo), deviceInfo, &infoSize) == CL_SUCCESS)
+            hash = openclHash(hash, deviceInfo, infoSize);
+    }
+    char binaryFile[OPENCL_PATH_LENGTH];
+    snprintf(binaryFile, sizeof(binaryFile), "%s/terrain_%016llx.clbin", cacheDirectory, (unsigned long long)hash);
+
+    cl_int err;
+    u64 binarySize;
+    unsigned char *binary = (unsigned char*)openclReadFile(binaryFile, &binarySize);
+    cl->programFromCache = false;
+    if(binary)
+    {
+        size_t size = (size_t)binarySize;
+        const unsigned char *binaries[1] = {binary};
+        cl_int binaryStatus;
+        cl->program = clCreateProgramWithBinary(cl->context, 1, &cl->device, &size, binaries, &binaryStatus, &err);
+        if(err == CL_SUCCESS && binaryStatus == CL_SUCCESS && openclBuild(cl, cl->program, options))
+            cl->programFromCache = true;
+        else if(err == CL_SUCCESS)
+            clReleaseProgram(cl->program);
+        free(binary);
+    }
+
+    b32 ret = true;
+    if(!cl->programFromCache)
+    {
+        const char *sources[1] = {source};
+        size_t size = (size_t)sourceSize;
+        cl->program = clCreateProgramWithSource(cl->context, 1, sources, &size, &err);
+        ret = openclCheck(err, "clCreateProgramWithSource") && openclBuild(cl, cl->program, options);
+        if(ret)
+            openclSaveBinary(cl, cacheDirectory, binaryFile);
+        else if(err == CL_SUCCESS)
+            clReleaseProgram(cl->program);
+    }
+    free(source);
+    return ret;
+}
+
+b32 openclInit(OpenclState *cl, cl_device_type preferredType, const char *kernelFile, const char *cacheDirectory)
+{
+    memset(cl, 0, sizeof(OpenclState));
+    cl_platform_id platform;
+    if(!openclPickDevice(cl, preferredType, &platform))
+        return false;
+    clGetDeviceInfo(cl->device, CL_DEVICE_NAME, sizeof(cl->deviceName), cl->deviceName, 0);
+
+    const cl_context_properties contextProperties[] =
+    {
+        CL_CONTEXT_PLATFORM,
+        (cl_context_properties)platform,
+        0, 0
+    };
+    cl_int err;
+    cl->context = clCreateContext(contextProperties, 1, &cl->device, 0, 0, &err);
+    if(!openclCheck(err, "clCreateContext"))
+        return false;
+    if(!openclLoadProgram(cl, kernelFile, cacheDirectory))
+    {
+        clReleaseContext(cl->context);
+        return false;
+    }
+
+    cl_kernel *kernels[4] = {&cl->sampleKernel, &cl->countKernel, &cl->scanKernel, &cl->emitKernel};
+    const char *names[4] = {"terrainSample", "terrainCount", "terrainScan", "terrainEmit"};
+    b32 ok = true;
+    for(u32 i = 0; i < 4 && ok; i++)
+    {
+        *kernels[i] = clCreateKernel(cl->program, names[i], &err);
+        ok = openclCheck(err, names[i]);
+    }
+    if(ok)
+    {
+        cl->triangleTable = clCreateBuffer(cl->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                           sizeof(a2iTriangleConnectionTable), a2iTriangleConnectionTable, &err);
+        ok = openclCheck(err, "clCreateBuffer");
+    }
+    cl->initialized = true;
+    if(!ok)
+    {
+        openclShutdown(cl);
+        return false;
+    }
+    printf("OpenCL terrain device: %s (kernels %s)\n", cl->deviceName, cl->programFromCache ? "from cache" : "compiled");
+    return true;
+}
+
+void openclShutdown(OpenclState *cl)
+{
+    if(!cl->initialized)
+        return;
+    cl_kernel kernels[4] = {cl->sampleKernel, cl->countKernel, cl->scanKernel, cl->emitKernel};
+    for(u32 i = 0; i < 4; i++)
+    {
+        if(kernels[i])
+            clReleaseKernel(kernels[i]);
+    }
+    if(cl->triangleTable)
+        clReleaseMemObject(cl->triangleTable);
+    clReleaseProgram(cl->program);
+    clReleaseContext(cl->context);
+    memset(cl, 0, sizeof(OpenclState));
+}
+
+b32 openclJobInit(OpenclState *cl, OpenclTerrainJob *job, u32 maxGroups, u32 maxVertices, u32 maxTriangles)
+{
+    memset(job, 0, sizeof(OpenclTerrainJob));
+    cl_int err;
+    job->queue = clCreateCommandQueue(cl->context, cl->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if(!openclCheck(err, "clCreateCommandQueue"))
+        return false;
+
+    u64 blocks = (u64)maxGroups*maxGroups*maxGroups;
+    cl_mem *buffers[7] = {&job->values, &job->columnMasks, &job->columnCounts, &job->blockStarts,
+                          &job->totals, &job->vertices, &job->triangles};
+    u64 sizes[7] =
+    {
+        blocks*OPENCL_BLOCK_VALUES*sizeof(r32),
+        blocks*OPENCL_BLOCK_COLUMNS*sizeof(u64),
+        blocks*OPENCL_BLOCK_COLUMNS*2*sizeof(u32),
+        blocks*2*sizeof(u32),
+        3*sizeof(u32),
+        (u64)maxVertices*sizeof(VertexOut),
+        (u64)maxTriangles*sizeof(TriangleOut)
+    };
+    b32 ok = true;
+    for(u32 i = 0; i < 7 && ok; i++)
+    {
+        *buffers[i] = clCreateBuffer(cl->context, CL_MEM_READ_WRITE, sizes[i], 0, &err);
+        ok = openclCheck(err, "clCreateBuffer");
+    }
+    job->maxGroups = maxGroups;
+    job->maxVertices = maxVertices;
+    job->maxTriangles = maxTriangles;
+    if(!ok)
+        openclJobDestroy(job);
+    return ok;
+}
+
+void openclJobDestroy(OpenclTerrainJob *job)
+{
+    cl_mem buffers[9] = {job->field, job->edits, job->values, job->columnMasks, job->columnCounts,
+                         job->blockStarts, job->totals, job->vertices, job->triangles};
+    if(job->queue)
+        clFinish(job->queue);
+    for(u32 i = 0; i < 9; i++)
+    {
+        if(buffers[i])
+            clReleaseMemObject(buffers[i]);
+    }
+    if(job->sampleEvent)
+        clReleaseEvent(job->sampleEvent);
+    if(job->resultEvent)
+        clReleaseEvent(job->resultEvent);
+    if(job->queue)
+        clReleaseCommandQueue(job->queue);
+    memset(job, 0, sizeof(OpenclTerrainJob));
+}
+
+// buffer of at least size bytes, what was in it is lost
+static void openclReserve(OpenclState *cl, cl_mem *buffer, u64 *capacity, u64 size)
+{
+    if(size <= *capacity)
+        return;
+    if(*buffer)
+        clReleaseMemObject(*buffer);
+    cl_int err;
+    *buffer = clCreateBuffer(cl->context, CL_MEM_READ_ONLY, size, 0, &err);
+    b32 created = openclCheck(err, "clCreateBuffer");
+    assert(created);
+    (void)created;
+    *capacity = size;
+}
+
+static void openclSetArgs(cl_kernel kernel, u32 count, size_t *sizes, const void **values)
+{
+    for(u32 i = 0; i < count; i++)
+    {
+        b32 set = openclCheck(clSetKernelArg(kernel, i, sizes[i], values[i]), "clSetKernelArg");
+        assert(set);
+        (void)set;
+    }
+}
+
+void openclTerrainSubmit(OpenclState *cl, OpenclTerrainJob *job, VoxelField *field, Vec3 worldOffset,
+                         u32 groups, r32 voxelScale, VoxelMesher mesher)
+{
+    assert(groups <= job->maxGroups && !job->resultEvent);
+
+    // the caller's copies may change right after, so the writes block
+    u32 tunnelCount = field->gen->tunnelCount;
+    openclReserve(cl, &job->field, &job->fieldCapacity, sizeof(ChunkGenData) + tunnelCount*sizeof(Line3D));
+    clEnqueueWriteBuffer(job->queue, job->field, CL_TRUE, 0, sizeof(ChunkGenData), field->gen, 0, 0, 0);
+    if(tunnelCount > 0)
+    {
+        clEnqueueWriteBuffer(job->queue, job->field, CL_TRUE, sizeof(ChunkGenData), tunnelCount*sizeof(Line3D),
+                             field->tunnels, 0, 0, 0);
+    }
+    // without bricks only brickCount is read
+    u32 brickCount = field->edits->brickCount;
+    openclReserve(cl, &job->edits, &job->editCapacity, sizeof(VoxelEditChunk) + brickCount*sizeof(VoxelBrick));
+    clEnqueueWriteBuffer(job->queue, job->edits, CL_TRUE, 0,
+                         brickCount > 0 ? sizeof(VoxelEditChunk) : offsetof(VoxelEditChunk, table), field->edits, 0, 0, 0);
+    if(brickCount > 0)
+    {
+        clEnqueueWriteBuffer(job->queue, job->edits, CL_TRUE, sizeof(VoxelEditChunk), brickCount*sizeof(VoxelBrick),
+                             field->bricks, 0, 0, 0);
+    }
+
+    OpenclTerrainParams params;
+    params.worldOffset[0] = worldOffset.x;
+    params.worldOffset[1] = worldOffset.y;
+    params.worldOffset[2] = worldOffset.z;
+    params.voxelScale = voxelScale;
+    params.groups = groups;
+    params.mesher = mesher;
+    params.maxVertices = job->maxVertices;
+    params.maxTriangles = job->maxTriangles;
+
+    size_t mem = sizeof(cl_mem);
+    size_t paramSize = sizeof(OpenclTerrainParams);
+    {
+        size_t sizes[] = {mem, mem, paramSize, mem};
+        const void *values[] = {&job->field, &job->edits, &params, &job->values};
+        openclSetArgs(cl->sampleKernel, ARRAY_COUNT(sizes), sizes, values);
+    }
+    {
+        size_t sizes[] = {paramSize, mem, mem, mem, mem};
+        const void *values[] = {&params, &cl->triangleTable, &job->values, &job->columnMasks, &job->columnCounts};
+        openclSetArgs(cl->countKernel, ARRAY_COUNT(sizes), sizes, values);
+    }
+    {
+        size_t sizes[] = {paramSize, mem, mem, mem};
+        const void *values[] = {&params, &job->columnCounts, &job->blockStarts, &job->totals};
+        openclSetArgs(cl->scanKernel, ARRAY_COUNT(sizes), sizes, values);
+    }
+    {
+        size_t sizes[] = {mem, mem, paramSize, mem, mem, mem, mem, mem, mem, mem, mem};
+        const void *values[] = {&job->field, &job->edits, &params, &cl->triangleTable, &job->values, &job->columnMasks,
+                                &job->columnCounts, &job->blockStarts, &job->totals, &job->vertices, &job->triangles};
+        openclSetArgs(cl->emitKernel, ARRAY_COUNT(sizes), sizes, values);
+    }
+
+    size_t columns = (size_t)groups*groups*groups*OPENCL_BLOCK_COLUMNS;
+    size_t one = 1;
+    cl_int err = clEnqueueNDRangeKernel(job->queue, cl->sampleKernel, 1, 0, &columns, 0, 0, 0, &job->sampleEvent);
+    err |= clEnqueueNDRangeKernel(job->queue, cl->countKernel, 1, 0, &columns, 0, 0, 0, 0);
+    err |= clEnqueueNDRangeKernel(job->queue, cl->scanKernel, 1, 0, &one, 0, 0, 0, 0);
+    err |= clEnqueueNDRangeKernel(job->queue, cl->emitKernel, 1, 0, &columns, 0, 0, 0, 0);
+    err |= clEnqueueReadBuffer(job->queue, job->totals, CL_FALSE, 0, sizeof(job->result), job->result, 0, 0, &job->resultEvent);
+    b32 queued = openclCheck(err, "queueing the terrain kernels");
+    assert(queued);
+    (void)queued;
+    clFlush(job->queue);
+}
+
+b32 openclTerrainDone(OpenclTerrainJob *job)
+{
+    cl_int status = CL_COMPLETE;
+    clGetEventInfo(job->resultEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+    // negative is an error, it's done as well
+    return status <= CL_COMPLETE;
+}
+
+r32 openclTerrainRead(OpenclTerrainJob *job, VoxelMeshOutput *out)
+{
+    out->vertexCount = 0;
+    out->triangleCount = 0;
+    out->overflow = false;
+
+    cl_int status;
+    clGetEventInfo(job->resultEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+    if(status < 0)
+    {
+        printf("OpenCL: terrain generation failed (%d)\n", status);
+        out->overflow = true;
+    }
+    else if(job->result[2] || job->result[0] > out->maxVertices || job->result[1] > out->maxTriangles)
+    {
+        out->overflow = true;
+    }
+    else
+    {
+        // the queue has nothing else, these don't wait for anything
+        cl_int err = CL_SUCCESS;
+        if(job->result[0] > 0)
+        {
+            err |= clEnqueueReadBuffer(job->queue, job->vertices, CL_TRUE, 0, job->result[0]*sizeof(VertexOut),
+                                       out->vertices, 0, 0, 0);
+            err |= clEnqueueReadBuffer(job->queue, job->triangles, CL_TRUE, 0, job->result[1]*sizeof(TriangleOut),
+                                       out->triangles, 0, 0, 0);
+        }
+        if(openclCheck(err, "reading the terrain mesh"))
+        {
+            out->vertexCount = job->result[0];
+            out->triangleCount = job->result[1];
+        }
+        else
+        {
+            out->overflow = true;
+        }
+    }
+
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(job->sampleEvent, CL_PROFILING_COMMAND_START, sizeof(start), &start, 0);
+    clGetEventProfilingInfo(job->resultEvent, CL_PROFILING_COMMAND_END, sizeof(end), &end, 0);
+    clReleaseEvent(job->sampleEvent);
+    clReleaseEvent(job->resultEvent);
+    job->sampleEvent = 0;
+    job->resultEvent = 0;
+    return end > start ? (end - start)/1000000.0f : 0.0f;
+}
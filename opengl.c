@@ -2,57 +2,88 @@
 #include "core.h"
 
 #include "math.h"
+#include <stddef.h>
 
 void openglInitializeTerrainGeneration(TerrainGeneratorState* tgstate, u32 maxGroups, u32 cubesPerSeed, r32 voxelScale)
 {
     tgstate->voxelScale = voxelScale;
     u32 seedBufferSize = maxGroups*maxGroups*maxGroups*sizeof(Vec4);
 
-    glGenBuffers(1, &tgstate->vertInbuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tgstate->vertInbuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, seedBufferSize, 0, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    terrainGenInitParams(tgstate);
 
-    tgstate->tunnelData.tunnelCount = 0;
-    // DOEST WORK
-    tgstate->tunnelData.firstOctaveMax = 4.5f;
-    tgstate->tunnelData.secondOctaveMax = 20.6f;
+    u32 workGroups = maxGroups*maxGroups*maxGroups;
+    // room for the extra layer surface nets sample
+    u32 bufferSize = workGroups*VOXEL_NETS_SAMPLES*VOXEL_NETS_SAMPLES*VOXEL_NETS_SAMPLES*sizeof(r32);
 
-    glGenBuffers(1, &tgstate->tunnelBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tgstate->tunnelBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ChunkGenData), &tgstate->tunnelData, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // every slot gets its own scratch so generations don't have to wait for each other
+    for(u32 i = 0; i < TERRAIN_GEN_SLOTS; i++)
+    {
+        TerrainGenSlot *slot = &tgstate->slots[i];
+
+        glGenBuffers(1, &slot->vertInbuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->vertInbuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, seedBufferSize, 0, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glGenBuffers(1, &slot->densityBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->densityBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bufferSize, 0, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glGenBuffers(1, &slot->blockBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->blockBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, workGroups*sizeof(GLuint)*2, NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        slot->tunnelBufferSize = sizeof(ChunkGenData) + 16*sizeof(Line3D);
+        glGenBuffers(1, &slot->tunnelBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->tunnelBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slot->tunnelBufferSize, 0, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        slot->editBufferSize = sizeof(VoxelEditChunk);
+        glGenBuffers(1, &slot->editBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->editBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slot->editBufferSize, 0, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // sized by the first emit that needs it
+        glGenBuffers(1, &slot->readbackBuffer);
+        slot->readbackBufferSize = 0;
+
+        glGenQueries(1, &slot->timerQuery);
+        glGenQueries(1, &slot->emitTimerQuery);
+        slot->fence = 0;
+        slot->busy = false;
+    }
+    printf("Density buffer size %.1fMB (x%d slots)\n", bufferSize/(r64)Megabytes(1), TERRAIN_GEN_SLOTS);
 
-    glGenBuffers(1, &tgstate->edgeVertexBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tgstate->edgeVertexBuffer);
-    u32 workgourpsPerChunk = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
-    int workGroups = workgourpsPerChunk * workgourpsPerChunk * workgourpsPerChunk ;
-    u32 bufferSize = workGroups*(CHUNK_WORKGROUP_SIZE+1)*(CHUNK_WORKGROUP_SIZE+1)*(CHUNK_WORKGROUP_SIZE+1)*sizeof(Vec4)*3;
-    tgstate->edgeVertexBufferSize = bufferSize;
-    glBufferData(GL_SHADER_STORAGE_BUFFER, bufferSize, 0, GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    printf("Buffer size %dMB\n",bufferSize/(u32)Megabytes(1));
+    // the grid of the finest LOD, coarser ones take every n-th sample of it
+    u32 gridSize = (CHUNK_SIZE+1)*(CHUNK_SIZE+1)*(CHUNK_SIZE+1)*sizeof(r32);
+    for(u32 i = 0; i < TERRAIN_DENSITY_CACHE_ENTRIES; i++)
+    {
+        TerrainDensityEntry *entry = &tgstate->densityCache[i];
+        glGenBuffers(1, &entry->buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, entry->buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, gridSize, 0, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        entry->stride = 0;
+        entry->lastUsedFrame = 0;
+    }
+    printf("Density cache size %.1fMB (x%d chunks)\n", gridSize/(r64)Megabytes(1), TERRAIN_DENSITY_CACHE_ENTRIES);
 
-    glGenBuffers(1, &tgstate->vertAtomicBuffer);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, tgstate->vertAtomicBuffer);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint)*2, NULL, GL_DYNAMIC_READ);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+    meshArenaInit(&tgstate->meshArena);
 
+    tgstate->slotsInFlight = 0;
+    tgstate->frame = 0;
     tgstate->initialized = true;
 }
 
-void openglPrepageTerrainGeneration(TerrainGeneratorState* tgstate, GLuint outBuffer, GLuint outElementBuffer, u32 groups, r32 scale)
+void openglPrepageTerrainGeneration(TerrainGeneratorState* tgstate, TerrainGenSlot* slot, u32 groups, r32 scale,
+                                    VoxelField *field)
 {
     assert(tgstate->initialized);
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, outBuffer);
-    // TODO: is this guaranteed to not reallocate if we always use same size even on buffer previously created?
-    glBufferData(GL_SHADER_STORAGE_BUFFER, (CHUNK_VERTEX_BUFFER_SIZE/(CHUNK_SIZE/CHUNK_WORKGROUP_SIZE))*groups, 0, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, outElementBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, (CHUNK_ELEMENT_BUFFER_SIZE/(CHUNK_SIZE/CHUNK_WORKGROUP_SIZE))*groups, 0, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    assert(!slot->busy);
 
     u32 seedBufferSize = groups*groups*groups*sizeof(Vec4);
     Vec4* seedVerts = (Vec4*)alloca(seedBufferSize);
@@ -74,25 +105,45 @@ void openglPrepageTerrainGeneration(TerrainGeneratorState* tgstate, GLuint outBu
     }
 
     // update seed vertices
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tgstate->vertInbuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->vertInbuffer);
     glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, seedBufferSize, (GLvoid*)seedVerts);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    // reset atomic counters
-    GLuint* counter;
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, tgstate->vertAtomicBuffer);
-    counter = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint)*2,
-                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT
-                                             );
-    memset(counter, 0, sizeof(GLuint)*2);
-    glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
-
-    // update tunnel data;
-    //printf("first was %f",tgstate->tunnelData.firstOctaveMax);
-    glBindBuffer(GL_ARRAY_BUFFER, tgstate->tunnelBuffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(ChunkGenData), &tgstate->tunnelData);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // parameters and the chunk's tunnels, the buffer doubles when they don't fit
+    ChunkGenData *gen = field->gen;
+    u32 tunnelSize = gen->tunnelCount*sizeof(Line3D);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->tunnelBuffer);
+    if(sizeof(ChunkGenData) + tunnelSize > slot->tunnelBufferSize)
+    {
+        while(sizeof(ChunkGenData) + tunnelSize > slot->tunnelBufferSize)
+            slot->tunnelBufferSize *= 2;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slot->tunnelBufferSize, 0, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ChunkGenData), gen);
+    if(tunnelSize > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ChunkGenData), tunnelSize, field->tunnels);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // edit bricks the chunk samples, without any the shader only reads brickCount
+    VoxelEditChunk *edits = field->edits;
+    u32 brickSize = edits->brickCount*sizeof(VoxelBrick);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->editBuffer);
+    if(edits->brickCount == 0)
+    {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, offsetof(VoxelEditChunk, table), edits);
+    }
+    else
+    {
+        if(sizeof(VoxelEditChunk) + brickSize > slot->editBufferSize)
+        {
+            while(sizeof(VoxelEditChunk) + brickSize > slot->editBufferSize)
+                slot->editBufferSize *= 2;
+            glBufferData(GL_SHADER_STORAGE_BUFFER, slot->editBufferSize, 0, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(VoxelEditChunk), edits);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(VoxelEditChunk), brickSize, field->bricks);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     int glerror = glGetError();
     if(glerror != 0)
@@ -595,7 +646,8 @@ void openGLRenderCommands(OpenglState* glstate, RenderCommands *commands, u32 wi
                 //printf("render terrain \n");
 
                 glBindVertexArray(entry->mesh->VAO);
-                glDrawElements(GL_TRIANGLES, entry->mesh->faces*3, GL_UNSIGNED_INT, 0);
+                glDrawElementsBaseVertex(GL_TRIANGLES, entry->mesh->faces*3, GL_UNSIGNED_INT,
+                                         (GLvoid*)(entry->mesh->firstIndex*sizeof(GLuint)), entry->mesh->baseVertex);
                 glBindVertexArray(0);
 
             } break;
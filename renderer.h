@@ -35,6 +35,12 @@ typedef struct TerrainGenShader
     GLuint cameraPosition;
     GLuint worldOffset;
     GLuint voxelScale;
+    GLuint stage;
+    GLuint firstVertex;
+    GLuint firstTriangle;
+    GLuint cachedStride;
+    GLuint gridStride;
+    GLuint mesher;
 } TerrainGenShader;
 
 typedef struct PostProcShader
@@ -157,6 +163,8 @@ typedef struct ArrayMesh
     b32 loadedToGPU;
     r32 boundingRadius;
     u32 vertexStride;
+    i32 baseVertex; // added to every index, meshes share their buffers
+    u32 firstIndex;
     void *data;
 } ArrayMesh;
 
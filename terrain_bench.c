@@ -0,0 +1,714 @@
+#include "core.h"
+
+#include <GL/glx.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Headless terrain generation benchmark.
+//
+// Generates a grid of chunks at every LOD with the game's generator
+// parameters and a tunnel set made from a fixed seed. Prints the generation
+// time percentiles of a chunk, mesh sizes, how much of the CPU output buffers
+// the meshes use and a checksum of all meshes, which only changes if the
+// generator's output does.
+//
+//   terrain_bench.out [-backend cpu|opencl|gl] [-grid N] [-layers N] [-lod 1-3]
+//                     [-mesher mc|nets] [-warp 3d|column] [-tunnels N] [-seed N] [-threads N]
+//                     [-cldevice gpu|cpu]
+//
+// cpu runs voxelGenerateChunk() on the worker pool and opencl the kernels of
+// opencl.c, neither needs a display. gl goes through terrain_generator.c like
+// the game does, in the context of a window that is never shown, and reads
+// the meshes back from the mesh arena. Its time is from submit to completion
+// with one chunk in flight, cpu is a worker's time and opencl the device's.
+// Before that it checks on the CPU that neighbouring chunks agree on their
+// shared face, with a tunnel just past it, and fails if they don't.
+// Run it from the build directory, kernels/ and shaders/ are looked up there.
+// build.sh builds the game library with -O0, compare times of the same build.
+
+#define BENCH_MAX_SLOTS 64
+
+typedef enum BenchBackend
+{
+    BenchBackend_CPU,
+    BenchBackend_OpenCL,
+    BenchBackend_GL
+} BenchBackend;
+
+typedef struct BenchConfig
+{
+    BenchBackend backend;
+    u32 grid; // chunks along x and z
+    u32 layers; // chunks along y, centered on y 0
+    u32 lodLevel; // 0 for all of them
+    VoxelMesher mesher;
+    u32 columnWarp; // ChunkGenData::columnWarp
+    u32 tunnels;
+    u32 seed;
+    u32 threads; // 0 is one per core
+    cl_device_type clDevice;
+} BenchConfig;
+
+typedef struct BenchChunk
+{
+    IVec3 chunkId;
+    u32 lodLevel;
+    VoxelMesher mesher;
+    ChunkGenData genData;
+    Line3D *tunnels; // genData.tunnelCount of them
+
+    r32 ms;
+    u32 vertexCount;
+    u32 triangleCount;
+    b32 overflow;
+    u64 hash; // of the vertices and triangles
+} BenchChunk;
+
+// a chunk on a worker or an OpenCL queue
+typedef struct BenchSlot
+{
+    BenchChunk *chunk;
+    VoxelEditChunk edits; // none
+    VoxelScratch *scratch;
+    VoxelMeshOutput out;
+    OpenclTerrainJob job;
+    volatile b32 done;
+    b32 busy;
+} BenchSlot;
+
+static r64 benchElapsedMs(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start->tv_sec)*1000.0+(now.tv_nsec-start->tv_nsec)/1000000.0;
+}
+
+// FNV-1a
+static u64 benchHash(u64 hash, const void *data, u64 size)
+{
+    const u8 *bytes = (const u8*)data;
+    for(u64 i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void benchHashMesh(BenchChunk *chunk, VertexOut *vertices, u32 vertexCount, TriangleOut *triangles, u32 triangleCount)
+{
+    chunk->vertexCount = vertexCount;
+    chunk->triangleCount = triangleCount;
+    chunk->hash = benchHash(0xcbf29ce484222325ULL, vertices, vertexCount*sizeof(VertexOut));
+    chunk->hash = benchHash(chunk->hash, triangles, triangleCount*sizeof(TriangleOut));
+}
+
+static u32 benchRandom(u32 *seed)
+{
+    *seed = *seed*1664525u + 1013904223u;
+    return *seed >> 8;
+}
+
+static r32 benchRandomRange(u32 *seed, r32 low, r32 high)
+{
+    return low + (high - low)*(benchRandom(seed)/16777216.0f);
+}
+
+// straight tunnels 20 to 80 units long through the benchmarked chunks
+static void benchAddTunnels(TerrainGeneratorState *tgstate, BenchConfig *config)
+{
+    u32 seed = config->seed;
+    r32 half = (r32)(config->grid*CHUNK_SIZE)/2.0f;
+    r32 height = (r32)(config->layers*CHUNK_SIZE)/2.0f;
+    for(u32 i = 0; i < config->tunnels; i++)
+    {
+        Vec3 start = vec3(benchRandomRange(&seed, -half, half), benchRandomRange(&seed, -height, height),
+                          benchRandomRange(&seed, -half, half));
+        Vec3 direction = vec3(benchRandomRange(&seed, -1.0f, 1.0f), benchRandomRange(&seed, -0.5f, 0.5f),
+                              benchRandomRange(&seed, -1.0f, 1.0f));
+        direction = vec3Normalized(&direction);
+        r32 length = benchRandomRange(&seed, 20.0f, 80.0f);
+        Line3D tunnel;
+        tunnel.start = vec4FromVec3AndW(start, 1.0f);
+        tunnel.end = vec4(start.x + direction.x*length, start.y + direction.y*length, start.z + direction.z*length, 1.0f);
+        tunnelGridAdd(&tgstate->tunnels, tunnel);
+    }
+}
+
+// Generates the chunks at the origin and past its +x face at LOD 1 with a
+// tunnel that carves just past the face, so only the samples and normals the
+// first chunk takes beyond its cube see it. Every vertex of the first chunk's
+// cells past the face must also be in the second chunk, otherwise the seam
+// cracks. Returns how many aren't, *checked is how many were looked at.
+static u32 benchSeamCheck(BenchConfig *config, u32 *checked)
+{
+    TerrainGeneratorState *tgstate = (TerrainGeneratorState*)calloc(1, sizeof(TerrainGeneratorState));
+    terrainGenInitParams(tgstate);
+    tgstate->genData.columnWarp = config->columnWarp;
+    // sets the parameters up, there are no tunnels yet
+    IVec3 chunkId = {};
+    terrainGenClassify(tgstate, chunkId);
+
+    // the tunnel is under the surface where it crosses the face
+    r32 tunnelX = CHUNK_SIZE + 1.0f + VOXEL_TUNNEL_RADIUS;
+    r32 surfaceY = 4.0f*CHUNK_SIZE;
+    while(surfaceY > -4.0f*CHUNK_SIZE && voxelProceduralDensity(&tgstate->genData, 0, vec3(tunnelX, surfaceY, CHUNK_SIZE/2.0f)) < 0.0f)
+        surfaceY -= 0.5f;
+    Line3D tunnel;
+    tunnel.start = vec4(tunnelX, surfaceY - 2.0f, -CHUNK_SIZE/4.0f, 1.0f);
+    tunnel.end = vec4(tunnelX, surfaceY - 2.0f, CHUNK_SIZE*1.25f, 1.0f);
+    tunnelGridAdd(&tgstate->tunnels, tunnel);
+
+    VoxelScratch *scratch = (VoxelScratch*)malloc(sizeof(VoxelScratch));
+    VoxelEditChunk edits = {};
+    VoxelMeshOutput out[2];
+    chunkId = getChunkId(vec3(0.0f, surfaceY, CHUNK_SIZE/2.0f));
+    for(u32 i = 0; i < 2; i++)
+    {
+        chunkId.x = (i32)i;
+        terrainGenClassify(tgstate, chunkId);
+        VoxelField field;
+        field.gen = &tgstate->genData;
+        field.tunnels = tgstate->chunkTunnels;
+        field.edits = &edits;
+        field.bricks = 0;
+        out[i].maxVertices = terrainGenMaxVertices(1);
+        out[i].maxTriangles = terrainGenMaxTriangles(1);
+        out[i].vertices = (VertexOut*)malloc(out[i].maxVertices*sizeof(VertexOut));
+        out[i].triangles = (TriangleOut*)malloc(out[i].maxTriangles*sizeof(TriangleOut));
+        voxelGenerateChunk(&field, getChunkOrigin(chunkId), 1, CHUNK_SIZE/CHUNK_WORKGROUP_SIZE, VoxelMesher_SurfaceNets,
+                           scratch, &out[i]);
+    }
+
+    // a quantization step apart at most, the chunks round to different origins
+    r32 unit = VOXEL_POSITION_RANGE/65535.0f;
+    u32 ret = 0;
+    *checked = 0;
+    for(u32 i = 0; i < out[0].vertexCount; i++)
+    {
+        VertexOut *a = &out[0].vertices[i];
+        Vec3 pa = vec3(a->position[0]*unit, a->position[1]*unit, a->position[2]*unit);
+        if(pa.x <= CHUNK_SIZE || pa.y >= CHUNK_SIZE || pa.z >= CHUNK_SIZE)
+            continue;
+        (*checked)++;
+        b32 found = false;
+        for(u32 j = 0; j < out[1].vertexCount && !found; j++)
+        {
+            VertexOut *b = &out[1].vertices[j];
+            found = fabsf(pa.x - CHUNK_SIZE - b->position[0]*unit) <= 2.0f*unit
+                && fabsf(pa.y - b->position[1]*unit) <= 2.0f*unit
+                && fabsf(pa.z - b->position[2]*unit) <= 2.0f*unit
+                && abs(a->normal[0] - b->normal[0]) <= 64 && abs(a->normal[1] - b->normal[1]) <= 64;
+        }
+        if(!found)
+            ret++;
+    }
+
+    for(u32 i = 0; i < 2; i++)
+    {
+        free(out[i].vertices);
+        free(out[i].triangles);
+    }
+    free(scratch);
+    tunnelGridDestroy(&tgstate->tunnels);
+    voxelEditDestroy(&tgstate->edits);
+    free(tgstate->chunkTunnels);
+    free(tgstate->chunkBricks);
+    free(tgstate);
+    return ret;
+}
+
+static void benchCpuJob(void *data)
+{
+    BenchSlot *slot = (BenchSlot*)data;
+    BenchChunk *chunk = slot->chunk;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    VoxelField field;
+    field.gen = &chunk->genData;
+    field.tunnels = chunk->tunnels;
+    field.edits = &slot->edits;
+    field.bricks = 0;
+    u32 groups = powInt(2, chunk->lodLevel-1);
+    r32 scale = (CHUNK_SIZE/CHUNK_WORKGROUP_SIZE)/groups;
+    voxelGenerateChunk(&field, getChunkOrigin(chunk->chunkId), groups, scale, chunk->mesher, slot->scratch, &slot->out);
+    chunk->ms = (r32)benchElapsedMs(&start);
+    chunk->overflow = slot->out.overflow;
+    benchHashMesh(chunk, slot->out.vertices, slot->out.vertexCount, slot->out.triangles, slot->out.triangleCount);
+    __atomic_store_n(&slot->done, true, __ATOMIC_RELEASE);
+}
+
+static void benchSubmitCl(OpenclState *cl, BenchSlot *slot)
+{
+    BenchChunk *chunk = slot->chunk;
+    VoxelField field;
+    field.gen = &chunk->genData;
+    field.tunnels = chunk->tunnels;
+    field.edits = &slot->edits;
+    field.bricks = 0;
+    u32 groups = powInt(2, chunk->lodLevel-1);
+    r32 scale = (CHUNK_SIZE/CHUNK_WORKGROUP_SIZE)/groups;
+    openclTerrainSubmit(cl, &slot->job, &field, getChunkOrigin(chunk->chunkId), groups, scale, chunk->mesher);
+}
+
+// keeps every slot busy until all chunks are done, false if the backend couldn't start
+static b32 benchRunSlots(BenchConfig *config, BenchChunk *chunks, u32 chunkCount)
+{
+    OpenclState cl;
+    WorkerPool pool;
+    BenchSlot *slots = (BenchSlot*)calloc(BENCH_MAX_SLOTS, sizeof(BenchSlot));
+    u32 slotCount;
+    u32 maxGroups = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
+    u32 maxVertices = terrainGenMaxVertices(maxGroups);
+    u32 maxTriangles = terrainGenMaxTriangles(maxGroups);
+    if(config->backend == BenchBackend_CPU)
+    {
+        if(!workerPoolInit(&pool, config->threads))
+        {
+            printf("Starting the workers failed\n");
+            free(slots);
+            return false;
+        }
+        // enough that a worker never waits for the main thread
+        slotCount = min(pool.threadCount*2, BENCH_MAX_SLOTS);
+        printf("backend: CPU, %u workers\n", pool.threadCount);
+    }
+    else
+    {
+        if(!openclInit(&cl, config->clDevice, "kernels/terrain.cl", "clcache"))
+        {
+            free(slots);
+            return false;
+        }
+        slotCount = TERRAIN_GEN_CL_SLOTS;
+        printf("backend: OpenCL on %s\n", cl.deviceName);
+    }
+
+    for(u32 i = 0; i < slotCount; i++)
+    {
+        BenchSlot *slot = &slots[i];
+        if(config->backend == BenchBackend_OpenCL && !openclJobInit(&cl, &slot->job, maxGroups, maxVertices, maxTriangles))
+        {
+            slotCount = i;
+            break;
+        }
+        if(config->backend == BenchBackend_CPU)
+            slot->scratch = (VoxelScratch*)malloc(sizeof(VoxelScratch));
+        slot->out.vertices = (VertexOut*)malloc(maxVertices*sizeof(VertexOut));
+        slot->out.triangles = (TriangleOut*)malloc(maxTriangles*sizeof(TriangleOut));
+    }
+    if(slotCount == 0)
+    {
+        openclShutdown(&cl);
+        free(slots);
+        return false;
+    }
+
+    u32 next = 0;
+    u32 finished = 0;
+    while(finished < chunkCount)
+    {
+        for(u32 i = 0; i < slotCount; i++)
+        {
+            BenchSlot *slot = &slots[i];
+            if(slot->busy)
+            {
+                if(config->backend == BenchBackend_CPU && __atomic_load_n(&slot->done, __ATOMIC_ACQUIRE))
+                {
+                    slot->busy = false;
+                    finished++;
+                }
+                else if(config->backend == BenchBackend_OpenCL && openclTerrainDone(&slot->job))
+                {
+                    BenchChunk *chunk = slot->chunk;
+                    chunk->ms = openclTerrainRead(&slot->job, &slot->out);
+                    chunk->overflow = slot->out.overflow;
+                    benchHashMesh(chunk, slot->out.vertices, slot->out.vertexCount, slot->out.triangles, slot->out.triangleCount);
+                    slot->busy = false;
+                    finished++;
+                }
+            }
+            if(!slot->busy && next < chunkCount)
+            {
+                BenchChunk *chunk = &chunks[next++];
+                u32 groups = powInt(2, chunk->lodLevel-1);
+                slot->chunk = chunk;
+                slot->edits.brickCount = 0;
+                slot->out.maxVertices = terrainGenMaxVertices(groups);
+                slot->out.maxTriangles = terrainGenMaxTriangles(groups);
+                slot->done = false;
+                slot->busy = true;
+                if(config->backend == BenchBackend_CPU)
+                {
+                    b32 pushed = workerPoolPush(&pool, benchCpuJob, slot);
+                    assert(pushed);
+                    (void)pushed;
+                }
+                else
+                {
+                    benchSubmitCl(&cl, slot);
+                }
+            }
+        }
+    }
+
+    if(config->backend == BenchBackend_CPU)
+        workerPoolDestroy(&pool);
+    for(u32 i = 0; i < slotCount; i++)
+    {
+        if(config->backend == BenchBackend_OpenCL)
+            openclJobDestroy(&slots[i].job);
+        free(slots[i].scratch);
+        free(slots[i].out.vertices);
+        free(slots[i].out.triangles);
+    }
+    if(config->backend == BenchBackend_OpenCL)
+        openclShutdown(&cl);
+    free(slots);
+    return true;
+}
+
+static PLATFORM_OPEN_FILE(benchOpenFile)
+{
+    PlatformFileHandle result;
+    result.PlatformData = fopen(fileName, "rb");
+    result.noErrors = result.PlatformData != 0;
+    return result;
+}
+
+static PLATFORM_GET_FILE_SIZE(benchGetFileSize)
+{
+    FILE *file = (FILE*)fh->PlatformData;
+    fseek(file, 0, SEEK_END);
+    return ftell(file);
+}
+
+static PLATFORM_READ_DATA_FROM_FILE(benchReadFromFile)
+{
+    FILE *file = (FILE*)source->PlatformData;
+    if(fseek(file, offset, SEEK_SET) != 0 || fread(dest, 1, size, file) != size)
+    {
+        printf("Error when reading from file\n");
+        source->noErrors = false;
+    }
+}
+
+static PLATFORM_CLOSE_FILE(benchCloseFile)
+{
+    fclose((FILE*)handle->PlatformData);
+}
+
+// a context on a window that is never mapped, false without a display or compute shaders
+static b32 benchCreateGlContext()
+{
+    Display *display = XOpenDisplay(0);
+    if(!display)
+    {
+        printf("GL backend needs a display, DISPLAY isn't set or can't be opened\n");
+        return false;
+    }
+    int screen = DefaultScreen(display);
+    int attribList[] = {GLX_RENDER_TYPE, GLX_RGBA_BIT, GLX_RED_SIZE, 8, GLX_GREEN_SIZE, 8, GLX_BLUE_SIZE, 8, None};
+    int configCount = 0;
+    GLXFBConfig *fbconfig = glXChooseFBConfig(display, screen, attribList, &configCount);
+    XVisualInfo *visinfo = fbconfig ? glXGetVisualFromFBConfig(display, *fbconfig) : 0;
+    if(!visinfo)
+    {
+        printf("No GLX visual for the GL backend\n");
+        return false;
+    }
+    XSetWindowAttributes winAttr;
+    winAttr.colormap = XCreateColormap(display, RootWindow(display, screen), visinfo->visual, AllocNone);
+    winAttr.border_pixel = 0;
+    Window win = XCreateWindow(display, RootWindow(display, screen), 0, 0, 16, 16, 0, visinfo->depth, InputOutput,
+                               visinfo->visual, CWBorderPixel | CWColormap, &winAttr);
+    GLXContext context = glXCreateContext(display, visinfo, NULL, GL_TRUE);
+    if(!context || !glXMakeCurrent(display, win, context))
+    {
+        printf("Creating a GL context failed\n");
+        return false;
+    }
+    if(glewInit() != GLEW_OK || !GLEW_ARB_compute_shader)
+    {
+        printf("GL backend needs compute shaders\n");
+        return false;
+    }
+    printf("backend: GL on %s\n", (const char*)glGetString(GL_RENDERER));
+    return true;
+}
+
+// one chunk at a time through terrainGenSubmit() and terrainGenPoll()
+static b32 benchRunGl(BenchConfig *config, BenchChunk *chunks, u32 chunkCount)
+{
+    if(!benchCreateGlContext())
+        return false;
+    Platform.openFile = benchOpenFile;
+    Platform.getFileSize = benchGetFileSize;
+    Platform.readFromFile = benchReadFromFile;
+    Platform.closeFile = benchCloseFile;
+
+    Permanent_Storage *state = (Permanent_Storage*)calloc(1, sizeof(Permanent_Storage));
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    initMCubesBuffer2(state);
+    initializeComputeProgram(&state->terrainComputeShader, "shaders/terrain_compute2.glsl", ST_Particle);
+    u32 maxGroups = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
+    openglInitializeTerrainGeneration(tgstate, maxGroups, CHUNK_WORKGROUP_SIZE, 4.0);
+    benchAddTunnels(tgstate, config);
+    for(u32 lod = 1; lod < 4; lod++)
+        tgstate->lodMesher[lod] = config->mesher;
+    tgstate->genData.columnWarp = config->columnWarp;
+    tgstate->backend = TerrainGenBackend_GPU;
+
+    TerrainChunk *tchunk = &state->game.loadedChunks[0];
+    VertexOut *vertices = (VertexOut*)malloc(terrainGenMaxVertices(maxGroups)*sizeof(VertexOut));
+    TriangleOut *triangles = (TriangleOut*)malloc(terrainGenMaxTriangles(maxGroups)*sizeof(TriangleOut));
+    for(u32 i = 0; i < chunkCount; i++)
+    {
+        BenchChunk *chunk = &chunks[i];
+        tchunk->chunkCoordinate = chunk->chunkId;
+        tchunk->origin = getChunkOrigin(chunk->chunkId);
+        u32 completed = tgstate->totalCompleted;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        terrainGenSubmit(state, tchunk, chunk->lodLevel);
+        while(tgstate->totalCompleted == completed && tgstate->slotsInFlight > 0)
+            terrainGenPoll(state);
+        chunk->ms = (r32)benchElapsedMs(&start);
+
+        MeshArenaAllocation *alloc = &tchunk->meshAlloc;
+        u32 vertexCount = alloc->valid ? alloc->vertexCount : 0;
+        u32 triangleCount = alloc->valid ? alloc->triangleCount : 0;
+        if(vertexCount > terrainGenMaxVertices(maxGroups) || triangleCount > terrainGenMaxTriangles(maxGroups))
+        {
+            chunk->overflow = true;
+            vertexCount = triangleCount = 0;
+        }
+        if(vertexCount > 0)
+        {
+            MeshArenaPage *page = &tgstate->meshArena.pages[alloc->page];
+            glBindBuffer(GL_COPY_READ_BUFFER, page->vertexBuffer);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, alloc->firstVertex*sizeof(VertexOut), vertexCount*sizeof(VertexOut), vertices);
+            glBindBuffer(GL_COPY_READ_BUFFER, page->elementBuffer);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, alloc->firstTriangle*sizeof(TriangleOut), triangleCount*sizeof(TriangleOut), triangles);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        benchHashMesh(chunk, vertices, vertexCount, triangles, triangleCount);
+        meshArenaFree(&tgstate->meshArena, alloc);
+    }
+    free(vertices);
+    free(triangles);
+    terrainGenShutdown(tgstate);
+    free(state);
+    return true;
+}
+
+static int benchCompareMs(const void *a, const void *b)
+{
+    r32 x = *(const r32*)a, y = *(const r32*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void benchPrintLod(u32 lod, BenchChunk *chunks, u32 chunkCount, u32 *classified)
+{
+    r32 *times = (r32*)malloc((chunkCount ? chunkCount : 1)*sizeof(r32));
+    u32 count = 0, overflows = 0;
+    u64 vertices = 0, triangles = 0;
+    r64 totalMs = 0.0;
+    r32 vertexUse = 0.0f, triangleUse = 0.0f, maxVertexUse = 0.0f, maxTriangleUse = 0.0f;
+    u32 groups = powInt(2, lod-1);
+    r32 maxVertices = (r32)terrainGenMaxVertices(groups);
+    r32 maxTriangles = (r32)terrainGenMaxTriangles(groups);
+    for(u32 i = 0; i < chunkCount; i++)
+    {
+        BenchChunk *chunk = &chunks[i];
+        if(chunk->lodLevel != lod)
+            continue;
+        times[count++] = chunk->ms;
+        totalMs += chunk->ms;
+        vertices += chunk->vertexCount;
+        triangles += chunk->triangleCount;
+        overflows += chunk->overflow;
+        vertexUse += chunk->vertexCount/maxVertices;
+        triangleUse += chunk->triangleCount/maxTriangles;
+        maxVertexUse = maxf(maxVertexUse, chunk->vertexCount/maxVertices);
+        maxTriangleUse = maxf(maxTriangleUse, chunk->triangleCount/maxTriangles);
+    }
+    printf("LOD %u: %u surface chunks, %u air, %u solid\n", lod, count, classified[VoxelChunkClass_Air],
+           classified[VoxelChunkClass_Solid]);
+    if(count > 0)
+    {
+        qsort(times, count, sizeof(r32), benchCompareMs);
+        printf("  ms per chunk: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", totalMs/count,
+               times[count/2], times[count*9/10], times[count*99/100], times[count-1]);
+        printf("  per chunk: %.0f vertices, %.0f triangles\n", (r64)vertices/count, (r64)triangles/count);
+        printf("  output buffers used: vertices %.1f%% (max %.1f%%), triangles %.1f%% (max %.1f%%), %u overflowed\n",
+               100.0f*vertexUse/count, 100.0f*maxVertexUse, 100.0f*triangleUse/count, 100.0f*maxTriangleUse, overflows);
+    }
+    free(times);
+}
+
+static b32 benchParseArgs(int argc, char **argv, BenchConfig *config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i+1 < argc ? argv[i+1] : 0;
+        if(!value)
+            return false;
+        i++;
+        if(strcmp(arg, "-backend") == 0)
+        {
+            if(strcmp(value, "cpu") == 0)
+                config->backend = BenchBackend_CPU;
+            else if(strcmp(value, "opencl") == 0)
+                config->backend = BenchBackend_OpenCL;
+            else if(strcmp(value, "gl") == 0)
+                config->backend = BenchBackend_GL;
+            else
+                return false;
+        }
+        else if(strcmp(arg, "-mesher") == 0)
+        {
+            if(strcmp(value, "mc") == 0)
+                config->mesher = VoxelMesher_MarchingCubes;
+            else if(strcmp(value, "nets") == 0)
+                config->mesher = VoxelMesher_SurfaceNets;
+            else
+                return false;
+        }
+        else if(strcmp(arg, "-warp") == 0)
+        {
+            if(strcmp(value, "3d") == 0)
+                config->columnWarp = 0;
+            else if(strcmp(value, "column") == 0)
+                config->columnWarp = 1;
+            else
+                return false;
+        }
+        else if(strcmp(arg, "-cldevice") == 0)
+        {
+            if(strcmp(value, "gpu") == 0)
+                config->clDevice = CL_DEVICE_TYPE_GPU;
+            else if(strcmp(value, "cpu") == 0)
+                config->clDevice = CL_DEVICE_TYPE_CPU;
+            else
+                return false;
+        }
+        else if(strcmp(arg, "-grid") == 0)
+            config->grid = (u32)atoi(value);
+        else if(strcmp(arg, "-layers") == 0)
+            config->layers = (u32)atoi(value);
+        else if(strcmp(arg, "-lod") == 0)
+            config->lodLevel = (u32)atoi(value);
+        else if(strcmp(arg, "-tunnels") == 0)
+            config->tunnels = (u32)atoi(value);
+        else if(strcmp(arg, "-seed") == 0)
+            config->seed = (u32)atoi(value);
+        else if(strcmp(arg, "-threads") == 0)
+            config->threads = (u32)atoi(value);
+        else
+            return false;
+    }
+    return config->grid > 0 && config->layers > 0 && config->lodLevel < 4;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    config.backend = BenchBackend_CPU;
+    config.grid = 4;
+    config.layers = 4;
+    config.lodLevel = 0;
+    config.mesher = VoxelMesher_MarchingCubes;
+    config.columnWarp = 0;
+    config.tunnels = 64;
+    config.seed = 1;
+    config.threads = 0;
+    config.clDevice = CL_DEVICE_TYPE_GPU;
+    if(!benchParseArgs(argc, argv, &config))
+    {
+        printf("usage: %s [-backend cpu|opencl|gl] [-grid N] [-layers N] [-lod 1-3] [-mesher mc|nets]\n"
+               "       [-warp 3d|column] [-tunnels N] [-seed N] [-threads N] [-cldevice gpu|cpu]\n", argv[0]);
+        return 2;
+    }
+
+    u32 seamVertices;
+    u32 seamCracks = benchSeamCheck(&config, &seamVertices);
+    printf("seam check: %u of %u vertices past a chunk face differ from the next chunk's\n", seamCracks, seamVertices);
+    if(seamCracks > 0 || seamVertices == 0)
+        return 1;
+
+    // the chunks with a surface, classified like the game does before submitting
+    TerrainGeneratorState *tgstate = (TerrainGeneratorState*)calloc(1, sizeof(TerrainGeneratorState));
+    terrainGenInitParams(tgstate);
+    tgstate->genData.columnWarp = config.columnWarp;
+    benchAddTunnels(tgstate, &config);
+    u32 maxChunks = config.grid*config.grid*config.layers*3;
+    BenchChunk *chunks = (BenchChunk*)calloc(maxChunks, sizeof(BenchChunk));
+    u32 chunkCount = 0;
+    u32 classified[4][3] = {};
+    i32 first = -(i32)config.grid/2;
+    i32 firstLayer = -(i32)config.layers/2;
+    for(u32 lod = 1; lod < 4; lod++)
+    {
+        if(config.lodLevel != 0 && lod != config.lodLevel)
+            continue;
+        for(u32 y = 0; y < config.layers; y++)
+        for(u32 z = 0; z < config.grid; z++)
+        for(u32 x = 0; x < config.grid; x++)
+        {
+            IVec3 chunkId;
+            chunkId.x = first + (i32)x;
+            chunkId.y = firstLayer + (i32)y;
+            chunkId.z = first + (i32)z;
+            VoxelChunkClass chunkClass = terrainGenClassify(tgstate, chunkId);
+            classified[lod][chunkClass]++;
+            if(chunkClass != VoxelChunkClass_Surface)
+                continue;
+            BenchChunk *chunk = &chunks[chunkCount++];
+            chunk->chunkId = chunkId;
+            chunk->lodLevel = lod;
+            chunk->mesher = config.mesher;
+            chunk->genData = tgstate->genData;
+            chunk->tunnels = (Line3D*)malloc((tgstate->genData.tunnelCount+1)*sizeof(Line3D));
+            memcpy(chunk->tunnels, tgstate->chunkTunnels, tgstate->genData.tunnelCount*sizeof(Line3D));
+        }
+    }
+    printf("terrain bench: %ux%ux%u chunks, %s, %s warp, %u tunnels (seed %u), %u chunks to generate\n",
+           config.grid, config.layers, config.grid, config.mesher == VoxelMesher_SurfaceNets ? "surface nets" : "marching cubes",
+           config.columnWarp ? "column" : "3D", config.tunnels, config.seed, chunkCount);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    b32 ran = config.backend == BenchBackend_GL ? benchRunGl(&config, chunks, chunkCount)
+                                                : benchRunSlots(&config, chunks, chunkCount);
+    r64 wallMs = benchElapsedMs(&start);
+    if(!ran)
+    {
+        printf("backend unavailable\n");
+        return 1;
+    }
+
+    u64 checksum = 0xcbf29ce484222325ULL;
+    for(u32 i = 0; i < chunkCount; i++)
+        checksum = benchHash(checksum, &chunks[i].hash, sizeof(u64));
+    for(u32 lod = 1; lod < 4; lod++)
+    {
+        if(config.lodLevel == 0 || lod == config.lodLevel)
+            benchPrintLod(lod, chunks, chunkCount, classified[lod]);
+    }
+    printf("total: %u chunks in %.1fms, %.1f chunks/s\n", chunkCount, wallMs, chunkCount ? chunkCount/(wallMs/1000.0) : 0.0);
+    printf("checksum: %016llx\n", (unsigned long long)checksum);
+
+    for(u32 i = 0; i < chunkCount; i++)
+        free(chunks[i].tunnels);
+    free(chunks);
+    tunnelGridDestroy(&tgstate->tunnels);
+    voxelEditDestroy(&tgstate->edits);
+    free(tgstate->chunkTunnels);
+    free(tgstate->chunkBricks);
+    free(tgstate);
+    return 0;
+}
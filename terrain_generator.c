@@ -0,0 +1,1021 @@
+#include "core.h"
+
+#include <time.h>
+
+// Pipelined chunk generation.
+//
+// GPU backend: every generation gets a slot with its own seed, block count and
+// density buffers and goes through two passes of terrain_compute2.glsl. The
+// count pass samples the chunk and counts the vertices and triangles of every
+// block. When a later frame sees its fence signaled the counts are read back,
+// the mesh gets an exact sized arena range and the emit pass writes it there
+// directly, behind another fence. Nothing is over-allocated or copied and no
+// thread waits on another.
+//
+// CPU backend: chunks are meshed by voxelGenerateChunk() on the worker pool
+// into per slot memory, the main thread only uploads finished slots.
+//
+// OpenCL backend: the kernels of kernels/terrain.cl (see opencl.c) mesh a
+// chunk on any OpenCL device, a CPU runtime included, into the slot's host
+// memory. The main thread polls the slots and uploads them like CPU meshes.
+//
+// Meshes live in the mesh arena (see mesh_arena.c) and get an exact sized range
+// once their size is known, the old mesh stays visible until the new one is
+// complete.
+//
+// If a chunk is submitted again before the previous result arrived, the older
+// result is dropped (see TerrainChunk::genTicket).
+//
+// Finished meshes of all backends go to the chunk cache, a submit that hits
+// the cache uploads right away and never reaches a backend. Chunks that
+// voxelClassifyChunk() proves all air or all solid don't get generated at all.
+//
+// Tunnels are kept in a TunnelGrid (see tunnel_grid.c). A generation only
+// gets the tunnels that reach its chunk, on the GPU they are uploaded into the
+// slot's tunnel buffer behind the parameters. The chunk cache keys a mesh by
+// those tunnels too, so a new tunnel only misses the cache where it is.
+//
+// Brush edits live in a VoxelEditStore (see voxel_edit.c) and work the same
+// way, a generation gets copies of the bricks its chunk samples and they are
+// part of the cache key. Chunks without edits upload and hash nothing extra.
+//
+// The samples GPU count passes take stay in the density cache, keyed by the
+// generator parameters and the chunk's edit hash, what goes into the density
+// and nothing about the mesh. The sample points of a LOD are every second one
+// of the next finer LOD, so when a chunk changes LOD the count pass reads
+// what an earlier generation sampled and only evaluates the density where it
+// has to. A finer LOD fills in the missing points of the same grid, a coarser
+// one needs no noise at all. Passes using an entry run in submission order, so an entry
+// can be handed to the next chunk right away.
+//
+// Every LOD has a VoxelMesher, marching cubes or surface nets. All backends
+// do both and write the same vertex and triangle layouts, so the arena, the
+// cache and the renderer don't know which one made a mesh.
+//
+// With simplification on (see terrainGenCycleSimplify()) the LOD 1 meshes go
+// through voxelSimplifyMesh() before they are uploaded and cached. That needs
+// the whole mesh in memory, so those chunks are meshed on the workers even on
+// the GPU and OpenCL backends.
+
+static r32 terrainGenElapsedMs(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start->tv_sec)*1000.0f+(now.tv_nsec-start->tv_nsec)/1000000.0f;
+}
+
+static void terrainGenRecordCost(TerrainGeneratorState *tgstate, u32 lodLevel, r32 ms)
+{
+    r32 *cost = &tgstate->lodCostMs[lodLevel];
+    *cost = *cost == 0.0f ? ms : *cost*0.9f + ms*0.1f;
+}
+
+static void terrainGenRecordMesh(TerrainGeneratorState *tgstate, u32 lodLevel, VoxelMesher mesher, u32 vertexCount, u32 triangleCount)
+{
+    if(triangleCount == 0)
+        return;
+    tgstate->meshedChunks[mesher][lodLevel]++;
+    tgstate->meshedVertices[mesher][lodLevel] += vertexCount;
+    tgstate->meshedTriangles[mesher][lodLevel] += triangleCount;
+}
+
+// CPU output buffer sizes of a LOD, the GPU path counts first and needs none
+u32 terrainGenMaxVertices(u32 groups)
+{
+    return (CHUNK_VERTEX_BUFFER_SIZE/(CHUNK_SIZE/CHUNK_WORKGROUP_SIZE))*groups/sizeof(VertexOut);
+}
+
+u32 terrainGenMaxTriangles(u32 groups)
+{
+    return (CHUNK_ELEMENT_BUFFER_SIZE/(CHUNK_SIZE/CHUNK_WORKGROUP_SIZE))*groups/sizeof(TriangleOut);
+}
+
+// generator parameters without tunnels or edits, doesn't need GL
+void terrainGenInitParams(TerrainGeneratorState *tgstate)
+{
+    tgstate->genData.tunnelCount = 0;
+    // DOEST WORK
+    tgstate->genData.firstOctaveMax = 4.5f;
+    tgstate->genData.secondOctaveMax = 20.6f;
+    tunnelGridInit(&tgstate->tunnels);
+    voxelEditInit(&tgstate->edits);
+}
+
+void terrainGenInitCpu(TerrainGeneratorState *tgstate, u32 threadCount)
+{
+    u32 maxGroups = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
+    for(u32 i = 0; i < TERRAIN_GEN_CPU_SLOTS; i++)
+    {
+        TerrainGenCpuSlot *slot = &tgstate->cpuSlots[i];
+        slot->scratch = (VoxelScratch*)malloc(sizeof(VoxelScratch));
+        slot->out.vertices = (VertexOut*)malloc(terrainGenMaxVertices(maxGroups)*sizeof(VertexOut));
+        slot->out.triangles = (TriangleOut*)malloc(terrainGenMaxTriangles(maxGroups)*sizeof(TriangleOut));
+        slot->busy = false;
+        slot->done = false;
+    }
+    tgstate->cpuSlotsInFlight = 0;
+
+    if(workerPoolInit(&tgstate->workers, threadCount))
+        printf("Terrain generation workers: %u\n", tgstate->workers.threadCount);
+    else
+        printf("Starting terrain generation workers failed, CPU backend unavailable\n");
+}
+
+// OpenCL backend stays unavailable if there is no device or the kernels don't build
+void terrainGenInitOpencl(TerrainGeneratorState *tgstate, const char *kernelFile, const char *cacheDirectory)
+{
+    if(!openclInit(&tgstate->opencl, CL_DEVICE_TYPE_GPU, kernelFile, cacheDirectory))
+    {
+        printf("OpenCL terrain backend unavailable\n");
+        return;
+    }
+    u32 maxGroups = CHUNK_SIZE/CHUNK_WORKGROUP_SIZE;
+    for(u32 i = 0; i < TERRAIN_GEN_CL_SLOTS; i++)
+    {
+        TerrainGenClSlot *slot = &tgstate->clSlots[i];
+        if(!openclJobInit(&tgstate->opencl, &slot->job, maxGroups, terrainGenMaxVertices(maxGroups), terrainGenMaxTriangles(maxGroups)))
+        {
+            printf("Creating OpenCL terrain jobs failed, OpenCL backend unavailable\n");
+            for(u32 j = 0; j < i; j++)
+                openclJobDestroy(&tgstate->clSlots[j].job);
+            openclShutdown(&tgstate->opencl);
+            return;
+        }
+        slot->out.vertices = (VertexOut*)malloc(terrainGenMaxVertices(maxGroups)*sizeof(VertexOut));
+        slot->out.triangles = (TriangleOut*)malloc(terrainGenMaxTriangles(maxGroups)*sizeof(TriangleOut));
+        slot->out.maxVertices = terrainGenMaxVertices(maxGroups);
+        slot->out.maxTriangles = terrainGenMaxTriangles(maxGroups);
+        slot->busy = false;
+    }
+    tgstate->clSlotsInFlight = 0;
+}
+
+void terrainGenShutdown(TerrainGeneratorState *tgstate)
+{
+    if(tgstate->opencl.initialized)
+    {
+        for(u32 i = 0; i < TERRAIN_GEN_CL_SLOTS; i++)
+        {
+            TerrainGenClSlot *slot = &tgstate->clSlots[i];
+            openclJobDestroy(&slot->job);
+            free(slot->out.vertices);
+            free(slot->out.triangles);
+            slot->out.vertices = 0;
+            slot->out.triangles = 0;
+            slot->busy = false;
+        }
+        tgstate->clSlotsInFlight = 0;
+        openclShutdown(&tgstate->opencl);
+    }
+    workerPoolDestroy(&tgstate->workers);
+    for(u32 i = 0; i < TERRAIN_GEN_CPU_SLOTS; i++)
+    {
+        TerrainGenCpuSlot *slot = &tgstate->cpuSlots[i];
+        free(slot->scratch);
+        voxelSimplifyDestroy(&slot->simplify);
+        free(slot->out.vertices);
+        free(slot->out.triangles);
+        free(slot->tunnels);
+        free(slot->bricks);
+        slot->scratch = 0;
+        slot->out.vertices = 0;
+        slot->out.triangles = 0;
+        slot->tunnels = 0;
+        slot->tunnelCapacity = 0;
+        slot->bricks = 0;
+        slot->brickCapacity = 0;
+    }
+    free(tgstate->verifyScratch);
+    tgstate->verifyScratch = 0;
+    meshArenaDestroy(&tgstate->meshArena);
+    tunnelGridDestroy(&tgstate->tunnels);
+    voxelEditDestroy(&tgstate->edits);
+    free(tgstate->chunkTunnels);
+    tgstate->chunkTunnels = 0;
+    tgstate->chunkTunnelCapacity = 0;
+    free(tgstate->chunkBricks);
+    tgstate->chunkBricks = 0;
+    tgstate->chunkBrickCapacity = 0;
+}
+
+void terrainGenSetBackend(TerrainGeneratorState *tgstate, TerrainGenBackend backend)
+{
+    static const char *names[] = {"GPU", "CPU", "OpenCL"};
+    if((backend == TerrainGenBackend_CPU && !tgstate->workers.initialized)
+            || (backend == TerrainGenBackend_OpenCL && !tgstate->opencl.initialized))
+    {
+        printf("%s terrain backend unavailable, staying on %s\n", names[backend], names[tgstate->backend]);
+        return;
+    }
+    tgstate->backend = backend;
+    if(backend == TerrainGenBackend_OpenCL)
+        printf("Terrain generation backend: OpenCL on %s\n", tgstate->opencl.deviceName);
+    else
+        printf("Terrain generation backend: %s\n", names[backend]);
+}
+
+// Surface nets on no LOD, the coarsest one, the two coarsest, all of them and
+// around again. Like a backend switch it's for the chunks generated from now on.
+void terrainGenCycleMeshers(TerrainGeneratorState *tgstate)
+{
+    u32 netsLods = 0;
+    for(u32 lod = 1; lod < 4; lod++)
+        netsLods += tgstate->lodMesher[lod] == VoxelMesher_SurfaceNets;
+    netsLods = (netsLods + 1) % 4;
+    for(u32 lod = 1; lod < 4; lod++)
+        tgstate->lodMesher[lod] = lod <= netsLods ? VoxelMesher_SurfaceNets : VoxelMesher_MarchingCubes;
+    if(netsLods == 0)
+        printf("Terrain mesher: marching cubes on every LOD\n");
+    else
+        printf("Terrain mesher: surface nets on LOD 1 to %u, marching cubes above\n", netsLods);
+}
+
+// Simplification of LOD 1 meshes off, then with more and more error allowed
+// (in units of the chunk), for the chunks generated from now on.
+void terrainGenCycleSimplify(TerrainGeneratorState *tgstate)
+{
+    static const r32 errors[] = {0.0f, 0.25f, 0.5f, 1.0f};
+    if(!tgstate->workers.initialized)
+    {
+        printf("Mesh simplification runs on the terrain workers, they are unavailable\n");
+        return;
+    }
+    u32 next = 0;
+    for(u32 i = 0; i < ARRAY_COUNT(errors); i++)
+    {
+        if(tgstate->simplifyError == errors[i])
+            next = (i + 1) % ARRAY_COUNT(errors);
+    }
+    tgstate->simplifyError = errors[next];
+    if(tgstate->simplifyError == 0.0f)
+        printf("LOD 1 mesh simplification: off\n");
+    else
+        printf("LOD 1 mesh simplification: up to %.2f units of error\n", tgstate->simplifyError);
+}
+
+// Warp noise along the whole column instead of in 3D. The terrain loses its
+// overhangs but becomes a height map, which every backend samples once per
+// column of a block instead of for every sample. For the chunks generated
+// from now on, the cache keys include it.
+void terrainGenToggleColumnWarp(TerrainGeneratorState *tgstate)
+{
+    tgstate->genData.columnWarp = !tgstate->genData.columnWarp;
+    if(tgstate->genData.columnWarp)
+        printf("Terrain warp: per column, height map fast path\n");
+    else
+        printf("Terrain warp: 3D\n");
+}
+
+u32 terrainGenFreeSlots(TerrainGeneratorState *tgstate)
+{
+    u32 cpuFree = TERRAIN_GEN_CPU_SLOTS - tgstate->cpuSlotsInFlight;
+    if(tgstate->backend == TerrainGenBackend_CPU)
+        return cpuFree;
+    u32 deviceFree = tgstate->backend == TerrainGenBackend_OpenCL ? TERRAIN_GEN_CL_SLOTS - tgstate->clSlotsInFlight
+                                                                   : TERRAIN_GEN_SLOTS - tgstate->slotsInFlight;
+    // LOD 1 chunks go to the workers
+    return tgstate->simplifyError > 0.0f ? min(deviceFree, cpuFree) : deviceFree;
+}
+
+// replaces the chunk's arena range with one of the new size, false if the
+// chunk ends up without a mesh
+static b32 terrainGenAllocMesh(TerrainGeneratorState *tgstate, TerrainChunk *tchunk, u32 vertexCount, u32 triangleCount)
+{
+    meshArenaFree(&tgstate->meshArena, &tchunk->meshAlloc);
+    if(vertexCount == 0 || triangleCount == 0)
+        return false;
+    if(!meshArenaAlloc(&tgstate->meshArena, vertexCount, triangleCount, &tchunk->meshAlloc))
+    {
+        printf("Mesh arena is full, chunk mesh dropped\n");
+        return false;
+    }
+    return true;
+}
+
+static void terrainGenUpload(TerrainGeneratorState *tgstate, TerrainChunk *tchunk, VertexOut *vertices, u32 vertexCount, TriangleOut *triangles, u32 triangleCount)
+{
+    if(!terrainGenAllocMesh(tgstate, tchunk, vertexCount, triangleCount))
+        return;
+    MeshArenaAllocation *alloc = &tchunk->meshAlloc;
+    MeshArenaPage *page = &tgstate->meshArena.pages[alloc->page];
+    // copy write target so the bound VAO's element buffer isn't touched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, page->vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, alloc->firstVertex*sizeof(VertexOut), vertexCount*sizeof(VertexOut), vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, page->elementBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, alloc->firstTriangle*sizeof(TriangleOut), triangleCount*sizeof(TriangleOut), triangles);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// chunk's arena range holds the new mesh, make it drawable
+static void terrainGenFinish(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel, b32 empty)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    ArrayMesh* mesh = &tchunk->entity.amesh;
+    MeshArenaAllocation *alloc = &tchunk->meshAlloc;
+    mesh->vertices = alloc->valid ? alloc->vertexCount : 0;
+    mesh->faces = alloc->valid ? alloc->triangleCount : 0;
+    mesh->loadedToGPU = true;
+    mesh->data = NULL;
+    mesh->boundingRadius = sqrtf(3*CHUNK_SIZE*CHUNK_SIZE);
+    mesh->vertexStride = sizeof(VertexOut);
+
+    MeshArenaPage *page = &tgstate->meshArena.pages[alloc->valid ? alloc->page : 0];
+    mesh->VAO = page->VAO;
+    mesh->AttribBuffer = page->vertexBuffer;
+    mesh->ElementBuffer = page->elementBuffer;
+    mesh->baseVertex = alloc->valid ? alloc->firstVertex : 0;
+    mesh->firstIndex = alloc->valid ? alloc->firstTriangle*3 : 0;
+
+    u32 difFromHighest = 4-lodLevel;
+    Vec3 offset = vec3(0.0f,-0.2f*difFromHighest,0.0f);
+    Vec3 position;
+    vec3Add(&position, &offset, &tchunk->origin);
+    setPosition(&tchunk->entity.transform, position);
+    // vertex positions are 0..1 of VOXEL_POSITION_RANGE from the chunk origin
+    tchunk->entity.transform.scale = vec3(VOXEL_POSITION_RANGE, VOXEL_POSITION_RANGE, VOXEL_POSITION_RANGE);
+
+    // no surface in the chunk, the scheduler hands its slot to another one
+    if(empty && !tchunk->isEmpty && state->game.emptyChunkCount < MAX_LOADED_CHUNKS)
+    {
+        tchunk->isEmpty = true;
+        state->game.emptyChunks[state->game.emptyChunkCount++] = (u32)(tchunk - state->game.loadedChunks);
+    }
+}
+
+static void terrainGenCpuJob(void *data)
+{
+    TerrainGenCpuSlot *slot = (TerrainGenCpuSlot*)data;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    VoxelField field;
+    field.gen = &slot->genData;
+    field.tunnels = slot->tunnels;
+    field.edits = &slot->edits;
+    field.bricks = slot->bricks;
+    voxelGenerateChunk(&field, slot->origin, slot->groups, slot->scale, slot->mesher, slot->scratch, &slot->out);
+    slot->generatedTriangles = slot->out.triangleCount;
+    slot->simplifyMs = 0.0f;
+    if(slot->simplifyError > 0.0f && !slot->out.overflow)
+    {
+        struct timespec simplifyStart;
+        clock_gettime(CLOCK_MONOTONIC, &simplifyStart);
+        voxelSimplifyMesh(&slot->out, CHUNK_SIZE, slot->simplifyError, &slot->simplify);
+        slot->simplifyMs = terrainGenElapsedMs(&simplifyStart);
+    }
+    slot->genMs = terrainGenElapsedMs(&start);
+    __atomic_store_n(&slot->done, true, __ATOMIC_RELEASE);
+}
+
+static void terrainGenSubmitCpu(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel, u32 groups, r32 scale,
+                                VoxelMesher mesher, r32 simplifyError, u64 genHash, u64 meshHash)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    TerrainGenCpuSlot *slot = 0;
+    for(u32 i = 0; i < TERRAIN_GEN_CPU_SLOTS; i++)
+    {
+        if(!tgstate->cpuSlots[i].busy)
+        {
+            slot = &tgstate->cpuSlots[i];
+            break;
+        }
+    }
+    // caller has to check terrainGenFreeSlots()
+    assert(slot);
+
+    slot->genData = tgstate->genData;
+    u32 tunnelCount = tgstate->genData.tunnelCount;
+    if(tunnelCount > slot->tunnelCapacity)
+    {
+        slot->tunnelCapacity = tunnelCount;
+        slot->tunnels = (Line3D*)realloc(slot->tunnels, tunnelCount*sizeof(Line3D));
+    }
+    memcpy(slot->tunnels, tgstate->chunkTunnels, tunnelCount*sizeof(Line3D));
+    u32 brickCount = tgstate->chunkEdits.brickCount;
+    if(brickCount > 0)
+    {
+        slot->edits = tgstate->chunkEdits;
+        if(brickCount > slot->brickCapacity)
+        {
+            slot->brickCapacity = brickCount;
+            slot->bricks = (VoxelBrick*)realloc(slot->bricks, brickCount*sizeof(VoxelBrick));
+        }
+        memcpy(slot->bricks, tgstate->chunkBricks, brickCount*sizeof(VoxelBrick));
+    }
+    slot->edits.brickCount = brickCount;
+    slot->origin = tchunk->origin;
+    slot->groups = groups;
+    slot->scale = scale;
+    slot->mesher = mesher;
+    slot->simplifyError = simplifyError;
+    slot->out.maxVertices = terrainGenMaxVertices(groups);
+    slot->out.maxTriangles = terrainGenMaxTriangles(groups);
+    slot->done = false;
+
+    tchunk->genTicket++;
+    slot->busy = true;
+    slot->chunkIndex = (u32)(tchunk - state->game.loadedChunks);
+    slot->ticket = tchunk->genTicket;
+    slot->lodLevel = lodLevel;
+    slot->submitFrame = tgstate->frame;
+    slot->chunkId = tchunk->chunkCoordinate;
+    slot->genHash = genHash;
+    slot->meshHash = meshHash;
+    tgstate->cpuSlotsInFlight++;
+
+    // can't fail, there are fewer slots than queue entries
+    b32 pushed = workerPoolPush(&tgstate->workers, terrainGenCpuJob, slot);
+    assert(pushed);
+    (void)pushed;
+}
+
+static void terrainGenSubmitCl(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel, u32 groups, r32 scale,
+                               VoxelMesher mesher, VoxelField *field, u64 genHash, u64 meshHash)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    TerrainGenClSlot *slot = 0;
+    for(u32 i = 0; i < TERRAIN_GEN_CL_SLOTS; i++)
+    {
+        if(!tgstate->clSlots[i].busy)
+        {
+            slot = &tgstate->clSlots[i];
+            break;
+        }
+    }
+    // caller has to check terrainGenFreeSlots()
+    assert(slot);
+
+    openclTerrainSubmit(&tgstate->opencl, &slot->job, field, tchunk->origin, groups, scale, mesher);
+    slot->mesher = mesher;
+
+    tchunk->genTicket++;
+    slot->busy = true;
+    slot->chunkIndex = (u32)(tchunk - state->game.loadedChunks);
+    slot->ticket = tchunk->genTicket;
+    slot->lodLevel = lodLevel;
+    slot->submitFrame = tgstate->frame;
+    slot->chunkId = tchunk->chunkCoordinate;
+    slot->genHash = genHash;
+    slot->meshHash = meshHash;
+    tgstate->clSlotsInFlight++;
+}
+
+static void terrainGenApplyParams(TerrainGeneratorState *tgstate)
+{
+    tgstate->genData.secondOctaveMax = 30.0f;
+    tgstate->genData.dxgoalFirstOctaveMax = 0.0f;
+    tgstate->genData.dzgoalFirstOctaveMax = 0.0f;
+    tgstate->genData.dxgoalSecondOctaveMax = 0.0f;
+    tgstate->genData.dzgoalSecondOctaveMax = 0.0f;
+}
+
+static VoxelField terrainGenChunkField(TerrainGeneratorState *tgstate)
+{
+    VoxelField ret;
+    ret.gen = &tgstate->genData;
+    ret.tunnels = tgstate->chunkTunnels;
+    ret.edits = &tgstate->chunkEdits;
+    ret.bricks = tgstate->chunkBricks;
+    return ret;
+}
+
+// parameters, chunkTunnels and chunkEdits are set up for the chunk until the next call
+VoxelChunkClass terrainGenClassify(TerrainGeneratorState *tgstate, IVec3 chunkId)
+{
+    terrainGenApplyParams(tgstate);
+    Vec3 origin = getChunkOrigin(chunkId);
+    tgstate->genData.tunnelCount = tunnelGridGather(&tgstate->tunnels, origin, &tgstate->chunkTunnels, &tgstate->chunkTunnelCapacity);
+    voxelEditGather(&tgstate->edits, origin, &tgstate->chunkEdits, &tgstate->chunkBricks, &tgstate->chunkBrickCapacity);
+    VoxelField field = terrainGenChunkField(tgstate);
+    VoxelChunkClass ret = voxelClassifyChunk(&field, origin, CHUNK_SIZE);
+    tgstate->classified[ret]++;
+    return ret;
+}
+
+// applies a brush and queues the chunks it changed, returns the changed voxels
+u32 terrainGenEdit(Permanent_Storage *state, VoxelBrush brush, Vec3 center, r32 radius, r32 strength)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    terrainGenApplyParams(tgstate);
+    u32 changed = voxelEditApply(&tgstate->edits, &tgstate->genData, &tgstate->tunnels, brush, center, radius, strength);
+    if(changed > 0)
+    {
+        r32 reach = minf(radius, VOXEL_EDIT_MAX_RADIUS) + 1.0f;
+        chunkSchedulerInvalidateBox(state, vec3(center.x - reach, center.y - reach, center.z - reach),
+                                    vec3(center.x + reach, center.y + reach, center.z + reach));
+    }
+    return changed;
+}
+
+// Entry holding the chunk's samples. Otherwise an unused one, the coarsest or
+// the least recently used is cleared for it, finer samples are worth more.
+static TerrainDensityEntry* terrainGenDensityEntry(TerrainGeneratorState *tgstate, IVec3 chunkId, u64 genHash, u64 editHash)
+{
+    TerrainDensityEntry *ret = 0;
+    for(u32 i = 0; i < TERRAIN_DENSITY_CACHE_ENTRIES; i++)
+    {
+        TerrainDensityEntry *entry = &tgstate->densityCache[i];
+        if(entry->stride > 0 && entry->chunkId.x == chunkId.x && entry->chunkId.y == chunkId.y && entry->chunkId.z == chunkId.z)
+        {
+            // tunnels or edits changed, the samples are stale
+            if(entry->genHash != genHash || entry->editHash != editHash)
+                entry->stride = 0;
+            ret = entry;
+            break;
+        }
+        u32 stride = entry->stride > 0 ? entry->stride : U32MAX;
+        u32 retStride = ret ? (ret->stride > 0 ? ret->stride : U32MAX) : 0;
+        if(!ret || stride > retStride || (stride == retStride && entry->lastUsedFrame < ret->lastUsedFrame))
+            ret = entry;
+    }
+    if(ret->chunkId.x != chunkId.x || ret->chunkId.y != chunkId.y || ret->chunkId.z != chunkId.z)
+        ret->stride = 0;
+    ret->chunkId = chunkId;
+    ret->genHash = genHash;
+    ret->editHash = editHash;
+    ret->lastUsedFrame = tgstate->frame;
+    return ret;
+}
+
+// program state and buffers both passes of a slot use
+static void terrainGenBindSlot(Permanent_Storage *state, TerrainGenSlot *slot)
+{
+    TerrainGenShader *shader = &state->terrainComputeShader.terrainGen;
+    glUseProgram(state->terrainComputeShader.program);
+    glUniform1i(shader->mcubesTexture1, 0);
+    glUniform1i(shader->mcubesTexture2, 2);
+    glUniform1f(shader->voxelScale, slot->scale);
+    glUniform1i(shader->stage, slot->stage);
+    glUniform1i(shader->mesher, slot->mesher);
+    if(shader->mcubesTexture1 == -1 || shader->worldOffset == -1 || shader->voxelScale == -1 || shader->stage == -1)
+    {
+        assert(false);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, state->mcubesTexture);
+    glActiveTexture(GL_TEXTURE0+2);
+    glBindTexture(GL_TEXTURE_1D, state->mcubesTexture2);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, slot->vertInbuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, slot->tunnelBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, slot->blockBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, slot->densityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, slot->editBuffer);
+}
+
+void terrainGenSubmit(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+
+    // nothing to mesh, finish right away with an empty mesh
+    if(terrainGenClassify(tgstate, tchunk->chunkCoordinate) != VoxelChunkClass_Surface)
+    {
+        tchunk->genTicket++;
+        terrainGenAllocMesh(tgstate, tchunk, 0, 0);
+        terrainGenFinish(state, tchunk, lodLevel, true);
+        return;
+    }
+
+    u32 groups = powInt(2,lodLevel-1);
+    r32 scale = (CHUNK_SIZE/CHUNK_WORKGROUP_SIZE)/groups;
+    VoxelMesher mesher = tgstate->lodMesher[lodLevel];
+    r32 simplifyError = lodLevel == 1 ? tgstate->simplifyError : 0.0f;
+
+    u32 tunnelCount = tgstate->genData.tunnelCount;
+    u64 genHash = chunkCacheHashGenData(&tgstate->genData);
+    VoxelField field = terrainGenChunkField(tgstate);
+    u64 editHash = chunkCacheHashEdits(&field);
+    u64 meshHash = chunkCacheHashMesh(editHash, mesher, simplifyError);
+    ChunkCacheResult cached;
+    if(chunkCacheLookup(&state->game.chunkCache, tchunk->chunkCoordinate, lodLevel, genHash, meshHash, &cached))
+    {
+        // drops whatever is still in flight for this chunk
+        tchunk->genTicket++;
+        terrainGenUpload(tgstate, tchunk, cached.vertices, cached.vertexCount, cached.triangles, cached.triangleCount);
+        terrainGenFinish(state, tchunk, lodLevel, cached.triangleCount == 0);
+        terrainGenRecordMesh(tgstate, lodLevel, mesher, cached.vertexCount, cached.triangleCount);
+        tgstate->cachedLastFrame++;
+        return;
+    }
+
+    tgstate->generationsSubmitted++;
+    tgstate->tunnelsSubmitted += tunnelCount;
+    tgstate->maxChunkTunnels = max(tgstate->maxChunkTunnels, tunnelCount);
+    if(tgstate->chunkEdits.brickCount > 0)
+    {
+        tgstate->editedSubmitted++;
+        tgstate->bricksSubmitted += tgstate->chunkEdits.brickCount;
+    }
+    if(tgstate->backend == TerrainGenBackend_CPU || simplifyError > 0.0f)
+    {
+        terrainGenSubmitCpu(state, tchunk, lodLevel, groups, scale, mesher, simplifyError, genHash, meshHash);
+        return;
+    }
+    if(tgstate->backend == TerrainGenBackend_OpenCL)
+    {
+        terrainGenSubmitCl(state, tchunk, lodLevel, groups, scale, mesher, &field, genHash, meshHash);
+        return;
+    }
+
+    TerrainGenSlot *slot = 0;
+    for(u32 i = 0; i < TERRAIN_GEN_SLOTS; i++)
+    {
+        if(!tgstate->slots[i].busy)
+        {
+            slot = &tgstate->slots[i];
+            break;
+        }
+    }
+    // caller has to check terrainGenFreeSlots()
+    assert(slot);
+
+    Vec3 origin = tchunk->origin;
+
+    openglPrepageTerrainGeneration(tgstate, slot, groups, scale, &field);
+    slot->stage = TerrainGenStage_Count;
+    slot->groups = groups;
+    slot->scale = scale;
+    slot->mesher = mesher;
+    slot->alloc.valid = false;
+    terrainGenBindSlot(state, slot);
+    glUniform3fv(state->terrainComputeShader.terrainGen.worldOffset, 1, (GLfloat*)&origin);
+
+    // grid units between this LOD's samples, the finest LOD has 1
+    u32 gridStride = (CHUNK_SIZE/CHUNK_WORKGROUP_SIZE)/groups;
+    TerrainDensityEntry *density = terrainGenDensityEntry(tgstate, tchunk->chunkCoordinate, genHash, editHash);
+    glUniform1i(state->terrainComputeShader.terrainGen.cachedStride, density->stride);
+    glUniform1i(state->terrainComputeShader.terrainGen.gridStride, gridStride);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, density->buffer);
+    u64 side = CHUNK_SIZE/gridStride + 1;
+    tgstate->densitySamples += side*side*side;
+    if(density->stride > 0)
+    {
+        u64 reusedSide = CHUNK_SIZE/max(density->stride, gridStride) + 1;
+        tgstate->densitySamplesReused += reusedSide*reusedSide*reusedSide;
+    }
+    density->stride = density->stride > 0 ? min(density->stride, gridStride) : gridStride;
+
+    glBeginQuery(GL_TIME_ELAPSED, slot->timerQuery);
+    glDispatchCompute(groups*groups*groups, 1, 1);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    // block counts are read back, the samples are read by the emit pass and
+    // the cached ones by later count passes
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // the field is only set up for this chunk now, so the reference is counted right away
+    slot->verify = tgstate->verifyCounts;
+    if(slot->verify)
+    {
+        if(!tgstate->verifyScratch)
+            tgstate->verifyScratch = (VoxelScratch*)malloc(sizeof(VoxelScratch));
+        voxelCountChunk(&field, origin, groups, scale, mesher, tgstate->verifyScratch, &slot->expectedVertices, &slot->expectedTriangles);
+    }
+
+    tchunk->genTicket++;
+    slot->busy = true;
+    slot->chunkIndex = (u32)(tchunk - state->game.loadedChunks);
+    slot->ticket = tchunk->genTicket;
+    slot->lodLevel = lodLevel;
+    slot->submitFrame = tgstate->frame;
+    slot->chunkId = tchunk->chunkCoordinate;
+    slot->genHash = genHash;
+    slot->meshHash = meshHash;
+    tgstate->slotsInFlight++;
+}
+
+// The count pass is done: sums the block counts, compares them with the CPU
+// when asked to and dispatches the emit pass into an exact sized arena range.
+// Returns false if there was nothing to emit, the chunk is finished then.
+static b32 terrainGenFinishCount(Permanent_Storage *state, TerrainGenSlot *slot)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    TerrainChunk *tchunk = &state->game.loadedChunks[slot->chunkIndex];
+
+    // fence already signaled, this doesn't stall
+    u32 blockCount = slot->groups*slot->groups*slot->groups;
+    u32 vertexCount = 0;
+    u32 triangleCount = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->blockBuffer);
+    GLuint *counts = (GLuint*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, blockCount*sizeof(GLuint)*2, GL_MAP_READ_BIT);
+    for(u32 i = 0; i < blockCount; i++)
+    {
+        vertexCount += counts[2*i];
+        triangleCount += counts[2*i+1];
+        tgstate->surfaceBlocks += counts[2*i] > 0;
+    }
+    u32 side = slot->mesher == VoxelMesher_SurfaceNets ? VOXEL_NETS_SAMPLES : VOXEL_BLOCK_SAMPLES;
+    for(u32 i = 0; i < blockCount; i++)
+        tgstate->surfaceBlockSamples += counts[2*i] > 0 ? side*side*side : 0;
+    tgstate->blockSamples += blockCount*side*side*side;
+    tgstate->chunksCounted++;
+    tgstate->blocksCounted += blockCount;
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLuint64 gpuNs;
+    glGetQueryObjectui64v(slot->timerQuery, GL_QUERY_RESULT, &gpuNs);
+    slot->countMs = gpuNs/1000000.0f;
+
+    if(slot->verify)
+    {
+        tgstate->countsVerified++;
+        if(vertexCount != slot->expectedVertices || triangleCount != slot->expectedTriangles)
+        {
+            tgstate->countMismatches++;
+            printf("chunk (%d, %d, %d) LOD %u: GPU counted %u vertices and %u triangles, CPU %u and %u\n",
+                   slot->chunkId.x, slot->chunkId.y, slot->chunkId.z, slot->lodLevel,
+                   vertexCount, triangleCount, slot->expectedVertices, slot->expectedTriangles);
+        }
+    }
+
+    if(triangleCount == 0 || !meshArenaAlloc(&tgstate->meshArena, vertexCount, triangleCount, &slot->alloc))
+    {
+        if(triangleCount > 0)
+            printf("Mesh arena is full, chunk mesh dropped\n");
+        terrainGenRecordCost(tgstate, slot->lodLevel, slot->countMs);
+        terrainGenAllocMesh(tgstate, tchunk, 0, 0);
+        terrainGenFinish(state, tchunk, slot->lodLevel, triangleCount == 0);
+        return false;
+    }
+
+    MeshArenaAllocation *alloc = &slot->alloc;
+    MeshArenaPage *page = &tgstate->meshArena.pages[alloc->page];
+    slot->stage = TerrainGenStage_Emit;
+    terrainGenBindSlot(state, slot);
+    glUniform1ui(state->terrainComputeShader.terrainGen.firstVertex, alloc->firstVertex);
+    glUniform1ui(state->terrainComputeShader.terrainGen.firstTriangle, alloc->firstTriangle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, page->vertexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, page->elementBuffer);
+
+    glBeginQuery(GL_TIME_ELAPSED, slot->emitTimerQuery);
+    glDispatchCompute(blockCount, 1, 1);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    // the mesh is drawn from the arena and copied out for the cache
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // mapping the arena page would wait for everything else writing to it,
+    // the copy is in the slot's own buffer by the time the fence signals
+    if(state->game.chunkCache.enabled)
+    {
+        u32 vertexBytes = vertexCount*sizeof(VertexOut);
+        u32 triangleBytes = triangleCount*sizeof(TriangleOut);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, slot->readbackBuffer);
+        if(vertexBytes + triangleBytes > slot->readbackBufferSize)
+        {
+            while(vertexBytes + triangleBytes > slot->readbackBufferSize)
+                slot->readbackBufferSize = slot->readbackBufferSize > 0 ? slot->readbackBufferSize*2 : Megabytes(1);
+            glBufferData(GL_COPY_WRITE_BUFFER, slot->readbackBufferSize, 0, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, page->vertexBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, alloc->firstVertex*sizeof(VertexOut), 0, vertexBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, page->elementBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, alloc->firstTriangle*sizeof(TriangleOut), vertexBytes, triangleBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    return true;
+}
+
+// the emit pass is done, the new mesh replaces the chunk's old one
+static void terrainGenFinishEmit(Permanent_Storage *state, TerrainGenSlot *slot)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    TerrainChunk *tchunk = &state->game.loadedChunks[slot->chunkIndex];
+
+    GLuint64 gpuNs;
+    glGetQueryObjectui64v(slot->emitTimerQuery, GL_QUERY_RESULT, &gpuNs);
+    terrainGenRecordCost(tgstate, slot->lodLevel, slot->countMs + gpuNs/1000000.0f);
+
+    meshArenaFree(&tgstate->meshArena, &tchunk->meshAlloc);
+    tchunk->meshAlloc = slot->alloc;
+    slot->alloc.valid = false;
+
+    // the copy is complete, mapping it doesn't stall
+    u32 vertexCount = tchunk->meshAlloc.vertexCount;
+    u32 triangleCount = tchunk->meshAlloc.triangleCount;
+    if(state->game.chunkCache.enabled)
+    {
+        u32 vertexBytes = vertexCount*sizeof(VertexOut);
+        glBindBuffer(GL_COPY_READ_BUFFER, slot->readbackBuffer);
+        u8 *mesh = (u8*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, vertexBytes + triangleCount*sizeof(TriangleOut), GL_MAP_READ_BIT);
+        if(mesh)
+        {
+            chunkCacheStore(&state->game.chunkCache, slot->chunkId, slot->lodLevel, slot->genHash, slot->meshHash,
+                            (VertexOut*)mesh, vertexCount, (TriangleOut*)(mesh + vertexBytes), triangleCount);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    terrainGenFinish(state, tchunk, slot->lodLevel, false);
+    terrainGenRecordMesh(tgstate, slot->lodLevel, slot->mesher, vertexCount, triangleCount);
+}
+
+// mesh of a CPU or OpenCL slot is complete in host memory
+static void terrainGenFinishHost(Permanent_Storage *state, TerrainChunk *tchunk, u32 lodLevel, VoxelMesher mesher,
+                                 IVec3 chunkId, u64 genHash, u64 meshHash, VoxelMeshOutput *out, const char *backendName)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    if(out->overflow)
+    {
+        printf("%s terrain chunk ran out of output space, mesh is incomplete\n", backendName);
+        tgstate->hostOverflows++;
+    }
+    else
+    {
+        chunkCacheStore(&state->game.chunkCache, chunkId, lodLevel, genHash, meshHash,
+                        out->vertices, out->vertexCount, out->triangles, out->triangleCount);
+    }
+    terrainGenUpload(tgstate, tchunk, out->vertices, out->vertexCount, out->triangles, out->triangleCount);
+    terrainGenFinish(state, tchunk, lodLevel, out->triangleCount == 0);
+    terrainGenRecordMesh(tgstate, lodLevel, mesher, out->vertexCount, out->triangleCount);
+}
+
+static void terrainGenFinishCpu(Permanent_Storage *state, TerrainGenCpuSlot *slot)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    if(slot->simplifyError > 0.0f && !slot->out.overflow && slot->generatedTriangles > 0)
+    {
+        tgstate->simplifiedChunks++;
+        tgstate->simplifiedBefore += slot->generatedTriangles;
+        tgstate->simplifiedAfter += slot->out.triangleCount;
+        tgstate->simplifyMs += slot->simplifyMs;
+    }
+    terrainGenFinishHost(state, &state->game.loadedChunks[slot->chunkIndex], slot->lodLevel, slot->mesher,
+                         slot->chunkId, slot->genHash, slot->meshHash, &slot->out, "CPU");
+}
+
+void terrainGenPoll(Permanent_Storage *state)
+{
+    TerrainGeneratorState *tgstate = &state->terrainGenState;
+    tgstate->completedLastFrame = 0;
+    tgstate->cachedLastFrame = 0;
+    tgstate->discardedLastFrame = 0;
+
+    for(u32 i = 0; i < TERRAIN_GEN_SLOTS; i++)
+    {
+        TerrainGenSlot *slot = &tgstate->slots[i];
+        if(!slot->busy)
+            continue;
+        GLenum res = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(res == GL_TIMEOUT_EXPIRED)
+            continue;
+        if(res == GL_WAIT_FAILED)
+        {
+            printf("terrain generation fence wait failed\n");
+            assert(false);
+        }
+        glDeleteSync(slot->fence);
+        slot->fence = 0;
+
+        // chunk was resubmitted meanwhile, a newer result is on the way
+        if(slot->ticket != state->game.loadedChunks[slot->chunkIndex].genTicket)
+        {
+            meshArenaFree(&tgstate->meshArena, &slot->alloc);
+            tgstate->discardedLastFrame++;
+        }
+        else if(slot->stage == TerrainGenStage_Count && terrainGenFinishCount(state, slot))
+        {
+            // emit pass is in flight now
+            continue;
+        }
+        else
+        {
+            if(slot->stage == TerrainGenStage_Emit)
+                terrainGenFinishEmit(state, slot);
+            tgstate->completedLastFrame++;
+            tgstate->totalCompleted++;
+            tgstate->maxLatencyFrames = max(tgstate->maxLatencyFrames, tgstate->frame - slot->submitFrame);
+        }
+        slot->busy = false;
+        tgstate->slotsInFlight--;
+    }
+
+    tgstate->cpuGenMs = 0.0f;
+    for(u32 i = 0; i < TERRAIN_GEN_CPU_SLOTS; i++)
+    {
+        TerrainGenCpuSlot *slot = &tgstate->cpuSlots[i];
+        if(!slot->busy || !__atomic_load_n(&slot->done, __ATOMIC_ACQUIRE))
+            continue;
+
+        if(slot->ticket == state->game.loadedChunks[slot->chunkIndex].genTicket)
+        {
+            terrainGenFinishCpu(state, slot);
+            tgstate->completedLastFrame++;
+            tgstate->totalCompleted++;
+            tgstate->cpuGenMs += slot->genMs;
+            terrainGenRecordCost(tgstate, slot->lodLevel, slot->genMs);
+            tgstate->maxLatencyFrames = max(tgstate->maxLatencyFrames, tgstate->frame - slot->submitFrame);
+        }
+        else
+        {
+            tgstate->discardedLastFrame++;
+        }
+        slot->busy = false;
+        tgstate->cpuSlotsInFlight--;
+    }
+
+    tgstate->clGenMs = 0.0f;
+    for(u32 i = 0; i < TERRAIN_GEN_CL_SLOTS; i++)
+    {
+        TerrainGenClSlot *slot = &tgstate->clSlots[i];
+        if(!slot->busy || !openclTerrainDone(&slot->job))
+            continue;
+
+        // read even if the chunk moved on, that frees the job for the next one
+        slot->genMs = openclTerrainRead(&slot->job, &slot->out);
+        if(slot->ticket == state->game.loadedChunks[slot->chunkIndex].genTicket)
+        {
+            terrainGenFinishHost(state, &state->game.loadedChunks[slot->chunkIndex], slot->lodLevel, slot->mesher,
+                                 slot->chunkId, slot->genHash, slot->meshHash, &slot->out, "OpenCL");
+            tgstate->completedLastFrame++;
+            tgstate->totalCompleted++;
+            tgstate->clGenMs += slot->genMs;
+            terrainGenRecordCost(tgstate, slot->lodLevel, slot->genMs);
+            tgstate->maxLatencyFrames = max(tgstate->maxLatencyFrames, tgstate->frame - slot->submitFrame);
+        }
+        else
+        {
+            tgstate->discardedLastFrame++;
+        }
+        slot->busy = false;
+        tgstate->clSlotsInFlight--;
+    }
+    tgstate->frame++;
+}
+
+void terrainGenPrintStats(TerrainGeneratorState *tgstate)
+{
+    if(tgstate->backend == TerrainGenBackend_CPU)
+    {
+        printf("terrain gen (CPU, %u workers): %u done (%.2fms worker time), %u cached, %u dropped, %u/%d slots in flight, %u total, max latency %u frames\n",
+               tgstate->workers.threadCount, tgstate->completedLastFrame, tgstate->cpuGenMs, tgstate->cachedLastFrame, tgstate->discardedLastFrame,
+               tgstate->cpuSlotsInFlight, TERRAIN_GEN_CPU_SLOTS, tgstate->totalCompleted, tgstate->maxLatencyFrames);
+    }
+    else if(tgstate->backend == TerrainGenBackend_OpenCL)
+    {
+        printf("terrain gen (OpenCL, %s): %u done (%.2fms device time), %u cached, %u dropped, %u/%d slots in flight, %u total, max latency %u frames\n",
+               tgstate->opencl.deviceName, tgstate->completedLastFrame, tgstate->clGenMs, tgstate->cachedLastFrame, tgstate->discardedLastFrame,
+               tgstate->clSlotsInFlight, TERRAIN_GEN_CL_SLOTS, tgstate->totalCompleted, tgstate->maxLatencyFrames);
+    }
+    else
+    {
+        printf("terrain gen (GPU): %u done, %u cached, %u dropped, %u/%d slots in flight, %u total, max latency %u frames\n",
+               tgstate->completedLastFrame, tgstate->cachedLastFrame, tgstate->discardedLastFrame, tgstate->slotsInFlight, TERRAIN_GEN_SLOTS,
+               tgstate->totalCompleted, tgstate->maxLatencyFrames);
+    }
+    u32 culled = tgstate->classified[VoxelChunkClass_Air] + tgstate->classified[VoxelChunkClass_Solid];
+    u32 total = culled + tgstate->classified[VoxelChunkClass_Surface];
+    printf("chunk classifier: %u air, %u solid, %u surface, %.1f%% culled\n",
+           tgstate->classified[VoxelChunkClass_Air], tgstate->classified[VoxelChunkClass_Solid],
+           tgstate->classified[VoxelChunkClass_Surface], total ? 100.0f*culled/total : 0.0f);
+    printf("tunnels: %u total in %u cells, %.2f per generated chunk, %u max\n",
+           tgstate->tunnels.tunnelCount, tgstate->tunnels.cellCount,
+           tgstate->generationsSubmitted ? (r64)tgstate->tunnelsSubmitted/tgstate->generationsSubmitted : 0.0,
+           tgstate->maxChunkTunnels);
+    printf("edits: %u bricks (%.1fMB), %u generated chunks had edits, %.1f bricks each\n",
+           tgstate->edits.brickCount, tgstate->edits.brickCount*sizeof(VoxelBrick)/(r64)Megabytes(1),
+           tgstate->editedSubmitted, tgstate->editedSubmitted ? (r64)tgstate->bricksSubmitted/tgstate->editedSubmitted : 0.0);
+    if(tgstate->densitySamples > 0)
+    {
+        printf("density cache: %.1f%% of %llu samples reused\n",
+               100.0*tgstate->densitySamplesReused/tgstate->densitySamples, (unsigned long long)tgstate->densitySamples);
+    }
+    if(tgstate->chunksCounted > 0)
+    {
+        // written by the count pass and read by the emit pass
+        r64 sampleBytes = sizeof(r32)*2.0;
+        printf("GPU scratch: %.1f%% of blocks had a surface, %.0fKB of samples stored and read per chunk (%.0fKB if all were)\n",
+               100.0*tgstate->surfaceBlocks/tgstate->blocksCounted,
+               tgstate->surfaceBlockSamples*sampleBytes/tgstate->chunksCounted/1024.0,
+               tgstate->blockSamples*sampleBytes/tgstate->chunksCounted/1024.0);
+    }
+    for(u32 lod = 1; lod < 4; lod++)
+    {
+        u32 *chunks = tgstate->meshedChunks[0];
+        u32 *netsChunks = tgstate->meshedChunks[1];
+        if(chunks[lod] == 0 && netsChunks[lod] == 0)
+            continue;
+        // per chunk with a surface, both columns fill up once J switched the LOD
+        printf("LOD %u meshes: marching cubes %.0f vertices %.0f triangles (%u chunks), surface nets %.0f vertices %.0f triangles (%u chunks)\n",
+               lod, chunks[lod] ? (r64)tgstate->meshedVertices[0][lod]/chunks[lod] : 0.0,
+               chunks[lod] ? (r64)tgstate->meshedTriangles[0][lod]/chunks[lod] : 0.0, chunks[lod],
+               netsChunks[lod] ? (r64)tgstate->meshedVertices[1][lod]/netsChunks[lod] : 0.0,
+               netsChunks[lod] ? (r64)tgstate->meshedTriangles[1][lod]/netsChunks[lod] : 0.0, netsChunks[lod]);
+    }
+    if(tgstate->simplifiedChunks > 0)
+    {
+        printf("simplification: %u LOD 1 chunks, %llu -> %llu triangles (-%.1f%%), %.2fms per chunk\n",
+               tgstate->simplifiedChunks, (unsigned long long)tgstate->simplifiedBefore,
+               (unsigned long long)tgstate->simplifiedAfter,
+               100.0*(tgstate->simplifiedBefore - tgstate->simplifiedAfter)/tgstate->simplifiedBefore,
+               tgstate->simplifyMs/tgstate->simplifiedChunks);
+    }
+    if(tgstate->countsVerified > 0)
+    {
+        printf("count check: %u GPU chunks counted again on the CPU, %u mismatched\n",
+               tgstate->countsVerified, tgstate->countMismatches);
+    }
+}
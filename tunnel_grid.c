@@ -0,0 +1,175 @@
+#include "voxel_terrain.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Spatial index of the tunnels.
+//
+// The world is split into cells of TUNNEL_GRID_CELL_SIZE, a tunnel is added
+// to every cell its capsule (grown into a box, see voxelTunnelTouchesBox())
+// reaches. Cells live in an open addressing hash map and keep a linked list of
+// their tunnels, so a chunk only ever sees the tunnels near it no matter how
+// many there are in total. Nothing has a fixed limit, the arrays are doubled
+// when they run out.
+
+#define TUNNEL_GRID_NONE 0xFFFFFFFF
+// cells are grown by what a chunk samples past its cube, and a unit so
+// rounding never drops a tunnel that grazes one
+#define TUNNEL_GRID_MARGIN (VOXEL_CHUNK_REACH + 1.0f)
+
+static IVec3 tunnelGridCell(Vec3 position)
+{
+    IVec3 ret;
+    ret.x = (i32)floorf(position.x/TUNNEL_GRID_CELL_SIZE);
+    ret.y = (i32)floorf(position.y/TUNNEL_GRID_CELL_SIZE);
+    ret.z = (i32)floorf(position.z/TUNNEL_GRID_CELL_SIZE);
+    return ret;
+}
+
+static void* tunnelGridGrow(void *array, u32 *capacity, u32 elementSize)
+{
+    *capacity = *capacity > 0 ? *capacity*2 : 64;
+    void *ret = realloc(array, (u64)*capacity*elementSize);
+    assert(ret);
+    return ret;
+}
+
+void tunnelGridInit(TunnelGrid *grid)
+{
+    memset(grid, 0, sizeof(TunnelGrid));
+    grid->cellCapacity = 1024;
+    grid->cells = (TunnelGridCell*)calloc(grid->cellCapacity, sizeof(TunnelGridCell));
+}
+
+void tunnelGridDestroy(TunnelGrid *grid)
+{
+    free(grid->tunnels);
+    free(grid->cells);
+    free(grid->nodes);
+    memset(grid, 0, sizeof(TunnelGrid));
+}
+
+static TunnelGridCell* tunnelGridFindCell(TunnelGridCell *cells, u32 capacity, IVec3 cell)
+{
+    u32 slot = voxelHashCell(cell) & (capacity-1);
+    while(cells[slot].used)
+    {
+        if(cells[slot].cell.x == cell.x && cells[slot].cell.y == cell.y && cells[slot].cell.z == cell.z)
+            return &cells[slot];
+        slot = (slot+1) & (capacity-1);
+    }
+    return &cells[slot];
+}
+
+// returns the cell's entry, adding it if needed, keeps the map at most half full
+static TunnelGridCell* tunnelGridGetCell(TunnelGrid *grid, IVec3 cell)
+{
+    if((grid->cellCount+1)*2 > grid->cellCapacity)
+    {
+        u32 oldCapacity = grid->cellCapacity;
+        TunnelGridCell *oldCells = grid->cells;
+        grid->cellCapacity *= 2;
+        grid->cells = (TunnelGridCell*)calloc(grid->cellCapacity, sizeof(TunnelGridCell));
+        for(u32 i = 0; i < oldCapacity; i++)
+        {
+            if(oldCells[i].used)
+                *tunnelGridFindCell(grid->cells, grid->cellCapacity, oldCells[i].cell) = oldCells[i];
+        }
+        free(oldCells);
+    }
+
+    TunnelGridCell *ret = tunnelGridFindCell(grid->cells, grid->cellCapacity, cell);
+    if(!ret->used)
+    {
+        ret->used = true;
+        ret->cell = cell;
+        ret->first = TUNNEL_GRID_NONE;
+        grid->cellCount++;
+    }
+    return ret;
+}
+
+// The capsule is walked a cell length at a time, only the cells around each
+// piece are tested. Returns the index of the tunnel.
+u32 tunnelGridAdd(TunnelGrid *grid, Line3D tunnel)
+{
+    if(grid->tunnelCount == grid->tunnelCapacity)
+        grid->tunnels = (Line3D*)tunnelGridGrow(grid->tunnels, &grid->tunnelCapacity, sizeof(Line3D));
+    u32 index = grid->tunnelCount++;
+    grid->tunnels[index] = tunnel;
+
+    Vec3 start = vec3FromVec4(tunnel.start);
+    Vec3 end = vec3FromVec4(tunnel.end);
+    Vec3 delta;
+    vec3Sub(&delta, &end, &start);
+    u32 pieces = (u32)(vec3Mag(&delta)/TUNNEL_GRID_CELL_SIZE) + 1;
+    for(u32 piece = 0; piece < pieces; piece++)
+    {
+        Vec3 a, b;
+        vec3Scale(&a, &delta, (r32)piece/pieces);
+        vec3Add(&a, &a, &start);
+        vec3Scale(&b, &delta, (r32)(piece+1)/pieces);
+        vec3Add(&b, &b, &start);
+        r32 reach = VOXEL_TUNNEL_RADIUS + TUNNEL_GRID_MARGIN;
+        IVec3 minCell = tunnelGridCell(vec3(minf(a.x, b.x) - reach, minf(a.y, b.y) - reach, minf(a.z, b.z) - reach));
+        IVec3 maxCell = tunnelGridCell(vec3(maxf(a.x, b.x) + reach, maxf(a.y, b.y) + reach, maxf(a.z, b.z) + reach));
+        for(i32 x = minCell.x; x <= maxCell.x; x++)
+        {
+            for(i32 y = minCell.y; y <= maxCell.y; y++)
+            {
+                for(i32 z = minCell.z; z <= maxCell.z; z++)
+                {
+                    Vec3 origin = vec3((r32)x*TUNNEL_GRID_CELL_SIZE - TUNNEL_GRID_MARGIN, (r32)y*TUNNEL_GRID_CELL_SIZE - TUNNEL_GRID_MARGIN,
+                                       (r32)z*TUNNEL_GRID_CELL_SIZE - TUNNEL_GRID_MARGIN);
+                    if(!voxelTunnelTouchesBox(&tunnel, origin, TUNNEL_GRID_CELL_SIZE + 2.0f*TUNNEL_GRID_MARGIN))
+                        continue;
+                    IVec3 cellId;
+                    cellId.x = x;
+                    cellId.y = y;
+                    cellId.z = z;
+                    TunnelGridCell *cell = tunnelGridGetCell(grid, cellId);
+                    // cells shared by neighbouring pieces already have it at the front
+                    if(cell->first != TUNNEL_GRID_NONE && grid->nodes[cell->first].tunnel == index)
+                        continue;
+                    if(grid->nodeCount == grid->nodeCapacity)
+                        grid->nodes = (TunnelGridNode*)tunnelGridGrow(grid->nodes, &grid->nodeCapacity, sizeof(TunnelGridNode));
+                    TunnelGridNode *node = &grid->nodes[grid->nodeCount];
+                    node->tunnel = index;
+                    node->next = cell->first;
+                    cell->first = grid->nodeCount++;
+                }
+            }
+        }
+    }
+    return index;
+}
+
+// Copies the tunnels reaching the cell at cellOrigin into *tunnels, growing it
+// as needed, and returns how many there are. They come out in the order they
+// were added, the density function gives the first tunnel that contains a
+// point precedence.
+u32 tunnelGridGather(TunnelGrid *grid, Vec3 cellOrigin, Line3D **tunnels, u32 *capacity)
+{
+    if(grid->cellCount == 0)
+        return 0;
+    TunnelGridCell *cell = tunnelGridFindCell(grid->cells, grid->cellCapacity, tunnelGridCell(cellOrigin));
+    if(!cell->used)
+        return 0;
+
+    u32 count = 0;
+    for(u32 node = cell->first; node != TUNNEL_GRID_NONE; node = grid->nodes[node].next)
+    {
+        if(count == *capacity)
+            *tunnels = (Line3D*)tunnelGridGrow(*tunnels, capacity, sizeof(Line3D));
+        (*tunnels)[count++] = grid->tunnels[grid->nodes[node].tunnel];
+    }
+    // the list is newest first
+    for(u32 i = 0; i < count/2; i++)
+    {
+        Line3D tmp = (*tunnels)[i];
+        (*tunnels)[i] = (*tunnels)[count-1-i];
+        (*tunnels)[count-1-i] = tmp;
+    }
+    return count;
+}
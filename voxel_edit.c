@@ -0,0 +1,254 @@
+#include "voxel_terrain.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Sparse edits of the terrain.
+//
+// Brushes never touch the procedural field, they store the difference they
+// want in bricks of VOXEL_BRICK_SIZE^3 voxels that get added to it when a chunk
+// is meshed. Bricks are found through an open addressing hash map keyed by
+// brick coordinate and only exist where a brush actually changed something,
+// the rest of the world has no edit data at all. Meshing a chunk copies out
+// just the bricks it samples, see voxelEditGather().
+
+// smaller changes are rounding noise, they don't make bricks
+#define VOXEL_EDIT_EPSILON 0.001f
+
+static i32 voxelEditFloorDiv(i32 a, i32 b)
+{
+    return a >= 0 ? a/b : -((-a+b-1)/b);
+}
+
+static void* voxelEditGrow(void *array, u32 *capacity, u32 elementSize)
+{
+    *capacity = *capacity > 0 ? *capacity*2 : 16;
+    void *ret = realloc(array, (u64)*capacity*elementSize);
+    assert(ret);
+    return ret;
+}
+
+void voxelEditInit(VoxelEditStore *store)
+{
+    memset(store, 0, sizeof(VoxelEditStore));
+    store->cellCapacity = 1024;
+    store->cells = (VoxelEditCell*)calloc(store->cellCapacity, sizeof(VoxelEditCell));
+}
+
+void voxelEditDestroy(VoxelEditStore *store)
+{
+    free(store->bricks);
+    free(store->cells);
+    memset(store, 0, sizeof(VoxelEditStore));
+}
+
+static VoxelEditCell* voxelEditFindCell(VoxelEditCell *cells, u32 capacity, IVec3 brick)
+{
+    u32 slot = voxelHashCell(brick) & (capacity-1);
+    while(cells[slot].used)
+    {
+        if(cells[slot].brick.x == brick.x && cells[slot].brick.y == brick.y && cells[slot].brick.z == brick.z)
+            return &cells[slot];
+        slot = (slot+1) & (capacity-1);
+    }
+    return &cells[slot];
+}
+
+// index of the brick, a new one is all zeroes, keeps the map at most half full
+static u32 voxelEditGetBrick(VoxelEditStore *store, IVec3 brick)
+{
+    VoxelEditCell *cell = voxelEditFindCell(store->cells, store->cellCapacity, brick);
+    if(cell->used)
+        return cell->index;
+
+    if((store->brickCount+1)*2 > store->cellCapacity)
+    {
+        u32 oldCapacity = store->cellCapacity;
+        VoxelEditCell *oldCells = store->cells;
+        store->cellCapacity *= 2;
+        store->cells = (VoxelEditCell*)calloc(store->cellCapacity, sizeof(VoxelEditCell));
+        for(u32 i = 0; i < oldCapacity; i++)
+        {
+            if(oldCells[i].used)
+                *voxelEditFindCell(store->cells, store->cellCapacity, oldCells[i].brick) = oldCells[i];
+        }
+        free(oldCells);
+        cell = voxelEditFindCell(store->cells, store->cellCapacity, brick);
+    }
+    if(store->brickCount == store->brickCapacity)
+        store->bricks = (VoxelBrick*)voxelEditGrow(store->bricks, &store->brickCapacity, sizeof(VoxelBrick));
+
+    cell->used = true;
+    cell->brick = brick;
+    cell->index = store->brickCount++;
+    memset(&store->bricks[cell->index], 0, sizeof(VoxelBrick));
+    return cell->index;
+}
+
+static IVec3 voxelEditBrickOf(i32 x, i32 y, i32 z)
+{
+    IVec3 ret;
+    ret.x = voxelEditFloorDiv(x, VOXEL_BRICK_SIZE);
+    ret.y = voxelEditFloorDiv(y, VOXEL_BRICK_SIZE);
+    ret.z = voxelEditFloorDiv(z, VOXEL_BRICK_SIZE);
+    return ret;
+}
+
+static u32 voxelEditVoxelIndex(IVec3 brick, i32 x, i32 y, i32 z)
+{
+    i32 lx = x - brick.x*VOXEL_BRICK_SIZE;
+    i32 ly = y - brick.y*VOXEL_BRICK_SIZE;
+    i32 lz = z - brick.z*VOXEL_BRICK_SIZE;
+    return (lz*VOXEL_BRICK_SIZE + ly)*VOXEL_BRICK_SIZE + lx;
+}
+
+static r32 voxelEditGet(VoxelEditStore *store, i32 x, i32 y, i32 z)
+{
+    IVec3 brick = voxelEditBrickOf(x, y, z);
+    VoxelEditCell *cell = voxelEditFindCell(store->cells, store->cellCapacity, brick);
+    if(!cell->used)
+        return 0.0f;
+    return store->bricks[cell->index].delta[voxelEditVoxelIndex(brick, x, y, z)];
+}
+
+static void voxelEditAdd(VoxelEditStore *store, i32 x, i32 y, i32 z, r32 amount)
+{
+    IVec3 brick = voxelEditBrickOf(x, y, z);
+    u32 index = voxelEditGetBrick(store, brick);
+    store->bricks[index].delta[voxelEditVoxelIndex(brick, x, y, z)] += amount;
+}
+
+// Moves every voxel within radius of center the strength part of the way to
+// what the brush wants there. Dig and fill are a CSG subtraction and union of
+// the sphere, smooth pulls voxels towards the average of their neighbours and
+// fades out towards the rim. Tunnels are part of the density that is edited,
+// so they are gathered a cell at a time like for a chunk. Returns how many
+// voxels changed, the caller has to regenerate the chunks around the sphere.
+u32 voxelEditApply(VoxelEditStore *store, ChunkGenData *gen, TunnelGrid *tunnels, VoxelBrush brush,
+                   Vec3 center, r32 radius, r32 strength)
+{
+    radius = minf(radius, VOXEL_EDIT_MAX_RADIUS);
+    // the voxels the sphere reaches and a border for the neighbours
+    i32 minX = (i32)floorf(center.x - radius) - 1;
+    i32 minY = (i32)floorf(center.y - radius) - 1;
+    i32 minZ = (i32)floorf(center.z - radius) - 1;
+    i32 sizeX = (i32)ceilf(center.x + radius) + 1 - minX + 1;
+    i32 sizeY = (i32)ceilf(center.y + radius) + 1 - minY + 1;
+    i32 sizeZ = (i32)ceilf(center.z + radius) + 1 - minZ + 1;
+    i32 strideZ = sizeX*sizeY;
+    r32 *current = (r32*)malloc(strideZ*sizeZ*sizeof(r32));
+
+    ChunkGenData cellGen = *gen;
+    Line3D *cellTunnels = 0;
+    u32 cellTunnelCapacity = 0;
+    IVec3 lastCell;
+    b32 haveCell = false;
+    for(i32 z = 0; z < sizeZ; z++)
+    {
+        for(i32 y = 0; y < sizeY; y++)
+        {
+            for(i32 x = 0; x < sizeX; x++)
+            {
+                i32 wx = minX+x, wy = minY+y, wz = minZ+z;
+                IVec3 cell;
+                cell.x = voxelEditFloorDiv(wx, TUNNEL_GRID_CELL_SIZE);
+                cell.y = voxelEditFloorDiv(wy, TUNNEL_GRID_CELL_SIZE);
+                cell.z = voxelEditFloorDiv(wz, TUNNEL_GRID_CELL_SIZE);
+                if(!haveCell || cell.x != lastCell.x || cell.y != lastCell.y || cell.z != lastCell.z)
+                {
+                    Vec3 cellOrigin = vec3((r32)cell.x*TUNNEL_GRID_CELL_SIZE, (r32)cell.y*TUNNEL_GRID_CELL_SIZE,
+                                           (r32)cell.z*TUNNEL_GRID_CELL_SIZE);
+                    cellGen.tunnelCount = tunnelGridGather(tunnels, cellOrigin, &cellTunnels, &cellTunnelCapacity);
+                    lastCell = cell;
+                    haveCell = true;
+                }
+                Vec3 position = vec3((r32)wx, (r32)wy, (r32)wz);
+                current[z*strideZ + y*sizeX + x] = voxelProceduralDensity(&cellGen, cellTunnels, position)
+                        + voxelEditGet(store, wx, wy, wz);
+            }
+        }
+    }
+
+    u32 changed = 0;
+    for(i32 z = 1; z < sizeZ-1; z++)
+    {
+        for(i32 y = 1; y < sizeY-1; y++)
+        {
+            for(i32 x = 1; x < sizeX-1; x++)
+            {
+                i32 wx = minX+x, wy = minY+y, wz = minZ+z;
+                Vec3 toCenter = vec3(wx - center.x, wy - center.y, wz - center.z);
+                r32 distance = vec3Mag(&toCenter);
+                if(distance > radius)
+                    continue;
+
+                i32 index = z*strideZ + y*sizeX + x;
+                r32 value = current[index];
+                r32 target = value;
+                switch(brush)
+                {
+                    case VoxelBrush_Dig:
+                    {
+                        target = minf(value, distance - radius);
+                    } break;
+                    case VoxelBrush_Fill:
+                    {
+                        target = maxf(value, radius - distance);
+                    } break;
+                    case VoxelBrush_Smooth:
+                    {
+                        r32 average = (current[index-1] + current[index+1] + current[index-sizeX]
+                                       + current[index+sizeX] + current[index-strideZ] + current[index+strideZ])/6.0f;
+                        target = value + (1.0f - distance/radius)*(average - value);
+                    } break;
+                }
+                if(fabsf(target - value) < VOXEL_EDIT_EPSILON)
+                    continue;
+                voxelEditAdd(store, wx, wy, wz, strength*(target - value));
+                changed++;
+            }
+        }
+    }
+
+    free(cellTunnels);
+    free(current);
+    return changed;
+}
+
+// Copies the bricks the chunk at chunkOrigin samples into *bricks, growing it
+// as needed, and fills in the table pointing at them.
+void voxelEditGather(VoxelEditStore *store, Vec3 chunkOrigin, VoxelEditChunk *edits, VoxelBrick **bricks, u32 *capacity)
+{
+    edits->brickCount = 0;
+    // nothing was ever edited, the table isn't even looked at
+    if(store->brickCount == 0)
+        return;
+
+    edits->firstBrick = voxelEditBrickOf((i32)floorf(chunkOrigin.x+0.5f), (i32)floorf(chunkOrigin.y+0.5f),
+                                         (i32)floorf(chunkOrigin.z+0.5f));
+    for(i32 z = 0; z < VOXEL_CHUNK_BRICKS; z++)
+    {
+        for(i32 y = 0; y < VOXEL_CHUNK_BRICKS; y++)
+        {
+            for(i32 x = 0; x < VOXEL_CHUNK_BRICKS; x++)
+            {
+                IVec3 brick;
+                brick.x = edits->firstBrick.x + x;
+                brick.y = edits->firstBrick.y + y;
+                brick.z = edits->firstBrick.z + z;
+                i32 *entry = &edits->table[(z*VOXEL_CHUNK_BRICKS + y)*VOXEL_CHUNK_BRICKS + x];
+                VoxelEditCell *cell = voxelEditFindCell(store->cells, store->cellCapacity, brick);
+                if(!cell->used)
+                {
+                    *entry = -1;
+                    continue;
+                }
+                if(edits->brickCount == *capacity)
+                    *bricks = (VoxelBrick*)voxelEditGrow(*bricks, capacity, sizeof(VoxelBrick));
+                (*bricks)[edits->brickCount] = store->bricks[cell->index];
+                *entry = (i32)edits->brickCount++;
+            }
+        }
+    }
+}
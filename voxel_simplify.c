@@ -0,0 +1,344 @@
+#include "voxel_terrain.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Quadric error mesh simplification of finished chunk meshes.
+//
+// Every vertex gets the sum of the plane quadrics of its triangles, the cost
+// of collapsing an edge is the squared distance of the kept vertex to all the
+// planes the removed one had. Edges only collapse onto one of their vertices,
+// so no vertex moves and the packed normals stay valid. Passes collapse the
+// cheapest edges below the error that don't touch each other until none is
+// left. Vertices on the mesh border, where the chunk meets its neighbours, and
+// on non-manifold edges never go away, seams stay as they were generated.
+
+// flags of a vertex
+#define VOXEL_SIMPLIFY_LOCKED 1
+#define VOXEL_SIMPLIFY_TOUCHED 2 // by a collapse of this pass
+
+static void* voxelSimplifyGrow(void *array, u32 count, u32 elementSize)
+{
+    void *ret = realloc(array, (u64)count*elementSize);
+    assert(ret);
+    return ret;
+}
+
+static void voxelSimplifyReserve(VoxelSimplifyScratch *scratch, u32 vertexCount, u32 triangleCount)
+{
+    if(vertexCount > scratch->vertexCapacity)
+    {
+        scratch->vertexCapacity = vertexCount;
+        scratch->positions = (Vec3*)voxelSimplifyGrow(scratch->positions, vertexCount, sizeof(Vec3));
+        scratch->quadrics = (r64*)voxelSimplifyGrow(scratch->quadrics, vertexCount*10, sizeof(r64));
+        scratch->remap = (u32*)voxelSimplifyGrow(scratch->remap, vertexCount, sizeof(u32));
+        scratch->flags = (u8*)voxelSimplifyGrow(scratch->flags, vertexCount, sizeof(u8));
+        scratch->adjacencyStart = (u32*)voxelSimplifyGrow(scratch->adjacencyStart, vertexCount+1, sizeof(u32));
+    }
+    if(triangleCount > scratch->triangleCapacity)
+    {
+        scratch->triangleCapacity = triangleCount;
+        scratch->adjacency = (u32*)voxelSimplifyGrow(scratch->adjacency, triangleCount*3, sizeof(u32));
+        scratch->edges = (u64*)voxelSimplifyGrow(scratch->edges, triangleCount*3, sizeof(u64));
+        scratch->collapses = (VoxelCollapse*)voxelSimplifyGrow(scratch->collapses, triangleCount*3, sizeof(VoxelCollapse));
+    }
+}
+
+void voxelSimplifyDestroy(VoxelSimplifyScratch *scratch)
+{
+    free(scratch->positions);
+    free(scratch->quadrics);
+    free(scratch->remap);
+    free(scratch->flags);
+    free(scratch->adjacencyStart);
+    free(scratch->adjacency);
+    free(scratch->edges);
+    free(scratch->collapses);
+    memset(scratch, 0, sizeof(VoxelSimplifyScratch));
+}
+
+static Vec3 voxelSimplifyNormal(Vec3 a, Vec3 b, Vec3 c)
+{
+    Vec3 e1, e2;
+    vec3Sub(&e1, &b, &a);
+    vec3Sub(&e2, &c, &a);
+    return vec3Cross(&e1, &e2);
+}
+
+// squared distance of p to the planes summed in q
+static r64 voxelQuadricError(r64 *q, Vec3 p)
+{
+    r64 x = p.x, y = p.y, z = p.z;
+    return q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x
+           + q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y
+           + q[7]*z*z + 2.0*q[8]*z
+           + q[9];
+}
+
+static int voxelCollapseCompare(const void *a, const void *b)
+{
+    r32 ca = ((const VoxelCollapse*)a)->cost;
+    r32 cb = ((const VoxelCollapse*)b)->cost;
+    return ca < cb ? -1 : ca > cb;
+}
+
+static int voxelEdgeCompare(const void *a, const void *b)
+{
+    u64 ea = *(const u64*)a;
+    u64 eb = *(const u64*)b;
+    return ea < eb ? -1 : ea > eb;
+}
+
+// triangles around every vertex, for the collapse checks
+static void voxelSimplifyAdjacency(VoxelSimplifyScratch *scratch, TriangleOut *triangles, u32 triangleCount, u32 vertexCount)
+{
+    u32 *start = scratch->adjacencyStart;
+    memset(start, 0, (vertexCount+1)*sizeof(u32));
+    for(u32 i = 0; i < triangleCount; i++)
+    {
+        for(i32 c = 0; c < 3; c++)
+            start[triangles[i].index[c]+1]++;
+    }
+    for(u32 v = 0; v < vertexCount; v++)
+        start[v+1] += start[v];
+    for(u32 i = 0; i < triangleCount; i++)
+    {
+        for(i32 c = 0; c < 3; c++)
+            scratch->adjacency[start[triangles[i].index[c]]++] = i;
+    }
+    // filling moved every start to the next vertex's
+    for(u32 v = vertexCount; v > 0; v--)
+        start[v] = start[v-1];
+    start[0] = 0;
+}
+
+// Only collapses that keep the surface a manifold and don't fold any
+// triangle over: from and to must share exactly the two vertices across
+// their edge and every triangle that keeps from's place must face the same way.
+static b32 voxelCollapseAllowed(VoxelSimplifyScratch *scratch, TriangleOut *triangles, u32 from, u32 to)
+{
+    u32 shared = 0;
+    for(u32 i = scratch->adjacencyStart[from]; i < scratch->adjacencyStart[from+1]; i++)
+    {
+        TriangleOut *t = &triangles[scratch->adjacency[i]];
+        for(i32 c = 0; c < 3; c++)
+        {
+            u32 v = (u32)t->index[c];
+            if(v == from || v == to)
+                continue;
+            for(u32 j = scratch->adjacencyStart[to]; j < scratch->adjacencyStart[to+1]; j++)
+            {
+                TriangleOut *o = &triangles[scratch->adjacency[j]];
+                if((u32)o->index[0] == v || (u32)o->index[1] == v || (u32)o->index[2] == v)
+                {
+                    shared++;
+                    break;
+                }
+            }
+        }
+    }
+    // every shared vertex is found through both triangles of from it's in
+    if(shared != 4)
+        return false;
+
+    for(u32 i = scratch->adjacencyStart[from]; i < scratch->adjacencyStart[from+1]; i++)
+    {
+        TriangleOut *t = &triangles[scratch->adjacency[i]];
+        if((u32)t->index[0] == to || (u32)t->index[1] == to || (u32)t->index[2] == to)
+            continue;
+        Vec3 p[3], q[3];
+        for(i32 c = 0; c < 3; c++)
+        {
+            p[c] = scratch->positions[t->index[c]];
+            q[c] = (u32)t->index[c] == from ? scratch->positions[to] : p[c];
+        }
+        Vec3 before = voxelSimplifyNormal(p[0], p[1], p[2]);
+        Vec3 after = voxelSimplifyNormal(q[0], q[1], q[2]);
+        r32 afterMag = vec3Mag(&after);
+        if(afterMag < 1e-6f || vec3Dot(&before, &after) < 0.25f*vec3Mag(&before)*afterMag)
+            return false;
+    }
+    return true;
+}
+
+// Simplifies the mesh in place until a collapse would move the surface more
+// than maxError (in the units of the positions), returns the triangles left.
+// Vertices on the faces of the chunk, the box from 0 to chunkSize, are kept:
+// the neighbour generated the same ones and its mesh has to meet them.
+u32 voxelSimplifyMesh(VoxelMeshOutput *mesh, r32 chunkSize, r32 maxError, VoxelSimplifyScratch *scratch)
+{
+    u32 vertexCount = mesh->vertexCount;
+    u32 triangleCount = mesh->triangleCount;
+    TriangleOut *triangles = mesh->triangles;
+    if(triangleCount == 0)
+        return 0;
+    voxelSimplifyReserve(scratch, vertexCount, triangleCount);
+
+    // far faces, in the packed units, anything past them is locked too
+    u32 facePosition = (u32)(chunkSize*(65535.0f/VOXEL_POSITION_RANGE) + 0.5f);
+
+    for(u32 v = 0; v < vertexCount; v++)
+    {
+        u16 *p = mesh->vertices[v].position;
+        scratch->positions[v] = vec3(p[0]*(VOXEL_POSITION_RANGE/65535.0f), p[1]*(VOXEL_POSITION_RANGE/65535.0f),
+                                     p[2]*(VOXEL_POSITION_RANGE/65535.0f));
+        scratch->remap[v] = v;
+        scratch->flags[v] = 0;
+        for(i32 c = 0; c < 3; c++)
+        {
+            if(p[c] <= 1 || p[c] >= facePosition - 1)
+                scratch->flags[v] |= VOXEL_SIMPLIFY_LOCKED;
+        }
+    }
+
+    memset(scratch->quadrics, 0, vertexCount*10*sizeof(r64));
+    for(u32 i = 0; i < triangleCount; i++)
+    {
+        i32 *index = triangles[i].index;
+        Vec3 n = voxelSimplifyNormal(scratch->positions[index[0]], scratch->positions[index[1]], scratch->positions[index[2]]);
+        r32 mag = vec3Mag(&n);
+        if(mag < 1e-12f)
+            continue;
+        vec3Scale(&n, &n, 1.0f/mag);
+        r64 a = n.x, b = n.y, c = n.z;
+        r64 d = -vec3Dot(&n, &scratch->positions[index[0]]);
+        r64 plane[10] = {a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d};
+        for(i32 corner = 0; corner < 3; corner++)
+        {
+            r64 *q = &scratch->quadrics[index[corner]*10];
+            for(i32 k = 0; k < 10; k++)
+                q[k] += plane[k];
+        }
+    }
+
+    r64 maxCost = (r64)maxError*maxError;
+    for(;;)
+    {
+        // edges used by anything but two triangles are borders or non-manifold
+        u32 edgeCount = 0;
+        for(u32 i = 0; i < triangleCount; i++)
+        {
+            for(i32 c = 0; c < 3; c++)
+            {
+                u32 a = (u32)triangles[i].index[c];
+                u32 b = (u32)triangles[i].index[(c+1)%3];
+                scratch->edges[edgeCount++] = a < b ? (u64)a << 32 | b : (u64)b << 32 | a;
+            }
+        }
+        qsort(scratch->edges, edgeCount, sizeof(u64), voxelEdgeCompare);
+
+        u32 collapseCount = 0;
+        for(u32 i = 0; i < edgeCount;)
+        {
+            u32 uses = 1;
+            while(i + uses < edgeCount && scratch->edges[i + uses] == scratch->edges[i])
+                uses++;
+            u32 a = (u32)(scratch->edges[i] >> 32);
+            u32 b = (u32)scratch->edges[i];
+            i += uses;
+            if(uses != 2)
+            {
+                scratch->flags[a] |= VOXEL_SIMPLIFY_LOCKED;
+                scratch->flags[b] |= VOXEL_SIMPLIFY_LOCKED;
+                continue;
+            }
+            // both directions, the cheaper one is the candidate
+            r64 costAB = voxelQuadricError(&scratch->quadrics[a*10], scratch->positions[b])
+                         + voxelQuadricError(&scratch->quadrics[b*10], scratch->positions[b]);
+            r64 costBA = voxelQuadricError(&scratch->quadrics[a*10], scratch->positions[a])
+                         + voxelQuadricError(&scratch->quadrics[b*10], scratch->positions[a]);
+            VoxelCollapse *collapse = &scratch->collapses[collapseCount];
+            collapse->from = costAB <= costBA ? a : b;
+            collapse->to = costAB <= costBA ? b : a;
+            collapse->cost = (r32)(costAB <= costBA ? costAB : costBA);
+            collapseCount += collapse->cost <= maxCost;
+        }
+
+        // a locked vertex can still be what an edge collapses onto
+        u32 candidates = 0;
+        for(u32 i = 0; i < collapseCount; i++)
+        {
+            VoxelCollapse c = scratch->collapses[i];
+            if(scratch->flags[c.from] & VOXEL_SIMPLIFY_LOCKED)
+            {
+                if(scratch->flags[c.to] & VOXEL_SIMPLIFY_LOCKED)
+                    continue;
+                u32 from = c.to;
+                c.to = c.from;
+                c.from = from;
+                c.cost = (r32)(voxelQuadricError(&scratch->quadrics[c.from*10], scratch->positions[c.to])
+                               + voxelQuadricError(&scratch->quadrics[c.to*10], scratch->positions[c.to]));
+                if(c.cost > maxCost)
+                    continue;
+            }
+            scratch->collapses[candidates++] = c;
+        }
+        if(candidates == 0)
+            break;
+        qsort(scratch->collapses, candidates, sizeof(VoxelCollapse), voxelCollapseCompare);
+
+        voxelSimplifyAdjacency(scratch, triangles, triangleCount, vertexCount);
+        u32 collapsed = 0;
+        for(u32 i = 0; i < candidates; i++)
+        {
+            VoxelCollapse c = scratch->collapses[i];
+            if((scratch->flags[c.from] | scratch->flags[c.to]) & VOXEL_SIMPLIFY_TOUCHED)
+                continue;
+            if(!voxelCollapseAllowed(scratch, triangles, c.from, c.to))
+                continue;
+            scratch->remap[c.from] = c.to;
+            for(i32 k = 0; k < 10; k++)
+                scratch->quadrics[c.to*10 + k] += scratch->quadrics[c.from*10 + k];
+            // the triangles around from change, nothing else may use them this pass
+            for(u32 j = scratch->adjacencyStart[c.from]; j < scratch->adjacencyStart[c.from+1]; j++)
+            {
+                i32 *index = triangles[scratch->adjacency[j]].index;
+                for(i32 corner = 0; corner < 3; corner++)
+                    scratch->flags[index[corner]] |= VOXEL_SIMPLIFY_TOUCHED;
+            }
+            collapsed++;
+        }
+        if(collapsed == 0)
+            break;
+
+        u32 kept = 0;
+        for(u32 i = 0; i < triangleCount; i++)
+        {
+            TriangleOut t = triangles[i];
+            for(i32 corner = 0; corner < 3; corner++)
+                t.index[corner] = (i32)scratch->remap[t.index[corner]];
+            if(t.index[0] == t.index[1] || t.index[1] == t.index[2] || t.index[2] == t.index[0])
+                continue;
+            triangles[kept++] = t;
+        }
+        triangleCount = kept;
+        for(u32 v = 0; v < vertexCount; v++)
+            scratch->flags[v] &= ~VOXEL_SIMPLIFY_TOUCHED;
+    }
+
+    // vertices still in use move to the front, in their old order
+    for(u32 v = 0; v < vertexCount; v++)
+        scratch->remap[v] = U32MAX;
+    for(u32 i = 0; i < triangleCount; i++)
+    {
+        for(i32 corner = 0; corner < 3; corner++)
+            scratch->remap[triangles[i].index[corner]] = 0;
+    }
+    u32 used = 0;
+    for(u32 v = 0; v < vertexCount; v++)
+    {
+        if(scratch->remap[v] == U32MAX)
+            continue;
+        mesh->vertices[used] = mesh->vertices[v];
+        scratch->remap[v] = used++;
+    }
+    for(u32 i = 0; i < triangleCount; i++)
+    {
+        for(i32 corner = 0; corner < 3; corner++)
+            triangles[i].index[corner] = (i32)scratch->remap[triangles[i].index[corner]];
+    }
+    mesh->vertexCount = used;
+    mesh->triangleCount = triangleCount;
+    return triangleCount;
+}
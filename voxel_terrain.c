@@ -1,386 +1,894 @@
-#include "shared.h"
+#include "voxel_terrain.h"
 
-struct VertexOut {
-    Vec4 position;
-    Vec4 normal;
-};
+#include <math.h>
+#include <string.h>
+
+// Port of terrain_compute2.glsl. The chunk is split into the same blocks as
+// the compute dispatch (one workgroup each) and vertices are only shared
+// inside a block. Blocks are counted and then emitted like the two shader
+// passes do, so the output has the same vertices and triangles in the same
+// order as the GPU path.
 
-struct TriangleOut
+// edge -> (x, y, z, axis) of the edge vertex relative to the cube
+static const i32 edgeVertexOffset[12][4] =
 {
-    i32 index[3];
+    {0, 0, 0, 0}, // 0
+    {1, 0, 0, 1},
+    {0, 1, 0, 0},
+    {0, 0, 0, 1},
+    {0, 0, 1, 0}, // 4
+    {1, 0, 1, 1},
+    {0, 1, 1, 0},
+    {0, 0, 1, 1},
+    {0, 0, 0, 2}, // 8
+    {1, 0, 0, 2},
+    {1, 1, 0, 2},
+    {0, 1, 0, 2} // 11
 };
 
-struct Line {
-    Vec4 start;
-    Vec4 end;
-};
+static inline r32 mod289(r32 x)
+{
+    return x - floorf(x * (1.0f / 289.0f)) * 289.0f;
+}
 
-struct GenData
+static inline r32 permute(r32 x)
 {
-    uint tunnelCount;
-    float firstOctaveMax;
-    float secondOctaveMax;
-    float padding;
-    float dxgoalFirstOctaveMax;
-    float dxgoalSecondOctaveMax;
-    float dzgoalFirstOctaveMax;
-    float dzgoalSecondOctaveMax;
-    Vec4 chunkOrigin;
-} GenData;
+    return mod289(((x*34.0f)+1.0f)*x);
+}
 
-struct GlobalVert
+// simplex noise, same operations as snoise() in the shader
+r32 voxelSnoise(Vec3 v)
 {
-    Vec3 coord;
-    int index;
-} GlobalVert;
+    const r32 Cx = 1.0f/6.0f;
+    const r32 Cy = 1.0f/3.0f;
 
-struct EdgeVertices{
-    struct GlobalVert left[17][17][17][3];
-} EdgeVertices;
+    // First corner
+    r32 s = (v.x + v.y + v.z)*Cy;
+    r32 ix = floorf(v.x + s);
+    r32 iy = floorf(v.y + s);
+    r32 iz = floorf(v.z + s);
+    r32 t = (ix + iy + iz)*Cx;
+    r32 x0[3] = {v.x - ix + t, v.y - iy + t, v.z - iz + t};
 
-// Shader storage buffer objects
-/*layout(std430, binding = 0) readonly buffer InputVertexBuffer {
-    vec4 data[];
-} inputVertexBuffer;
+    // Other corners
+    r32 g[3] = {x0[0] >= x0[1] ? 1.0f : 0.0f, x0[1] >= x0[2] ? 1.0f : 0.0f, x0[2] >= x0[0] ? 1.0f : 0.0f};
+    r32 l[3] = {1.0f - g[0], 1.0f - g[1], 1.0f - g[2]};
+    r32 i1[3] = {minf(g[0], l[2]), minf(g[1], l[0]), minf(g[2], l[1])};
+    r32 i2[3] = {maxf(g[0], l[2]), maxf(g[1], l[0]), maxf(g[2], l[1])};
 
-layout(std430, binding = 1) writeonly buffer OutputVertexBuffer {
-    VertexOut data[];
-} outputVertexBuffer;
+    r32 x[4][3];
+    for(int c = 0; c < 3; c++)
+    {
+        x[0][c] = x0[c];
+        x[1][c] = x0[c] - i1[c] + Cx;
+        x[2][c] = x0[c] - i2[c] + Cy;
+        x[3][c] = x0[c] - 0.5f;
+    }
 
-layout(std430, binding = 5) writeonly buffer OutputElementBuffer {
-    TriangleOut data[];
-} outputElementBuffer;
+    // Permutations
+    ix = mod289(ix);
+    iy = mod289(iy);
+    iz = mod289(iz);
+    r32 offX[4] = {0.0f, i1[0], i2[0], 1.0f};
+    r32 offY[4] = {0.0f, i1[1], i2[1], 1.0f};
+    r32 offZ[4] = {0.0f, i1[2], i2[2], 1.0f};
 
-layout(std430, binding = 2) readonly buffer TunnelData
-{
-    GenData genData;
-    Line tunnels[];
-} tunnelData;
+    // Gradients: 7x7 points over a square, mapped onto an octahedron.
+    const r32 n_ = 0.142857142857f; // 1.0/7.0
+    const r32 nsx = n_*2.0f;
+    const r32 nsy = n_*0.5f - 1.0f;
+    const r32 nsz = n_;
 
-layout(std430, binding = 4) buffer EdgeVertexData
-{
-    EdgeVertices data[];
-} edgeVertexData;
+    r32 result = 0.0f;
+    for(int c = 0; c < 4; c++)
+    {
+        r32 p = permute(permute(permute(iz + offZ[c]) + iy + offY[c]) + ix + offX[c]);
 
-layout (binding = 3, offset = 0) uniform atomic_uint triangleCount;
-layout (binding = 3, offset = 4) uniform atomic_uint indexCount;*/
+        r32 j = p - 49.0f * floorf(p * nsz * nsz); // mod(p,7*7)
+        r32 x_ = floorf(j * nsz);
+        r32 y_ = floorf(j - 7.0f * x_); // mod(j,N)
 
-// Uniforms
-i32 mcubesLookup[256][16];
-//uniform isampler1D mcubesLookup2;
-Vec3 worldOffset;
-r32 voxelScale;
+        r32 gx = x_*nsx + nsy;
+        r32 gy = y_*nsx + nsy;
+        r32 h = 1.0f - absf(gx) - absf(gy);
 
-// Shared values between all the threads in the group
-r32 cubeValues[18][18][18]; // the actual used size is 17, but using 18 saves 3 overflow checks
+        r32 sh = h <= 0.0f ? -1.0f : 0.0f;
+        gx += (floorf(gx)*2.0f + 1.0f)*sh;
+        gy += (floorf(gy)*2.0f + 1.0f)*sh;
+        r32 gz = h;
 
-const IVec4 edgeVertexOffset[12] =
-{
-    {0, 0, 0, 0}, // 0
-    {1, 0, 0, 1},
-    {0, 1, 0, 0},
-    {0, 0, 0, 1},
-    {0, 0, 1, 0}, // 4
-    {1, 0, 1, 1},
-    {0, 1, 1, 0},
-    {0, 0, 1, 1},
-    {0, 0, 0, 2}, // 8
-    {1, 0, 0, 2},
-    {1, 1, 0, 2},
-    {0, 1, 0, 2} // 11
-};
+        // Normalise gradients
+        r32 norm = 1.79284291400159f - 0.85373472095314f * (gx*gx + gy*gy + gz*gz);
 
-Vec3 vec3Mod289(Vec3 x) {
-    Vec3 ret = x;
-    ret.x -= floorf(x.x * (1.0f / 289.0f)) * 289.0f;
-    ret.y -= floorf(x.y * (1.0f / 289.0f)) * 289.0f;
-    ret.z -= floorf(x.z * (1.0f / 289.0f)) * 289.0f;
-    return ret;
+        // Mix final noise value
+        r32 m = maxf(0.6f - (x[c][0]*x[c][0] + x[c][1]*x[c][1] + x[c][2]*x[c][2]), 0.0f);
+        m = m * m;
+        result += m*m*norm*(gx*x[c][0] + gy*x[c][1] + gz*x[c][2]);
+    }
+    return 42.0f * result;
 }
 
-Vec4 vec4Mod289(Vec4 x) {
-    Vec4 ret = x;
-    ret.x -= floorf(x.x * (1.0f / 289.0f)) * 289.0f;
-    ret.y -= floorf(x.y * (1.0f / 289.0f)) * 289.0f;
-    ret.z -= floorf(x.z * (1.0f / 289.0f)) * 289.0f;
-    ret.w -= floorf(x.w * (1.0f / 289.0f)) * 289.0f;
-    return ret;
+static inline r32 getOffset(r32 v1, r32 v2)
+{
+    r32 delta = v1 - v2;
+    if(delta == 0.0f)
+        return 0.5f;
+    return v1/delta;
 }
 
-Vec4 permute(Vec4 x) {
-    Vec4 ret;
-    ret.x = ((x.x*34.0f)+1.0f)*x.x;
-    ret.y = ((x.y*34.0f)+1.0f)*x.y;
-    ret.z = ((x.z*34.0f)+1.0f)*x.z;
-    ret.w = ((x.w*34.0f)+1.0f)*x.w;
-    return vec4Mod289(ret);
+static Vec3 closestPointOnSegment(Vec3 a, Vec3 b, Vec3 from)
+{
+    Vec3 atob, atop;
+    vec3Sub(&atob, &b, &a);
+    vec3Sub(&atop, &from, &a);
+    r32 t = vec3Dot(&atop, &atob) / vec3Dot(&atob, &atob);
+    t = clamp01(t);
+    vec3Scale(&atob, &atob, t);
+    vec3Add(&atob, &atob, &a);
+    return atob;
 }
 
-Vec4 taylorInvSqrt(Vec4 r)
+// the heightmap is sampled at a position warped by the first noise
+static Vec3 voxelSampleCoord(Vec3 worldPos, r32 warpNoise)
 {
-    Vec4 ret;
-    ret.x = 1.79284291400159f - 0.85373472095314f * r.x;
-    ret.y = 1.79284291400159f - 0.85373472095314f * r.y;
-    ret.z = 1.79284291400159f - 0.85373472095314f * r.z;
-    ret.w = 1.79284291400159f - 0.85373472095314f * r.w;
-    return ret;
+    r32 warp = warpNoise+1.0f;
+    return vec3(0.2f*warp*10.0f + worldPos.x, VOXEL_HEIGHT_PLANE, 0.48f*warp*10.0f + worldPos.z);
 }
 
-/*r32 snoise(Vec3 v)
+// Input of the warp noise. It normally changes along y as well, which makes
+// overhangs. With columnWarp it's taken on the heightmap's plane, so the
+// height only depends on x and z and a chunk needs it once per column.
+static Vec3 voxelWarpCoord(ChunkGenData *gen, Vec3 worldPos)
 {
-    const Vec2  C = vec2(1.0f/6.0f, 1.0f/3.0f) ;
-    const Vec4  D = vec4(0.0f, 0.5f, 1.0f, 2.0f);
+    r32 y = gen->columnWarp ? VOXEL_HEIGHT_PLANE : worldPos.y;
+    return vec3(worldPos.x*0.08f, y*0.08f, worldPos.z*0.08f);
+}
 
-    // First corner
-    Vec3 i  = floor(v + dot(v, C.yyy) );
-    Vec3 x0 =   v - i + dot(i, C.xxx) ;
+// the octaves of the heightmap are voxelSnoise() at these scales of the sample coordinate
+static const r32 voxelOctaveScale[3] =
+{
+    0.005f,
+    0.08f, // 0.005*lacunarity^4
+    0.002f // 0.0005*lacunarity^2
+};
 
-    // Other corners
-    Vec3 g = step(x0.yzx, x0.xyz);
-    Vec3 l = 1.0 - g;
-    Vec3 i1 = min( g.xyz, l.zxy );
-    Vec3 i2 = max( g.xyz, l.zxy );
-
-    //   x0 = x0 - 0.0 + 0.0 * C.xxx;
-    //   x1 = x0 - i1  + 1.0 * C.xxx;
-    //   x2 = x0 - i2  + 2.0 * C.xxx;
-    //   x3 = x0 - 1.0 + 3.0 * C.xxx;
-    Vec3 x1 = x0 - i1 + C.xxx;
-    Vec3 x2 = x0 - i2 + C.yyy; // 2.0*C.x = 1/3 = C.y
-    Vec3 x3 = x0 - D.yyy;      // -1.0+3.0*C.x = -0.5 = -D.y
+// height of the terrain once the noise values are known, x and z of worldPos matter
+static r32 voxelTerrainHeight(ChunkGenData *gen, Vec3 worldPos, r32 octaves[3])
+{
+    r32 progressX = (worldPos.x - gen->chunkOrigin.x)/64.0f; // TODO: 64=chunk size
+    r32 progressZ = (worldPos.z - gen->chunkOrigin.z)/64.0f;
+    r32 fom = gen->dxgoalFirstOctaveMax*progressX + gen->dzgoalFirstOctaveMax*progressZ;
+    r32 som = gen->dxgoalSecondOctaveMax*progressX + gen->dzgoalSecondOctaveMax*progressZ;
+
+    r32 h2noise = octaves[0]+1.0f;
+    r32 h2 = h2noise*(gen->secondOctaveMax+som);
+    r32 h0 = h2noise*0.5f*(octaves[1]+1.0f);
+    r32 h1 = h2noise*0.5f*(octaves[2]+1.0f)*(gen->firstOctaveMax+fom);
+    return h0+h1+h2;
+}
 
-    // Permutations
-    i = mod289(i);
-    Vec4 p = permute( permute( permute(
-                                   i.z + vec4(0.0, i1.z, i2.z, 1.0 ))
-                               + i.y + vec4(0.0, i1.y, i2.y, 1.0 ))
-                      + i.x + vec4(0.0, i1.x, i2.x, 1.0 ));
+// rest of voxelProceduralDensity() once the height is known
+static r32 voxelTerrainDensity(ChunkGenData *gen, Line3D *tunnels, Vec3 worldPos, r32 height)
+{
+    r32 minHeight = height - worldPos.y;
 
-    // Gradients: 7x7 points over a square, mapped onto an octahedron.
-    // The ring size 17*17 = 289 is close to a multiple of 49 (49*6 = 294)
-    float n_ = 0.142857142857; // 1.0/7.0
-    Vec3  ns = n_ * D.wyz - D.xzx;
+    for(u32 i = 0; i < gen->tunnelCount; i++)
+    {
+        Vec3 p0 = vec3FromVec4(tunnels[i].start);
+        Vec3 p1 = vec3FromVec4(tunnels[i].end);
+        Vec3 cp = closestPointOnSegment(p0, p1, worldPos);
+        Vec3 d;
+        vec3Sub(&d, &worldPos, &cp);
+        r32 sphere = vec3Mag(&d);
+        if(sphere < VOXEL_TUNNEL_RADIUS)
+            return (-VOXEL_TUNNEL_RADIUS+sphere)*10.0f;
+    }
 
-    Vec4 j = p - 49.0 * floor(p * ns.z * ns.z);  //  mod(p,7*7)
+    return minHeight;
+}
 
-    Vec4 x_ = floor(j * ns.z);
-    Vec4 y_ = floor(j - 7.0 * x_ );    // mod(j,N)
+r32 voxelProceduralDensity(ChunkGenData *gen, Line3D *tunnels, Vec3 worldPos)
+{
+    Vec3 sampleCoord = voxelSampleCoord(worldPos, voxelSnoise(voxelWarpCoord(gen, worldPos)));
 
-    Vec4 x = x_ *ns.x + ns.yyyy;
-    Vec4 y = y_ *ns.x + ns.yyyy;
-    Vec4 h = 1.0 - abs(x) - abs(y);
+    r32 octaves[3];
+    for(i32 i = 0; i < 3; i++)
+    {
+        Vec3 c;
+        vec3Scale(&c, &sampleCoord, voxelOctaveScale[i]);
+        octaves[i] = voxelSnoise(c);
+    }
+    return voxelTerrainDensity(gen, tunnels, worldPos, voxelTerrainHeight(gen, worldPos, octaves));
+}
 
-    Vec4 b0 = vec4( x.xy, y.xy );
-    Vec4 b1 = vec4( x.zw, y.zw );
+static i32 floorDivInt(i32 a, i32 b)
+{
+    return a >= 0 ? a/b : -((-a+b-1)/b);
+}
 
-    //vec4 s0 = vec4(lessThan(b0,0.0))*2.0 - 1.0;
-    //vec4 s1 = vec4(lessThan(b1,0.0))*2.0 - 1.0;
-    Vec4 s0 = floor(b0)*2.0 + 1.0;
-    Vec4 s1 = floor(b1)*2.0 + 1.0;
-    Vec4 sh = -step(h, vec4(0.0));
+// samples are at whole units, every LOD hits voxels of the bricks exactly
+static r32 voxelEditDelta(VoxelEditChunk *edits, VoxelBrick *bricks, Vec3 worldPos)
+{
+    i32 vx = (i32)floorf(worldPos.x+0.5f);
+    i32 vy = (i32)floorf(worldPos.y+0.5f);
+    i32 vz = (i32)floorf(worldPos.z+0.5f);
+    i32 bx = floorDivInt(vx, VOXEL_BRICK_SIZE);
+    i32 by = floorDivInt(vy, VOXEL_BRICK_SIZE);
+    i32 bz = floorDivInt(vz, VOXEL_BRICK_SIZE);
+    i32 tx = bx - edits->firstBrick.x;
+    i32 ty = by - edits->firstBrick.y;
+    i32 tz = bz - edits->firstBrick.z;
+    if(tx < 0 || ty < 0 || tz < 0 || tx >= VOXEL_CHUNK_BRICKS || ty >= VOXEL_CHUNK_BRICKS || tz >= VOXEL_CHUNK_BRICKS)
+        return 0.0f;
+    i32 brick = edits->table[(tz*VOXEL_CHUNK_BRICKS + ty)*VOXEL_CHUNK_BRICKS + tx];
+    if(brick < 0)
+        return 0.0f;
+    i32 lx = vx - bx*VOXEL_BRICK_SIZE;
+    i32 ly = vy - by*VOXEL_BRICK_SIZE;
+    i32 lz = vz - bz*VOXEL_BRICK_SIZE;
+    return bricks[brick].delta[(lz*VOXEL_BRICK_SIZE + ly)*VOXEL_BRICK_SIZE + lx];
+}
 
-    Vec4 a0 = b0.xzyw + s0.xzyw*sh.xxyy ;
-    Vec4 a1 = b1.xzyw + s1.xzyw*sh.zzww ;
+r32 voxelDensity(VoxelField *field, Vec3 worldPos)
+{
+    r32 ret = voxelProceduralDensity(field->gen, field->tunnels, worldPos);
+    if(field->edits->brickCount > 0)
+        ret += voxelEditDelta(field->edits, field->bricks, worldPos);
+    return ret;
+}
 
-    Vec3 p0 = vec3(a0.xy,h.x);
-    Vec3 p1 = vec3(a0.zw,h.y);
-    Vec3 p2 = vec3(a1.xy,h.z);
-    Vec3 p3 = vec3(a1.zw,h.w);
+// The four noises of every point go through voxelSnoiseBatch() into the
+// terrain height, the rest is the same code as voxelProceduralDensity(), so
+// the results are identical.
+static void voxelTerrainHeightBatch(ChunkGenData *gen, const r32 *x, const r32 *y, const r32 *z, r32 *out, u32 count)
+{
+    assert(count <= VOXEL_NETS_SAMPLES);
+    r32 cx[VOXEL_NETS_SAMPLES], cy[VOXEL_NETS_SAMPLES], cz[VOXEL_NETS_SAMPLES];
+    r32 noise[4][VOXEL_NETS_SAMPLES];
+    for(u32 i = 0; i < count; i++)
+    {
+        Vec3 warpCoord = voxelWarpCoord(gen, vec3(x[i], y[i], z[i]));
+        cx[i] = warpCoord.x;
+        cy[i] = warpCoord.y;
+        cz[i] = warpCoord.z;
+    }
+    voxelSnoiseBatch(cx, cy, cz, noise[3], count);
 
-    //Normalise gradients
-    Vec4 norm = taylorInvSqrt(vec4(dot(p0,p0), dot(p1,p1), dot(p2, p2), dot(p3,p3)));
-    p0 *= norm.x;
-    p1 *= norm.y;
-    p2 *= norm.z;
-    p3 *= norm.w;
+    Vec3 sampleCoord[VOXEL_NETS_SAMPLES];
+    for(u32 i = 0; i < count; i++)
+        sampleCoord[i] = voxelSampleCoord(vec3(x[i], y[i], z[i]), noise[3][i]);
+    for(i32 octave = 0; octave < 3; octave++)
+    {
+        for(u32 i = 0; i < count; i++)
+        {
+            cx[i] = sampleCoord[i].x*voxelOctaveScale[octave];
+            cy[i] = sampleCoord[i].y*voxelOctaveScale[octave];
+            cz[i] = sampleCoord[i].z*voxelOctaveScale[octave];
+        }
+        voxelSnoiseBatch(cx, cy, cz, noise[octave], count);
+    }
 
-    // Mix final noise value
-    vec4 m = max(0.6 - vec4(dot(x0,x0), dot(x1,x1), dot(x2,x2), dot(x3,x3)), 0.0);
-    m = m * m;
-    return 42.0 * dot( m*m, vec4( dot(p0,x0), dot(p1,x1),
-                                  dot(p2,x2), dot(p3,x3) ) );
+    for(u32 i = 0; i < count; i++)
+    {
+        r32 octaves[3] = {noise[0][i], noise[1][i], noise[2][i]};
+        out[i] = voxelTerrainHeight(gen, vec3(x[i], y[i], z[i]), octaves);
+    }
 }
 
-float getOffset(float v1, float v2)
+void voxelHeightBatch(ChunkGenData *gen, const r32 *x, const r32 *z, r32 *out, u32 count)
 {
-    float delta = v1 - v2;
-    if(delta == 0.0)
-        return 0.5;
-    return v1/delta;
+    assert(gen->columnWarp);
+    r32 y[VOXEL_NETS_SAMPLES];
+    for(u32 i = 0; i < count; i++)
+        y[i] = VOXEL_HEIGHT_PLANE;
+    voxelTerrainHeightBatch(gen, x, y, z, out, count);
 }
 
-Vec4 getOffsetv(Vec4 v1, Vec4 v2)
+// density of count points, tunnels and edits on top of their heights
+static void voxelFieldDensity(VoxelField *field, const r32 *x, const r32 *y, const r32 *z, const r32 *heights,
+                              r32 *out, u32 count)
 {
-    Vec4 delta = v1 - v2;
-    Vec4 eq = vec4(equal(delta,vec4(0.0)));
-    Vec4 neq = vec4(notEqual(delta,vec4(0.0)));
-     return eq*vec4(0.5)+neq*(v1/delta); // TODO: division by 0 can happen
+    for(u32 i = 0; i < count; i++)
+    {
+        Vec3 worldPos = vec3(x[i], y[i], z[i]);
+        out[i] = voxelTerrainDensity(field->gen, field->tunnels, worldPos, heights[i]);
+        if(field->edits->brickCount > 0)
+            out[i] += voxelEditDelta(field->edits, field->bricks, worldPos);
+    }
 }
 
-Vec3 getClosestPointOnLine(Vec3 a, Vec3 b, Vec3 from)
+void voxelDensityBatch(VoxelField *field, const r32 *x, const r32 *y, const r32 *z, r32 *out, u32 count)
 {
-    Vec3 atob = b-a;
-    from = from-a;
-    float atob2 = dot(atob,atob); // squared length
-    float atopDotAtob = dot(from, atob);
-    float t = atopDotAtob / atob2;
-    t = clamp(t,0.0,1.0);
-    atob *= t;
-    return a+atob;
+    r32 heights[VOXEL_NETS_SAMPLES];
+    voxelTerrainHeightBatch(field->gen, x, y, z, heights, count);
+    voxelFieldDensity(field, x, y, z, heights, out, count);
 }
 
-float voxel(vec3 worldPos)
+// [lo, hi] of a*b for a in [aLo, aHi] and b in [bLo, bHi]
+static void intervalMul(r32 aLo, r32 aHi, r32 bLo, r32 bHi, r32 *lo, r32 *hi)
 {
-   Vec3 curVec = worldPos-tunnelData.genData.chunkOrigin.xyz;
-   float progressX = curVec.x/64.0; 	// TODO: 64=chunk size
-   float progressZ = curVec.z/64.0;
-   float fom = mix(0.0,tunnelData.genData.dxgoalFirstOctaveMax,progressX) + mix(0.0,tunnelData.genData.dzgoalFirstOctaveMax,progressZ);
-   float som = mix(0.0,tunnelData.genData.dxgoalSecondOctaveMax,progressX) + mix(0.0,tunnelData.genData.dzgoalSecondOctaveMax,progressZ);
-
-    float warp = (snoise(0.08*worldPos)+1)*0.5;
-    Vec3 sampleCoord = vec3(0.5,0.9,0.68)*warp*10 + worldPos;
-    sampleCoord.y = 33.11;
+    r32 p0 = aLo*bLo, p1 = aLo*bHi, p2 = aHi*bLo, p3 = aHi*bHi;
+    *lo = minf(minf(p0, p1), minf(p2, p3));
+    *hi = maxf(maxf(p0, p1), maxf(p2, p3));
+}
 
-    float h1 = (snoise(0.05*sampleCoord)+1)*(tunnelData.genData.firstOctaveMax);
-    float h2 = (snoise(0.005*sampleCoord)+1)*(tunnelData.genData.secondOctaveMax+som);
+// slab test of the segment against the box
+static b32 segmentIntersectsBox(Vec3 a, Vec3 b, Vec3 boxMin, Vec3 boxMax)
+{
+    r32 start[3] = {a.x, a.y, a.z};
+    r32 dir[3] = {b.x-a.x, b.y-a.y, b.z-a.z};
+    r32 mins[3] = {boxMin.x, boxMin.y, boxMin.z};
+    r32 maxs[3] = {boxMax.x, boxMax.y, boxMax.z};
+    r32 tMin = 0.0f, tMax = 1.0f;
+    for(int i = 0; i < 3; i++)
+    {
+        if(dir[i] == 0.0f)
+        {
+            if(start[i] < mins[i] || start[i] > maxs[i])
+                return false;
+            continue;
+        }
+        r32 t0 = (mins[i]-start[i])/dir[i];
+        r32 t1 = (maxs[i]-start[i])/dir[i];
+        tMin = maxf(tMin, minf(t0, t1));
+        tMax = minf(tMax, maxf(t0, t1));
+        if(tMin > tMax)
+            return false;
+    }
+    return true;
+}
 
-    float minHeight = (h1+h2) - worldPos.y ;
+// does the tunnel carve anything in the cube [origin, origin+size], the capsule
+// is grown into a box so this can give false positives near the box corners
+b32 voxelTunnelTouchesBox(Line3D *tunnel, Vec3 origin, r32 size)
+{
+    Vec3 boxMin = vec3(origin.x - VOXEL_TUNNEL_RADIUS, origin.y - VOXEL_TUNNEL_RADIUS, origin.z - VOXEL_TUNNEL_RADIUS);
+    Vec3 boxMax = vec3(origin.x + size + VOXEL_TUNNEL_RADIUS, origin.y + size + VOXEL_TUNNEL_RADIUS, origin.z + size + VOXEL_TUNNEL_RADIUS);
+    return segmentIntersectsBox(vec3FromVec4(tunnel->start), vec3FromVec4(tunnel->end), boxMin, boxMax);
+}
 
-    for(int i = 0; i < tunnelData.genData.tunnelCount; i++)
+// Interval bound of voxelDensity() over the cube [origin, origin+size]. The
+// noise terms are bounded by VOXEL_NOISE_BOUND, which is only sampled, so the
+// height's interval gets VOXEL_CLASSIFY_SLACK on both ends. Its lower bound
+// above the cube means solid, its upper bound below the cube means air.
+// Tunnels only ever carve air, so they can only turn a solid cube into a
+// surface one, see voxelTunnelTouchesBox(). Edits can go either way, a cube
+// with any is always a surface one.
+VoxelChunkClass voxelClassifyChunk(VoxelField *field, Vec3 origin, r32 size)
+{
+    if(field->edits->brickCount > 0)
+        return VoxelChunkClass_Surface;
+
+    ChunkGenData *gen = field->gen;
+    r32 pxLo = (origin.x - gen->chunkOrigin.x)/64.0f;
+    r32 pxHi = (origin.x + size - gen->chunkOrigin.x)/64.0f;
+    r32 pzLo = (origin.z - gen->chunkOrigin.z)/64.0f;
+    r32 pzHi = (origin.z + size - gen->chunkOrigin.z)/64.0f;
+    r32 lo, hi, lo2, hi2;
+
+    // firstOctaveMax+fom and secondOctaveMax+som
+    r32 firstLo, firstHi, secondLo, secondHi;
+    intervalMul(gen->dxgoalFirstOctaveMax, gen->dxgoalFirstOctaveMax, pxLo, pxHi, &lo, &hi);
+    intervalMul(gen->dzgoalFirstOctaveMax, gen->dzgoalFirstOctaveMax, pzLo, pzHi, &lo2, &hi2);
+    firstLo = gen->firstOctaveMax + lo + lo2;
+    firstHi = gen->firstOctaveMax + hi + hi2;
+    intervalMul(gen->dxgoalSecondOctaveMax, gen->dxgoalSecondOctaveMax, pxLo, pxHi, &lo, &hi);
+    intervalMul(gen->dzgoalSecondOctaveMax, gen->dzgoalSecondOctaveMax, pzLo, pzHi, &lo2, &hi2);
+    secondLo = gen->secondOctaveMax + lo + lo2;
+    secondHi = gen->secondOctaveMax + hi + hi2;
+
+    r32 noisePlusOneLo = 1.0f - VOXEL_NOISE_BOUND;
+    r32 noisePlusOneHi = 1.0f + VOXEL_NOISE_BOUND;
+
+    // h2 = h2noise*second
+    r32 h2Lo, h2Hi;
+    intervalMul(noisePlusOneLo, noisePlusOneHi, secondLo, secondHi, &h2Lo, &h2Hi);
+    // h0 = h2noise*0.5*(noise+1)
+    r32 h0Lo, h0Hi;
+    intervalMul(noisePlusOneLo, noisePlusOneHi, 0.5f*noisePlusOneLo, 0.5f*noisePlusOneHi, &h0Lo, &h0Hi);
+    // h1 = h0*first
+    r32 h1Lo, h1Hi;
+    intervalMul(h0Lo, h0Hi, firstLo, firstHi, &h1Lo, &h1Hi);
+
+    r32 heightLo = h0Lo + h1Lo + h2Lo - VOXEL_CLASSIFY_SLACK;
+    r32 heightHi = h0Hi + h1Hi + h2Hi + VOXEL_CLASSIFY_SLACK;
+    if(heightHi < origin.y)
+        return VoxelChunkClass_Air;
+    if(heightLo <= origin.y + size)
+        return VoxelChunkClass_Surface;
+
+    for(u32 i = 0; i < gen->tunnelCount; i++)
     {
-        vec3 p0 = tunnelData.tunnels[i].start.xyz;
-        vec3 p1 = tunnelData.tunnels[i].end.xyz;
-        vec3 cp = getClosestPointOnLine(p0,p1,worldPos);
-        float sphere = length(worldPos-cp);
-        if(sphere < 5.0)
-            return (-5.0+sphere)*10.0;
+        if(voxelTunnelTouchesBox(&field->tunnels[i], origin, size))
+            return VoxelChunkClass_Surface;
     }
+    return VoxelChunkClass_Solid;
+}
 
-    return minHeight;
+static Vec3 voxelEdgeVertex(VoxelScratch *scratch, Vec3 seed, r32 voxelScale, i32 x, i32 y, i32 z, i32 axis)
+{
+    i32 nx = x + (axis == 0);
+    i32 ny = y + (axis == 1);
+    i32 nz = z + (axis == 2);
+    r32 fOffset = getOffset(scratch->values[x][y][z], scratch->values[nx][ny][nz]);
+    return vec3(seed.x + (x + (axis == 0)*fOffset)*voxelScale,
+                seed.y + (y + (axis == 1)*fOffset)*voxelScale,
+                seed.z + (z + (axis == 2)*fOffset)*voxelScale);
 }
 
-void vMarchCube1(int i, int j, int k, vec3 wcoord, uint index)
+// does the edge from sample (x, y, z) along axis cross the surface, edges
+// leaving the block don't exist
+static b32 voxelEdgeCrosses(VoxelScratch *scratch, i32 x, i32 y, i32 z, i32 axis)
 {
-    i32 iterate, iFlagIndex;
-    Vec4 afCubeValuev[2];
+    i32 nx = x + (axis == 0);
+    i32 ny = y + (axis == 1);
+    i32 nz = z + (axis == 2);
+    if(nx >= VOXEL_BLOCK_SAMPLES || ny >= VOXEL_BLOCK_SAMPLES || nz >= VOXEL_BLOCK_SAMPLES)
+        return false;
+    return (scratch->values[x][y][z] <= 0.0f) != (scratch->values[nx][ny][nz] <= 0.0f);
+}
 
-    afCubeValuev[0].x = cubeValues[i][j][k];
-    afCubeValuev[0].y = cubeValues[i+1][j][k];
-    afCubeValuev[0].z = cubeValues[i+1][j+1][k];
-    afCubeValuev[0].w = cubeValues[i][j+1][k];
-    afCubeValuev[1].x = cubeValues[i][j][k+1];
-    afCubeValuev[1].y = cubeValues[i+1][j][k+1];
-    afCubeValuev[1].z = cubeValues[i+1][j+1][k+1];
-    afCubeValuev[1].w = cubeValues[i][j+1][k+1];
+static i32 voxelCubeCase(VoxelScratch *scratch, i32 i, i32 j, i32 k)
+{
+    r32 (*v)[VOXEL_NETS_SAMPLES][VOXEL_NETS_SAMPLES] = scratch->values;
+    return (v[i][j][k] <= 0.0f)
+            | (v[i+1][j][k] <= 0.0f) << 1
+            | (v[i+1][j+1][k] <= 0.0f) << 2
+            | (v[i][j+1][k] <= 0.0f) << 3
+            | (v[i][j][k+1] <= 0.0f) << 4
+            | (v[i+1][j][k+1] <= 0.0f) << 5
+            | (v[i+1][j+1][k+1] <= 0.0f) << 6
+            | (v[i][j+1][k+1] <= 0.0f) << 7;
+}
 
-     // I heard GPU likes vectors...
-    iFlagIndex = int(dot(ivec4(1, 2, 4, 8)*ivec4(step(afCubeValuev[0],vec4(0.0))),ivec4(1)) +
-        dot(ivec4(16, 32, 64, 128)*ivec4(step(afCubeValuev[1],vec4(0.0))),ivec4(1)) + vec4(0.1));
+// Same as vertexNormal() in the compute shader, central differences of the
+// field half a voxel around the vertex, pointing towards the air.
+static Vec3 voxelNormal(VoxelField *field, Vec3 worldPos, r32 voxelScale)
+{
+    r32 h = 0.5f*voxelScale;
+    Vec3 ret;
+    ret.x = voxelDensity(field, vec3(worldPos.x - h, worldPos.y, worldPos.z)) - voxelDensity(field, vec3(worldPos.x + h, worldPos.y, worldPos.z));
+    ret.y = voxelDensity(field, vec3(worldPos.x, worldPos.y - h, worldPos.z)) - voxelDensity(field, vec3(worldPos.x, worldPos.y + h, worldPos.z));
+    ret.z = voxelDensity(field, vec3(worldPos.x, worldPos.y, worldPos.z - h)) - voxelDensity(field, vec3(worldPos.x, worldPos.y, worldPos.z + h));
+    return ret;
+}
 
-     int edgeConnection[3];
+// gradient of the samples at (x, y, z) towards the air, over one voxel like
+// voxelNormal(), its neighbours must be in the block
+static Vec3 voxelSampleNormal(VoxelScratch *scratch, i32 x, i32 y, i32 z)
+{
+    r32 (*v)[VOXEL_NETS_SAMPLES][VOXEL_NETS_SAMPLES] = scratch->values;
+    return vec3(0.5f*(v[x-1][y][z] - v[x+1][y][z]), 0.5f*(v[x][y-1][z] - v[x][y+1][z]), 0.5f*(v[x][y][z-1] - v[x][y][z+1]));
+}
+
+// Normal of the vertex on an edge, the gradients of the edge's samples
+// interpolated like its position. Vertices on or next to the block's faces
+// take voxelNormal() instead, the neighbours of their samples aren't in the
+// block and they are the ones the next block and chunk have too.
+static Vec3 voxelEdgeNormal(VoxelField *field, VoxelScratch *scratch, Vec3 worldPos, r32 voxelScale, i32 x, i32 y, i32 z, i32 axis)
+{
+    i32 p[3] = {x, y, z};
+    for(i32 i = 0; i < 3; i++)
+    {
+        if(p[i] < 1 || p[i] > VOXEL_BLOCK_CUBES - 1 - (i == axis))
+            return voxelNormal(field, worldPos, voxelScale);
+    }
+    i32 nx = x + (axis == 0);
+    i32 ny = y + (axis == 1);
+    i32 nz = z + (axis == 2);
+    r32 t = getOffset(scratch->values[x][y][z], scratch->values[nx][ny][nz]);
+    Vec3 a = voxelSampleNormal(scratch, x, y, z);
+    Vec3 b = voxelSampleNormal(scratch, nx, ny, nz);
+    return vec3(a.x + (b.x - a.x)*t, a.y + (b.y - a.y)*t, a.z + (b.z - a.z)*t);
+}
 
-    for(iterate = 0; iterate < 5; iterate++)
+// Same for the vertex of a surface nets cell, the gradients of its corners
+// interpolated at the vertex.
+static Vec3 voxelCellNormal(VoxelField *field, VoxelScratch *scratch, Vec3 seed, Vec3 worldOffset, Vec3 position,
+                            r32 voxelScale, i32 x, i32 y, i32 z)
+{
+    if(x < 1 || y < 1 || z < 1 || x > VOXEL_BLOCK_CUBES - 1 || y > VOXEL_BLOCK_CUBES - 1 || z > VOXEL_BLOCK_CUBES - 1)
+    {
+        return voxelNormal(field, vec3(position.x + worldOffset.x, position.y + worldOffset.y, position.z + worldOffset.z),
+                           voxelScale);
+    }
+    // weights of the near and far corners along each axis
+    r32 fx = (position.x - seed.x)/voxelScale - x;
+    r32 fy = (position.y - seed.y)/voxelScale - y;
+    r32 fz = (position.z - seed.z)/voxelScale - z;
+    r32 wx[2] = {1.0f - fx, fx}, wy[2] = {1.0f - fy, fy}, wz[2] = {1.0f - fz, fz};
+    Vec3 ret = vec3(0.0f, 0.0f, 0.0f);
+    for(i32 c = 0; c < 8; c++)
     {
-          edgeConnection[0] = texelFetch2D(mcubesLookup, ivec2(3*iterate, iFlagIndex), 0).a;
-          edgeConnection[1] = texelFetch2D(mcubesLookup, ivec2(3*iterate+1, iFlagIndex), 0).a;
-          edgeConnection[2] = texelFetch2D(mcubesLookup, ivec2(3*iterate+2, iFlagIndex), 0).a;
+        i32 dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+        r32 w = wx[dx]*wy[dy]*wz[dz];
+        Vec3 g = voxelSampleNormal(scratch, x + dx, y + dy, z + dz);
+        ret = vec3(ret.x + g.x*w, ret.y + g.y*w, ret.z + g.z*w);
+    }
+    return ret;
+}
 
-        if(edgeConnection[0] > -1)
+// samples^3 of them, VOXEL_BLOCK_SAMPLES or VOXEL_NETS_SAMPLES
+static void voxelSampleBlock(VoxelField *field, Vec3 seed, Vec3 worldOffset, r32 voxelScale, i32 samples, VoxelScratch *scratch)
+{
+    if(field->gen->columnWarp)
+    {
+        // the height of every x, z column first, then the samples below and
+        // above it need no noise at all
+        r32 heights[VOXEL_NETS_SAMPLES][VOXEL_NETS_SAMPLES];
+        r32 px[VOXEL_NETS_SAMPLES], py[VOXEL_NETS_SAMPLES], pz[VOXEL_NETS_SAMPLES];
+        for(i32 x = 0; x < samples; x++)
+        {
+            for(i32 z = 0; z < samples; z++)
+            {
+                px[z] = seed.x + x*voxelScale + worldOffset.x;
+                pz[z] = seed.z + z*voxelScale + worldOffset.z;
+            }
+            voxelHeightBatch(field->gen, px, pz, heights[x], samples);
+        }
+        for(i32 x = 0; x < samples; x++)
         {
-            uint indexIndex = atomicCounterIncrement(indexCount);
+            for(i32 y = 0; y < samples; y++)
+            {
+                for(i32 z = 0; z < samples; z++)
+                {
+                    px[z] = seed.x + x*voxelScale + worldOffset.x;
+                    py[z] = seed.y + y*voxelScale + worldOffset.y;
+                    pz[z] = seed.z + z*voxelScale + worldOffset.z;
+                }
+                voxelFieldDensity(field, px, py, pz, heights[x], scratch->values[x][y], samples);
+            }
+        }
+        return;
+    }
 
-            // calculate vertex positions and normal of the triangle
-            Vec3 verts[3];
-            for(int curVert = 0; curVert < 3; curVert++)
+    for(i32 x = 0; x < samples; x++)
+    {
+        for(i32 y = 0; y < samples; y++)
+        {
+            // a column at a time, the noise is evaluated in batches
+            r32 px[VOXEL_NETS_SAMPLES], py[VOXEL_NETS_SAMPLES], pz[VOXEL_NETS_SAMPLES];
+            for(i32 z = 0; z < samples; z++)
             {
-                ivec4 indexOffset = edgeVertexOffset[edgeConnection[curVert]];
-                verts[curVert] = edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].coord;
+                px[z] = seed.x + x*voxelScale + worldOffset.x;
+                py[z] = seed.y + y*voxelScale + worldOffset.y;
+                pz[z] = seed.z + z*voxelScale + worldOffset.z;
             }
-            Vec3 normal = normalize(cross(verts[1].xyz -verts[0].xyz, verts[2].xyz - verts[0].xyz));
+            voxelDensityBatch(field, px, py, pz, scratch->values[x][y], samples);
+        }
+    }
+}
 
-            // add missing vertices and indices
-            for(int curVert = 0; curVert < 3; curVert++)
+// Count pass of the compute shader. Every edge that crosses the surface is
+// used by the cubes around it, so it's exactly one vertex.
+static void voxelCountBlock(VoxelScratch *scratch, u32 *vertexCount, u32 *triangleCount)
+{
+    u32 vertices = 0, triangles = 0;
+    for(i32 x = 0; x < VOXEL_BLOCK_SAMPLES; x++)
+    {
+        for(i32 y = 0; y < VOXEL_BLOCK_SAMPLES; y++)
+        {
+            for(i32 z = 0; z < VOXEL_BLOCK_SAMPLES; z++)
             {
-                ivec4 indexOffset = edgeVertexOffset[edgeConnection[curVert]];
-                int res = -2;
-                do
+                for(i32 axis = 0; axis < 3; axis++)
+                    vertices += voxelEdgeCrosses(scratch, x, y, z, axis);
+                if(x == VOXEL_BLOCK_CUBES || y == VOXEL_BLOCK_CUBES || z == VOXEL_BLOCK_CUBES)
+                    continue;
+                i32 *edges = a2iTriangleConnectionTable[voxelCubeCase(scratch, x, y, z)];
+                for(i32 tri = 0; tri < 5 && edges[3*tri] > -1; tri++)
+                    triangles++;
+            }
+        }
+    }
+    *vertexCount = vertices;
+    *triangleCount = triangles;
+}
+
+// Emit pass of the compute shader, in the same order: vertices by sample
+// column (y, then x), then z and axis, triangles by cube column the same way.
+// The block's exact size is known, so it either fits entirely or not at all.
+static void voxelEmitBlock(VoxelField *field, VoxelScratch *scratch, Vec3 seed, Vec3 worldOffset, r32 voxelScale,
+                           u32 vertexCount, u32 triangleCount, VoxelMeshOutput *out)
+{
+    if(out->vertexCount + vertexCount > out->maxVertices || out->triangleCount + triangleCount > out->maxTriangles)
+    {
+        out->overflow = true;
+        return;
+    }
+
+    u32 firstVertex = out->vertexCount;
+    for(i32 y = 0; y < VOXEL_BLOCK_SAMPLES; y++)
+    {
+        for(i32 x = 0; x < VOXEL_BLOCK_SAMPLES; x++)
+        {
+            for(i32 z = 0; z < VOXEL_BLOCK_SAMPLES; z++)
+            {
+                for(i32 axis = 0; axis < 3; axis++)
                 {
-                    res = atomicCompSwap(edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].index, -1, -2);
-                    if(res == -1) // new vertex
-                    {
-                        // create new vertex
-                        uint vertexIndex = atomicCounterIncrement(triangleCount);
-                        // write new vertex index so others can read it
-                        atomicExchange(edgeVertexData.data[index].left[i+indexOffset.x][j+indexOffset.y][k+indexOffset.z][indexOffset.w].index, int(vertexIndex));
-                        outputVertexBuffer.data[vertexIndex].position = vec4(verts[curVert], 1.0);
-                        outputVertexBuffer.data[vertexIndex].normal = vec4(normal,1.0);
-                        // add new index
-                        outputElementBuffer.data[indexIndex].index[curVert] = int(vertexIndex);
-                    }
-                    else if(res != -2)	// some other thread already created this vertex, just use the stored value
+                    if(!voxelEdgeCrosses(scratch, x, y, z, axis))
+                        continue;
+                    Vec3 position = voxelEdgeVertex(scratch, seed, voxelScale, x, y, z, axis);
+                    Vec3 normal = voxelEdgeNormal(field, scratch, vec3(position.x + worldOffset.x, position.y + worldOffset.y,
+                                                                       position.z + worldOffset.z), voxelScale, x, y, z, axis);
+                    out->vertices[out->vertexCount] = voxelPackVertex(position, normal);
+                    scratch->edgeIndex[x][y][z][axis] = (i32)(out->vertexCount++ - firstVertex);
+                }
+            }
+        }
+    }
+
+    for(i32 j = 0; j < VOXEL_BLOCK_CUBES; j++)
+    {
+        for(i32 i = 0; i < VOXEL_BLOCK_CUBES; i++)
+        {
+            for(i32 k = 0; k < VOXEL_BLOCK_CUBES; k++)
+            {
+                i32 *edges = a2iTriangleConnectionTable[voxelCubeCase(scratch, i, j, k)];
+                for(i32 tri = 0; tri < 5 && edges[3*tri] > -1; tri++)
+                {
+                    TriangleOut *triangle = &out->triangles[out->triangleCount++];
+                    for(i32 curVert = 0; curVert < 3; curVert++)
                     {
-                        // add new index
-                        outputElementBuffer.data[indexIndex].index[curVert] = res;
-                        // TODO: atomic?
-                        outputVertexBuffer.data[res].normal += vec4(normal,1.0);
+                        const i32 *o = edgeVertexOffset[edges[3*tri+curVert]];
+                        triangle->index[curVert] = (i32)firstVertex + scratch->edgeIndex[i+o[0]][j+o[1]][k+o[2]][o[3]];
                     }
-                } while (res == -2);
+                }
             }
         }
     }
 }
 
-// cant use 17 17 17 because "local work size runs out of limitaion"
-layout(local_size_x = 17, local_size_y = 17, local_size_z = 1) in;
-void main() {
-    ivec2 location = ivec2(gl_WorkGroupID.xy);
-    ivec2 itemID = ivec2(gl_LocalInvocationID.xy);
-    ivec2 tileNumber = ivec2(gl_NumWorkGroups.xy);
-    uint index = location.x;
+// Surface nets, same as the STAGE_*_NETS parts of the compute shader. A block
+// owns the edges that start in one of its cells along the edge and lie on its
+// far faces or inside it across the edge, so every edge of the chunk belongs
+// to exactly one block. The cells around an owned edge reach one past the far
+// faces, their vertices are duplicated in the next block and chunk like the
+// edge vertices of marching cubes.
+static b32 voxelNetsEdgeOwned(i32 x, i32 y, i32 z, i32 axis)
+{
+    i32 p[3] = {x, y, z};
+    for(i32 i = 0; i < 3; i++)
+    {
+        if(i == axis ? p[i] >= VOXEL_BLOCK_CUBES : (p[i] < 1 || p[i] > VOXEL_BLOCK_CUBES))
+            return false;
+    }
+    return true;
+}
+
+static b32 voxelNetsSignChange(VoxelScratch *scratch, i32 x, i32 y, i32 z, i32 axis)
+{
+    i32 nx = x + (axis == 0);
+    i32 ny = y + (axis == 1);
+    i32 nz = z + (axis == 2);
+    return (scratch->values[x][y][z] <= 0.0f) != (scratch->values[nx][ny][nz] <= 0.0f);
+}
+
+static b32 voxelNetsEdgeCrosses(VoxelScratch *scratch, i32 x, i32 y, i32 z, i32 axis)
+{
+    return voxelNetsEdgeOwned(x, y, z, axis) && voxelNetsSignChange(scratch, x, y, z, axis);
+}
 
-     // take all the samples we will need
-    for(int i = 0; i < 17; i++) {
-          vec3 worldPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,itemID.y*voxelScale,i*voxelScale);
-        cubeValues[itemID.x][itemID.y][i] = voxel(worldPosition+worldOffset);
+// does a quad use the cell, only those get a vertex
+static b32 voxelNetsCellUsed(VoxelScratch *scratch, i32 x, i32 y, i32 z)
+{
+    for(i32 axis = 0; axis < 3; axis++)
+    {
+        for(i32 e = 0; e < 4; e++)
+        {
+            i32 d[3] = {0, 0, 0};
+            d[(axis+1)%3] = e & 1;
+            d[(axis+2)%3] = e >> 1;
+            if(voxelNetsEdgeCrosses(scratch, x + d[0], y + d[1], z + d[2], axis))
+                return true;
+        }
     }
+    return false;
+}
 
-     int dummy = 3; // i don't understand the dynamically uniform expression thing, so I use these
-    dummy;
-    barrier();
+// mean of the points where the cell's edges cross the surface
+static Vec3 voxelNetsCellVertex(VoxelScratch *scratch, Vec3 seed, r32 voxelScale, i32 x, i32 y, i32 z)
+{
+    Vec3 sum = vec3(0.0f, 0.0f, 0.0f);
+    r32 crossings = 0.0f;
+    for(i32 axis = 0; axis < 3; axis++)
+    {
+        for(i32 e = 0; e < 4; e++)
+        {
+            i32 d[3] = {0, 0, 0};
+            d[(axis+1)%3] = e & 1;
+            d[(axis+2)%3] = e >> 1;
+            if(!voxelNetsSignChange(scratch, x + d[0], y + d[1], z + d[2], axis))
+                continue;
+            Vec3 p = voxelEdgeVertex(scratch, seed, voxelScale, x + d[0], y + d[1], z + d[2], axis);
+            vec3Add(&sum, &sum, &p);
+            crossings += 1.0f;
+        }
+    }
+    vec3Scale(&sum, &sum, 1.0f/crossings);
+    return sum;
+}
 
-     // calculate all possible vertex positions
-     for(int i = 0; i < 17; i++) {
-          vec3 worldPosition = inputVertexBuffer.data[index].xyz + vec3(itemID.x*voxelScale,itemID.y*voxelScale,i*voxelScale) + worldOffset;
+// a vertex per used cell, two triangles per owned edge crossing the surface
+static void voxelNetsCountBlock(VoxelScratch *scratch, u32 *vertexCount, u32 *triangleCount)
+{
+    u32 vertices = 0, triangles = 0;
+    for(i32 x = 0; x < VOXEL_BLOCK_SAMPLES; x++)
+    {
+        for(i32 y = 0; y < VOXEL_BLOCK_SAMPLES; y++)
+        {
+            for(i32 z = 0; z < VOXEL_BLOCK_SAMPLES; z++)
+            {
+                vertices += voxelNetsCellUsed(scratch, x, y, z);
+                for(i32 axis = 0; axis < 3; axis++)
+                    triangles += 2*voxelNetsEdgeCrosses(scratch, x, y, z, axis);
+            }
+        }
+    }
+    *vertexCount = vertices;
+    *triangleCount = triangles;
+}
 
-         float fOffset = 0.5;
-         edgeVertexData.data[index].left[itemID.x][itemID.y][i][0].coord = worldPosition + fOffset*vec3(1.0,0.0,0.0);
-          edgeVertexData.data[index].left[itemID.x][itemID.y][i][0].index = -1;
+// In the order of the compute shader: vertices by cell column (y, then x) and
+// z, quads by sample column the same way, then z and axis. The quad around
+// an edge is made of the four cells sharing it, wound so that it faces the
+// side of the edge that's air, like the marching cubes triangles.
+static void voxelNetsEmitBlock(VoxelField *field, VoxelScratch *scratch, Vec3 seed, Vec3 worldOffset, r32 voxelScale,
+                               u32 vertexCount, u32 triangleCount, VoxelMeshOutput *out)
+{
+    if(out->vertexCount + vertexCount > out->maxVertices || out->triangleCount + triangleCount > out->maxTriangles)
+    {
+        out->overflow = true;
+        return;
+    }
 
-         fOffset = getOffset(cubeValues[itemID.x][itemID.y][i], cubeValues[itemID.x][itemID.y+1][i]);
-         edgeVertexData.data[index].left[itemID.x][itemID.y][i][1].coord = worldPosition + fOffset*vec3(0.0,1.0,0.0);
-          edgeVertexData.data[index].left[itemID.x][itemID.y][i][1].index = -1;
+    u32 firstVertex = out->vertexCount;
+    for(i32 y = 0; y < VOXEL_BLOCK_SAMPLES; y++)
+    {
+        for(i32 x = 0; x < VOXEL_BLOCK_SAMPLES; x++)
+        {
+            for(i32 z = 0; z < VOXEL_BLOCK_SAMPLES; z++)
+            {
+                if(!voxelNetsCellUsed(scratch, x, y, z))
+                    continue;
+                Vec3 position = voxelNetsCellVertex(scratch, seed, voxelScale, x, y, z);
+                Vec3 normal = voxelCellNormal(field, scratch, seed, worldOffset, position, voxelScale, x, y, z);
+                out->vertices[out->vertexCount] = voxelPackVertex(position, normal);
+                scratch->cellIndex[x][y][z] = (i32)(out->vertexCount++ - firstVertex);
+            }
+        }
+    }
 
-         fOffset = 0.5;
-         edgeVertexData.data[index].left[itemID.x][itemID.y][i][2].coord = worldPosition + fOffset*vec3(0.0,0.0,1.0);
-          edgeVertexData.data[index].left[itemID.x][itemID.y][i][2].index = -1;
+    for(i32 y = 0; y < VOXEL_BLOCK_SAMPLES; y++)
+    {
+        for(i32 x = 0; x < VOXEL_BLOCK_SAMPLES; x++)
+        {
+            for(i32 z = 0; z < VOXEL_BLOCK_SAMPLES; z++)
+            {
+                for(i32 axis = 0; axis < 3; axis++)
+                {
+                    if(!voxelNetsEdgeCrosses(scratch, x, y, z, axis))
+                        continue;
+                    // cells at -u-v, -v, 0 and -u of the edge's start
+                    i32 u = (axis+1)%3, v = (axis+2)%3;
+                    i32 quad[4];
+                    for(i32 c = 0; c < 4; c++)
+                    {
+                        i32 p[3] = {x, y, z};
+                        p[u] -= (c == 0 || c == 3);
+                        p[v] -= (c == 0 || c == 1);
+                        quad[c] = (i32)firstVertex + scratch->cellIndex[p[0]][p[1]][p[2]];
+                    }
+                    b32 flip = scratch->values[x][y][z] <= 0.0f;
+                    TriangleOut *triangle = &out->triangles[out->triangleCount];
+                    triangle[0].index[0] = quad[0];
+                    triangle[0].index[1] = quad[flip ? 2 : 1];
+                    triangle[0].index[2] = quad[flip ? 1 : 2];
+                    triangle[1].index[0] = quad[0];
+                    triangle[1].index[1] = quad[flip ? 3 : 2];
+                    triangle[1].index[2] = quad[flip ? 2 : 3];
+                    out->triangleCount += 2;
+                }
+            }
+        }
     }
+}
 
-     dummy = 4;
-    dummy;
-    barrier();
+static i16 voxelPackSnorm(r32 v)
+{
+    return (i16)roundf(maxf(-1.0f, minf(v, 1.0f))*32767.0f);
+}
 
-    if(itemID.x == 16 || itemID.y == 16)
-        return;
+// Same rounding as packUnorm2x16() and packSnorm2x16() in the compute
+// shader. The octahedral encoding projects the normal onto |x|+|y|+|z| = 1 and
+// folds the lower half over the diagonals, so two numbers are enough.
+VertexOut voxelPackVertex(Vec3 position, Vec3 normal)
+{
+    VertexOut ret;
+    r32 p[3] = {position.x, position.y, position.z};
+    for(i32 i = 0; i < 3; i++)
+        ret.position[i] = (u16)roundf(maxf(0.0f, minf(p[i]/VOXEL_POSITION_RANGE, 1.0f))*65535.0f);
+    ret.padding = 0;
+
+    r32 sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+    Vec3 n = sum > 0.0f ? vec3(normal.x/sum, normal.y/sum, normal.z/sum) : vec3(0.0f, 1.0f, 0.0f);
+    r32 ex = n.x, ey = n.y;
+    if(n.z < 0.0f)
+    {
+        ex = (1.0f - fabsf(n.y))*(n.x >= 0.0f ? 1.0f : -1.0f);
+        ey = (1.0f - fabsf(n.x))*(n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    ret.normal[0] = voxelPackSnorm(ex);
+    ret.normal[1] = voxelPackSnorm(ey);
+    return ret;
+}
 
-     for(int i = 0; i < 16; i++)
-     {
-        vec3 coord = vec3(inputVertexBuffer.data[index].x + ((itemID.x)*voxelScale),
-                           inputVertexBuffer.data[index].y + ((itemID.y)*voxelScale),
-                           inputVertexBuffer.data[index].z + (i*voxelScale)) + worldOffset;
-         vMarchCube1(itemID.x, itemID.y, i, coord, index);
-     }
+// groups^3 blocks of VOXEL_BLOCK_CUBES^3 cubes, positions are relative to worldOffset
+void voxelGenerateChunk(VoxelField *field, Vec3 worldOffset, u32 groups, r32 voxelScale, VoxelMesher mesher,
+                        VoxelScratch *scratch, VoxelMeshOutput *out)
+{
+    out->vertexCount = 0;
+    out->triangleCount = 0;
+    out->overflow = false;
 
-}*/
+    // same block order as the seed buffer in openglPrepageTerrainGeneration
+    r32 blockSize = voxelScale*VOXEL_BLOCK_CUBES;
+    for(u32 k = 0; k < groups && !out->overflow; k++)
+    {
+        for(u32 i = 0; i < groups && !out->overflow; i++)
+        {
+            for(u32 j = 0; j < groups && !out->overflow; j++)
+            {
+                Vec3 seed = vec3(i*blockSize, k*blockSize, j*blockSize);
+                u32 vertexCount, triangleCount;
+                if(mesher == VoxelMesher_SurfaceNets)
+                {
+                    voxelSampleBlock(field, seed, worldOffset, voxelScale, VOXEL_NETS_SAMPLES, scratch);
+                    voxelNetsCountBlock(scratch, &vertexCount, &triangleCount);
+                    if(vertexCount > 0)
+                        voxelNetsEmitBlock(field, scratch, seed, worldOffset, voxelScale, vertexCount, triangleCount, out);
+                    continue;
+                }
+                voxelSampleBlock(field, seed, worldOffset, voxelScale, VOXEL_BLOCK_SAMPLES, scratch);
+                voxelCountBlock(scratch, &vertexCount, &triangleCount);
+                // like the emit pass, blocks without a surface are skipped
+                if(vertexCount > 0)
+                    voxelEmitBlock(field, scratch, seed, worldOffset, voxelScale, vertexCount, triangleCount, out);
+            }
+        }
+    }
+}
+
+// Only the count pass, what the GPU's block counts have to add up to.
+void voxelCountChunk(VoxelField *field, Vec3 worldOffset, u32 groups, r32 voxelScale, VoxelMesher mesher,
+                     VoxelScratch *scratch, u32 *vertexCount, u32 *triangleCount)
+{
+    *vertexCount = 0;
+    *triangleCount = 0;
+    r32 blockSize = voxelScale*VOXEL_BLOCK_CUBES;
+    for(u32 k = 0; k < groups; k++)
+    {
+        for(u32 i = 0; i < groups; i++)
+        {
+            for(u32 j = 0; j < groups; j++)
+            {
+                Vec3 seed = vec3(i*blockSize, k*blockSize, j*blockSize);
+                u32 vertices, triangles;
+                if(mesher == VoxelMesher_SurfaceNets)
+                {
+                    voxelSampleBlock(field, seed, worldOffset, voxelScale, VOXEL_NETS_SAMPLES, scratch);
+                    voxelNetsCountBlock(scratch, &vertices, &triangles);
+                }
+                else
+                {
+                    voxelSampleBlock(field, seed, worldOffset, voxelScale, VOXEL_BLOCK_SAMPLES, scratch);
+                    voxelCountBlock(scratch, &vertices, &triangles);
+                }
+                *vertexCount += vertices;
+                *triangleCount += triangles;
+            }
+        }
+    }
+}
 
 i32 aiCubeEdgeFlags[256]=
 {
@@ -410,7 +918,7 @@ i32 aiCubeEdgeFlags[256]=
 //
 //  I found this table in an example program someone wrote long ago.  It was probably generated by hand
 
-i32 mcubesLookup[256][16] =
+i32 a2iTriangleConnectionTable[256][16] =
 {
     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
     {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
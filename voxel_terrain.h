@@ -0,0 +1,262 @@
+#ifndef VOXEL_TERRAIN_H
+#define VOXEL_TERRAIN_H
+
+// CPU version of build/shaders/terrain_compute2.glsl, doesn't depend on GL so
+// it can run on worker threads and on machines without a GPU.
+
+#include "shared.h"
+
+// cubes along one side of a block (a compute workgroup), same as CHUNK_WORKGROUP_SIZE
+#define VOXEL_BLOCK_CUBES 16
+#define VOXEL_BLOCK_SAMPLES (VOXEL_BLOCK_CUBES+1)
+// surface nets also need the cells past a block's far faces, see voxelNetsEmitBlock()
+#define VOXEL_NETS_SAMPLES (VOXEL_BLOCK_SAMPLES+1)
+// y of the plane the heightmap noise is sampled on, and the warp noise too
+// with ChunkGenData::columnWarp
+#define VOXEL_HEIGHT_PLANE 33.11f
+// |voxelSnoise()|, sampled maximum is about 1.038
+#define VOXEL_NOISE_BOUND 1.05f
+// height voxelClassifyChunk() adds to both ends of its interval because the
+// bound above isn't proven, with the game's octave amplitudes it still holds
+// for noise up to 1.15
+#define VOXEL_CLASSIFY_SLACK 4.0f
+// points voxelSnoiseBatch() evaluates at once
+#define VOXEL_NOISE_BATCH 8
+#define VOXEL_TUNNEL_RADIUS 5.0f
+// edit bricks are VOXEL_BRICK_SIZE^3 voxels of density, a voxel is one unit
+#define VOXEL_BRICK_SIZE 8
+#define VOXEL_BRICK_VOXELS (VOXEL_BRICK_SIZE*VOXEL_BRICK_SIZE*VOXEL_BRICK_SIZE)
+// bricks along a side of the block a chunk samples, the samples on its far
+// faces are in the next chunk's bricks (CHUNK_SIZE/VOXEL_BRICK_SIZE+1)
+#define VOXEL_CHUNK_BRICKS 9
+#define VOXEL_CHUNK_BRICK_SLOTS (VOXEL_CHUNK_BRICKS*VOXEL_CHUNK_BRICKS*VOXEL_CHUNK_BRICKS)
+// largest brush, bounds the scratch space of an edit
+#define VOXEL_EDIT_MAX_RADIUS 32.0f
+// side of the box vertex positions are quantized over, CHUNK_SIZE and a cell
+// of the coarsest LOD for the surface nets vertices past the far faces
+#define VOXEL_POSITION_RANGE 68.0f
+// side of a TunnelGrid cell, same as CHUNK_SIZE so a chunk is a single cell
+#define TUNNEL_GRID_CELL_SIZE 64
+// how far past its cube a chunk samples the density: the surface nets cells
+// past the far faces, and half a voxel of the coarsest LOD on both sides of a
+// vertex for its normal (VOXEL_POSITION_RANGE-CHUNK_SIZE is that voxel)
+#define VOXEL_CHUNK_REACH ((VOXEL_POSITION_RANGE - TUNNEL_GRID_CELL_SIZE)*1.5f)
+
+typedef struct Line3D
+{
+    Vec4 start;
+    Vec4 end;
+} Line3D;
+
+// same layout as GenData in the compute shader, the tunnels of the chunk
+// follow it in the tunnel buffer
+typedef struct ChunkGenData
+{
+    u32 tunnelCount;
+    r32 firstOctaveMax;
+    r32 secondOctaveMax;
+    u32 columnWarp; // warp the whole column alike, the field is a height map then
+    r32 dxgoalFirstOctaveMax;
+    r32 dxgoalSecondOctaveMax;
+    r32 dzgoalFirstOctaveMax;
+    r32 dzgoalSecondOctaveMax;
+    Vec4 chunkOrigin;
+} ChunkGenData;
+
+typedef struct TunnelGridNode
+{
+    u32 tunnel;
+    u32 next; // U32MAX ends the list
+} TunnelGridNode;
+
+typedef struct TunnelGridCell
+{
+    IVec3 cell;
+    u32 first; // newest tunnel of the cell
+    b32 used;
+} TunnelGridCell;
+
+// every tunnel ever added, bucketed by the cells its capsule reaches, see tunnel_grid.c
+typedef struct TunnelGrid
+{
+    Line3D *tunnels;
+    u32 tunnelCount;
+    u32 tunnelCapacity;
+
+    TunnelGridCell *cells; // open addressing, power of 2
+    u32 cellCount;
+    u32 cellCapacity;
+
+    TunnelGridNode *nodes;
+    u32 nodeCount;
+    u32 nodeCapacity;
+} TunnelGrid;
+
+// density added to the procedural field, x changes fastest
+typedef struct VoxelBrick
+{
+    r32 delta[VOXEL_BRICK_VOXELS];
+} VoxelBrick;
+
+typedef struct VoxelEditCell
+{
+    IVec3 brick;
+    u32 index;
+    b32 used;
+} VoxelEditCell;
+
+// sparse edits of the terrain, only bricks something was done to exist, see voxel_edit.c
+typedef struct VoxelEditStore
+{
+    VoxelBrick *bricks;
+    u32 brickCount;
+    u32 brickCapacity;
+
+    VoxelEditCell *cells; // open addressing, power of 2
+    u32 cellCapacity;
+} VoxelEditStore;
+
+// same layout as EditData in the compute shader, the bricks of the chunk
+// follow it in the edit buffer, the table is only valid if brickCount > 0
+typedef struct VoxelEditChunk
+{
+    IVec3 firstBrick;
+    u32 brickCount;
+    i32 table[VOXEL_CHUNK_BRICK_SLOTS]; // -1 where nothing was edited
+} VoxelEditChunk;
+
+// everything the density function of a chunk reads
+typedef struct VoxelField
+{
+    ChunkGenData *gen;
+    Line3D *tunnels; // gen->tunnelCount of them
+    VoxelEditChunk *edits;
+    VoxelBrick *bricks; // edits->brickCount of them
+} VoxelField;
+
+// how chunks are turned into triangles, chosen per LOD. Both write the same
+// vertex and triangle layouts.
+typedef enum VoxelMesher
+{
+    VoxelMesher_MarchingCubes,
+    VoxelMesher_SurfaceNets // a vertex per surface cell, a quad per crossing edge
+} VoxelMesher;
+
+typedef enum VoxelBrush
+{
+    VoxelBrush_Dig,
+    VoxelBrush_Fill,
+    VoxelBrush_Smooth
+} VoxelBrush;
+
+// output layouts of the compute shader, what chunk meshes are made of. The
+// position is relative to the chunk in 1/65535ths of VOXEL_POSITION_RANGE, the
+// chunk's transform scales it back. The normal is octahedral encoded, see
+// voxelPackVertex().
+typedef struct VertexOut
+{
+    u16 position[3];
+    u16 padding;
+    i16 normal[2];
+} VertexOut;
+
+typedef struct TriangleOut
+{
+    i32 index[3];
+} TriangleOut;
+
+// per thread working memory for one block
+typedef struct VoxelScratch
+{
+    r32 values[VOXEL_NETS_SAMPLES][VOXEL_NETS_SAMPLES][VOXEL_NETS_SAMPLES];
+    i32 edgeIndex[VOXEL_BLOCK_SAMPLES][VOXEL_BLOCK_SAMPLES][VOXEL_BLOCK_SAMPLES][3]; // marching cubes
+    i32 cellIndex[VOXEL_BLOCK_SAMPLES][VOXEL_BLOCK_SAMPLES][VOXEL_BLOCK_SAMPLES]; // surface nets
+} VoxelScratch;
+
+typedef enum VoxelChunkClass
+{
+    VoxelChunkClass_Surface,
+    VoxelChunkClass_Air,
+    VoxelChunkClass_Solid
+} VoxelChunkClass;
+
+typedef struct VoxelMeshOutput
+{
+    VertexOut *vertices;
+    TriangleOut *triangles;
+    u32 maxVertices;
+    u32 maxTriangles;
+    u32 vertexCount;
+    u32 triangleCount;
+    b32 overflow;
+} VoxelMeshOutput;
+
+typedef struct VoxelCollapse
+{
+    u32 from; // removed, its triangles use to instead
+    u32 to;
+    r32 cost;
+} VoxelCollapse;
+
+// working memory of voxelSimplifyMesh(), grows to the largest mesh it saw
+typedef struct VoxelSimplifyScratch
+{
+    u32 vertexCapacity;
+    u32 triangleCapacity;
+    Vec3 *positions;
+    r64 *quadrics; // 10 per vertex, the upper triangle of a symmetric 4x4
+    u32 *remap;
+    u8 *flags;
+    u32 *adjacencyStart; // vertexCapacity+1 of them
+    u32 *adjacency; // triangles around each vertex
+    u64 *edges;
+    VoxelCollapse *collapses;
+} VoxelSimplifyScratch;
+
+extern i32 a2iTriangleConnectionTable[256][16];
+extern i32 aiCubeEdgeFlags[256];
+
+static inline u32 voxelHashCell(IVec3 cell)
+{
+    u32 h = (u32)cell.x*73856093u ^ (u32)cell.y*19349663u ^ (u32)cell.z*83492791u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+r32 voxelSnoise(Vec3 v);
+void voxelSnoiseBatch(const r32 *x, const r32 *y, const r32 *z, r32 *out, u32 count);
+void voxelNoiseBenchmark();
+// terrain and tunnels, without edits
+r32 voxelProceduralDensity(ChunkGenData *gen, Line3D *tunnels, Vec3 worldPos);
+r32 voxelDensity(VoxelField *field, Vec3 worldPos);
+// the terrain height of count columns, only with ChunkGenData::columnWarp
+void voxelHeightBatch(ChunkGenData *gen, const r32 *x, const r32 *z, r32 *out, u32 count);
+// voxelDensity() of count points, at most VOXEL_NETS_SAMPLES
+void voxelDensityBatch(VoxelField *field, const r32 *x, const r32 *y, const r32 *z, r32 *out, u32 count);
+b32 voxelTunnelTouchesBox(Line3D *tunnel, Vec3 origin, r32 size);
+VoxelChunkClass voxelClassifyChunk(VoxelField *field, Vec3 origin, r32 size);
+void voxelGenerateChunk(VoxelField *field, Vec3 worldOffset, u32 groups, r32 voxelScale, VoxelMesher mesher,
+                        VoxelScratch *scratch, VoxelMeshOutput *out);
+void voxelCountChunk(VoxelField *field, Vec3 worldOffset, u32 groups, r32 voxelScale, VoxelMesher mesher,
+                     VoxelScratch *scratch, u32 *vertexCount, u32 *triangleCount);
+VertexOut voxelPackVertex(Vec3 position, Vec3 normal);
+
+u32 voxelSimplifyMesh(VoxelMeshOutput *mesh, r32 chunkSize, r32 maxError, VoxelSimplifyScratch *scratch);
+void voxelSimplifyDestroy(VoxelSimplifyScratch *scratch);
+
+void tunnelGridInit(TunnelGrid *grid);
+void tunnelGridDestroy(TunnelGrid *grid);
+u32 tunnelGridAdd(TunnelGrid *grid, Line3D tunnel);
+u32 tunnelGridGather(TunnelGrid *grid, Vec3 cellOrigin, Line3D **tunnels, u32 *capacity);
+
+void voxelEditInit(VoxelEditStore *store);
+void voxelEditDestroy(VoxelEditStore *store);
+u32 voxelEditApply(VoxelEditStore *store, ChunkGenData *gen, TunnelGrid *tunnels, VoxelBrush brush,
+                   Vec3 center, r32 radius, r32 strength);
+void voxelEditGather(VoxelEditStore *store, Vec3 chunkOrigin, VoxelEditChunk *edits, VoxelBrick **bricks, u32 *capacity);
+
+#endif // VOXEL_TERRAIN_H
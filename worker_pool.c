@@ -0,0 +1,119 @@
+#include "worker_pool.h"
+
+#include <unistd.h>
+
+static void* workerPoolThread(void *param)
+{
+    WorkerPool *pool = (WorkerPool*)param;
+    pthread_mutex_lock(&pool->mutex);
+    for(;;)
+    {
+        while(pool->count == 0 && !pool->quit)
+            pthread_cond_wait(&pool->jobAvailable, &pool->mutex);
+        if(pool->quit)
+            break;
+
+        WorkerJob job = pool->queue[pool->head];
+        pool->head = (pool->head+1) % WORKER_POOL_QUEUE_SIZE;
+        pool->count--;
+        pool->running++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        job.proc(job.data);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if(pool->count == 0 && pool->running == 0)
+            pthread_cond_broadcast(&pool->jobsDone);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+u32 workerPoolCpuCount()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (u32)cpus : 1;
+}
+
+// threadCount 0 uses one thread per core except the one the main thread runs on
+b32 workerPoolInit(WorkerPool *pool, u32 threadCount)
+{
+    if(threadCount == 0)
+        threadCount = max(1, (i32)workerPoolCpuCount()-1);
+    threadCount = min(threadCount, WORKER_POOL_MAX_THREADS);
+
+    pool->head = 0;
+    pool->count = 0;
+    pool->running = 0;
+    pool->quit = false;
+    pthread_mutex_init(&pool->mutex, 0);
+    pthread_cond_init(&pool->jobAvailable, 0);
+    pthread_cond_init(&pool->jobsDone, 0);
+
+    pool->threadCount = 0;
+    for(u32 i = 0; i < threadCount; i++)
+    {
+        if(pthread_create(&pool->threads[i], 0, workerPoolThread, pool) != 0)
+        {
+            printf("Creating worker thread %u failed\n", i);
+            break;
+        }
+        pool->threadCount++;
+    }
+    pool->initialized = pool->threadCount > 0;
+    if(!pool->initialized)
+    {
+        pthread_cond_destroy(&pool->jobsDone);
+        pthread_cond_destroy(&pool->jobAvailable);
+        pthread_mutex_destroy(&pool->mutex);
+    }
+    return pool->initialized;
+}
+
+// returns false if the queue is full
+b32 workerPoolPush(WorkerPool *pool, WorkerJobProc proc, void *data)
+{
+    assert(pool->initialized);
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->count >= WORKER_POOL_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&pool->mutex);
+        return false;
+    }
+    WorkerJob *job = &pool->queue[(pool->head+pool->count) % WORKER_POOL_QUEUE_SIZE];
+    job->proc = proc;
+    job->data = data;
+    pool->count++;
+    pthread_cond_signal(&pool->jobAvailable);
+    pthread_mutex_unlock(&pool->mutex);
+    return true;
+}
+
+// blocks until the queue is empty and no job is running
+void workerPoolWait(WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->count > 0 || pool->running > 0)
+        pthread_cond_wait(&pool->jobsDone, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// finishes running jobs, queued jobs that haven't started are dropped
+void workerPoolDestroy(WorkerPool *pool)
+{
+    if(!pool->initialized)
+        return;
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->jobAvailable);
+    pthread_mutex_unlock(&pool->mutex);
+    for(u32 i = 0; i < pool->threadCount; i++)
+        pthread_join(pool->threads[i], 0);
+
+    pthread_cond_destroy(&pool->jobsDone);
+    pthread_cond_destroy(&pool->jobAvailable);
+    pthread_mutex_destroy(&pool->mutex);
+    pool->threadCount = 0;
+    pool->initialized = false;
+}
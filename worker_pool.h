@@ -0,0 +1,43 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+
+#include "shared.h"
+
+#define WORKER_POOL_MAX_THREADS 32
+#define WORKER_POOL_QUEUE_SIZE 256
+
+typedef void (*WorkerJobProc)(void *data);
+
+typedef struct WorkerJob
+{
+    WorkerJobProc proc;
+    void *data;
+} WorkerJob;
+
+// fixed size thread pool with a FIFO job queue
+// NOTE: workers run game code, stop the pool before the game library is unloaded
+typedef struct WorkerPool
+{
+    pthread_t threads[WORKER_POOL_MAX_THREADS];
+    u32 threadCount;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t jobAvailable;
+    pthread_cond_t jobsDone;
+    WorkerJob queue[WORKER_POOL_QUEUE_SIZE];
+    u32 head;
+    u32 count;
+    u32 running;
+    b32 quit;
+    b32 initialized;
+} WorkerPool;
+
+u32 workerPoolCpuCount();
+b32 workerPoolInit(WorkerPool *pool, u32 threadCount);
+b32 workerPoolPush(WorkerPool *pool, WorkerJobProc proc, void *data);
+void workerPoolWait(WorkerPool *pool);
+void workerPoolDestroy(WorkerPool *pool);
+
+#endif // WORKER_POOL_H